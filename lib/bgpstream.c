@@ -80,6 +80,9 @@ err:
 int bgpstream_add_filter(bgpstream_t *bs, bgpstream_filter_type_t filter_type,
                           const char *filter_value)
 {
+  // filters are validated and compiled into the elem filter program when the
+  // stream is started, and the data interface queries resources using them
+  assert(!bs->started);
   return bgpstream_filter_mgr_filter_add(bs->filter_mgr, filter_type,
       filter_value);
 }
@@ -202,6 +205,18 @@ void bgpstream_set_live_mode(bgpstream_t *bs)
   bgpstream_di_mgr_set_blocking(bs->di_mgr);
 }
 
+void bgpstream_set_lazy_decode(bgpstream_t *bs)
+{
+  assert(!bs->started);
+  bs->filter_mgr->lazy_decode = 1;
+}
+
+void bgpstream_set_zero_copy_elems(bgpstream_t *bs)
+{
+  assert(!bs->started);
+  bs->filter_mgr->zero_copy_elems = 1;
+}
+
 /* turn on the bgpstream interface, i.e.:
  * it makes the interface ready
  * for a new get next call
@@ -216,6 +231,11 @@ int bgpstream_start(bgpstream_t *bs)
     return rc;
   }
 
+  // and build the elem filter program from them
+  if (bgpstream_filter_mgr_compile(bs->filter_mgr) != 0) {
+    return -1;
+  }
+
   // start the data interface
   if (bgpstream_di_mgr_start(bs->di_mgr) != 0) {
     return -1;
@@ -225,6 +245,22 @@ int bgpstream_start(bgpstream_t *bs)
   return 0;
 }
 
+int bgpstream_get_filter_stats(bgpstream_t *bs,
+                               bgpstream_filter_stats_t *stats, int stats_len)
+{
+  bgpstream_filter_pred_t *pred;
+  int i;
+
+  for (i = 0; i < bs->filter_mgr->prog_cnt && i < stats_len; i++) {
+    pred = &bs->filter_mgr->prog[i];
+    stats[i].name = bgpstream_filter_pred_name(pred->type);
+    stats[i].eval_cnt = pred->eval_cnt;
+    stats[i].reject_cnt = pred->reject_cnt;
+  }
+
+  return bs->filter_mgr->prog_cnt;
+}
+
 int bgpstream_get_next_record(bgpstream_t *bs, bgpstream_record_t **record)
 {
   assert(bs->started);
@@ -303,6 +303,10 @@ void bgpstream_elem_clear(bgpstream_elem_t *elem);
  * The `dst` elem must have been created using bgpstream_elem_create, or if
  * being re-used, cleared using bgpstream_elem_clear before calling this
  * function.
+ *
+ * The AS path and communities are deep-copied, so `dst` remains valid after
+ * the record that `src` was borrowed from has been re-used (including when
+ * `src` references message data, see bgpstream_set_zero_copy_elems).
  */
 bgpstream_elem_t *bgpstream_elem_copy(bgpstream_elem_t *dst,
                                       const bgpstream_elem_t *src);
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2019 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_elem_batch_int.h"
+#include "utils.h"
+#include <stdlib.h>
+
+#define BATCH_INIT_ALLOC_CNT 64
+
+#define GROW_COL(col, cnt)                                                     \
+  do {                                                                         \
+    void *tmp;                                                                 \
+    if ((tmp = realloc((col), sizeof(*(col)) * (cnt))) == NULL) {              \
+      return -1;                                                               \
+    }                                                                          \
+    (col) = tmp;                                                               \
+  } while (0)
+
+/* Make room for one more elem in each of the columns */
+static int batch_reserve_elem(bgpstream_elem_batch_t *batch)
+{
+  int new_cnt;
+
+  if (batch->cnt < batch->alloc_cnt) {
+    return 0;
+  }
+
+  new_cnt = batch->alloc_cnt == 0 ? BATCH_INIT_ALLOC_CNT : batch->alloc_cnt * 2;
+
+  GROW_COL(batch->type, new_cnt);
+  GROW_COL(batch->time_sec, new_cnt);
+  GROW_COL(batch->time_usec, new_cnt);
+  GROW_COL(batch->peer_asn, new_cnt);
+  GROW_COL(batch->peer_ip, new_cnt);
+  GROW_COL(batch->prefix, new_cnt);
+  GROW_COL(batch->mask_len, new_cnt);
+  GROW_COL(batch->origin_asn, new_cnt);
+  GROW_COL(batch->path_simple, new_cnt);
+  GROW_COL(batch->path_offset, new_cnt + 1);
+
+  if (batch->alloc_cnt == 0) {
+    batch->path_offset[0] = 0;
+  }
+  batch->alloc_cnt = new_cnt;
+  return 0;
+}
+
+/* Make room for asn_cnt more ASNs in the path arena */
+static int batch_reserve_asns(bgpstream_elem_batch_t *batch, uint32_t asn_cnt)
+{
+  uint32_t need = batch->path_offset[batch->cnt] + asn_cnt;
+  uint32_t new_cnt = batch->path_asns_alloc_cnt;
+
+  if (need <= new_cnt) {
+    return 0;
+  }
+
+  if (new_cnt == 0) {
+    new_cnt = BATCH_INIT_ALLOC_CNT * 8;
+  }
+  while (new_cnt < need) {
+    new_cnt *= 2;
+  }
+
+  GROW_COL(batch->path_asns, new_cnt);
+  batch->path_asns_alloc_cnt = new_cnt;
+  return 0;
+}
+
+/* ==================== PROTECTED FUNCTIONS ==================== */
+
+int bgpstream_elem_batch_append(bgpstream_elem_batch_t *batch,
+                                const bgpstream_record_t *record,
+                                const bgpstream_elem_t *elem)
+{
+  bgpstream_as_path_iter_t iter;
+  bgpstream_as_path_seg_t *seg;
+  uint32_t off;
+  uint32_t origin = 0;
+  uint8_t simple = 1;
+  int i = batch->cnt;
+
+  if (batch_reserve_elem(batch) != 0 ||
+      batch_reserve_asns(batch,
+                         bgpstream_as_path_get_len(elem->as_path)) != 0) {
+    return -1;
+  }
+
+  batch->type[i] = elem->type;
+  batch->time_sec[i] = record->time_sec;
+  batch->time_usec[i] = record->time_usec;
+  batch->peer_asn[i] = elem->peer_asn;
+  batch->peer_ip[i] = elem->peer_ip;
+  batch->prefix[i] = elem->prefix.address;
+  batch->mask_len[i] = elem->prefix.mask_len;
+
+  // flatten the simple segments of the path into the arena, one ASN per
+  // segment (BGPStream already split AS_SEQ segments into single ASNs)
+  off = batch->path_offset[i];
+  bgpstream_as_path_iter_reset(&iter);
+  while ((seg = bgpstream_as_path_get_next_seg(elem->as_path, &iter)) !=
+         NULL) {
+    if (seg->type == BGPSTREAM_AS_PATH_SEG_ASN) {
+      batch->path_asns[off++] = seg->asn.asn;
+      origin = seg->asn.asn;
+    } else {
+      simple = 0;
+      origin = 0;
+    }
+  }
+
+  batch->origin_asn[i] = origin;
+  batch->path_simple[i] = simple;
+  batch->path_offset[i + 1] = off;
+  batch->cnt++;
+
+  return 0;
+}
+
+/* ==================== PUBLIC FUNCTIONS ==================== */
+
+bgpstream_elem_batch_t *bgpstream_elem_batch_create(void)
+{
+  return malloc_zero(sizeof(bgpstream_elem_batch_t));
+}
+
+void bgpstream_elem_batch_destroy(bgpstream_elem_batch_t *batch)
+{
+  if (batch == NULL) {
+    return;
+  }
+
+  free(batch->type);
+  free(batch->time_sec);
+  free(batch->time_usec);
+  free(batch->peer_asn);
+  free(batch->peer_ip);
+  free(batch->prefix);
+  free(batch->mask_len);
+  free(batch->origin_asn);
+  free(batch->path_simple);
+  free(batch->path_offset);
+  free(batch->path_asns);
+
+  free(batch);
+}
+
+void bgpstream_elem_batch_clear(bgpstream_elem_batch_t *batch)
+{
+  batch->cnt = 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2019 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BGPSTREAM_ELEM_BATCH_H
+#define __BGPSTREAM_ELEM_BATCH_H
+
+#include "bgpstream_elem.h"
+#include "bgpstream_utils.h"
+
+/** @file
+ *
+ * @brief Header file that exposes the public interface of a columnar batch of
+ * bgpstream elems.
+ *
+ * A batch stores the most commonly scanned elem fields as parallel arrays
+ * (one array per field, indexed by elem) so that analytics code that only
+ * looks at a few fields does not need to touch entire elem structures. The
+ * ASNs of all the AS paths in the batch are stored back-to-back in a single
+ * arena and are located using per-elem offsets.
+ *
+ * Use bgpstream_record_get_elem_batch to fill a batch from a record.
+ *
+ */
+
+/**
+ * @name Public Data Structures
+ *
+ * @{ */
+
+/** A columnar batch of BGP Stream Elems
+ *
+ * All the per-elem arrays have `cnt` valid entries, except for `path_offset`
+ * which has `cnt + 1` so that the ASNs of the AS path of elem `i` are
+ * `path_asns[path_offset[i]]` to `path_asns[path_offset[i+1] - 1]`.
+ *
+ * The fields of the structure are read-only for users of the batch.
+ */
+typedef struct bgpstream_elem_batch {
+
+  /** Number of elems in the batch */
+  int cnt;
+
+  /** Elem type (a bgpstream_elem_type_t value) */
+  uint8_t *type;
+
+  /** Record timestamp (seconds component) */
+  uint32_t *time_sec;
+
+  /** Record timestamp (microseconds component) */
+  uint32_t *time_usec;
+
+  /** Peer AS number */
+  uint32_t *peer_asn;
+
+  /** Peer IP address */
+  bgpstream_ip_addr_t *peer_ip;
+
+  /** Prefix address (RIB, Announcement and Withdrawal elems only) */
+  bgpstream_ip_addr_t *prefix;
+
+  /** Prefix mask length (RIB, Announcement and Withdrawal elems only) */
+  uint8_t *mask_len;
+
+  /** Origin ASN, or 0 if the path is empty or the origin segment is a set or
+      confederation */
+  uint32_t *origin_asn;
+
+  /** 1 if the AS path only has simple ASN segments, 0 otherwise */
+  uint8_t *path_simple;
+
+  /** Offset of the first ASN of each AS path in the path_asns arena */
+  uint32_t *path_offset;
+
+  /** Arena of the ASNs of all the AS paths in the batch.
+   *
+   * Only simple ASN segments are stored. AS set and confederation segments
+   * are skipped (and path_simple is set to 0 for the elem); use the elem API
+   * if these are needed.
+   */
+  uint32_t *path_asns;
+
+  /** Number of elems allocated for each per-elem array */
+  int alloc_cnt;
+
+  /** Number of ASNs allocated in the path_asns arena */
+  uint32_t path_asns_alloc_cnt;
+
+} bgpstream_elem_batch_t;
+
+/** @} */
+
+/**
+ * @name Public API Functions
+ *
+ * @{ */
+
+/** Create a new, empty, BGP Stream Elem Batch
+ *
+ * @return a pointer to an Elem Batch instance if successful, NULL otherwise
+ */
+bgpstream_elem_batch_t *bgpstream_elem_batch_create(void);
+
+/** Destroy the given BGP Stream Elem Batch
+ *
+ * @param batch         pointer to the Elem Batch to destroy
+ */
+void bgpstream_elem_batch_destroy(bgpstream_elem_batch_t *batch);
+
+/** Remove all elems from the given BGP Stream Elem Batch
+ *
+ * @param batch         pointer to the Elem Batch to clear
+ *
+ * Memory allocated by the batch is kept for re-use.
+ */
+void bgpstream_elem_batch_clear(bgpstream_elem_batch_t *batch);
+
+/** @} */
+
+#endif /* __BGPSTREAM_ELEM_BATCH_H */
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2019 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BGPSTREAM_ELEM_BATCH_INT_H
+#define __BGPSTREAM_ELEM_BATCH_INT_H
+
+#include "bgpstream_elem_batch.h"
+#include "bgpstream_record.h"
+
+/** @file
+ *
+ * @brief Header file that exposes the protected interface of a columnar batch
+ * of bgpstream elems.
+ *
+ */
+
+/**
+ * @name Protected API Functions
+ *
+ * @{ */
+
+/** Append the columns of the given elem to the batch
+ *
+ * @param batch         pointer to the Elem Batch to append to
+ * @param record        pointer to the record the elem belongs to
+ * @param elem          pointer to the elem to append
+ * @return 0 if the elem was appended successfully, -1 otherwise
+ */
+int bgpstream_elem_batch_append(bgpstream_elem_batch_t *batch,
+                                const bgpstream_record_t *record,
+                                const bgpstream_elem_t *elem);
+
+/** @} */
+
+#endif /* __BGPSTREAM_ELEM_BATCH_INT_H */
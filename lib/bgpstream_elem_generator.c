@@ -27,10 +27,67 @@
 #include "bgpstream_elem_generator.h"
 #include "utils.h"
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Number of elems in the first slab (later slabs double in size) */
+#define SLAB_INIT_ELEM_CNT 64
+
+/* Size of the first attribute arena chunk (later chunks double in size) */
+#define ARENA_INIT_SIZE 16384
+
+/* Where the AS path and communities of an elem slot keep their data */
+typedef enum {
+
+  /* never populated (the attribute objects hold no memory) */
+  ATTRS_EMPTY = 0,
+
+  /* populated via get_new_elem (the attribute objects own their memory) */
+  ATTRS_OWNED = 1,
+
+  /* populated via copy_elem (the attribute objects point into the arena) */
+  ATTRS_ARENA = 2,
+
+} attrs_mode_t;
+
+/* An elem slot in a slab */
+typedef struct gen_elem {
+
+  /* the elem handed out by the generator (must be the first field) */
+  bgpstream_elem_t elem;
+
+  /* an attrs_mode_t value */
+  uint8_t attrs_mode;
+
+} gen_elem_t;
+
+/* A contiguous block of elem slots */
+typedef struct gen_slab {
+
+  gen_elem_t *slots;
+
+  int slots_cnt;
+
+  struct gen_slab *next;
+
+} gen_slab_t;
+
+/* A chunk of the attribute arena */
+typedef struct arena_chunk {
+
+  uint8_t *buf;
+
+  size_t size;
+
+  size_t used;
+
+  struct arena_chunk *next;
+
+} arena_chunk_t;
 
 struct bgpstream_elem_generator {
 
-  /** Array of elems */
+  /** Array of elems (pointing into the slabs) */
   bgpstream_elem_t **elems;
 
   /** Number of elems that are active in the elems list */
@@ -41,10 +98,165 @@ struct bgpstream_elem_generator {
 
   /* Current iterator position (iter == cnt means end-of-list) */
   int iter;
+
+  /** List of slabs that hold the elem structures */
+  gen_slab_t *slabs;
+
+  /** List of arena chunks that hold AS path and community data */
+  arena_chunk_t *chunks;
+
+  /** Chunk currently being carved (NULL until the first copy) */
+  arena_chunk_t *cur_chunk;
 };
 
 /* ==================== PRIVATE FUNCTIONS ==================== */
 
+static int slab_init(gen_slab_t *slab)
+{
+  int i;
+  bgpstream_elem_t *elem;
+
+  for (i = 0; i < slab->slots_cnt; i++) {
+    elem = &slab->slots[i].elem;
+    if ((elem->as_path = bgpstream_as_path_create()) == NULL ||
+        (elem->communities = bgpstream_community_set_create()) == NULL) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void slab_destroy(gen_slab_t *slab)
+{
+  int i;
+  bgpstream_elem_t *elem;
+
+  for (i = 0; i < slab->slots_cnt; i++) {
+    elem = &slab->slots[i].elem;
+    if (elem->as_path != NULL) {
+      bgpstream_as_path_destroy(elem->as_path);
+    }
+    if (elem->communities != NULL) {
+      bgpstream_community_set_destroy(elem->communities);
+    }
+  }
+
+  free(slab->slots);
+  free(slab);
+}
+
+/* Add a slab large enough to double the number of elems */
+static int grow_elems(bgpstream_elem_generator_t *self)
+{
+  gen_slab_t *slab = NULL;
+  bgpstream_elem_t **tmp;
+  int cnt;
+  int i;
+
+  cnt = self->elems_alloc_cnt == 0 ? SLAB_INIT_ELEM_CNT : self->elems_alloc_cnt;
+
+  if ((tmp = realloc(self->elems, sizeof(bgpstream_elem_t *) *
+                                    (self->elems_alloc_cnt + cnt))) == NULL) {
+    return -1;
+  }
+  self->elems = tmp;
+
+  if ((slab = malloc_zero(sizeof(gen_slab_t))) == NULL) {
+    return -1;
+  }
+  if ((slab->slots = malloc_zero(sizeof(gen_elem_t) * cnt)) == NULL) {
+    free(slab);
+    return -1;
+  }
+  slab->slots_cnt = cnt;
+  if (slab_init(slab) != 0) {
+    slab_destroy(slab);
+    return -1;
+  }
+  slab->next = self->slabs;
+  self->slabs = slab;
+
+  for (i = 0; i < cnt; i++) {
+    self->elems[self->elems_alloc_cnt + i] = &slab->slots[i].elem;
+  }
+  self->elems_alloc_cnt += cnt;
+
+  return 0;
+}
+
+/* Carve len bytes (aligned for 32-bit values) from the attribute arena */
+static void *arena_alloc(bgpstream_elem_generator_t *self, size_t len)
+{
+  arena_chunk_t *chunk = self->cur_chunk;
+  arena_chunk_t *next;
+  size_t size;
+  void *ptr;
+
+  len = (len + 3) & ~(size_t)3;
+
+  while (chunk == NULL || chunk->used + len > chunk->size) {
+    // re-use a chunk left over from before the last reset
+    next = (chunk == NULL) ? self->chunks : chunk->next;
+    if (next != NULL) {
+      next->used = 0;
+      chunk = next;
+      continue;
+    }
+
+    // out of chunks, so add one at the end of the list
+    size = (chunk == NULL) ? ARENA_INIT_SIZE : chunk->size * 2;
+    while (size < len) {
+      size *= 2;
+    }
+    if ((next = malloc_zero(sizeof(arena_chunk_t))) == NULL) {
+      return NULL;
+    }
+    if ((next->buf = malloc(size)) == NULL) {
+      free(next);
+      return NULL;
+    }
+    next->size = size;
+    if (chunk == NULL) {
+      self->chunks = next;
+    } else {
+      chunk->next = next;
+    }
+    chunk = next;
+  }
+
+  self->cur_chunk = chunk;
+  ptr = chunk->buf + chunk->used;
+  chunk->used += len;
+  return ptr;
+}
+
+/* Forget everything carved from the arena (chunks are kept for re-use) */
+static void arena_reset(bgpstream_elem_generator_t *self)
+{
+  if (self->chunks != NULL) {
+    self->chunks->used = 0;
+  }
+  self->cur_chunk = self->chunks;
+}
+
+/* Replace the attribute objects of the elem with empty ones. Used when a
+   slot switches between owned and arena-backed attributes. */
+static int reset_elem_attrs(gen_elem_t *ge)
+{
+  bgpstream_as_path_destroy(ge->elem.as_path);
+  bgpstream_community_set_destroy(ge->elem.communities);
+  ge->elem.communities = NULL;
+  ge->attrs_mode = ATTRS_EMPTY;
+
+  if ((ge->elem.as_path = bgpstream_as_path_create()) == NULL ||
+      (ge->elem.communities = bgpstream_community_set_create()) == NULL) {
+    return -1;
+  }
+
+  return 0;
+}
+
 /* ==================== PROTECTED FUNCTIONS ==================== */
 
 bgpstream_elem_generator_t *bgpstream_elem_generator_create()
@@ -63,15 +275,23 @@ bgpstream_elem_generator_t *bgpstream_elem_generator_create()
 
 void bgpstream_elem_generator_destroy(bgpstream_elem_generator_t *self)
 {
-  int i;
+  gen_slab_t *slab;
+  arena_chunk_t *chunk;
+
   if (self == NULL) {
     return;
   }
 
-  /* free all the alloc'd elems */
-  for (i = 0; i < self->elems_alloc_cnt; i++) {
-    bgpstream_elem_destroy(self->elems[i]);
-    self->elems[i] = NULL;
+  /* free all the slabs of elems */
+  while ((slab = self->slabs) != NULL) {
+    self->slabs = slab->next;
+    slab_destroy(slab);
+  }
+
+  while ((chunk = self->chunks) != NULL) {
+    self->chunks = chunk->next;
+    free(chunk->buf);
+    free(chunk);
   }
 
   free(self->elems);
@@ -87,12 +307,14 @@ void bgpstream_elem_generator_clear(bgpstream_elem_generator_t *self)
 
   self->elems_cnt = -1;
   self->iter = 0;
+  arena_reset(self);
 }
 
 void bgpstream_elem_generator_empty(bgpstream_elem_generator_t *self)
 {
   self->elems_cnt = 0;
   self->iter = 0;
+  arena_reset(self);
 }
 
 int bgpstream_elem_generator_is_populated(bgpstream_elem_generator_t *self)
@@ -103,30 +325,24 @@ int bgpstream_elem_generator_is_populated(bgpstream_elem_generator_t *self)
 bgpstream_elem_t *
 bgpstream_elem_generator_get_new_elem(bgpstream_elem_generator_t *self)
 {
-  bgpstream_elem_t *elem = NULL;
+  gen_elem_t *ge;
 
-  /* check if we need to alloc more elems */
-  if (self->elems_cnt + 1 >= self->elems_alloc_cnt) {
-
-    /* alloc more memory */
-    if ((self->elems = realloc(self->elems, sizeof(bgpstream_elem_t *) *
-                                              (self->elems_alloc_cnt + 1))) ==
-        NULL) {
-      return NULL;
-    }
-
-    /* create an elem */
-    if ((self->elems[self->elems_alloc_cnt] = bgpstream_elem_create()) ==
-        NULL) {
-      return NULL;
-    }
+  if (self->elems_cnt < 0) {
+    self->elems_cnt = 0;
+  }
 
-    self->elems_alloc_cnt++;
+  /* check if we need to alloc more elems */
+  if (self->elems_cnt >= self->elems_alloc_cnt && grow_elems(self) != 0) {
+    return NULL;
   }
 
-  elem = self->elems[self->elems_cnt];
-  bgpstream_elem_clear(elem);
-  return elem;
+  ge = (gen_elem_t *)self->elems[self->elems_cnt];
+  if (ge->attrs_mode == ATTRS_ARENA && reset_elem_attrs(ge) != 0) {
+    return NULL;
+  }
+  ge->attrs_mode = ATTRS_OWNED;
+  bgpstream_elem_clear(&ge->elem);
+  return &ge->elem;
 }
 
 void bgpstream_elem_generator_commit_elem(bgpstream_elem_generator_t *self,
@@ -136,6 +352,63 @@ void bgpstream_elem_generator_commit_elem(bgpstream_elem_generator_t *self,
   self->elems_cnt++;
 }
 
+bgpstream_elem_t *
+bgpstream_elem_generator_copy_elem(bgpstream_elem_generator_t *self,
+                                   const bgpstream_elem_t *src)
+{
+  gen_elem_t *ge;
+  bgpstream_as_path_t *path;
+  bgpstream_community_set_t *comms;
+  uint8_t *path_data;
+  uint16_t path_len;
+  int comms_cnt;
+  void *ptr = NULL;
+
+  if (self->elems_cnt < 0) {
+    self->elems_cnt = 0;
+  }
+  if (self->elems_cnt >= self->elems_alloc_cnt && grow_elems(self) != 0) {
+    return NULL;
+  }
+  ge = (gen_elem_t *)self->elems[self->elems_cnt];
+  if (ge->attrs_mode == ATTRS_OWNED && reset_elem_attrs(ge) != 0) {
+    return NULL;
+  }
+
+  /* copy the fixed-size fields, keeping our own attribute objects */
+  path = ge->elem.as_path;
+  comms = ge->elem.communities;
+  memcpy(&ge->elem, src, sizeof(bgpstream_elem_t));
+  ge->elem.as_path = path;
+  ge->elem.communities = comms;
+
+  /* and point the attribute objects at copies carved from the arena */
+  path_len = bgpstream_as_path_get_data(src->as_path, &path_data);
+  if (path_len > 0 && (ptr = arena_alloc(self, path_len)) == NULL) {
+    return NULL;
+  }
+  if (path_len > 0) {
+    memcpy(ptr, path_data, path_len);
+  }
+  bgpstream_as_path_populate_from_data_zc(path, ptr, path_len);
+
+  ptr = NULL;
+  comms_cnt = bgpstream_community_set_size(src->communities);
+  if (comms_cnt > 0) {
+    if ((ptr = arena_alloc(self, sizeof(bgpstream_community_t) * comms_cnt)) ==
+        NULL) {
+      return NULL;
+    }
+    memcpy(ptr, bgpstream_community_set_get(src->communities, 0),
+           sizeof(bgpstream_community_t) * comms_cnt);
+  }
+  bgpstream_community_set_populate_from_array_zc(comms, ptr, comms_cnt);
+
+  ge->attrs_mode = ATTRS_ARENA;
+  self->elems_cnt++;
+  return &ge->elem;
+}
+
 bgpstream_elem_t *
 bgpstream_elem_generator_get_next_elem(bgpstream_elem_generator_t *self)
 {
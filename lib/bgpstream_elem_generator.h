@@ -112,6 +112,21 @@ bgpstream_elem_generator_get_new_elem(bgpstream_elem_generator_t *generator);
 void bgpstream_elem_generator_commit_elem(bgpstream_elem_generator_t *generator,
                                           bgpstream_elem_t *elem);
 
+/** Copy the given elem into the generator and commit it
+ *
+ * @param generator     pointer to the generator to copy the elem into
+ * @param elem          pointer to the elem to copy
+ * @return borrowed pointer to the copy if successful, NULL otherwise
+ *
+ * The elem structure is taken from the generator's slabs, and the AS path and
+ * community data are carved from an arena owned by the generator, so once the
+ * generator has warmed up copying an elem does not allocate. The arena is
+ * reset (in constant time) when the generator is cleared or emptied.
+ */
+bgpstream_elem_t *
+bgpstream_elem_generator_copy_elem(bgpstream_elem_generator_t *generator,
+                                   const bgpstream_elem_t *elem);
+
 /** Get the next elem from the generator
  *
  * @param generator     pointer to the generator to retrieve an elem from
@@ -37,6 +37,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <ctype.h>
 
@@ -75,6 +76,152 @@ static int bsf_str_set_insert(bgpstream_str_set_t **setp, const char *value)
   return bgpstream_str_set_insert(*setp, value) >= 0;
 }
 
+// Create *setp if needed, and insert the interned ID of value into *setp.
+// Returns 1 for success, 0 for failure.
+static int bsf_str_id_insert(bgpstream_id_set_t **setp, const char *value)
+{
+  bgpstream_str_id_t id;
+
+  if ((id = bgpstream_str_intern(value)) == BGPSTREAM_STR_ID_INVALID) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "can't allocate memory");
+    return 0;
+  }
+  return bsf_id_set_insert(setp, id);
+}
+
+// Parse an ASN (or the "[0-9]+" wildcard) from a simple AS path expression.
+// Returns 1 for success, 0 if there is no ASN here. ASNs with leading zeros
+// are rejected, since they never appear in a rendered path and so must be
+// left for regexec to (not) match.
+static int aspath_expr_parse_asn(const char **c_ptr, uint32_t *asn, int *any)
+{
+  const char *c = *c_ptr;
+  uint64_t val = 0;
+
+  if (strncmp(c, "[0-9]+", 6) == 0) {
+    *any = 1;
+    *c_ptr = c + 6;
+    return 1;
+  }
+  if (!isdigit(*c) || (c[0] == '0' && isdigit(c[1]))) {
+    return 0;
+  }
+  while (isdigit(*c)) {
+    val = val * 10 + (*c - '0');
+    if (val > UINT32_MAX) {
+      return 0;
+    }
+    c++;
+  }
+  *asn = (uint32_t)val;
+  *any = 0;
+  *c_ptr = c;
+  return 1;
+}
+
+// Try to compile a Cisco AS path regex into a sequence of ASNs that can be
+// matched against the path segments without rendering the path to a string.
+// This only handles whole ASNs (or "[0-9]+") delimited by "_" or " ", and
+// optionally anchored with "^" and "$", e.g., "_3356_", "^174 3356_",
+// "_[0-9]+_13335$". Anything else (including regexes that match parts of
+// ASNs) is left to regexec.
+static void aspath_expr_compile(bgpstream_aspath_expr_t *expr,
+                                const char *cisco_re)
+{
+  uint32_t asns[BGPSTREAM_ASPATH_EXPR_MAX_ASNS];
+  uint64_t any_mask = 0;
+  int cnt = 0;
+  int any;
+  const char *c = cisco_re;
+
+  expr->asn_cnt = 0;
+
+  // the first ASN must begin at the start of the path, or at an ASN boundary
+  if (*c == '^') {
+    expr->anchor_start = 1;
+  } else if (*c != '_') {
+    return;
+  }
+  c++;
+
+  while (1) {
+    if (cnt == BGPSTREAM_ASPATH_EXPR_MAX_ASNS ||
+        aspath_expr_parse_asn(&c, &asns[cnt], &any) == 0) {
+      return;
+    }
+    if (any) {
+      any_mask |= (uint64_t)1 << cnt;
+    }
+    cnt++;
+    // ASNs are delimited by a single space, which is also the only thing
+    // that "_" can match between two ASNs
+    if ((*c == '_' || *c == ' ') && (isdigit(c[1]) || c[1] == '[')) {
+      c++;
+      continue;
+    }
+    break;
+  }
+
+  // and the last ASN must end at the end of the path, or at a boundary
+  if (*c == '$') {
+    expr->anchor_end = 1;
+  } else if (*c != '_') {
+    return;
+  }
+  if (c[1] != '\0') {
+    return;
+  }
+
+  if ((expr->asns = malloc(sizeof(uint32_t) * cnt)) == NULL) {
+    // not fatal, we'll just use the regex
+    return;
+  }
+  memcpy(expr->asns, asns, sizeof(uint32_t) * cnt);
+  expr->any_mask = any_mask;
+  expr->asn_cnt = cnt;
+}
+
+int bgpstream_aspath_expr_match(const bgpstream_aspath_expr_t *expr,
+                                const bgpstream_as_path_t *path)
+{
+  bgpstream_as_path_iter_t iter;
+  bgpstream_as_path_seg_t *seg;
+  uint64_t state = 0, mask;
+  uint64_t last = (uint64_t)1 << (expr->asn_cnt - 1);
+  int first = 1;
+  int i;
+
+  if (expr->asn_cnt == 0) {
+    return -1;
+  }
+
+  // bit-parallel NFA (shift-and) over the ASNs of the path: bit i of state is
+  // set if the last i+1 ASNs match the first i+1 ASNs of the expression
+  bgpstream_as_path_iter_reset(&iter);
+  while ((seg = bgpstream_as_path_get_next_seg(path, &iter)) != NULL) {
+    if (seg->type != BGPSTREAM_AS_PATH_SEG_ASN) {
+      // sets and confederations are rendered with other delimiters
+      return -1;
+    }
+    mask = expr->any_mask;
+    for (i = 0; i < expr->asn_cnt; i++) {
+      if (expr->asns[i] == seg->asn.asn) {
+        mask |= (uint64_t)1 << i;
+      }
+    }
+    state = ((state << 1) | (expr->anchor_start == 0 || first)) & mask;
+    first = 0;
+    if (expr->anchor_end == 0 && (state & last) != 0) {
+      return 1;
+    }
+    if (expr->anchor_start != 0 && state == 0) {
+      return 0;
+    }
+  }
+
+  return (state & last) != 0;
+}
+
 int bgpstream_filter_mgr_filter_add(bgpstream_filter_mgr_t *this,
                                     bgpstream_filter_type_t filter_type,
                                     const char *filter_value)
@@ -208,8 +355,12 @@ int bgpstream_filter_mgr_filter_add(bgpstream_filter_mgr_t *this,
       this->aspath_exprs = tmp;
       this->aspath_expr_alloc_cnt = this->aspath_expr_cnt;
     }
+    memset(&this->aspath_exprs[this->aspath_expr_cnt - 1], 0,
+           sizeof(bgpstream_aspath_expr_t));
     this->aspath_exprs[this->aspath_expr_cnt-1].re = re;
     this->aspath_exprs[this->aspath_expr_cnt-1].negate = negate;
+    aspath_expr_compile(&this->aspath_exprs[this->aspath_expr_cnt - 1],
+                        filter_value);
     return 1;
   }
 
@@ -302,13 +453,16 @@ int bgpstream_filter_mgr_filter_add(bgpstream_filter_mgr_t *this,
     return 1;
 
   case BGPSTREAM_FILTER_TYPE_PROJECT:
-    return bsf_str_set_insert(&this->projects, filter_value);
+    return bsf_str_set_insert(&this->projects, filter_value) &&
+           bsf_str_id_insert(&this->project_ids, filter_value);
 
   case BGPSTREAM_FILTER_TYPE_COLLECTOR:
-    return bsf_str_set_insert(&this->collectors, filter_value);
+    return bsf_str_set_insert(&this->collectors, filter_value) &&
+           bsf_str_id_insert(&this->collector_ids, filter_value);
 
   case BGPSTREAM_FILTER_TYPE_ROUTER:
-    return bsf_str_set_insert(&this->routers, filter_value);
+    return bsf_str_set_insert(&this->routers, filter_value) &&
+           bsf_str_id_insert(&this->router_ids, filter_value);
 
   case BGPSTREAM_FILTER_TYPE_RECORD_TYPE:
     if (strcmp(filter_value, "ribs") != 0 &&
@@ -392,6 +546,353 @@ int bgpstream_filter_mgr_validate(bgpstream_filter_mgr_t *filter_mgr)
   return 0;
 }
 
+static const char *pred_names[] = {
+  "elemtype",   // BGPSTREAM_FILTER_PRED_ELEMTYPE
+  "ipversion",  // BGPSTREAM_FILTER_PRED_IPVERSION
+  "peer",       // BGPSTREAM_FILTER_PRED_PEER_ASN
+  "not-peer",   // BGPSTREAM_FILTER_PRED_NOT_PEER_ASN
+  "origin",     // BGPSTREAM_FILTER_PRED_ORIGIN_ASN
+  "prefix",     // BGPSTREAM_FILTER_PRED_PREFIX
+  "community",  // BGPSTREAM_FILTER_PRED_COMMUNITY
+  "aspath",     // BGPSTREAM_FILTER_PRED_ASPATH
+};
+
+const char *bgpstream_filter_pred_name(bgpstream_filter_pred_type_t type)
+{
+  assert(type < ARR_CNT(pred_names));
+  return pred_names[type];
+}
+
+static void prog_add(bgpstream_filter_mgr_t *this,
+                     bgpstream_filter_pred_type_t type, uint32_t cost)
+{
+  bgpstream_filter_pred_t *pred = &this->prog[this->prog_cnt++];
+  memset(pred, 0, sizeof(*pred));
+  pred->type = type;
+  pred->cost = cost;
+  this->prog_mask |= BGPSTREAM_FILTER_PRED_BIT(type);
+}
+
+#define BITMAP_SET(bm, i) ((bm)[(i) >> 3] |= (1 << ((i)&7)))
+#define BITMAP_TEST(bm, i) ((bm)[(i) >> 3] & (1 << ((i)&7)))
+
+static void community_index_clear(bgpstream_community_index_t *idx)
+{
+  if (idx->exact != NULL) {
+    kh_destroy(bgpstream_community_exact, idx->exact);
+  }
+  free(idx->asns);
+  free(idx->values);
+  memset(idx, 0, sizeof(*idx));
+}
+
+static int community_index_build(bgpstream_community_index_t *idx,
+                                 bgpstream_community_filter_t *communities)
+{
+  bgpstream_community_t *c;
+  uint8_t mask;
+  khiter_t k;
+  int khret;
+
+  community_index_clear(idx);
+
+  for (k = kh_begin(communities); k != kh_end(communities); ++k) {
+    if (!kh_exist(communities, k)) {
+      continue;
+    }
+    c = &kh_key(communities, k);
+    mask = kh_value(communities, k);
+
+    switch (mask) {
+    case BGPSTREAM_COMMUNITY_FILTER_EXACT:
+      if (idx->exact == NULL &&
+          (idx->exact = kh_init(bgpstream_community_exact)) == NULL) {
+        goto err;
+      }
+      kh_put(bgpstream_community_exact, idx->exact, c->ui32, &khret);
+      if (khret == -1) {
+        goto err;
+      }
+      break;
+
+    case BGPSTREAM_COMMUNITY_FILTER_ASN:
+      if (idx->asns == NULL &&
+          (idx->asns = malloc_zero((UINT16_MAX + 1) / 8)) == NULL) {
+        goto err;
+      }
+      BITMAP_SET(idx->asns, c->asn);
+      break;
+
+    case BGPSTREAM_COMMUNITY_FILTER_VALUE:
+      if (idx->values == NULL &&
+          (idx->values = malloc_zero((UINT16_MAX + 1) / 8)) == NULL) {
+        goto err;
+      }
+      BITMAP_SET(idx->values, c->value);
+      break;
+
+    default:
+      idx->any = 1;
+      break;
+    }
+  }
+
+  return 0;
+
+err:
+  bgpstream_log(BGPSTREAM_LOG_ERR, "can't allocate memory");
+  community_index_clear(idx);
+  return -1;
+}
+
+int bgpstream_community_index_match(const bgpstream_community_index_t *idx,
+                                    const bgpstream_community_set_t *set)
+{
+  const bgpstream_community_t *c;
+  int n = bgpstream_community_set_size(set);
+  int i;
+
+  if (n > 0 && idx->any != 0) {
+    return 1;
+  }
+
+  for (i = 0; i < n; i++) {
+    c = bgpstream_community_set_get(set, i);
+    if ((idx->asns != NULL && BITMAP_TEST(idx->asns, c->asn)) ||
+        (idx->values != NULL && BITMAP_TEST(idx->values, c->value)) ||
+        (idx->exact != NULL &&
+         kh_get(bgpstream_community_exact, idx->exact, c->ui32) !=
+           kh_end(idx->exact))) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int bgpstream_filter_mgr_check_pred(bgpstream_filter_mgr_t *filter_mgr,
+                                    bgpstream_filter_pred_type_t type,
+                                    bgpstream_elem_t *elem)
+{
+  switch (type) {
+  case BGPSTREAM_FILTER_PRED_ELEMTYPE:
+    /* check if this element is the right type */
+    if (elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE &&
+        !(filter_mgr->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_PEERSTATE)) {
+      return 0;
+    }
+
+    if (elem->type == BGPSTREAM_ELEM_TYPE_RIB &&
+        !(filter_mgr->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_RIB)) {
+      return 0;
+    }
+
+    if (elem->type == BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT &&
+        !(filter_mgr->elemtype_mask &
+          BGPSTREAM_FILTER_ELEM_TYPE_ANNOUNCEMENT)) {
+      return 0;
+    }
+
+    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL &&
+        !(filter_mgr->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_WITHDRAWAL)) {
+      return 0;
+    }
+    return 1;
+
+  case BGPSTREAM_FILTER_PRED_PEER_ASN:
+    /* Checking peer ASNs: if the filter is on and the peer asn is not in the
+     * set, return 0 */
+    return bgpstream_id_set_exists(filter_mgr->peer_asns, elem->peer_asn);
+
+  case BGPSTREAM_FILTER_PRED_NOT_PEER_ASN:
+    /* Checking not peer ASNs: if the filter is on and the peer asn is in the
+     * set, return 0 */
+    return bgpstream_id_set_exists(filter_mgr->not_peer_asns,
+                                   elem->peer_asn) == 0;
+
+  case BGPSTREAM_FILTER_PRED_ORIGIN_ASN: {
+    /* Checking origin ASN */
+    uint32_t origin_asn;
+
+    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
+        elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
+      return 0;
+    }
+
+    if (bgpstream_as_path_get_origin_val(elem->as_path, &origin_asn) < 0) {
+      return 0;
+    }
+
+    return bgpstream_id_set_exists(filter_mgr->origin_asns, origin_asn);
+  }
+
+  case BGPSTREAM_FILTER_PRED_IPVERSION:
+    /* Determine address version for the element prefix */
+    if (elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
+      return 0;
+    }
+
+    return elem->prefix.address.version == filter_mgr->ipversion;
+
+  case BGPSTREAM_FILTER_PRED_PREFIX:
+    if (elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
+      return 0;
+    }
+    return bgpstream_filter_pfx_index_match(filter_mgr->prefix_index,
+                                            &elem->prefix);
+
+  case BGPSTREAM_FILTER_PRED_ASPATH: {
+    /* Checking AS Path expressions */
+    char aspath[65536];
+    int pathlen = -1;
+    int result;
+
+    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
+        elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
+      return 0;
+    }
+
+    for (int i = 0; i < filter_mgr->aspath_expr_cnt; i++) {
+      // simple expressions are matched directly against the ASNs
+      result = bgpstream_aspath_expr_match(&filter_mgr->aspath_exprs[i],
+                                           elem->as_path);
+      if (result < 0) {
+        // otherwise we need the path as a string (rendered only once)
+        if (pathlen < 0) {
+          pathlen =
+            bgpstream_as_path_snprintf(aspath, sizeof(aspath), elem->as_path);
+          if (pathlen >= sizeof(aspath)) {
+            bgpstream_log(BGPSTREAM_LOG_WARN,
+                          "AS Path is too long? Filter may not work well.");
+          }
+        }
+        result =
+          regexec(filter_mgr->aspath_exprs[i].re, aspath, 0, NULL, 0) == 0;
+      }
+      // All aspath regexes must match
+      if (result != (filter_mgr->aspath_exprs[i].negate == 0)) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  case BGPSTREAM_FILTER_PRED_COMMUNITY:
+    /* Checking communities (unless it is a withdrawal message) */
+    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
+        elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
+      return 0;
+    }
+
+    return bgpstream_community_index_match(&filter_mgr->community_index,
+                                           elem->communities);
+
+  default:
+    assert(0);
+    return 1;
+  }
+}
+
+int bgpstream_filter_mgr_check_mask(bgpstream_filter_mgr_t *filter_mgr,
+                                    uint32_t mask, bgpstream_elem_t *elem)
+{
+  int i;
+
+  if ((filter_mgr->prog_mask & mask) == 0) {
+    return 1;
+  }
+
+  for (i = 0; i < filter_mgr->prog_cnt; i++) {
+    if ((BGPSTREAM_FILTER_PRED_BIT(filter_mgr->prog[i].type) & mask) != 0 &&
+        bgpstream_filter_mgr_check_pred(filter_mgr, filter_mgr->prog[i].type,
+                                        elem) == 0) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int bgpstream_filter_mgr_compile(bgpstream_filter_mgr_t *this)
+{
+  this->prog_cnt = 0;
+  this->prog_mask = 0;
+  this->prog_run_cnt = 0;
+
+  // the costs are rough guesses of the relative evaluation time of each
+  // predicate; reordering corrects them with the observed rejection rates
+  if (this->elemtype_mask) {
+    prog_add(this, BGPSTREAM_FILTER_PRED_ELEMTYPE, 1);
+  }
+  if (this->ipversion) {
+    prog_add(this, BGPSTREAM_FILTER_PRED_IPVERSION, 1);
+  }
+  if (this->peer_asns) {
+    prog_add(this, BGPSTREAM_FILTER_PRED_PEER_ASN, 2);
+  }
+  if (this->not_peer_asns) {
+    prog_add(this, BGPSTREAM_FILTER_PRED_NOT_PEER_ASN, 2);
+  }
+  if (this->origin_asns) {
+    prog_add(this, BGPSTREAM_FILTER_PRED_ORIGIN_ASN, 4);
+  }
+  if (this->prefixes) {
+    bgpstream_filter_pfx_index_destroy(this->prefix_index);
+    if ((this->prefix_index =
+           bgpstream_filter_pfx_index_create(this->prefixes)) == NULL) {
+      return -1;
+    }
+    prog_add(this, BGPSTREAM_FILTER_PRED_PREFIX, 8);
+  }
+  if (this->communities) {
+    if (community_index_build(&this->community_index, this->communities) !=
+        0) {
+      return -1;
+    }
+    prog_add(this, BGPSTREAM_FILTER_PRED_COMMUNITY, 4);
+  }
+  if (this->aspath_exprs) {
+    // expressions that can't be matched directly need the path rendered
+    uint32_t cost = 0;
+    for (int i = 0; i < this->aspath_expr_cnt; i++) {
+      cost += this->aspath_exprs[i].asn_cnt > 0 ? 4 : 64;
+    }
+    prog_add(this, BGPSTREAM_FILTER_PRED_ASPATH, cost);
+  }
+
+  return 0;
+}
+
+// expected cost of a predicate per rejected elem (lower is better)
+static double pred_rank(bgpstream_filter_pred_t *pred)
+{
+  // assume an unknown rejection rate of 50%
+  return (double)pred->cost * (pred->win_eval_cnt + 2) /
+         (pred->win_reject_cnt + 1);
+}
+
+void bgpstream_filter_mgr_reorder(bgpstream_filter_mgr_t *this)
+{
+  bgpstream_filter_pred_t tmp;
+  int i, j;
+
+  // the program is tiny, so a simple insertion sort will do
+  for (i = 1; i < this->prog_cnt; i++) {
+    tmp = this->prog[i];
+    for (j = i; j > 0 && pred_rank(&this->prog[j - 1]) > pred_rank(&tmp); j--) {
+      this->prog[j] = this->prog[j - 1];
+    }
+    this->prog[j] = tmp;
+  }
+
+  // decay the counts so that we adapt to changes in the stream
+  for (i = 0; i < this->prog_cnt; i++) {
+    this->prog[i].win_eval_cnt /= 2;
+    this->prog[i].win_reject_cnt /= 2;
+  }
+  this->prog_run_cnt = 0;
+}
+
 /* destroy the memory allocated for bgpstream filter */
 void bgpstream_filter_mgr_destroy(bgpstream_filter_mgr_t *this)
 {
@@ -413,6 +914,16 @@ void bgpstream_filter_mgr_destroy(bgpstream_filter_mgr_t *this)
   if (this->routers != NULL) {
     bgpstream_str_set_destroy(this->routers);
   }
+  // project/collector/router IDs
+  if (this->project_ids != NULL) {
+    bgpstream_id_set_destroy(this->project_ids);
+  }
+  if (this->collector_ids != NULL) {
+    bgpstream_id_set_destroy(this->collector_ids);
+  }
+  if (this->router_ids != NULL) {
+    bgpstream_id_set_destroy(this->router_ids);
+  }
   // bgp_types
   if (this->bgp_types != NULL) {
     bgpstream_str_set_destroy(this->bgp_types);
@@ -438,17 +949,21 @@ void bgpstream_filter_mgr_destroy(bgpstream_filter_mgr_t *this)
     for (int i = 0; i < this->aspath_expr_cnt; i++) {
       if (this->aspath_exprs[i].re) {
         regfree(this->aspath_exprs[i].re);
+        free(this->aspath_exprs[i].re);
       }
+      free(this->aspath_exprs[i].asns);
     }
     free(this->aspath_exprs);
   }
   // prefixes
   if (this->prefixes != NULL) {
     bgpstream_patricia_tree_destroy(this->prefixes);
+    bgpstream_filter_pfx_index_destroy(this->prefix_index);
   }
   // communities
   if (this->communities != NULL) {
     kh_destroy(bgpstream_community_filter, this->communities);
+    community_index_clear(&this->community_index);
   }
   // time_interval
   if (this->time_interval != NULL) {
@@ -34,6 +34,7 @@
 
 #include "bgpstream.h"
 #include "bgpstream_constants.h"
+#include "bgpstream_filter_pfx_index.h"
 #include "khash.h"
 #include <regex.h>
 
@@ -48,6 +49,23 @@ KHASH_INIT(bgpstream_community_filter, bgpstream_community_t, uint8_t, 1,
            bgpstream_community_hash_value, bgpstream_community_equal_value)
 typedef khash_t(bgpstream_community_filter) bgpstream_community_filter_t;
 
+/* set of exact communities (as packed 32-bit values) */
+KHASH_INIT(bgpstream_community_exact, uint32_t, char, 0, kh_int_hash_func,
+           kh_int_hash_equal)
+
+/* community filters indexed by match type, so that each community of an elem
+ * can be checked in constant time (built by bgpstream_filter_mgr_compile) */
+typedef struct struct_bgpstream_community_index_t {
+  /* communities that must match exactly (asn:value) */
+  khash_t(bgpstream_community_exact) * exact;
+  /* bitmaps of ASNs (asn:*) and values (*:value) that match, or NULL if
+   * there are no such filters */
+  uint8_t *asns;
+  uint8_t *values;
+  /* set if any community matches (*:*) */
+  uint8_t any;
+} bgpstream_community_index_t;
+
 typedef struct struct_bgpstream_interval_filter_t {
   uint32_t begin_time;
   uint32_t end_time;
@@ -58,15 +76,76 @@ KHASH_INIT(collector_ts, char *, uint32_t, 1, kh_str_hash_func,
 
 typedef khash_t(collector_ts) collector_ts_t;
 
+/* maximum number of ASNs in an AS path expression that can be matched without
+ * rendering the path */
+#define BGPSTREAM_ASPATH_EXPR_MAX_ASNS 64
+
 typedef struct struct_bgpstream_aspath_expr_t {
   regex_t *re;
   uint8_t negate;
+  /* if asn_cnt > 0, the expression is a simple sequence of ASNs (e.g.,
+   * "^174_3356_") that is matched directly against the path segments */
+  uint32_t *asns;
+  int asn_cnt;
+  /* bit i is set if asns[i] is a wildcard that matches any ASN */
+  uint64_t any_mask;
+  uint8_t anchor_start;
+  uint8_t anchor_end;
 } bgpstream_aspath_expr_t;
 
+/* elem filter predicates, in their default (cheapest first) order */
+typedef enum {
+  BGPSTREAM_FILTER_PRED_ELEMTYPE,
+  BGPSTREAM_FILTER_PRED_IPVERSION,
+  BGPSTREAM_FILTER_PRED_PEER_ASN,
+  BGPSTREAM_FILTER_PRED_NOT_PEER_ASN,
+  BGPSTREAM_FILTER_PRED_ORIGIN_ASN,
+  BGPSTREAM_FILTER_PRED_PREFIX,
+  BGPSTREAM_FILTER_PRED_COMMUNITY,
+  BGPSTREAM_FILTER_PRED_ASPATH,
+  BGPSTREAM_FILTER_PRED_CNT,
+} bgpstream_filter_pred_type_t;
+
+/* bit for the given predicate type in a predicate mask */
+#define BGPSTREAM_FILTER_PRED_BIT(type) (1 << (type))
+
+/* predicates that only depend on the peer of an elem */
+#define BGPSTREAM_FILTER_PRED_PEER_MASK                                        \
+  (BGPSTREAM_FILTER_PRED_BIT(BGPSTREAM_FILTER_PRED_PEER_ASN) |                 \
+   BGPSTREAM_FILTER_PRED_BIT(BGPSTREAM_FILTER_PRED_NOT_PEER_ASN))
+
+/* predicates that only depend on the path attributes of an elem (and that
+   reject all withdrawals) */
+#define BGPSTREAM_FILTER_PRED_ATTR_MASK                                        \
+  (BGPSTREAM_FILTER_PRED_BIT(BGPSTREAM_FILTER_PRED_ORIGIN_ASN) |               \
+   BGPSTREAM_FILTER_PRED_BIT(BGPSTREAM_FILTER_PRED_COMMUNITY) |                \
+   BGPSTREAM_FILTER_PRED_BIT(BGPSTREAM_FILTER_PRED_ASPATH))
+
+/* number of elems checked between reorderings of the filter program */
+#define BGPSTREAM_FILTER_REORDER_INTERVAL 4096
+
+/* one step of the compiled elem filter program */
+typedef struct struct_bgpstream_filter_pred_t {
+  bgpstream_filter_pred_type_t type;
+  /* estimated relative cost of evaluating the predicate */
+  uint32_t cost;
+  /* total number of evaluations and rejections */
+  uint64_t eval_cnt;
+  uint64_t reject_cnt;
+  /* decayed counts used to estimate the rejection rate */
+  uint32_t win_eval_cnt;
+  uint32_t win_reject_cnt;
+} bgpstream_filter_pred_t;
+
 typedef struct struct_bgpstream_filter_mgr_t {
   bgpstream_str_set_t *projects;
   bgpstream_str_set_t *collectors;
   bgpstream_str_set_t *routers;
+  /* interned IDs of the project/collector/router names, for checking
+   * records */
+  bgpstream_id_set_t *project_ids;
+  bgpstream_id_set_t *collector_ids;
+  bgpstream_id_set_t *router_ids;
   bgpstream_str_set_t *bgp_types;
   bgpstream_str_set_t *res_types;
   bgpstream_aspath_expr_t *aspath_exprs;
@@ -76,12 +155,24 @@ typedef struct struct_bgpstream_filter_mgr_t {
   bgpstream_id_set_t *not_peer_asns;
   bgpstream_id_set_t *origin_asns;
   bgpstream_patricia_tree_t *prefixes;
+  bgpstream_filter_pfx_index_t *prefix_index;
   bgpstream_community_filter_t *communities;
+  bgpstream_community_index_t community_index;
   bgpstream_interval_filter_t *time_interval;
   collector_ts_t *last_processed_ts;
   uint32_t rib_period;
   uint8_t ipversion;
   uint8_t elemtype_mask;
+  /* only decode message payloads when elems are requested */
+  uint8_t lazy_decode;
+  /* elems reference attribute data in the parsed messages */
+  uint8_t zero_copy_elems;
+  /* compiled elem filter program (see bgpstream_filter_mgr_compile) */
+  bgpstream_filter_pred_t prog[BGPSTREAM_FILTER_PRED_CNT];
+  int prog_cnt;
+  /* mask of the predicates in the program (see BGPSTREAM_FILTER_PRED_BIT) */
+  uint32_t prog_mask;
+  uint32_t prog_run_cnt;
 } bgpstream_filter_mgr_t;
 
 /* allocate memory for a new bgpstream filter */
@@ -102,6 +193,40 @@ int bgpstream_filter_mgr_interval_filter_add(
 /* validate the current filters */
 int bgpstream_filter_mgr_validate(bgpstream_filter_mgr_t *mgr);
 
+/* compile the configured elem filters into a program of predicates ordered by
+ * estimated cost */
+int bgpstream_filter_mgr_compile(bgpstream_filter_mgr_t *mgr);
+
+/* reorder the elem filter program so that the predicates that reject the most
+ * elems for their cost are evaluated first */
+void bgpstream_filter_mgr_reorder(bgpstream_filter_mgr_t *mgr);
+
+/* check a single predicate of the compiled program against an elem
+ * (returns 1 if the elem passes, 0 otherwise) */
+int bgpstream_filter_mgr_check_pred(bgpstream_filter_mgr_t *mgr,
+                                    bgpstream_filter_pred_type_t type,
+                                    bgpstream_elem_t *elem);
+
+/* check the predicates of the compiled program that are in the given mask
+ * against an elem, without updating the predicate statistics. Used by the
+ * format modules to decide whole messages before generating elems. */
+int bgpstream_filter_mgr_check_mask(bgpstream_filter_mgr_t *mgr, uint32_t mask,
+                                    bgpstream_elem_t *elem);
+
+/* match the given AS path against a simple AS path expression
+ * returns 1 if the path matches, 0 if it does not, or -1 if the expression (or
+ * path) is not simple, and the path has to be matched using the regex */
+int bgpstream_aspath_expr_match(const bgpstream_aspath_expr_t *expr,
+                                const bgpstream_as_path_t *path);
+
+/* check if any community in the given set matches the community filters
+ * returns 1 if there is a match, 0 otherwise */
+int bgpstream_community_index_match(const bgpstream_community_index_t *idx,
+                                    const bgpstream_community_set_t *set);
+
+/* name of the given elem filter predicate */
+const char *bgpstream_filter_pred_name(bgpstream_filter_pred_type_t type);
+
 /* destroy the memory allocated for bgpstream filter */
 void bgpstream_filter_mgr_destroy(bgpstream_filter_mgr_t *bs_filter_mgr);
 
@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_filter_pfx_index.h"
+#include "bgpstream_log.h"
+#include "utils.h"
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* arrays at least this long get a first-level index on the top 16 bits of the
+ * address */
+#define BUCKET_MIN_CNT 4096
+#define BUCKET_CNT (UINT16_MAX + 1)
+
+/* IPv4 and IPv6 addresses are both handled as 128 bit values (IPv4 addresses
+ * are in the top 32 bits) */
+typedef struct pfx_entry {
+  uint64_t hi;
+  uint64_t lo;
+  uint8_t len;
+} pfx_entry_t;
+
+typedef struct pfx_array {
+
+  /* prefixes, sorted by address then length */
+  pfx_entry_t *pfxs;
+  uint32_t cnt;
+  uint32_t alloc;
+
+  /* index of the first prefix whose address has the given top 16 bits (or
+   * more), or NULL if the array is small */
+  uint32_t *buckets;
+
+} pfx_array_t;
+
+typedef struct pfx_table {
+
+  /* all prefix filters */
+  pfx_array_t all;
+
+  /* outermost prefix filters that allow more specifics (these never overlap,
+   * so at most one of them can contain a given address) */
+  pfx_array_t more;
+
+  /* prefix filters that allow less specifics */
+  pfx_array_t less;
+
+} pfx_table_t;
+
+struct bgpstream_filter_pfx_index {
+  pfx_table_t v4;
+  pfx_table_t v6;
+};
+
+static void pfx_to_entry(const bgpstream_pfx_t *pfx, pfx_entry_t *e)
+{
+  const uint8_t *b;
+  int i;
+
+  e->len = pfx->mask_len;
+  if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+    e->hi = (uint64_t)ntohl(pfx->bs_ipv4.address.addr.s_addr) << 32;
+    e->lo = 0;
+  } else {
+    b = pfx->bs_ipv6.address.addr.s6_addr;
+    e->hi = e->lo = 0;
+    for (i = 0; i < 8; i++) {
+      e->hi = (e->hi << 8) | b[i];
+      e->lo = (e->lo << 8) | b[i + 8];
+    }
+  }
+
+  // ignore any host bits
+  if (e->len < 64) {
+    e->hi &= e->len == 0 ? 0 : ~(uint64_t)0 << (64 - e->len);
+    e->lo = 0;
+  } else if (e->len < 128) {
+    e->lo &= e->len == 64 ? 0 : ~(uint64_t)0 << (128 - e->len);
+  }
+}
+
+/* set the host bits of the given prefix (i.e., get its last address) */
+static void entry_last(const pfx_entry_t *e, uint64_t *hi, uint64_t *lo)
+{
+  *hi = e->hi;
+  *lo = e->lo;
+  if (e->len < 64) {
+    *hi |= e->len == 0 ? ~(uint64_t)0 : ~(~(uint64_t)0 << (64 - e->len));
+    *lo = ~(uint64_t)0;
+  } else if (e->len < 128) {
+    *lo |= e->len == 64 ? ~(uint64_t)0 : ~(~(uint64_t)0 << (128 - e->len));
+  }
+}
+
+static int entry_cmp(const pfx_entry_t *a, uint64_t hi, uint64_t lo,
+                     unsigned len)
+{
+  if (a->hi != hi) {
+    return a->hi < hi ? -1 : 1;
+  }
+  if (a->lo != lo) {
+    return a->lo < lo ? -1 : 1;
+  }
+  if (a->len != len) {
+    return a->len < len ? -1 : 1;
+  }
+  return 0;
+}
+
+static int entry_qsort_cmp(const void *a, const void *b)
+{
+  const pfx_entry_t *eb = b;
+  return entry_cmp(a, eb->hi, eb->lo, eb->len);
+}
+
+/* does prefix a contain the address (hi, lo)? */
+static int entry_contains(const pfx_entry_t *a, uint64_t hi, uint64_t lo)
+{
+  uint64_t last_hi, last_lo;
+  entry_last(a, &last_hi, &last_lo);
+  return (hi > a->hi || (hi == a->hi && lo >= a->lo)) &&
+         (hi < last_hi || (hi == last_hi && lo <= last_lo));
+}
+
+static int array_add(pfx_array_t *arr, const pfx_entry_t *e)
+{
+  pfx_entry_t *tmp;
+
+  if (arr->cnt == arr->alloc) {
+    arr->alloc = arr->alloc == 0 ? 64 : arr->alloc * 2;
+    if ((tmp = realloc(arr->pfxs, sizeof(pfx_entry_t) * arr->alloc)) ==
+        NULL) {
+      return -1;
+    }
+    arr->pfxs = tmp;
+  }
+  arr->pfxs[arr->cnt++] = *e;
+  return 0;
+}
+
+static int array_finalize(pfx_array_t *arr)
+{
+  uint32_t i = 0, b;
+
+  qsort(arr->pfxs, arr->cnt, sizeof(pfx_entry_t), entry_qsort_cmp);
+
+  if (arr->cnt < BUCKET_MIN_CNT) {
+    return 0;
+  }
+  if ((arr->buckets = malloc(sizeof(uint32_t) * (BUCKET_CNT + 1))) == NULL) {
+    return -1;
+  }
+  for (b = 0; b <= BUCKET_CNT; b++) {
+    while (i < arr->cnt && (arr->pfxs[i].hi >> 48) < b) {
+      i++;
+    }
+    arr->buckets[b] = i;
+  }
+  return 0;
+}
+
+/* index of the first prefix that is not less than (hi, lo, len) */
+static uint32_t array_lower_bound(const pfx_array_t *arr, uint64_t hi,
+                                  uint64_t lo, unsigned len)
+{
+  uint32_t first = 0, last = arr->cnt, mid;
+
+  if (arr->buckets != NULL) {
+    first = arr->buckets[hi >> 48];
+    last = arr->buckets[(hi >> 48) + 1];
+  }
+
+  while (first < last) {
+    mid = first + (last - first) / 2;
+    if (entry_cmp(&arr->pfxs[mid], hi, lo, len) < 0) {
+      first = mid + 1;
+    } else {
+      last = mid;
+    }
+  }
+  return first;
+}
+
+static void array_free(pfx_array_t *arr)
+{
+  free(arr->pfxs);
+  free(arr->buckets);
+}
+
+static bgpstream_patricia_walk_cb_result_t
+add_pfx(const bgpstream_patricia_tree_t *pt,
+        const bgpstream_patricia_node_t *node, void *data)
+{
+  bgpstream_filter_pfx_index_t *idx = data;
+  const bgpstream_pfx_t *pfx = bgpstream_patricia_tree_get_pfx(node);
+  pfx_table_t *tbl;
+  pfx_entry_t e;
+
+  tbl = pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4 ? &idx->v4
+                                                             : &idx->v6;
+  pfx_to_entry(pfx, &e);
+
+  if (array_add(&tbl->all, &e) != 0) {
+    return BGPSTREAM_PATRICIA_WALK_END_ALL;
+  }
+  if ((pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_ANY ||
+       pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_MORE) &&
+      array_add(&tbl->more, &e) != 0) {
+    return BGPSTREAM_PATRICIA_WALK_END_ALL;
+  }
+  if ((pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_ANY ||
+       pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_LESS) &&
+      array_add(&tbl->less, &e) != 0) {
+    return BGPSTREAM_PATRICIA_WALK_END_ALL;
+  }
+  return BGPSTREAM_PATRICIA_WALK_CONTINUE;
+}
+
+static int table_finalize(pfx_table_t *tbl)
+{
+  uint32_t i, j = 0;
+
+  // only keep the outermost prefixes that allow more specifics (since they
+  // are sorted, a prefix is contained by the last one that was kept, if any)
+  qsort(tbl->more.pfxs, tbl->more.cnt, sizeof(pfx_entry_t), entry_qsort_cmp);
+  for (i = 0; i < tbl->more.cnt; i++) {
+    if (j > 0 && entry_contains(&tbl->more.pfxs[j - 1], tbl->more.pfxs[i].hi,
+                                tbl->more.pfxs[i].lo)) {
+      continue;
+    }
+    tbl->more.pfxs[j++] = tbl->more.pfxs[i];
+  }
+  tbl->more.cnt = j;
+
+  if (array_finalize(&tbl->all) != 0 || array_finalize(&tbl->more) != 0 ||
+      array_finalize(&tbl->less) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static int table_match(const pfx_table_t *tbl, const pfx_entry_t *e)
+{
+  uint64_t last_hi, last_lo;
+  uint32_t i;
+
+  // is there an exact match?
+  i = array_lower_bound(&tbl->all, e->hi, e->lo, e->len);
+  if (i < tbl->all.cnt &&
+      entry_cmp(&tbl->all.pfxs[i], e->hi, e->lo, e->len) == 0) {
+    return 1;
+  }
+
+  // is there a less specific prefix that allows more specifics? only the
+  // last outermost prefix that starts at or before our address can contain
+  // it
+  i = array_lower_bound(&tbl->more, e->hi, e->lo, UINT8_MAX);
+  if (i > 0 && tbl->more.pfxs[i - 1].len < e->len &&
+      entry_contains(&tbl->more.pfxs[i - 1], e->hi, e->lo)) {
+    return 1;
+  }
+
+  // is there a more specific prefix that allows less specifics? the first
+  // prefix after (address, length) is more specific if it is within our
+  // range
+  i = array_lower_bound(&tbl->less, e->hi, e->lo, e->len + 1);
+  if (i < tbl->less.cnt) {
+    entry_last(e, &last_hi, &last_lo);
+    if (entry_cmp(&tbl->less.pfxs[i], last_hi, last_lo, UINT8_MAX) < 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+bgpstream_filter_pfx_index_t *
+bgpstream_filter_pfx_index_create(const bgpstream_patricia_tree_t *pt)
+{
+  bgpstream_filter_pfx_index_t *idx;
+  uint64_t cnt;
+
+  if ((idx = malloc_zero(sizeof(bgpstream_filter_pfx_index_t))) == NULL) {
+    return NULL;
+  }
+
+  bgpstream_patricia_tree_walk(pt, add_pfx, idx);
+
+  // the walk stops early if an allocation fails
+  cnt = bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV4) +
+        bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV6);
+  if (idx->v4.all.cnt + idx->v6.all.cnt != cnt ||
+      table_finalize(&idx->v4) != 0 || table_finalize(&idx->v6) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not build prefix filter index");
+    bgpstream_filter_pfx_index_destroy(idx);
+    return NULL;
+  }
+
+  return idx;
+}
+
+int bgpstream_filter_pfx_index_match(const bgpstream_filter_pfx_index_t *idx,
+                                     const bgpstream_pfx_t *pfx)
+{
+  pfx_entry_t e;
+
+  switch (pfx->address.version) {
+  case BGPSTREAM_ADDR_VERSION_IPV4:
+    pfx_to_entry(pfx, &e);
+    return table_match(&idx->v4, &e);
+
+  case BGPSTREAM_ADDR_VERSION_IPV6:
+    pfx_to_entry(pfx, &e);
+    return table_match(&idx->v6, &e);
+
+  default:
+    return 0;
+  }
+}
+
+void bgpstream_filter_pfx_index_destroy(bgpstream_filter_pfx_index_t *idx)
+{
+  if (idx == NULL) {
+    return;
+  }
+  array_free(&idx->v4.all);
+  array_free(&idx->v4.more);
+  array_free(&idx->v4.less);
+  array_free(&idx->v6.all);
+  array_free(&idx->v6.more);
+  array_free(&idx->v6.less);
+  free(idx);
+}
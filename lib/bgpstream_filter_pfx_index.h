@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _BGPSTREAM_FILTER_PFX_INDEX_H
+#define _BGPSTREAM_FILTER_PFX_INDEX_H
+
+#include "bgpstream_utils_patricia.h"
+#include "bgpstream_utils_pfx.h"
+
+/** Read-only index of the prefix filters
+ *
+ * The index is compiled from the patricia tree of prefix filters, and answers
+ * the same question as walking the tree up and down from an elem prefix: is
+ * there a filter prefix that is equal to it, a less specific filter prefix
+ * that allows more specifics, or a more specific filter prefix that allows
+ * less specifics? Each check is a binary search over a sorted array of
+ * prefixes (narrowed down using the top 16 bits of the address for large
+ * arrays), which is much more cache-friendly than walking the tree.
+ */
+typedef struct bgpstream_filter_pfx_index bgpstream_filter_pfx_index_t;
+
+/** Build a prefix index from the given tree of prefix filters
+ *
+ * @param pt            pointer to the patricia tree of prefix filters
+ * @return pointer to the index if successful, NULL otherwise
+ *
+ * The index is not updated if the tree changes.
+ */
+bgpstream_filter_pfx_index_t *
+bgpstream_filter_pfx_index_create(const bgpstream_patricia_tree_t *pt);
+
+/** Check if the given prefix matches the prefix filters
+ *
+ * @param idx           pointer to the prefix index
+ * @param pfx           pointer to the prefix to check
+ * @return 1 if the prefix matches, 0 otherwise
+ */
+int bgpstream_filter_pfx_index_match(const bgpstream_filter_pfx_index_t *idx,
+                                     const bgpstream_pfx_t *pfx);
+
+/** Destroy the given prefix index
+ *
+ * @param idx           pointer to the prefix index to destroy
+ */
+void bgpstream_filter_pfx_index_destroy(bgpstream_filter_pfx_index_t *idx);
+
+#endif /* _BGPSTREAM_FILTER_PFX_INDEX_H */
@@ -0,0 +1,816 @@
+/*
+ * Copyright (C) 2014 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_mrt_writer.h"
+#include "bgpstream_log.h"
+#include "khash.h"
+#include "utils.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wandio.h>
+
+/* MRT types and subtypes (RFC 6396) */
+#define MRT_TYPE_TABLE_DUMP_V2 13
+#define MRT_TYPE_BGP4MP 16
+#define MRT_TYPE_BGP4MP_ET 17
+
+#define TD2_PEER_INDEX_TABLE 1
+#define TD2_RIB_IPV4_UNICAST 2
+#define TD2_RIB_IPV6_UNICAST 4
+
+#define BGP4MP_MESSAGE_AS4 4
+#define BGP4MP_STATE_CHANGE_AS4 5
+
+#define MRT_HDR_LEN 12
+
+/* TABLE_DUMP_V2 peer types */
+#define TD2_PEER_TYPE_IPV6 0x01
+#define TD2_PEER_TYPE_AS4 0x02
+
+/* BGP message constants */
+#define BGP_HDR_LEN 19
+#define BGP_MSG_TYPE_UPDATE 2
+#define BGP_MSG_MAX_LEN 65535
+
+#define BGP_AFI_IPV4 1
+#define BGP_AFI_IPV6 2
+#define BGP_SAFI_UNICAST 1
+
+/* BGP path attributes */
+#define ATTR_FLAG_OPTIONAL 0x80
+#define ATTR_FLAG_TRANSITIVE 0x40
+#define ATTR_FLAG_EXTENDED 0x10
+
+#define ATTR_ORIGIN 1
+#define ATTR_AS_PATH 2
+#define ATTR_NEXT_HOP 3
+#define ATTR_MED 4
+#define ATTR_LOCAL_PREF 5
+#define ATTR_ATOMIC_AGGREGATE 6
+#define ATTR_AGGREGATOR 7
+#define ATTR_COMMUNITIES 8
+#define ATTR_MP_REACH_NLRI 14
+#define ATTR_MP_UNREACH_NLRI 15
+
+#define AS_PATH_SEG_SET 1
+#define AS_PATH_SEG_SEQUENCE 2
+#define AS_PATH_SEG_CONFED_SEQUENCE 3
+#define AS_PATH_SEG_CONFED_SET 4
+
+/* Maximum number of peers that a PEER_INDEX_TABLE can hold (the count is a
+ * 16-bit field) */
+#define TD2_MAX_PEERS UINT16_MAX
+
+/* Size of the buffered RIB records above which a new peer table is started,
+ * so that a full RIB dump is not held in memory */
+#define TD2_MAX_PENDING_LEN (64 * 1024 * 1024)
+
+/** Growable output buffer. Allocation failures are sticky so that encoders
+ * only need to check for errors once the whole record has been built */
+typedef struct mrt_buf {
+  uint8_t *data;
+  size_t len;
+  size_t size;
+  int err;
+} mrt_buf_t;
+
+/** A peer in the rebuilt PEER_INDEX_TABLE */
+typedef struct td2_peer {
+  bgpstream_ip_addr_t ip;
+  uint32_t asn;
+} td2_peer_t;
+
+#define td2_peer_hash_func(p) (bgpstream_addr_hash(&(p).ip) ^ (p).asn)
+#define td2_peer_hash_equal(p1, p2)                                            \
+  ((p1).asn == (p2).asn && bgpstream_addr_equal(&(p1).ip, &(p2).ip))
+
+KHASH_INIT(td2_peer_idx, td2_peer_t, uint16_t, 1, td2_peer_hash_func,
+           td2_peer_hash_equal)
+
+struct bgpstream_mrt_writer {
+
+  /** Output file */
+  iow_t *file;
+
+  /** Scratch buffer used to build a single MRT record */
+  mrt_buf_t msg;
+
+  /** Scratch buffer used to build path attributes */
+  mrt_buf_t attrs;
+
+  /** Scratch buffer used to build a single path attribute value */
+  mrt_buf_t val;
+
+  /* Pending TABLE_DUMP_V2 state */
+
+  /** Encoded RIB records waiting for their PEER_INDEX_TABLE */
+  mrt_buf_t rib;
+
+  /** Map from peer to its index in the peer table */
+  khash_t(td2_peer_idx) *peer_idx;
+
+  /** Peers in index order */
+  td2_peer_t *peers;
+  int peers_cnt;
+  int peers_alloc;
+
+  /** Dump that the pending RIB records belong to */
+  uint32_t rib_dump_time;
+  char rib_collector[BGPSTREAM_UTILS_STR_NAME_LEN];
+  bgpstream_str_id_t rib_collector_id;
+
+  /** Next RIB record sequence number */
+  uint32_t rib_seq;
+
+  /** Is there a RIB record that entries can still be appended to? */
+  int rib_open;
+
+  /** Prefix of the open RIB record */
+  bgpstream_pfx_t rib_pfx;
+
+  /** Offsets (into rib) of the MRT header and entry count of the open RIB
+   * record */
+  size_t rib_rec_off;
+  size_t rib_cnt_off;
+
+  /** Number of entries in the open RIB record */
+  uint16_t rib_entry_cnt;
+};
+
+/* ========== BUFFER HELPERS ========== */
+
+static void buf_reserve(mrt_buf_t *b, size_t need)
+{
+  size_t size;
+  uint8_t *tmp;
+
+  if (b->err != 0 || b->len + need <= b->size) {
+    return;
+  }
+  size = b->size == 0 ? 4096 : b->size;
+  while (size < b->len + need) {
+    size *= 2;
+  }
+  if ((tmp = realloc(b->data, size)) == NULL) {
+    b->err = 1;
+    return;
+  }
+  b->data = tmp;
+  b->size = size;
+}
+
+static void put_bytes(mrt_buf_t *b, const void *data, size_t len)
+{
+  buf_reserve(b, len);
+  if (b->err != 0) {
+    return;
+  }
+  if (data != NULL) {
+    memcpy(b->data + b->len, data, len);
+  } else {
+    memset(b->data + b->len, 0, len);
+  }
+  b->len += len;
+}
+
+static void put_u8(mrt_buf_t *b, uint8_t v)
+{
+  put_bytes(b, &v, sizeof(v));
+}
+
+static void put_u16(mrt_buf_t *b, uint16_t v)
+{
+  uint8_t d[2] = {v >> 8, v & 0xff};
+  put_bytes(b, d, sizeof(d));
+}
+
+static void put_u32(mrt_buf_t *b, uint32_t v)
+{
+  uint8_t d[4] = {v >> 24, (v >> 16) & 0xff, (v >> 8) & 0xff, v & 0xff};
+  put_bytes(b, d, sizeof(d));
+}
+
+static void patch_u16(mrt_buf_t *b, size_t off, uint16_t v)
+{
+  if (b->err == 0) {
+    b->data[off] = v >> 8;
+    b->data[off + 1] = v & 0xff;
+  }
+}
+
+static void patch_u32(mrt_buf_t *b, size_t off, uint32_t v)
+{
+  if (b->err == 0) {
+    b->data[off] = v >> 24;
+    b->data[off + 1] = (v >> 16) & 0xff;
+    b->data[off + 2] = (v >> 8) & 0xff;
+    b->data[off + 3] = v & 0xff;
+  }
+}
+
+/** Write an address as 4 (IPv4) or 16 (IPv6) bytes. Addresses of the wrong
+ * (or unknown) version are written as zero. */
+static void put_addr(mrt_buf_t *b, const bgpstream_ip_addr_t *addr, int v6)
+{
+  if (v6 && addr->version == BGPSTREAM_ADDR_VERSION_IPV6) {
+    put_bytes(b, &addr->bs_ipv6.addr, 16);
+  } else if (!v6 && addr->version == BGPSTREAM_ADDR_VERSION_IPV4) {
+    put_bytes(b, &addr->bs_ipv4.addr, 4);
+  } else {
+    put_bytes(b, NULL, v6 ? 16 : 4);
+  }
+}
+
+/** Write a prefix in NLRI encoding (mask length followed by the significant
+ * bytes of the address) */
+static void put_pfx(mrt_buf_t *b, const bgpstream_pfx_t *pfx)
+{
+  put_u8(b, pfx->mask_len);
+  put_bytes(b, &pfx->address.addr, (pfx->mask_len + 7) / 8);
+}
+
+/** Start an MRT record, returning the offset of its header */
+static size_t mrt_hdr_begin(mrt_buf_t *b, uint32_t time_sec,
+                            uint32_t time_usec, uint16_t type,
+                            uint16_t subtype)
+{
+  size_t off = b->len;
+  put_u32(b, time_sec);
+  put_u16(b, type);
+  put_u16(b, subtype);
+  put_u32(b, 0); // length, patched by mrt_hdr_end
+  if (type == MRT_TYPE_BGP4MP_ET) {
+    put_u32(b, time_usec);
+  }
+  return off;
+}
+
+static void mrt_hdr_end(mrt_buf_t *b, size_t off)
+{
+  patch_u32(b, off + 8, b->len - off - MRT_HDR_LEN);
+}
+
+static int write_buf(bgpstream_mrt_writer_t *writer, mrt_buf_t *b)
+{
+  if (b->err != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not allocate MRT output buffer");
+    return -1;
+  }
+  if (b->len > 0 &&
+      wandio_wwrite(writer->file, b->data, b->len) != (int64_t)b->len) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not write MRT data");
+    return -1;
+  }
+  return 0;
+}
+
+/* ========== PATH ATTRIBUTES ========== */
+
+/** Append a path attribute, using the extended length encoding if needed */
+static void put_attr(mrt_buf_t *b, uint8_t flags, uint8_t type,
+                     const mrt_buf_t *val)
+{
+  if (val->len > UINT8_MAX) {
+    put_u8(b, flags | ATTR_FLAG_EXTENDED);
+    put_u8(b, type);
+    put_u16(b, val->len);
+  } else {
+    put_u8(b, flags);
+    put_u8(b, type);
+    put_u8(b, val->len);
+  }
+  put_bytes(b, val->data, val->len);
+}
+
+static void put_as_path(mrt_buf_t *b, const bgpstream_as_path_t *path)
+{
+  bgpstream_as_path_iter_t iter;
+  bgpstream_as_path_seg_t *seg;
+  size_t seq_cnt_off = 0;
+  int seq_cnt = 0;
+  int i;
+
+  if (path == NULL) {
+    return;
+  }
+
+  // consecutive simple ASN segments are collapsed into AS_SEQUENCE segments
+  bgpstream_as_path_iter_reset(&iter);
+  while ((seg = bgpstream_as_path_get_next_seg(path, &iter)) != NULL) {
+    if (seg->type == BGPSTREAM_AS_PATH_SEG_ASN) {
+      if (seq_cnt == 0 || seq_cnt == UINT8_MAX) {
+        put_u8(b, AS_PATH_SEG_SEQUENCE);
+        seq_cnt_off = b->len;
+        put_u8(b, 0);
+        seq_cnt = 0;
+      }
+      put_u32(b, seg->asn.asn);
+      seq_cnt++;
+      if (b->err == 0) {
+        b->data[seq_cnt_off] = seq_cnt;
+      }
+      continue;
+    }
+    seq_cnt = 0;
+    switch (seg->type) {
+    case BGPSTREAM_AS_PATH_SEG_SET:
+      put_u8(b, AS_PATH_SEG_SET);
+      break;
+    case BGPSTREAM_AS_PATH_SEG_CONFED_SEQ:
+      put_u8(b, AS_PATH_SEG_CONFED_SEQUENCE);
+      break;
+    case BGPSTREAM_AS_PATH_SEG_CONFED_SET:
+      put_u8(b, AS_PATH_SEG_CONFED_SET);
+      break;
+    default:
+      bgpstream_log(BGPSTREAM_LOG_WARN,
+                    "Skipping AS path segment of unknown type %d", seg->type);
+      continue;
+    }
+    put_u8(b, seg->set.asn_cnt);
+    for (i = 0; i < seg->set.asn_cnt; i++) {
+      put_u32(b, seg->set.asn[i]);
+    }
+  }
+}
+
+/** Whether the prefix of an elem is announced in MP_REACH_NLRI (IPv6
+ * prefixes, and IPv4 prefixes with a non-IPv4 next-hop) rather than in the
+ * NLRI field of the UPDATE */
+static int uses_mp_reach(const bgpstream_elem_t *elem)
+{
+  return elem->prefix.address.version == BGPSTREAM_ADDR_VERSION_IPV6 ||
+         (elem->nexthop.version != BGPSTREAM_ADDR_VERSION_IPV4 &&
+          elem->nexthop.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
+}
+
+/** Encode the path attributes of a RIB or announcement elem into
+ * writer->attrs.
+ *
+ * If td2 is set, an IPv6 next-hop is encoded using the abbreviated
+ * MP_REACH_NLRI form used by TABLE_DUMP_V2, otherwise MP_REACH_NLRI also
+ * carries the AFI/SAFI and the announced prefix.
+ */
+static void encode_attrs(bgpstream_mrt_writer_t *writer,
+                         const bgpstream_elem_t *elem, int td2)
+{
+  mrt_buf_t *b = &writer->attrs;
+  mrt_buf_t *val = &writer->val;
+  const bgpstream_community_t *comm;
+  int pfx_v6 = elem->prefix.address.version == BGPSTREAM_ADDR_VERSION_IPV6;
+  int nh_v6 = elem->nexthop.version == BGPSTREAM_ADDR_VERSION_IPV6 ||
+              (pfx_v6 && elem->nexthop.version != BGPSTREAM_ADDR_VERSION_IPV4);
+  int i, cnt;
+
+  b->len = 0;
+
+  if (elem->has_origin) {
+    val->len = 0;
+    put_u8(val, elem->origin);
+    put_attr(b, ATTR_FLAG_TRANSITIVE, ATTR_ORIGIN, val);
+  }
+
+  val->len = 0;
+  put_as_path(val, elem->as_path);
+  b->err |= val->err;
+  put_attr(b, ATTR_FLAG_TRANSITIVE, ATTR_AS_PATH, val);
+
+  if (!pfx_v6 && elem->nexthop.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+    val->len = 0;
+    put_addr(val, &elem->nexthop, 0);
+    put_attr(b, ATTR_FLAG_TRANSITIVE, ATTR_NEXT_HOP, val);
+  }
+
+  if (elem->has_med) {
+    val->len = 0;
+    put_u32(val, elem->med);
+    put_attr(b, ATTR_FLAG_OPTIONAL, ATTR_MED, val);
+  }
+
+  if (elem->has_local_pref) {
+    val->len = 0;
+    put_u32(val, elem->local_pref);
+    put_attr(b, ATTR_FLAG_TRANSITIVE, ATTR_LOCAL_PREF, val);
+  }
+
+  if (elem->atomic_aggregate) {
+    val->len = 0;
+    put_attr(b, ATTR_FLAG_TRANSITIVE, ATTR_ATOMIC_AGGREGATE, val);
+  }
+
+  if (elem->aggregator.has_aggregator) {
+    val->len = 0;
+    put_u32(val, elem->aggregator.aggregator_asn);
+    put_addr(val, &elem->aggregator.aggregator_addr, 0);
+    put_attr(b, ATTR_FLAG_OPTIONAL | ATTR_FLAG_TRANSITIVE, ATTR_AGGREGATOR,
+             val);
+  }
+
+  if (elem->communities != NULL &&
+      (cnt = bgpstream_community_set_size(elem->communities)) > 0) {
+    val->len = 0;
+    for (i = 0; i < cnt; i++) {
+      comm = bgpstream_community_set_get(elem->communities, i);
+      put_u16(val, comm->asn);
+      put_u16(val, comm->value);
+    }
+    put_attr(b, ATTR_FLAG_OPTIONAL | ATTR_FLAG_TRANSITIVE, ATTR_COMMUNITIES,
+             val);
+  }
+
+  if (uses_mp_reach(elem)) {
+    val->len = 0;
+    if (!td2) {
+      put_u16(val, pfx_v6 ? BGP_AFI_IPV6 : BGP_AFI_IPV4);
+      put_u8(val, BGP_SAFI_UNICAST);
+    }
+    put_u8(val, nh_v6 ? 16 : 4);
+    put_addr(val, &elem->nexthop, nh_v6);
+    if (!td2) {
+      put_u8(val, 0); // reserved
+      put_pfx(val, &elem->prefix);
+    }
+    put_attr(b, ATTR_FLAG_OPTIONAL, ATTR_MP_REACH_NLRI, val);
+  }
+
+  b->err |= val->err;
+}
+
+/* ========== TABLE_DUMP_V2 ========== */
+
+static void rib_close_record(bgpstream_mrt_writer_t *writer)
+{
+  if (!writer->rib_open) {
+    return;
+  }
+  patch_u16(&writer->rib, writer->rib_cnt_off, writer->rib_entry_cnt);
+  mrt_hdr_end(&writer->rib, writer->rib_rec_off);
+  writer->rib_open = 0;
+}
+
+/** Look up (or add) the peer of the given elem in the pending peer table */
+static int rib_get_peer_idx(bgpstream_mrt_writer_t *writer,
+                            const bgpstream_elem_t *elem)
+{
+  td2_peer_t peer;
+  khiter_t k;
+  int khret;
+
+  memset(&peer, 0, sizeof(peer));
+  if (elem->peer_ip.version == BGPSTREAM_ADDR_VERSION_IPV4 ||
+      elem->peer_ip.version == BGPSTREAM_ADDR_VERSION_IPV6) {
+    bgpstream_addr_copy(&peer.ip, &elem->peer_ip);
+  } else {
+    peer.ip.version = BGPSTREAM_ADDR_VERSION_IPV4;
+  }
+  peer.asn = elem->peer_asn;
+
+  if ((k = kh_get(td2_peer_idx, writer->peer_idx, peer)) !=
+      kh_end(writer->peer_idx)) {
+    return kh_val(writer->peer_idx, k);
+  }
+
+  // the peer table is full, start a new one
+  if (writer->peers_cnt == TD2_MAX_PEERS &&
+      bgpstream_mrt_writer_flush(writer) != 0) {
+    return -1;
+  }
+
+  if (writer->peers_cnt == writer->peers_alloc) {
+    int alloc = writer->peers_alloc == 0 ? 64 : writer->peers_alloc * 2;
+    td2_peer_t *tmp = realloc(writer->peers, sizeof(td2_peer_t) * alloc);
+    if (tmp == NULL) {
+      return -1;
+    }
+    writer->peers = tmp;
+    writer->peers_alloc = alloc;
+  }
+  k = kh_put(td2_peer_idx, writer->peer_idx, peer, &khret);
+  if (khret < 0) {
+    return -1;
+  }
+  kh_val(writer->peer_idx, k) = writer->peers_cnt;
+  writer->peers[writer->peers_cnt] = peer;
+  return writer->peers_cnt++;
+}
+
+static int write_rib_elem(bgpstream_mrt_writer_t *writer,
+                          const bgpstream_record_t *record,
+                          const bgpstream_elem_t *elem)
+{
+  mrt_buf_t *b = &writer->rib;
+  int peer_idx;
+
+  // RIB records from a different dump get their own peer table
+  if (writer->rib.len > 0 &&
+      (writer->rib_dump_time != record->dump_time_sec ||
+       writer->rib_collector_id != record->collector_id) &&
+      bgpstream_mrt_writer_flush(writer) != 0) {
+    return -1;
+  }
+  // bound the buffered RIB records (only between two RIB records, since the
+  // entries of the open one refer to the current peer table)
+  if (writer->rib.len >= TD2_MAX_PENDING_LEN &&
+      !(writer->rib_open &&
+        bgpstream_pfx_equal(&writer->rib_pfx, &elem->prefix)) &&
+      bgpstream_mrt_writer_flush(writer) != 0) {
+    return -1;
+  }
+  if (writer->rib.len == 0) {
+    writer->rib_dump_time = record->dump_time_sec;
+    strcpy(writer->rib_collector, record->collector_name);
+    writer->rib_collector_id = record->collector_id;
+  }
+
+  if ((peer_idx = rib_get_peer_idx(writer, elem)) < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not add peer to MRT peer table");
+    return -1;
+  }
+
+  // entries for the same prefix are grouped into a single RIB record
+  if (writer->rib_open && (writer->rib_entry_cnt == UINT16_MAX ||
+                           !bgpstream_pfx_equal(&writer->rib_pfx,
+                                                &elem->prefix))) {
+    rib_close_record(writer);
+  }
+  if (!writer->rib_open) {
+    writer->rib_rec_off =
+      mrt_hdr_begin(b, record->time_sec, 0, MRT_TYPE_TABLE_DUMP_V2,
+                    elem->prefix.address.version == BGPSTREAM_ADDR_VERSION_IPV6
+                      ? TD2_RIB_IPV6_UNICAST
+                      : TD2_RIB_IPV4_UNICAST);
+    put_u32(b, writer->rib_seq++);
+    put_pfx(b, &elem->prefix);
+    writer->rib_cnt_off = b->len;
+    put_u16(b, 0); // entry count, patched when the record is closed
+    bgpstream_pfx_copy(&writer->rib_pfx, &elem->prefix);
+    writer->rib_entry_cnt = 0;
+    writer->rib_open = 1;
+  }
+
+  encode_attrs(writer, elem, 1);
+  if (writer->attrs.len > UINT16_MAX) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Path attributes too long for MRT");
+    return -1;
+  }
+  put_u16(b, peer_idx);
+  put_u32(b, elem->orig_time_sec);
+  put_u16(b, writer->attrs.len);
+  put_bytes(b, writer->attrs.data, writer->attrs.len);
+  writer->rib_entry_cnt++;
+
+  if (b->err != 0 || writer->attrs.err != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not allocate MRT output buffer");
+    return -1;
+  }
+  return 0;
+}
+
+/* ========== BGP4MP ========== */
+
+static const uint8_t bgp_marker[16] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+/** Write the common BGP4MP_*_AS4 header fields */
+static void put_bgp4mp_peer(mrt_buf_t *b, const bgpstream_elem_t *elem)
+{
+  int v6 = elem->peer_ip.version == BGPSTREAM_ADDR_VERSION_IPV6;
+
+  put_u32(b, elem->peer_asn);
+  put_u32(b, 0); // local AS
+  put_u16(b, 0); // interface index
+  put_u16(b, v6 ? BGP_AFI_IPV6 : BGP_AFI_IPV4);
+  put_addr(b, &elem->peer_ip, v6);
+  put_bytes(b, NULL, v6 ? 16 : 4); // local IP
+}
+
+static int write_bgp4mp_elem(bgpstream_mrt_writer_t *writer,
+                             const bgpstream_record_t *record,
+                             const bgpstream_elem_t *elem)
+{
+  mrt_buf_t *b = &writer->msg;
+  mrt_buf_t *val = &writer->val;
+  int pfx_v6 = elem->prefix.address.version == BGPSTREAM_ADDR_VERSION_IPV6;
+  uint16_t type = record->time_usec != 0 ? MRT_TYPE_BGP4MP_ET
+                                         : MRT_TYPE_BGP4MP;
+  size_t hdr_off, bgp_off;
+
+  b->len = 0;
+
+  if (elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
+    hdr_off = mrt_hdr_begin(b, record->time_sec, record->time_usec, type,
+                            BGP4MP_STATE_CHANGE_AS4);
+    put_bgp4mp_peer(b, elem);
+    put_u16(b, elem->old_state);
+    put_u16(b, elem->new_state);
+    mrt_hdr_end(b, hdr_off);
+    return write_buf(writer, b);
+  }
+
+  hdr_off = mrt_hdr_begin(b, record->time_sec, record->time_usec, type,
+                          BGP4MP_MESSAGE_AS4);
+  put_bgp4mp_peer(b, elem);
+
+  // BGP UPDATE message carrying a single prefix
+  bgp_off = b->len;
+  put_bytes(b, bgp_marker, sizeof(bgp_marker));
+  put_u16(b, 0); // length, patched below
+  put_u8(b, BGP_MSG_TYPE_UPDATE);
+
+  if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL) {
+    if (pfx_v6) {
+      put_u16(b, 0); // withdrawn routes length
+      val->len = 0;
+      put_u16(val, BGP_AFI_IPV6);
+      put_u8(val, BGP_SAFI_UNICAST);
+      put_pfx(val, &elem->prefix);
+      writer->attrs.len = 0;
+      put_attr(&writer->attrs, ATTR_FLAG_OPTIONAL, ATTR_MP_UNREACH_NLRI, val);
+      writer->attrs.err |= val->err;
+      put_u16(b, writer->attrs.len);
+      put_bytes(b, writer->attrs.data, writer->attrs.len);
+    } else {
+      put_u16(b, 1 + (elem->prefix.mask_len + 7) / 8);
+      put_pfx(b, &elem->prefix);
+      put_u16(b, 0); // path attribute length
+    }
+  } else {
+    encode_attrs(writer, elem, 0);
+    put_u16(b, 0); // withdrawn routes length
+    put_u16(b, writer->attrs.len);
+    put_bytes(b, writer->attrs.data, writer->attrs.len);
+    // the prefix is announced exactly once, either here or in MP_REACH_NLRI
+    if (!uses_mp_reach(elem)) {
+      put_pfx(b, &elem->prefix);
+    }
+  }
+
+  if (b->err != 0 || writer->attrs.err != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not allocate MRT output buffer");
+    return -1;
+  }
+  if (b->len - bgp_off > BGP_MSG_MAX_LEN) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "BGP UPDATE too long for MRT");
+    return -1;
+  }
+  patch_u16(b, bgp_off + 16, b->len - bgp_off);
+  mrt_hdr_end(b, hdr_off);
+
+  return write_buf(writer, b);
+}
+
+/* ========== PUBLIC API ========== */
+
+bgpstream_mrt_writer_t *bgpstream_mrt_writer_create(const char *filename)
+{
+  bgpstream_mrt_writer_t *writer;
+  int compress_type = WANDIO_COMPRESS_NONE;
+  size_t len = strlen(filename);
+
+  if ((writer = malloc_zero(sizeof(bgpstream_mrt_writer_t))) == NULL) {
+    return NULL;
+  }
+
+  if ((writer->peer_idx = kh_init(td2_peer_idx)) == NULL) {
+    goto err;
+  }
+
+  if (len > 3 && strcmp(filename + len - 3, ".gz") == 0) {
+    compress_type = WANDIO_COMPRESS_ZLIB;
+  } else if (len > 4 && strcmp(filename + len - 4, ".bz2") == 0) {
+    compress_type = WANDIO_COMPRESS_BZ2;
+  }
+  if ((writer->file = wandio_wcreate(filename, compress_type, 6, O_CREAT)) ==
+      NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not open %s for writing",
+                  filename);
+    goto err;
+  }
+
+  return writer;
+
+err:
+  bgpstream_mrt_writer_destroy(writer);
+  return NULL;
+}
+
+int bgpstream_mrt_writer_write_elem(bgpstream_mrt_writer_t *writer,
+                                    const bgpstream_record_t *record,
+                                    const bgpstream_elem_t *elem)
+{
+  switch (elem->type) {
+  case BGPSTREAM_ELEM_TYPE_RIB:
+    return write_rib_elem(writer, record, elem);
+
+  case BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT:
+  case BGPSTREAM_ELEM_TYPE_WITHDRAWAL:
+  case BGPSTREAM_ELEM_TYPE_PEERSTATE:
+    // keep the output in stream order
+    if (bgpstream_mrt_writer_flush(writer) != 0) {
+      return -1;
+    }
+    return write_bgp4mp_elem(writer, record, elem);
+
+  default:
+    bgpstream_log(BGPSTREAM_LOG_WARN, "Skipping elem of unknown type %d",
+                  elem->type);
+    return 0;
+  }
+}
+
+int bgpstream_mrt_writer_flush(bgpstream_mrt_writer_t *writer)
+{
+  mrt_buf_t *b = &writer->msg;
+  size_t hdr_off, name_len;
+  int v6, i, rc;
+
+  if (writer->rib.len == 0) {
+    return 0;
+  }
+  rib_close_record(writer);
+
+  // PEER_INDEX_TABLE describing the peers of the pending RIB records
+  b->len = 0;
+  hdr_off = mrt_hdr_begin(b, writer->rib_dump_time, 0, MRT_TYPE_TABLE_DUMP_V2,
+                          TD2_PEER_INDEX_TABLE);
+  put_u32(b, 0); // collector BGP ID
+  name_len = strlen(writer->rib_collector);
+  put_u16(b, name_len);
+  put_bytes(b, writer->rib_collector, name_len);
+  assert(writer->peers_cnt <= UINT16_MAX);
+  put_u16(b, writer->peers_cnt);
+  for (i = 0; i < writer->peers_cnt; i++) {
+    v6 = writer->peers[i].ip.version == BGPSTREAM_ADDR_VERSION_IPV6;
+    put_u8(b, TD2_PEER_TYPE_AS4 | (v6 ? TD2_PEER_TYPE_IPV6 : 0));
+    put_u32(b, 0); // peer BGP ID
+    put_addr(b, &writer->peers[i].ip, v6);
+    put_u32(b, writer->peers[i].asn);
+  }
+  mrt_hdr_end(b, hdr_off);
+
+  rc = write_buf(writer, b);
+  if (rc == 0) {
+    rc = write_buf(writer, &writer->rib);
+  }
+
+  // start a fresh table, even on error, so that a failed table is not retried
+  writer->rib.len = 0;
+  writer->rib.err = 0;
+  writer->rib_seq = 0;
+  writer->peers_cnt = 0;
+  kh_clear(td2_peer_idx, writer->peer_idx);
+
+  return rc;
+}
+
+void bgpstream_mrt_writer_destroy(bgpstream_mrt_writer_t *writer)
+{
+  if (writer == NULL) {
+    return;
+  }
+
+  if (writer->file != NULL) {
+    bgpstream_mrt_writer_flush(writer);
+    wandio_wdestroy(writer->file);
+    writer->file = NULL;
+  }
+
+  if (writer->peer_idx != NULL) {
+    kh_destroy(td2_peer_idx, writer->peer_idx);
+    writer->peer_idx = NULL;
+  }
+
+  free(writer->peers);
+  free(writer->msg.data);
+  free(writer->attrs.data);
+  free(writer->val.data);
+  free(writer->rib.data);
+  free(writer);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2014 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BGPSTREAM_MRT_WRITER_H_
+#define __BGPSTREAM_MRT_WRITER_H_
+
+#include "bgpstream_elem.h"
+#include "bgpstream_record.h"
+#include "bgpstream_utils.h"
+
+/** @file
+ *
+ * @brief Header file that exposes the public interface of the BGP Stream MRT
+ * writer.
+ *
+ * The MRT writer re-encodes elems (typically those that survived the stream
+ * filters) as MRT (RFC 6396) so that a narrow slice of a large dataset can be
+ * materialized once and re-read later with any MRT tool (including BGP
+ * Stream's "singlefile" data interface).
+ *
+ * - RIB elems are written as TABLE_DUMP_V2 RIB_IPV4_UNICAST/RIB_IPV6_UNICAST
+ *   records, preceded by a PEER_INDEX_TABLE that is rebuilt from the peers
+ *   actually seen. Consecutive RIB elems for the same prefix (i.e., from the
+ *   same source RIB record) are grouped into a single MRT record.
+ * - Announcement and withdrawal elems are written as BGP4MP_MESSAGE_AS4
+ *   records, each carrying a single-prefix BGP UPDATE.
+ * - Peer state elems are written as BGP4MP_STATE_CHANGE_AS4 records.
+ *
+ * Information that is not carried by elems (e.g., the local AS and address of
+ * the collector) is written as zero.
+ */
+
+/**
+ * @name Public Opaque Data Structures
+ *
+ * @{ */
+
+/** Opaque structure representing an MRT writer instance */
+typedef struct bgpstream_mrt_writer bgpstream_mrt_writer_t;
+
+/** @} */
+
+/**
+ * @name Public API Functions
+ *
+ * @{ */
+
+/** Create a new MRT writer that writes to the given file
+ *
+ * @param filename      path of the file to write to
+ * @return a pointer to an MRT writer instance if successful, NULL otherwise
+ *
+ * The output is compressed if the file name ends with ".gz" (zlib) or ".bz2"
+ * (bzip2).
+ */
+bgpstream_mrt_writer_t *bgpstream_mrt_writer_create(const char *filename);
+
+/** Encode the given record/elem as MRT and write it to the output file
+ *
+ * @param writer        pointer to the MRT writer to write to
+ * @param record        pointer to the BGP Stream Record the elem belongs to
+ * @param elem          pointer to the BGP Stream Elem to write
+ * @return 0 if the elem was written (or buffered) successfully, -1 otherwise
+ *
+ * RIB elems are buffered until a non-RIB elem, an elem from a different RIB
+ * dump, or a call to bgpstream_mrt_writer_flush, so that the peer index table
+ * can be written ahead of the RIB entries that reference it. At most about
+ * 64MB of encoded RIB records (and 65535 peers) are buffered: past that, the
+ * pending records are written and a new peer index table is started, so a
+ * large dump may be written as several tables.
+ */
+int bgpstream_mrt_writer_write_elem(bgpstream_mrt_writer_t *writer,
+                                    const bgpstream_record_t *record,
+                                    const bgpstream_elem_t *elem);
+
+/** Write any buffered RIB entries to the output file
+ *
+ * @param writer        pointer to the MRT writer to flush
+ * @return 0 if successful, -1 otherwise
+ */
+int bgpstream_mrt_writer_flush(bgpstream_mrt_writer_t *writer);
+
+/** Flush and destroy the given MRT writer, closing the output file
+ *
+ * @param writer        pointer to the MRT writer to destroy
+ */
+void bgpstream_mrt_writer_destroy(bgpstream_mrt_writer_t *writer);
+
+/** @} */
+
+#endif // __BGPSTREAM_MRT_WRITER_H_
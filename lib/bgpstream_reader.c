@@ -145,6 +145,13 @@ static int prepopulate_record(bgpstream_record_t *record,
   strncpy(record->collector_name, res->collector, BGPSTREAM_UTILS_STR_NAME_LEN);
   record->collector_name[BGPSTREAM_UTILS_STR_NAME_LEN - 1] = '\0';
 
+  if ((record->project_id = bgpstream_str_intern(record->project_name)) ==
+        BGPSTREAM_STR_ID_INVALID ||
+      (record->collector_id = bgpstream_str_intern(record->collector_name)) ==
+        BGPSTREAM_STR_ID_INVALID) {
+    return -1;
+  }
+
   // dump type
   record->type = res->record_type;
 
@@ -30,6 +30,7 @@
  */
 
 #include "bgpstream_record.h"
+#include "bgpstream_elem_batch_int.h"
 #include "bgpstream_elem_int.h"
 #include "bgpstream_format_interface.h" // to access filter mgr
 #include "bgpstream_int.h"
@@ -37,7 +38,6 @@
 #include "utils.h"
 #include <assert.h>
 #include <inttypes.h>
-#include <regex.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -67,6 +67,10 @@ void bgpstream_record_destroy(bgpstream_record_t *record)
 
   bgpstream_format_destroy_data(record);
 
+  if (record->__int != NULL) {
+    bgpstream_elem_generator_destroy(record->__int->batch);
+  }
+
   free(record->__int);
   free(record);
 }
@@ -78,217 +82,148 @@ void bgpstream_record_clear(bgpstream_record_t *record)
 {
   bgpstream_format_clear_data(record);
 
+  if (record->__int->batch != NULL) {
+    bgpstream_elem_generator_clear(record->__int->batch);
+  }
+
   // reset the record timestamps
   record->time_sec = 0;
   record->time_usec = 0;
 }
 
-static bgpstream_patricia_walk_cb_result_t pfx_exists(
-    const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node,
-    void *data)
-{
-  *(int*)data = 1;
-  return BGPSTREAM_PATRICIA_WALK_END_ALL;
-}
-
-static bgpstream_patricia_walk_cb_result_t pfx_allows_more_specifics(
-    const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node,
-    void *data)
-{
-  const bgpstream_pfx_t *pfx = bgpstream_patricia_tree_get_pfx(node);
-  if (pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_ANY ||
-      pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_MORE) {
-    *(int*)data = 1;
-    return BGPSTREAM_PATRICIA_WALK_END_ALL;
-  }
-  return BGPSTREAM_PATRICIA_WALK_CONTINUE;
-}
-
-static bgpstream_patricia_walk_cb_result_t pfx_allows_less_specifics(
-    const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node,
-    void *data)
-{
-  const bgpstream_pfx_t *pfx = bgpstream_patricia_tree_get_pfx(node);
-  if (pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_ANY ||
-      pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_LESS) {
-    *(int*)data = 1;
-    return BGPSTREAM_PATRICIA_WALK_END_ALL;
-  }
-  return BGPSTREAM_PATRICIA_WALK_CONTINUE;
-}
-
-static int bgpstream_elem_prefix_match(bgpstream_patricia_tree_t *prefixes,
-                                       bgpstream_pfx_t *search)
-{
-  int matched = 0;
-
-  bgpstream_patricia_tree_walk_up_down(prefixes, search, pfx_exists,
-      pfx_allows_more_specifics, pfx_allows_less_specifics, &matched);
-  return matched;
-}
-
+/* Run the compiled filter program (all predicates must pass) */
 static int elem_check_filters(bgpstream_record_t *record,
                               bgpstream_elem_t *elem)
 {
   bgpstream_filter_mgr_t *filter_mgr = record->__int->format->filter_mgr;
+  bgpstream_filter_pred_t *pred;
+  int pass = 1;
+  int i;
 
-  /* First up, check if this element is the right type */
-  if (filter_mgr->elemtype_mask) {
-
-    if (elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE &&
-        !(filter_mgr->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_PEERSTATE)) {
-      return 0;
-    }
-
-    if (elem->type == BGPSTREAM_ELEM_TYPE_RIB &&
-        !(filter_mgr->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_RIB)) {
-      return 0;
-    }
-
-    if (elem->type == BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT &&
-        !(filter_mgr->elemtype_mask &
-          BGPSTREAM_FILTER_ELEM_TYPE_ANNOUNCEMENT)) {
-      return 0;
-    }
+  if (filter_mgr->prog_cnt == 0) {
+    return 1;
+  }
 
-    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL &&
-        !(filter_mgr->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_WITHDRAWAL)) {
-      return 0;
+  for (i = 0; i < filter_mgr->prog_cnt; i++) {
+    pred = &filter_mgr->prog[i];
+    pred->eval_cnt++;
+    pred->win_eval_cnt++;
+    if (bgpstream_filter_mgr_check_pred(filter_mgr, pred->type, elem) == 0) {
+      pred->reject_cnt++;
+      pred->win_reject_cnt++;
+      pass = 0;
+      break;
     }
   }
 
-  /* Checking peer ASNs: if the filter is on and the peer asn is not in the
-   * set, return 0 */
-  if (filter_mgr->peer_asns &&
-      bgpstream_id_set_exists(filter_mgr->peer_asns, elem->peer_asn) == 0) {
-    return 0;
+  if (++filter_mgr->prog_run_cnt == BGPSTREAM_FILTER_REORDER_INTERVAL) {
+    bgpstream_filter_mgr_reorder(filter_mgr);
   }
 
-  /* Checking not peer ASNs: if the filter is on and the peer asn is in the
-  * set, return 0 */
-  if (filter_mgr->not_peer_asns &&
-      bgpstream_id_set_exists(filter_mgr->not_peer_asns, elem->peer_asn) == 1) {
-    return 0;
-  }
-
-  /* Checking origin ASN */
-  if (filter_mgr->origin_asns) {
-    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
-        elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
-      return 0;
-    }
-    uint32_t origin_asn;
+  return pass;
+}
 
-    if (bgpstream_as_path_get_origin_val(elem->as_path, &origin_asn) < 0) {
-      return 0;
-    }
+/* Pull elems from the format until one passes the filters */
+static int record_next_filtered_elem(bgpstream_record_t *record,
+                                     bgpstream_elem_t **elemp)
+{
+  int rc;
+  bgpstream_elem_t *elem = NULL;
+  *elemp = NULL;
 
-    if (bgpstream_id_set_exists(filter_mgr->origin_asns, origin_asn) == 0) {
-      return 0;
-    }
+  if (record == NULL ||
+      record->status != BGPSTREAM_RECORD_STATUS_VALID_RECORD ||
+      record->__int->format == NULL) {
+    return 0; // treat as end-of-elems
   }
 
-  if (filter_mgr->ipversion) {
-    /* Determine address version for the element prefix */
-
-    if (elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
-      return 0;
+  while (elem == NULL) {
+    if ((rc = bgpstream_format_get_next_elem(record->__int->format, record,
+                                             &elem)) <= 0) {
+      // either error or end-of-elems
+      return rc;
     }
 
-    if (elem->prefix.address.version != filter_mgr->ipversion)
-      return 0;
-  }
-
-  if (filter_mgr->prefixes) {
-    if (elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
-      return 0;
+    if (elem_check_filters(record, elem) == 0) {
+      elem = NULL;
     }
-    if (bgpstream_elem_prefix_match(filter_mgr->prefixes, &elem->prefix) == 0)
-      return 0;
   }
 
-  /* Checking AS Path expressions */
-  if (filter_mgr->aspath_exprs) {
-    char aspath[65536];
-    int pathlen;
+  *elemp = elem;
+  return 1;
+}
 
-    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
-        elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
-      return 0;
-    }
+int bgpstream_record_get_next_elem(bgpstream_record_t *record,
+                                   bgpstream_elem_t **elemp)
+{
+  return record_next_filtered_elem(record, elemp);
+}
 
-    pathlen = bgpstream_as_path_snprintf(aspath, sizeof(aspath), elem->as_path);
+int bgpstream_record_get_elems(bgpstream_record_t *record,
+                               bgpstream_elem_t **elems, int max)
+{
+  bgpstream_record_internal_t *ri;
+  bgpstream_elem_t *elem;
+  int cnt = 0;
+  int rc;
 
-    if (pathlen >= sizeof(aspath)) {
-      bgpstream_log(BGPSTREAM_LOG_WARN,
-                    "AS Path is too long? Filter may not work well.");
-    }
+  if (max <= 0 || record == NULL) {
+    return 0;
+  }
+  ri = record->__int;
 
-    for (int i = 0; i < filter_mgr->aspath_expr_cnt; i++) {
-      int result = regexec(filter_mgr->aspath_exprs[i].re, aspath, 0, NULL, 0);
-      // All aspath regexes must match
-      if ((result == 0) != (filter_mgr->aspath_exprs[i].negate == 0)) {
-        return 0;
-      }
-    }
+  if (ri->batch == NULL &&
+      (ri->batch = bgpstream_elem_generator_create()) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not create elem batch");
+    return -1;
   }
+  // elems from the previous batch are no longer needed
+  bgpstream_elem_generator_empty(ri->batch);
 
-  /* Checking communities (unless it is a withdrawal message) */
-  if (filter_mgr->communities) {
-    int pass = 0;
-    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
-        elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
-      return 0;
+  while (cnt < max) {
+    if ((rc = record_next_filtered_elem(record, &elem)) < 0) {
+      return -1;
     }
-
-    bgpstream_community_t *c;
-    khiter_t k;
-    for (k = kh_begin(filter_mgr->communities);
-         k != kh_end(filter_mgr->communities); ++k) {
-      if (kh_exist(filter_mgr->communities, k)) {
-        c = &(kh_key(filter_mgr->communities, k));
-        if (bgpstream_community_set_match(
-              elem->communities, c, kh_value(filter_mgr->communities, k))) {
-          pass = 1;
-          break;
-        }
-      }
+    if (rc == 0) {
+      break;
     }
-    if (pass == 0) {
-      return 0;
+
+    // the format re-uses its elem, so each one in the batch must be copied.
+    // the generator carves the copies from memory owned by the record
+    if ((elems[cnt] = bgpstream_elem_generator_copy_elem(ri->batch, elem)) ==
+        NULL) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not copy elem into batch");
+      return -1;
     }
+    cnt++;
   }
 
-  return 1;
+  return cnt;
 }
 
-int bgpstream_record_get_next_elem(bgpstream_record_t *record,
-                                   bgpstream_elem_t **elemp)
+int bgpstream_record_get_elem_batch(bgpstream_record_t *record,
+                                    bgpstream_elem_batch_t *batch, int max)
 {
+  bgpstream_elem_t *elem;
+  int cnt = 0;
   int rc;
-  bgpstream_elem_t *elem = NULL;
-  *elemp = NULL;
-
-  if (record == NULL ||
-      record->status != BGPSTREAM_RECORD_STATUS_VALID_RECORD ||
-      record->__int->format == NULL) {
-    return 0; // treat as end-of-elems
-  }
 
-  while (elem == NULL) {
-    if ((rc = bgpstream_format_get_next_elem(record->__int->format, record,
-                                             &elem)) <= 0) {
-      // either error or end-of-elems
-      return rc;
+  while (cnt < max) {
+    if ((rc = record_next_filtered_elem(record, &elem)) < 0) {
+      return -1;
+    }
+    if (rc == 0) {
+      break;
     }
 
-    if (elem_check_filters(record, elem) == 0) {
-      elem = NULL;
+    if (bgpstream_elem_batch_append(batch, record, elem) != 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not append elem to batch");
+      return -1;
     }
+    cnt++;
   }
 
-  *elemp = elem;
-  return 1;
+  return cnt;
 }
 
 int bgpstream_record_type_snprintf(char *buf, size_t len,
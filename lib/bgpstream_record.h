@@ -28,6 +28,7 @@
 #define __BGPSTREAM_RECORD_H
 
 #include "bgpstream_elem.h"
+#include "bgpstream_elem_batch.h"
 #include "bgpstream_utils.h"
 
 /** @file
@@ -218,6 +219,23 @@ typedef struct bgpstream_record {
   /** INTERNAL BGPStream State. Do not use. */
   bgpstream_record_internal_t *__int;
 
+  /* ---------- INTERNED NAME FIELDS: ---------- */
+
+  /** Project ID
+   *
+   * The ID of `project_name` in the string intern table (see
+   * bgpstream_str_intern_get). IDs are unique per string within a process, so
+   * they can be compared and hashed in place of the name.
+   * #BGPSTREAM_STR_ID_EMPTY if the name is empty.
+   */
+  bgpstream_str_id_t project_id;
+
+  /** Collector ID (the interned `collector_name`, see `project_id`) */
+  bgpstream_str_id_t collector_id;
+
+  /** Router ID (the interned `router_name`, see `project_id`) */
+  bgpstream_str_id_t router_id;
+
 } bgpstream_record_t;
 
 /** @} */
@@ -244,6 +262,46 @@ typedef struct bgpstream_record {
 int bgpstream_record_get_next_elem(bgpstream_record_t *record,
                                    bgpstream_elem_t **elem);
 
+/** Retrieve a batch of elems from the record
+ *
+ * @param record        pointer to the BGP Stream Record to retrieve the elems
+ *                      from
+ * @param[out] elems    array to fill with pointers to borrowed elems
+ * @param max           the maximum number of elems to return (i.e., the
+ *                      length of the elems array)
+ * @return the number of elems written to the array, 0 if there are no more
+ * elems, -1 if an error occurred
+ *
+ * Elems are filtered exactly as they are by bgpstream_record_get_next_elem,
+ * and calls to the two functions may be interleaved on the same record. Each
+ * elem in the batch is a distinct object owned by the record: the pointers
+ * remain valid until the next call to this function on the same record, until
+ * the record is re-used in a subsequent call to bgpstream_get_next_record, or
+ * until it is destroyed with bgpstream_record_destroy.
+ *
+ * This is most useful for RIB records, which may carry hundreds of elems.
+ */
+int bgpstream_record_get_elems(bgpstream_record_t *record,
+                               bgpstream_elem_t **elems, int max);
+
+/** Append a batch of elems from the record to a columnar elem batch
+ *
+ * @param record        pointer to the BGP Stream Record to retrieve the elems
+ *                      from
+ * @param batch         pointer to the Elem Batch to append the elems to
+ * @param max           the maximum number of elems to append
+ * @return the number of elems appended to the batch, 0 if there are no more
+ * elems, -1 if an error occurred
+ *
+ * Elems are filtered exactly as they are by bgpstream_record_get_next_elem.
+ * The batch is not cleared by this function, so elems from several records may
+ * be accumulated in the same batch; use bgpstream_elem_batch_clear to reset
+ * it. Unlike the elems returned by bgpstream_record_get_elems, the batch owns
+ * all of its data and stays valid after the record is re-used.
+ */
+int bgpstream_record_get_elem_batch(bgpstream_record_t *record,
+                                    bgpstream_elem_batch_t *batch, int max);
+
 /** Write the string representation of the record type into the provided buffer
  *
  * @param buf           pointer to a char array
@@ -28,6 +28,7 @@
 #define __BGPSTREAM_RECORD_INT_H
 
 #include "bgpstream_elem.h"
+#include "bgpstream_elem_generator.h"
 #include "bgpstream_format.h"
 #include "bgpstream_record.h"
 #include "bgpstream_utils.h"
@@ -52,6 +53,10 @@ struct bgpstream_record_internal {
 
   /** Private data-structure (optionally) populated by the format module */
   void *data;
+
+  /** Elems owned by the record and handed out by bgpstream_record_get_elems
+      (the format modules re-use a single elem instance) */
+  bgpstream_elem_generator_t *batch;
 };
 
 /** @} */
@@ -35,6 +35,9 @@
 #include "bgpstream_record.h"
 #include <stdint.h>
 
+/** Maximum value of the BGPSTREAM_RESOURCE_ATTR_DECODE_THREADS attribute */
+#define BGPSTREAM_RESOURCE_DECODE_THREADS_MAX 64
+
 /** Types of transport supported */
 typedef enum {
 
@@ -87,6 +90,11 @@ typedef enum bgpstream_resource_attr_type {
   /** The path toward a local cache */
   BGPSTREAM_RESOURCE_ATTR_CACHE_DIR_PATH = 3,
 
+  /** The number of threads to use to decode a RIB dump (MRT only). If unset
+      (or 0), records are decoded sequentially. At most
+      BGPSTREAM_RESOURCE_DECODE_THREADS_MAX */
+  BGPSTREAM_RESOURCE_ATTR_DECODE_THREADS = 4,
+
   /** INTERNAL: The total number of attribute types in use */
   _BGPSTREAM_RESOURCE_ATTR_CNT,
 
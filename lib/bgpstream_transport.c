@@ -42,6 +42,33 @@
 #include "bs_transport_kafka.h"
 #endif
 
+#include <string.h>
+
+/** Size of the blocks read by the line splitter */
+#define LINEBUF_BLOCK_LEN (1024 * 1024)
+
+/** Maximum length of a single line that the line splitter will buffer */
+#define LINEBUF_MAX_LINE_LEN (64 * 1024 * 1024)
+
+/** State for the block-read line splitter */
+struct bgpstream_transport_linebuf {
+
+  /** Buffer holding data read from the transport */
+  uint8_t *buf;
+
+  /** Allocated size of buf */
+  size_t size;
+
+  /** Offset of the first byte in buf not yet handed out */
+  size_t start;
+
+  /** Offset one past the last valid byte in buf */
+  size_t end;
+
+  /** Has the transport returned EOF? */
+  int eof;
+};
+
 /** Convenience typedef for the transport create function type */
 typedef int (*transport_create_func_t)(bgpstream_transport_t *transport);
 
@@ -119,6 +146,12 @@ void bgpstream_transport_destroy(bgpstream_transport_t *transport)
 
   transport->destroy(transport);
 
+  if (transport->linebuf != NULL) {
+    free(transport->linebuf->buf);
+    free(transport->linebuf);
+    transport->linebuf = NULL;
+  }
+
   free(transport);
 }
 
@@ -127,3 +160,126 @@ int64_t bgpstream_transport_readline(bgpstream_transport_t *transport,
 {
   return transport->readline(transport, buffer, len);
 }
+
+int64_t bgpstream_transport_readline_zc(bgpstream_transport_t *transport,
+                                        uint8_t **line)
+{
+  return transport->readline_zc(transport, line);
+}
+
+/* Find the next line in the line buffer, reading more blocks from the
+ * transport as needed. If max is non-zero, at most max bytes are considered
+ * (i.e., a line longer than that is returned in pieces). On success, returns
+ * the length of the line starting at linebuf->start (excluding the newline),
+ * and sets *nl to 1 if the line is terminated by a newline. */
+static int64_t linebuf_next(bgpstream_transport_t *transport, size_t max,
+                            int *nl)
+{
+  struct bgpstream_transport_linebuf *lb = transport->linebuf;
+  uint8_t *found;
+  size_t scan, avail;
+  int64_t rc;
+
+  if (lb == NULL) {
+    if ((lb = malloc_zero(sizeof(*lb))) == NULL ||
+        (lb->buf = malloc(LINEBUF_BLOCK_LEN)) == NULL) {
+      free(lb);
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not allocate line buffer");
+      return -1;
+    }
+    lb->size = LINEBUF_BLOCK_LEN;
+    transport->linebuf = lb;
+  }
+
+  *nl = 0;
+  scan = lb->start;
+
+  while (1) {
+    avail = lb->end - lb->start;
+    if (max != 0 && avail > max) {
+      avail = max;
+    }
+    if (scan < lb->start + avail &&
+        (found = memchr(lb->buf + scan, '\n', lb->start + avail - scan)) !=
+          NULL) {
+      *nl = 1;
+      return found - (lb->buf + lb->start);
+    }
+    if ((max != 0 && avail == max) || (lb->eof && avail != 0)) {
+      // line too long for the caller, or the last line has no newline
+      return avail;
+    }
+    if (lb->eof) {
+      return 0;
+    }
+    if (lb->end - lb->start > LINEBUF_MAX_LINE_LEN) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Line too long in %s (> %d bytes)",
+                    transport->res->url, LINEBUF_MAX_LINE_LEN);
+      return -1;
+    }
+    // no need to re-scan what we have already checked
+    scan = lb->end;
+
+    // shift the partial line to the front of the buffer, and grow the buffer
+    // if there is still not enough room for another block (we always keep
+    // one spare byte so that the last line can be nul-terminated)
+    if (lb->start != 0) {
+      memmove(lb->buf, lb->buf + lb->start, lb->end - lb->start);
+      scan -= lb->start;
+      lb->end -= lb->start;
+      lb->start = 0;
+    }
+    if (lb->size - lb->end <= LINEBUF_BLOCK_LEN / 2) {
+      uint8_t *tmp;
+      if ((tmp = realloc(lb->buf, lb->size * 2)) == NULL) {
+        bgpstream_log(BGPSTREAM_LOG_ERR, "Could not grow line buffer");
+        return -1;
+      }
+      lb->buf = tmp;
+      lb->size *= 2;
+    }
+
+    if ((rc = transport->read(transport, lb->buf + lb->end,
+                              lb->size - lb->end - 1)) < 0) {
+      return -1;
+    }
+    if (rc == 0) {
+      lb->eof = 1;
+    }
+    lb->end += rc;
+  }
+}
+
+int64_t bgpstream_transport_buffered_readline(bgpstream_transport_t *t,
+                                              uint8_t *buffer, int64_t len)
+{
+  int64_t llen;
+  int nl;
+
+  if (len <= 0) {
+    return -1;
+  }
+  if ((llen = linebuf_next(t, len - 1, &nl)) < 0) {
+    return -1;
+  }
+  memcpy(buffer, t->linebuf->buf + t->linebuf->start, llen);
+  buffer[llen] = '\0';
+  t->linebuf->start += llen + nl;
+  return llen;
+}
+
+int64_t bgpstream_transport_buffered_readline_zc(bgpstream_transport_t *t,
+                                                 uint8_t **line)
+{
+  int64_t llen;
+  int nl;
+
+  if ((llen = linebuf_next(t, 0, &nl)) < 0) {
+    return -1;
+  }
+  *line = t->linebuf->buf + t->linebuf->start;
+  // either overwrite the newline, or use the spare byte after the last line
+  (*line)[llen] = '\0';
+  t->linebuf->start += llen + nl;
+  return llen;
+}
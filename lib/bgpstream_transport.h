@@ -60,6 +60,18 @@ int64_t bgpstream_transport_read(bgpstream_transport_t *transport, void *buffer,
 int64_t bgpstream_transport_readline(bgpstream_transport_t *transport,
                                      void *buffer, int64_t len);
 
+/** Read one line from the given transport handler without copying it
+ *
+ * @param transport     pointer to a transport handler to read from
+ * @param[out] line     set to point to the (nul-terminated) line
+ * @return the length of the line if successful, -1 otherwise
+ *
+ * The line is owned by the transport and is only valid until the next read
+ * from the transport handler. It may be modified in place by the caller.
+ */
+int64_t bgpstream_transport_readline_zc(bgpstream_transport_t *transport,
+                                        uint8_t **line);
+
 /** Shutdown and destroy the given transport handler
  *
  * @param transport     pointer to a transport handler to destroy
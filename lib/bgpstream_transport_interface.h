@@ -53,12 +53,15 @@
                                      uint8_t *buffer, int64_t len);            \
   int64_t bs_transport_##name##_readline(bgpstream_transport_t *t,             \
                                          uint8_t *buffer, int64_t len);        \
+  int64_t bs_transport_##name##_readline_zc(bgpstream_transport_t *t,          \
+                                            uint8_t **line);                   \
   void bs_transport_##name##_destroy(bgpstream_transport_t *t);
 
 #define BS_TRANSPORT_SET_METHODS(classname, transport)                         \
   do {                                                                         \
     (transport)->read = bs_transport_##classname##_read;                       \
     (transport)->readline = bs_transport_##classname##_readline;               \
+    (transport)->readline_zc = bs_transport_##classname##_readline_zc;         \
     (transport)->destroy = bs_transport_##classname##_destroy;                 \
   } while (0)
 
@@ -89,6 +92,17 @@ struct bgpstream_transport {
   int64_t (*readline)(struct bgpstream_transport *t, uint8_t *buffer,
                       int64_t len);
 
+  /** Read line from this transport without copying it
+   *
+   * @param t           The data transport object to read from
+   * @param[out] line   Set to point to the (nul-terminated) line
+   * @return the length of the line if successful, -1 otherwise
+   *
+   * The line is owned by the transport and is only valid until the next read
+   * from this transport.
+   */
+  int64_t (*readline_zc)(struct bgpstream_transport *t, uint8_t **line);
+
   /** Shutdown and free this data transport
    *
    * @param transport   The data transport object to free
@@ -114,7 +128,42 @@ struct bgpstream_transport {
       transport */
   void *state;
 
+  /** State of the block-read line splitter (only used by transports that
+      use bgpstream_transport_buffered_readline{,_zc}) */
+  struct bgpstream_transport_linebuf *linebuf;
+
   /** }@ */
 };
 
+/** Read one line using the generic block-read line splitter
+ *
+ * @param t             The data transport object to read from
+ * @param buffer        The byte buffer to copy the line to
+ * @param len           The size of the buffer
+ * @return the number of bytes copied if successful, -1 otherwise
+ *
+ * This is a drop-in replacement for wandio_fgets (with chomp set) for
+ * stream-oriented transports. Data is pulled from the transport's read method
+ * in large blocks, and newlines are located with memchr. Lines longer than
+ * len-1 bytes are returned in several pieces.
+ *
+ * @note once a transport has been read using the line splitter, it must not be
+ * read from using the raw read method.
+ */
+int64_t bgpstream_transport_buffered_readline(bgpstream_transport_t *t,
+                                              uint8_t *buffer, int64_t len);
+
+/** Get a view of the next line using the generic block-read line splitter
+ *
+ * @param t             The data transport object to read from
+ * @param[out] line     Set to point to the line inside the splitter's buffer
+ * @return the length of the line if successful, -1 otherwise
+ *
+ * The trailing newline is replaced by a nul terminator. The line may be
+ * modified by the caller, but is only valid until the next read from the
+ * transport.
+ */
+int64_t bgpstream_transport_buffered_readline_zc(bgpstream_transport_t *t,
+                                                 uint8_t **line);
+
 #endif /* __BGPSTREAM_TRANSPORT_INTERFACE_H */
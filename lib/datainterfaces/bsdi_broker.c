@@ -61,6 +61,7 @@ enum {
   OPTION_BROKER_URL,
   OPTION_PARAM,
   OPTION_CACHE_DIR,
+  OPTION_DECODE_THREADS,
 #if WITH_KAFKA
   OPTION_KAFKA_GROUP,
   OPTION_KAFKA_OFFSET,
@@ -90,6 +91,14 @@ static bgpstream_data_interface_option_t options[] = {
     "cache-dir",                                 // name
     "Enable local cache at provided directory.", // description
   },
+  /* RIB decode threads */
+  {
+    BGPSTREAM_DATA_INTERFACE_BROKER, // interface ID
+    OPTION_DECODE_THREADS,           // internal ID
+    "decode-threads",                // name
+    "Number of threads to use to decode each MRT RIB dump (1-" STR(
+      BGPSTREAM_RESOURCE_DECODE_THREADS_MAX) ") (default: decode sequentially)",
+  },
 #if WITH_KAFKA
   /* Kafka group */
   {
@@ -141,6 +150,10 @@ typedef struct bsdi_broker_state {
   // User-specified location for cache: NULL means cache disabled
   char *cache_dir;
 
+  // User-specified number of RIB decode threads: NULL means decode
+  // sequentially
+  char *decode_threads;
+
 #if WITH_KAFKA
   // Kafka group name
   char *kafka_group;
@@ -539,6 +552,16 @@ static int process_json(bsdi_t *di, const char *js, jsmntok_t *root_tok,
           }
 #endif
 
+          // set decode threads attribute to resource
+          if (res != NULL && STATE->decode_threads != NULL &&
+              format_type == BGPSTREAM_RESOURCE_FORMAT_MRT &&
+              type == BGPSTREAM_RIB &&
+              bgpstream_resource_set_attr(
+                res, BGPSTREAM_RESOURCE_ATTR_DECODE_THREADS,
+                STATE->decode_threads) != 0) {
+            goto err;
+          }
+
           // set cache attribute to resource
           if (transport_type == BGPSTREAM_RESOURCE_TRANSPORT_CACHE &&
               bgpstream_resource_set_attr(res,
@@ -801,6 +824,9 @@ int bsdi_broker_set_option(bsdi_t *di,
                            const bgpstream_data_interface_option_t *option_type,
                            const char *option_value)
 {
+  long threads;
+  char *endp;
+
   switch (option_type->id) {
   case OPTION_BROKER_URL:
     // replaces our current URL
@@ -836,6 +862,22 @@ int bsdi_broker_set_option(bsdi_t *di,
     }
     break;
 
+  case OPTION_DECODE_THREADS:
+    // replaces our current thread count
+    threads = strtol(option_value, &endp, 10);
+    if (*option_value == '\0' || *endp != '\0' || threads < 1 ||
+        threads > BGPSTREAM_RESOURCE_DECODE_THREADS_MAX) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Invalid number of decode threads %s",
+                    option_value);
+      return -1;
+    }
+    free(STATE->decode_threads);
+    STATE->decode_threads = NULL;
+    if ((STATE->decode_threads = strdup(option_value)) == NULL) {
+      return -1;
+    }
+    break;
+
 #if WITH_KAFKA
   case OPTION_KAFKA_GROUP:
     // replaces our current group
@@ -888,6 +930,9 @@ void bsdi_broker_destroy(bsdi_t *di)
   free(STATE->cache_dir);
   STATE->cache_dir = NULL;
 
+  free(STATE->decode_threads);
+  STATE->decode_threads = NULL;
+
 #if WITH_KAFKA
   free(STATE->kafka_group);
   STATE->kafka_group = NULL;
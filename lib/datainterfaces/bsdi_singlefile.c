@@ -52,6 +52,7 @@ static const char *type_strs[] = {
 enum {
   OPTION_RIB_FILE,
   OPTION_RIB_TYPE,
+  OPTION_RIB_DECODE_THREADS,
   OPTION_UPDATE_FILE,
   OPTION_UPDATE_TYPE,
 };
@@ -72,6 +73,14 @@ static bgpstream_data_interface_option_t options[] = {
     "rib-type",                          // name
     "rib file type (mrt/bmp) (default: mrt)",
   },
+  /* RIB decode threads */
+  {
+    BGPSTREAM_DATA_INTERFACE_SINGLEFILE, // interface ID
+    OPTION_RIB_DECODE_THREADS,           // internal ID
+    "rib-decode-threads",                // name
+    "number of threads to use to decode the rib file (mrt only, 1-" STR(
+      BGPSTREAM_RESOURCE_DECODE_THREADS_MAX) ") (default: decode sequentially)",
+  },
   /* Update file path */
   {
     BGPSTREAM_DATA_INTERFACE_SINGLEFILE, // interface ID
@@ -113,6 +122,9 @@ typedef struct bsdi_singlefile_state {
   // Type of the given RIB file (MRT/BMP)
   bgpstream_resource_format_type_t rib_type;
 
+  // Number of threads to decode the RIB file with (NULL means sequential)
+  char *rib_decode_threads;
+
   // Path to an update file to read
   char *update_file;
 
@@ -203,6 +215,8 @@ int bsdi_singlefile_set_option(
   const char *option_value)
 {
   int found;
+  long threads;
+  char *endp;
 
   switch (option_type->id) {
   case OPTION_RIB_FILE:
@@ -232,6 +246,22 @@ int bsdi_singlefile_set_option(
     }
     break;
 
+  case OPTION_RIB_DECODE_THREADS:
+    // replaces our current thread count
+    threads = strtol(option_value, &endp, 10);
+    if (*option_value == '\0' || *endp != '\0' || threads < 1 ||
+        threads > BGPSTREAM_RESOURCE_DECODE_THREADS_MAX) {
+      bgpstream_log(BGPSTREAM_LOG_ERR,
+                    "Invalid rib-decode-threads specified: '%s'", option_value);
+      return -1;
+    }
+    free(STATE->rib_decode_threads);
+    STATE->rib_decode_threads = NULL;
+    if ((STATE->rib_decode_threads = strdup(option_value)) == NULL) {
+      return -1;
+    }
+    break;
+
   case OPTION_UPDATE_FILE:
     // replaces our current update file
     if (STATE->update_file != NULL) {
@@ -275,6 +305,9 @@ void bsdi_singlefile_destroy(bsdi_t *di)
   free(STATE->rib_file);
   STATE->rib_file = NULL;
 
+  free(STATE->rib_decode_threads);
+  STATE->rib_decode_threads = NULL;
+
   free(STATE->update_file);
   STATE->update_file = NULL;
 
@@ -285,6 +318,7 @@ void bsdi_singlefile_destroy(bsdi_t *di)
 int bsdi_singlefile_update_resources(bsdi_t *di)
 {
   uint32_t now = epoch_sec();
+  bgpstream_resource_t *res = NULL;
 
   /* if this is the first time we've read the file, then add it to the queue,
      otherwise check the header to see if it has changed */
@@ -298,7 +332,14 @@ int bsdi_singlefile_update_resources(bsdi_t *di)
           BSDI_GET_RES_MGR(di), BGPSTREAM_RESOURCE_TRANSPORT_FILE,
           STATE->rib_type, STATE->rib_file, STATE->last_rib_filetime,
           RIB_FREQUENCY_CHECK, "singlefile", "singlefile", BGPSTREAM_RIB,
-          NULL) < 0) {
+          &res) < 0) {
+      goto err;
+    }
+
+    if (res != NULL && STATE->rib_decode_threads != NULL &&
+        bgpstream_resource_set_attr(res,
+                                    BGPSTREAM_RESOURCE_ATTR_DECODE_THREADS,
+                                    STATE->rib_decode_threads) != 0) {
       goto err;
     }
   }
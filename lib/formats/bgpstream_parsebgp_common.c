@@ -32,8 +32,9 @@
 #include "bgpstream_utils_community_int.h"
 #include "bgpstream_log.h"
 #include <assert.h>
-#include <string.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 
 // if the parser encounters an "invalid" message, it will be written to
 // "debug.msg" if this is set
@@ -238,6 +239,21 @@ handle_eof(bgpstream_parsebgp_decode_state_t *state, bgpstream_record_t *record,
   return BGPSTREAM_FORMAT_END_OF_DUMP;
 }
 
+static bgpstream_format_status_t handle_read_error(bgpstream_record_t *record)
+{
+  // check if EIO happened during read. if so, return warning instead of error.
+  // EIO could happen if the file it's reading from is truncated.
+  if(errno == EIO){
+    bgpstream_log(BGPSTREAM_LOG_WARN, "Unexpected EOF. Input file potentially truncated or corrupted.");
+    // return corrupted dump
+    record->status = BGPSTREAM_RECORD_STATUS_CORRUPTED_RECORD;
+    return BGPSTREAM_FORMAT_CORRUPTED_DUMP;
+  }
+
+  bgpstream_log(BGPSTREAM_LOG_ERR, "Could not refill buffer");
+  return BGPSTREAM_FORMAT_READ_ERROR;
+}
+
 /* -------------------- PUBLIC API FUNCTIONS -------------------- */
 
 void bgpstream_parsebgp_upd_state_reset(
@@ -310,9 +326,101 @@ static int handle_prefix(bgpstream_elem_t *elem,
     }                                                                          \
   } while (0)
 
+static bgpstream_addr_version_t afi_version(parsebgp_bgp_afi_t afi)
+{
+  switch (afi) {
+  case PARSEBGP_BGP_AFI_IPV4:
+    return BGPSTREAM_ADDR_VERSION_IPV4;
+  case PARSEBGP_BGP_AFI_IPV6:
+    return BGPSTREAM_ADDR_VERSION_IPV6;
+  default:
+    return BGPSTREAM_ADDR_VERSION_UNKNOWN;
+  }
+}
+
+// Evaluate the filters that have the same outcome for every elem of the
+// update, and drop the groups of NLRIs that can't produce a wanted elem
+static int update_pushdown(bgpstream_parsebgp_upd_state_t *upd_state,
+                           bgpstream_elem_t *elem,
+                           parsebgp_bgp_update_t *update,
+                           bgpstream_filter_mgr_t *filter_mgr)
+{
+  parsebgp_bgp_update_path_attr_t *attrs = update->path_attrs.attrs;
+  uint32_t mask = filter_mgr->prog_mask;
+  bgpstream_addr_version_t v;
+
+  // the peer is the same for all elems
+  if ((mask & BGPSTREAM_FILTER_PRED_PEER_MASK) != 0 &&
+      bgpstream_filter_mgr_check_mask(filter_mgr,
+                                      BGPSTREAM_FILTER_PRED_PEER_MASK,
+                                      elem) == 0) {
+    upd_state->withdrawal_v4_cnt = upd_state->withdrawal_v6_cnt = 0;
+    upd_state->announce_v4_cnt = upd_state->announce_v6_cnt = 0;
+    return 0;
+  }
+
+  if ((mask & BGPSTREAM_FILTER_PRED_BIT(BGPSTREAM_FILTER_PRED_ELEMTYPE)) != 0) {
+    if ((filter_mgr->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_WITHDRAWAL) ==
+        0) {
+      upd_state->withdrawal_v4_cnt = upd_state->withdrawal_v6_cnt = 0;
+    }
+    if ((filter_mgr->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_ANNOUNCEMENT) ==
+        0) {
+      upd_state->announce_v4_cnt = upd_state->announce_v6_cnt = 0;
+    }
+  }
+
+  // native NLRIs are IPv4, MP NLRIs have the AFI of their attribute
+  if ((mask & BGPSTREAM_FILTER_PRED_BIT(BGPSTREAM_FILTER_PRED_IPVERSION)) !=
+      0) {
+    if (filter_mgr->ipversion != BGPSTREAM_ADDR_VERSION_IPV4) {
+      upd_state->withdrawal_v4_cnt = upd_state->announce_v4_cnt = 0;
+    }
+    if (upd_state->withdrawal_v6_cnt > 0) {
+      v = afi_version(attrs[PARSEBGP_BGP_PATH_ATTR_TYPE_MP_UNREACH_NLRI]
+                        .data.mp_unreach->afi);
+      if (v != BGPSTREAM_ADDR_VERSION_UNKNOWN && v != filter_mgr->ipversion) {
+        upd_state->withdrawal_v6_cnt = 0;
+      }
+    }
+    if (upd_state->announce_v6_cnt > 0) {
+      v = afi_version(attrs[PARSEBGP_BGP_PATH_ATTR_TYPE_MP_REACH_NLRI]
+                        .data.mp_reach->afi);
+      if (v != BGPSTREAM_ADDR_VERSION_UNKNOWN && v != filter_mgr->ipversion) {
+        upd_state->announce_v6_cnt = 0;
+      }
+    }
+  }
+
+  // path attribute filters never match withdrawals, and the attributes are
+  // shared by all the announcements
+  if ((mask & BGPSTREAM_FILTER_PRED_ATTR_MASK) != 0) {
+    upd_state->withdrawal_v4_cnt = upd_state->withdrawal_v6_cnt = 0;
+
+    if (upd_state->announce_v4_cnt > 0 || upd_state->announce_v6_cnt > 0) {
+      if (bgpstream_parsebgp_process_path_attrs(
+            elem, attrs, filter_mgr->zero_copy_elems) != 0) {
+        bgpstream_log(BGPSTREAM_LOG_ERR, "Could not extract path attributes");
+        return -1;
+      }
+      upd_state->path_attr_done = 1;
+
+      elem->type = BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT;
+      if (bgpstream_filter_mgr_check_mask(filter_mgr,
+                                          BGPSTREAM_FILTER_PRED_ATTR_MASK,
+                                          elem) == 0) {
+        upd_state->announce_v4_cnt = upd_state->announce_v6_cnt = 0;
+      }
+    }
+  }
+
+  return 0;
+}
+
 int bgpstream_parsebgp_process_update(bgpstream_parsebgp_upd_state_t *upd_state,
                                       bgpstream_elem_t *elem,
-                                      parsebgp_bgp_msg_t *bgp)
+                                      parsebgp_bgp_msg_t *bgp,
+                                      bgpstream_filter_mgr_t *filter_mgr)
 {
   parsebgp_bgp_update_t *update = bgp->types.update; // could be NULL!
   int rc = 0;
@@ -349,6 +457,11 @@ int bgpstream_parsebgp_process_update(bgpstream_parsebgp_upd_state_t *upd_state,
 
     // all other flags left set to zero
 
+    if (filter_mgr->prog_cnt > 0 &&
+        update_pushdown(upd_state, elem, update, filter_mgr) != 0) {
+      return -1;
+    }
+
     upd_state->ready = 1;
   }
 
@@ -368,8 +481,8 @@ int bgpstream_parsebgp_process_update(bgpstream_parsebgp_upd_state_t *upd_state,
 
   // at this point we need the path attributes processed
   if (upd_state->path_attr_done == 0) {
-    if (bgpstream_parsebgp_process_path_attrs(elem, update->path_attrs.attrs) !=
-        0) {
+    if (bgpstream_parsebgp_process_path_attrs(
+          elem, update->path_attrs.attrs, filter_mgr->zero_copy_elems) != 0) {
       bgpstream_log(BGPSTREAM_LOG_ERR, "Could not extract path attributes");
       return -1;
     }
@@ -390,10 +503,12 @@ int bgpstream_parsebgp_process_update(bgpstream_parsebgp_upd_state_t *upd_state,
 }
 
 int bgpstream_parsebgp_process_path_attrs(
-  bgpstream_elem_t *el, parsebgp_bgp_update_path_attr_t *attrs)
+  bgpstream_elem_t *el, parsebgp_bgp_update_path_attr_t *attrs, int zero_copy)
 {
   parsebgp_bgp_update_as_path_t *aspath = NULL;
   parsebgp_bgp_update_as_path_t *as4path = NULL;
+  parsebgp_bgp_update_path_attr_t *comms;
+  int rc;
 
   // AS Path(s)
   if (attrs[PARSEBGP_BGP_PATH_ATTR_TYPE_AS_PATH].type ==
@@ -465,14 +580,21 @@ int bgpstream_parsebgp_process_path_attrs(
 
   // Communities
   bgpstream_community_set_clear(el->communities);
-  if (attrs[PARSEBGP_BGP_PATH_ATTR_TYPE_COMMUNITIES].type ==
-        PARSEBGP_BGP_PATH_ATTR_TYPE_COMMUNITIES &&
-      bgpstream_community_set_populate(
-        el->communities,
-        attrs[PARSEBGP_BGP_PATH_ATTR_TYPE_COMMUNITIES].data.communities->raw,
-        attrs[PARSEBGP_BGP_PATH_ATTR_TYPE_COMMUNITIES].len) != 0) {
-    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not parse COMMUNITIES");
-    return -1;
+  comms = &attrs[PARSEBGP_BGP_PATH_ATTR_TYPE_COMMUNITIES];
+  if (comms->type == PARSEBGP_BGP_PATH_ATTR_TYPE_COMMUNITIES) {
+    // in zero-copy mode the raw attribute (owned by the message, which lives
+    // as long as the record) is decoded in place and referenced by the elem
+    if (zero_copy != 0) {
+      rc = bgpstream_community_set_populate_zc(
+        el->communities, comms->data.communities->raw, comms->len);
+    } else {
+      rc = bgpstream_community_set_populate(
+        el->communities, comms->data.communities->raw, comms->len);
+    }
+    if (rc != 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not parse COMMUNITIES");
+      return -1;
+    }
   }
 
   return 0;
@@ -503,24 +625,44 @@ int bgpstream_parsebgp_process_next_hop(bgpstream_elem_t *el,
   return 0;
 }
 
-bgpstream_format_status_t bgpstream_parsebgp_populate_record(
-  bgpstream_parsebgp_decode_state_t *state, parsebgp_msg_t *msg,
-  bgpstream_format_t *format, bgpstream_record_t *record,
-  bgpstream_parsebgp_prep_buf_cb_t *prep_cb,
-  bgpstream_parsebgp_check_filter_cb_t *filter_cb)
+static int raw_msg_set(bgpstream_parsebgp_raw_msg_t *raw, const uint8_t *buf,
+                       size_t len)
 {
-  assert(record->__int->format == format);
+  uint8_t *tmp;
+
+  if (len > raw->size) {
+    if ((tmp = realloc(raw->buf, len)) == NULL) {
+      return -1;
+    }
+    raw->buf = tmp;
+    raw->size = len;
+  }
+  memcpy(raw->buf, buf, len);
+  raw->len = len;
+  raw->decoded = 0;
+  return 0;
+}
+
+/* Decode the next message from the raw data buffer, refilling it from the
+   transport as needed.
 
+   If raw is set, the message is not decoded. Instead scan_cb is used to find
+   its length and check the filters (the result is returned in scan_rc), and
+   wanted messages are copied into raw. */
+static bgpstream_format_status_t
+decode_next(bgpstream_parsebgp_decode_state_t *state, parsebgp_msg_t *msg,
+            bgpstream_parsebgp_raw_msg_t *raw, bgpstream_format_t *format,
+            bgpstream_record_t *record,
+            bgpstream_parsebgp_prep_buf_cb_t *prep_cb,
+            bgpstream_parsebgp_scan_cb_t *scan_cb,
+            bgpstream_parsebgp_check_filter_rc_t *scan_rc,
+            uint64_t *skipped_cnt)
+{
   int refill = 0;
+  int prep_rc;
   ssize_t fill_len = 0;
   size_t dec_len = 0, hdr_len = 0;
-  uint64_t skipped_cnt = 0;
   parsebgp_error_t err;
-  bgpstream_parsebgp_check_filter_rc_t filter_rc;
-
-  record->status = BGPSTREAM_RECORD_STATUS_CORRUPTED_SOURCE;
-
-  assert(record->time_sec == 0);
 
 refill:
   // if there's nothing left in the buffer, it could just be because we happened
@@ -534,22 +676,11 @@ refill:
     // try to refill the buffer
     if ((fill_len = refill_buffer(state, format->transport)) == 0) {
       // EOF
-      return handle_eof(state, record, skipped_cnt);
+      return handle_eof(state, record, *skipped_cnt);
     }
     if (fill_len < 0) {
       // read error
-
-      // check if EIO happened during read. if so, return warning instead of error.
-      // EIO could happen if the file it's reading from is truncated.
-      if(errno == EIO){
-        bgpstream_log(BGPSTREAM_LOG_WARN, "Unexpected EOF. Input file potentially truncated or corrupted.");
-        // return corrupted dump
-        record->status = BGPSTREAM_RECORD_STATUS_CORRUPTED_RECORD;
-        return BGPSTREAM_FORMAT_CORRUPTED_DUMP;
-      }
-
-      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not refill buffer");
-      return BGPSTREAM_FORMAT_READ_ERROR;
+      return handle_read_error(record);
     }
     if (fill_len == state->remain) {
       record->status = BGPSTREAM_RECORD_STATUS_CORRUPTED_RECORD;
@@ -566,20 +697,61 @@ refill:
   // if we still have nothing to read, then we have nothing to read!
   if (state->remain == 0) {
     // EOF
-    return handle_eof(state, record, skipped_cnt);
+    return handle_eof(state, record, *skipped_cnt);
   }
 
   // see if the caller wants to parse some special headers (openbmp...)
   if (prep_cb != NULL) {
     hdr_len = state->remain;
-    if (prep_cb(format, state->ptr, &hdr_len, record) != 0) {
+    if ((prep_rc = prep_cb(format, state->ptr, &hdr_len, record)) < 0) {
       bgpstream_log(BGPSTREAM_LOG_ERR, "Failed to prep data buffer");
       return BGPSTREAM_FORMAT_UNKNOWN_ERROR;
     }
+    if (prep_rc != 0) {
+      // the header was enough for the caller to decide that it doesn't want
+      // this message, so skip over it without decoding the payload
+      if (hdr_len > state->remain) {
+        // the rest of the message isn't in the buffer yet
+        refill = 1;
+        goto refill;
+      }
+      state->ptr += hdr_len;
+      state->remain -= hdr_len;
+      if (*skipped_cnt == UINT64_MAX) {
+        *skipped_cnt = 0;
+      }
+      (*skipped_cnt)++;
+      state->successful_read_cnt++;
+      refill = 0;
+      goto refill;
+    }
     state->ptr += hdr_len;
     state->remain -= hdr_len;
   }
 
+  if (raw != NULL) {
+    // only look at the headers, and leave the payload for later
+    dec_len = 0;
+    *scan_rc = scan_cb(format, record, state->ptr, state->remain, &dec_len);
+    if (*scan_rc == BGPSTREAM_PARSEBGP_FILTER_ERROR) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Format-specific scanning failed");
+      return BGPSTREAM_FORMAT_UNKNOWN_ERROR;
+    }
+    if (dec_len == 0 || dec_len > state->remain) {
+      // the whole message isn't in the buffer yet
+      refill = 1;
+      goto refill;
+    }
+    if (*scan_rc == BGPSTREAM_PARSEBGP_KEEP &&
+        raw_msg_set(raw, state->ptr, dec_len) != 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not copy raw message");
+      return BGPSTREAM_FORMAT_UNKNOWN_ERROR;
+    }
+    state->ptr += dec_len;
+    state->remain -= dec_len;
+    return BGPSTREAM_FORMAT_OK;
+  }
+
   dec_len = state->remain;
   err = parsebgp_decode(state->parser_opts, state->msg_type, msg,
                              state->ptr, &dec_len);
@@ -617,9 +789,90 @@ refill:
   state->ptr += dec_len;
   state->remain -= dec_len;
 
+  return BGPSTREAM_FORMAT_OK;
+}
+
+/* Get the next message from the decoder pool */
+static bgpstream_format_status_t
+pool_decode_next(bgpstream_parsebgp_decode_state_t *state, parsebgp_msg_t **msg,
+                 bgpstream_format_t *format, bgpstream_record_t *record,
+                 uint64_t skipped_cnt)
+{
+  parsebgp_error_t err;
+
+  switch (bgpstream_parsebgp_pool_next(state->pool, format->transport, msg,
+                                       &err)) {
+  case BGPSTREAM_PARSEBGP_POOL_OK:
+    break;
+
+  case BGPSTREAM_PARSEBGP_POOL_EOF:
+    return handle_eof(state, record, skipped_cnt);
+
+  case BGPSTREAM_PARSEBGP_POOL_TRUNCATED:
+    record->status = BGPSTREAM_RECORD_STATUS_CORRUPTED_RECORD;
+    return BGPSTREAM_FORMAT_CORRUPTED_DUMP;
+
+  default:
+    return handle_read_error(record);
+  }
+
+  if (err == PARSEBGP_TRUNCATED_MSG) {
+    bgpstream_log(BGPSTREAM_LOG_WARN,
+                  "Read truncated record %"PRIu64" from '%s'",
+                  state->successful_read_cnt,
+                  format->res->url);
+  } else if (err != PARSEBGP_OK) {
+    // the pool hands us complete messages, so even a partial message is
+    // invalid
+    parsebgp_clear_msg(*msg);
+    bgpstream_log(BGPSTREAM_LOG_WARN,
+                  "Failed to parse message from '%s' (%d:%s)", format->res->url,
+                  err, parsebgp_strerror(err));
+    record->status = BGPSTREAM_RECORD_STATUS_CORRUPTED_RECORD;
+    return BGPSTREAM_FORMAT_CORRUPTED_MSG;
+  }
+
+  return BGPSTREAM_FORMAT_OK;
+}
+
+static bgpstream_format_status_t
+populate_record(bgpstream_parsebgp_decode_state_t *state, parsebgp_msg_t **msg,
+                bgpstream_parsebgp_raw_msg_t *raw, bgpstream_format_t *format,
+                bgpstream_record_t *record,
+                bgpstream_parsebgp_prep_buf_cb_t *prep_cb,
+                bgpstream_parsebgp_check_filter_cb_t *filter_cb,
+                bgpstream_parsebgp_scan_cb_t *scan_cb)
+{
+  assert(record->__int->format == format);
+
+  uint64_t skipped_cnt = 0;
+  bgpstream_format_status_t rc;
+  bgpstream_parsebgp_check_filter_rc_t filter_rc;
+
+  record->status = BGPSTREAM_RECORD_STATUS_CORRUPTED_SOURCE;
+
+  assert(record->time_sec == 0);
+
+next:
+  if (raw != NULL) {
+    rc = decode_next(state, NULL, raw, format, record, prep_cb, scan_cb,
+                     &filter_rc, &skipped_cnt);
+  } else if (state->pool != NULL) {
+    assert(prep_cb == NULL);
+    rc = pool_decode_next(state, msg, format, record, skipped_cnt);
+  } else {
+    rc = decode_next(state, *msg, NULL, format, record, prep_cb, NULL, NULL,
+                     &skipped_cnt);
+  }
+  if (rc != BGPSTREAM_FORMAT_OK) {
+    return rc;
+  }
+
   // got a message!
-  // let the caller decide if they want it
-  filter_rc = filter_cb(format, record, msg);
+  // let the caller decide if they want it (scanning already checked)
+  if (raw == NULL) {
+    filter_rc = filter_cb(format, record, *msg);
+  }
   if (filter_rc == BGPSTREAM_PARSEBGP_FILTER_ERROR) {
     bgpstream_log(BGPSTREAM_LOG_ERR, "Format-specific filtering failed");
     return BGPSTREAM_FORMAT_UNKNOWN_ERROR;
@@ -650,17 +903,18 @@ refill:
       skipped_cnt++;
       state->successful_read_cnt++;
     }
-    parsebgp_clear_msg(msg);
+    if (raw == NULL) {
+      parsebgp_clear_msg(*msg);
+    }
     // there is a cool corner case here when our buffer ends perfectly at the
     // end of a message, AND we filter the message out. previously i had a
     // simple "continue" which would have dropped out of the loop (since
     // remain == 0) and then would have been caught by the EOF check below.
-    // to avoid this, we jump back to the refill point (but without a forced
-    // refill), which in the normal case will drop into this loop as if a
-    // continue had been called, and in the special case where remain == 0,
-    // will try and refill the buffer.
-    refill = 0; // don't force the refill, just let it happen naturally
-    goto refill;
+    // to avoid this, decode_next jumps back to its refill point (but without
+    // a forced refill), which in the normal case will drop into the decode as
+    // if a continue had been called, and in the special case where remain ==
+    // 0, will try and refill the buffer.
+    goto next;
   }
 
   // if this is the first record we read and no previous
@@ -680,6 +934,67 @@ refill:
   return BGPSTREAM_FORMAT_OK;
 }
 
+bgpstream_format_status_t bgpstream_parsebgp_populate_record(
+  bgpstream_parsebgp_decode_state_t *state, parsebgp_msg_t **msg,
+  bgpstream_format_t *format, bgpstream_record_t *record,
+  bgpstream_parsebgp_prep_buf_cb_t *prep_cb,
+  bgpstream_parsebgp_check_filter_cb_t *filter_cb)
+{
+  return populate_record(state, msg, NULL, format, record, prep_cb, filter_cb,
+                         NULL);
+}
+
+bgpstream_format_status_t bgpstream_parsebgp_populate_record_deferred(
+  bgpstream_parsebgp_decode_state_t *state, bgpstream_parsebgp_raw_msg_t *raw,
+  bgpstream_format_t *format, bgpstream_record_t *record,
+  bgpstream_parsebgp_prep_buf_cb_t *prep_cb,
+  bgpstream_parsebgp_scan_cb_t *scan_cb)
+{
+  return populate_record(state, NULL, raw, format, record, prep_cb, NULL,
+                         scan_cb);
+}
+
+int bgpstream_parsebgp_decode_deferred(bgpstream_parsebgp_decode_state_t *state,
+                                       bgpstream_parsebgp_raw_msg_t *raw,
+                                       parsebgp_msg_t *msg)
+{
+  parsebgp_error_t err;
+  size_t dec_len = raw->len;
+
+  if (raw->decoded != 0) {
+    return raw->decoded > 0 ? 0 : -1;
+  }
+
+  err = parsebgp_decode(state->parser_opts, state->msg_type, msg, raw->buf,
+                        &dec_len);
+  if (err != PARSEBGP_OK && err != PARSEBGP_TRUNCATED_MSG) {
+    parsebgp_clear_msg(msg);
+    bgpstream_log(BGPSTREAM_LOG_WARN,
+                  "Failed to parse deferred message (%d:%s)", err,
+                  parsebgp_strerror(err));
+    raw->decoded = -1;
+    return -1;
+  }
+
+  raw->decoded = 1;
+  return 0;
+}
+
+void bgpstream_parsebgp_raw_msg_clear(bgpstream_parsebgp_raw_msg_t *raw)
+{
+  raw->len = 0;
+  raw->decoded = 0;
+}
+
+void bgpstream_parsebgp_raw_msg_destroy(bgpstream_parsebgp_raw_msg_t *raw)
+{
+  free(raw->buf);
+  raw->buf = NULL;
+  raw->len = 0;
+  raw->size = 0;
+  raw->decoded = 0;
+}
+
 void bgpstream_parsebgp_opts_init(parsebgp_opts_t *opts)
 {
   // select only the Path Attributes that we care about
@@ -28,7 +28,9 @@
 #define __BGPSTREAM_PARSEBGP_COMMON_H
 
 #include "bgpstream_elem.h"
+#include "bgpstream_filter.h"
 #include "bgpstream_format.h"
+#include "bgpstream_parsebgp_pool.h"
 #include "parsebgp.h"
 
 #define COPY_IP(dst, afi, src, do_unknown)                                     \
@@ -56,13 +58,19 @@
  *
  * @param el            pointer to the elem to populate
  * @param attrs         array of parsebgp path attributes to process
+ * @param zero_copy     if non-zero, the elem references attribute data in the
+ *                      parsed message rather than copying it (see
+ *                      bgpstream_set_zero_copy_elems)
  * @return 0 if processing was successful, -1 otherwise
  *
  * @note this does not process the NEXT_HOP attribute, nor the
  * MP_REACH/MP_UNREACH attributes
+ *
+ * @note in zero-copy mode the raw attributes are decoded in place, so this
+ * function must be called at most once for a given set of attributes.
  */
 int bgpstream_parsebgp_process_path_attrs(
-  bgpstream_elem_t *el, parsebgp_bgp_update_path_attr_t *attrs);
+  bgpstream_elem_t *el, parsebgp_bgp_update_path_attr_t *attrs, int zero_copy);
 
 /** Extract the appropriate NEXT-HOP information from the given attributes
  *
@@ -122,12 +130,19 @@ void bgpstream_parsebgp_upd_state_reset(
  * @param upd_state     pointer to the generator state
  * @param elem          pointer to the elem to populate
  * @param bgp           pointer to a parsed BGP message
+ * @param filter_mgr    pointer to the filter manager of the stream
  * @return 1 if the elem was populated, 0 if there are no more elems, -1 if an
  * error occurred.
+ *
+ * The peer fields of the elem must be populated before the first call for a
+ * message. Filters that are decided by the message as a whole (peer, elem
+ * type, IP version and path attributes) are evaluated once, and groups of
+ * NLRIs that cannot match are skipped without generating elems.
  */
 int bgpstream_parsebgp_process_update(bgpstream_parsebgp_upd_state_t *upd_state,
                                       bgpstream_elem_t *elem,
-                                      parsebgp_bgp_msg_t *bgp);
+                                      parsebgp_bgp_msg_t *bgp,
+                                      bgpstream_filter_mgr_t *filter_mgr);
 
 typedef struct bgpstream_parsebgp_decode_state {
 
@@ -152,6 +167,10 @@ typedef struct bgpstream_parsebgp_decode_state {
   // the number of non-filtered reads (i.e. "useful")
   uint64_t valid_read_cnt;
 
+  // if set, messages are decoded in parallel by this pool rather than from
+  // the buffer above (MRT only, no prep callback)
+  bgpstream_parsebgp_pool_t *pool;
+
 } bgpstream_parsebgp_decode_state_t;
 
 typedef enum {
@@ -200,19 +219,108 @@ typedef bgpstream_parsebgp_check_filter_rc_t(
  * @param[out] len      length of the data buffer, should updated with the
  *                      number of bytes read
  * @param record        pointer to the record being populated
- * @return 0 if successful, -1 otherwise
+ * @return 0 if successful, 1 if the message should be skipped without being
+ * decoded, -1 otherwise
+ *
+ * If the callee returns 1, len must be updated with the total length of the
+ * message (i.e., including the header) so that it can be skipped over.
  */
 typedef int(bgpstream_parsebgp_prep_buf_cb_t)(bgpstream_format_t *format,
                                               uint8_t *buf, size_t *len,
                                               bgpstream_record_t *record);
 
-/** Use libparsebgp to decode a message */
+/** Use libparsebgp to decode a message
+ *
+ * @param state         pointer to the decoder state
+ * @param[in,out] msg   pointer to the (cleared) message to decode into. If the
+ *                      state has a decoder pool, this is replaced with a
+ *                      pointer to a message owned by the pool.
+ * @param format        pointer to the format that is populating the record
+ * @param record        pointer to the record to populate
+ * @param prep_cb       optional callback to parse non-standard headers
+ * @param filter_cb     callback used to check filters on the decoded message
+ * @return BGPSTREAM_FORMAT_OK if the record was populated, another status code
+ * otherwise
+ */
 bgpstream_format_status_t bgpstream_parsebgp_populate_record(
-  bgpstream_parsebgp_decode_state_t *state, parsebgp_msg_t *msg,
+  bgpstream_parsebgp_decode_state_t *state, parsebgp_msg_t **msg,
   bgpstream_format_t *format, bgpstream_record_t *record,
   bgpstream_parsebgp_prep_buf_cb_t *prep_cb,
   bgpstream_parsebgp_check_filter_cb_t *filter_cb);
 
+/** Raw copy of a message whose decoding has been deferred */
+typedef struct bgpstream_parsebgp_raw_msg {
+
+  // raw message data
+  uint8_t *buf;
+
+  // length of the message in buf
+  size_t len;
+
+  // allocated size of buf
+  size_t size;
+
+  // 0 if the message has not been decoded yet, 1 if it was decoded
+  // successfully, -1 if decoding failed
+  int decoded;
+
+} bgpstream_parsebgp_raw_msg_t;
+
+/** Used instead of decoding (and the filter callback) when decoding is
+ * deferred: gives the caller a chance to find the length of the message and
+ * check filters using only the message headers.
+ *
+ * @param format        pointer to the format that originally called
+ * @param record        pointer to the record being populated
+ * @param buf           pointer to the start of the (undecoded) message
+ * @param len           number of bytes available in the buffer
+ * @param[out] msg_len  set to the total length of the message, or left as 0
+ *                      if more data is needed to find it
+ * @return the same values as the filter callback
+ *
+ * It is the responsibility of the callee to set the record timestamp fields.
+ */
+typedef bgpstream_parsebgp_check_filter_rc_t(bgpstream_parsebgp_scan_cb_t)(
+  bgpstream_format_t *format, bgpstream_record_t *record, const uint8_t *buf,
+  size_t len, size_t *msg_len);
+
+/** Populate a record from message headers only, deferring decoding
+ *
+ * @param state         pointer to the decoder state
+ * @param raw           pointer to the raw message store of the record
+ * @param format        pointer to the format that is populating the record
+ * @param record        pointer to the record to populate
+ * @param prep_cb       optional callback to parse non-standard headers
+ * @param scan_cb       callback used to check filters on the message headers
+ * @return BGPSTREAM_FORMAT_OK if the record was populated, another status code
+ * otherwise
+ *
+ * The raw message is kept in raw so that it can be decoded by
+ * bgpstream_parsebgp_decode_deferred if (and when) elems are requested.
+ */
+bgpstream_format_status_t bgpstream_parsebgp_populate_record_deferred(
+  bgpstream_parsebgp_decode_state_t *state, bgpstream_parsebgp_raw_msg_t *raw,
+  bgpstream_format_t *format, bgpstream_record_t *record,
+  bgpstream_parsebgp_prep_buf_cb_t *prep_cb,
+  bgpstream_parsebgp_scan_cb_t *scan_cb);
+
+/** Decode a message whose decoding was deferred
+ *
+ * @param state         pointer to the decoder state
+ * @param raw           pointer to the raw message to decode
+ * @param msg           pointer to the message to decode into
+ * @return 0 if the message was (or had already been) decoded, -1 otherwise
+ */
+int bgpstream_parsebgp_decode_deferred(bgpstream_parsebgp_decode_state_t *state,
+                                       bgpstream_parsebgp_raw_msg_t *raw,
+                                       parsebgp_msg_t *msg);
+
+/** Forget the raw message (keeping the buffer for reuse) */
+void bgpstream_parsebgp_raw_msg_clear(bgpstream_parsebgp_raw_msg_t *raw);
+
+/** Free the raw message buffer */
+void bgpstream_parsebgp_raw_msg_destroy(bgpstream_parsebgp_raw_msg_t *raw);
+
 /** Set options specific to how we use libparsebgp in BGPStream */
 void bgpstream_parsebgp_opts_init(parsebgp_opts_t *opts);
 
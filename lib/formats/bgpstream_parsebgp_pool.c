@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) 2014 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_parsebgp_pool.h"
+#include "bgpstream_log.h"
+#include "bgpstream_parsebgp_common.h"
+#include "utils.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/* Length of the common MRT header (timestamp, type, subtype, length) */
+#define MRT_HDR_LEN 12
+
+/* Offset of the length field in the MRT header */
+#define MRT_HDR_LEN_OFFSET 8
+
+/* Stop adding messages to a chunk once it holds this many bytes... */
+#define CHUNK_TARGET_LEN (BGPSTREAM_PARSEBGP_BUFLEN)
+
+/* ...or this many messages */
+#define CHUNK_MAX_MSGS 1024
+
+/* Largest message that we will accept. This is the same limit as the
+   sequential decoder, which fails on messages that don't fit in its buffer */
+#define MAX_MSG_LEN (BGPSTREAM_PARSEBGP_BUFLEN)
+
+/* A chunk always has room for one more message once it is below its target */
+#define CHUNK_BUFLEN (CHUNK_TARGET_LEN + MAX_MSG_LEN)
+
+/* Number of chunks per decoder thread. More than one lets the reading thread
+   keep every decoder busy while it consumes already decoded chunks */
+#define CHUNKS_PER_THREAD 2
+
+typedef enum {
+
+  /** Chunk is empty and may be filled by the reading thread */
+  CHUNK_FREE = 0,
+
+  /** Chunk has been filled and is waiting for a decoder */
+  CHUNK_READY = 1,
+
+  /** Chunk is being decoded */
+  CHUNK_DECODING = 2,
+
+  /** Chunk has been decoded and its messages can be consumed */
+  CHUNK_DECODED = 3,
+
+} chunk_state_t;
+
+typedef struct chunk {
+
+  // state of the chunk (protected by the pool mutex)
+  chunk_state_t state;
+
+  // raw data for all messages in the chunk
+  uint8_t *buf;
+  size_t buf_len;
+
+  // offset and length of each message within buf
+  size_t msg_off[CHUNK_MAX_MSGS];
+  size_t msg_len[CHUNK_MAX_MSGS];
+
+  // decoded messages, and the result of decoding each of them
+  parsebgp_msg_t *msgs[CHUNK_MAX_MSGS];
+  parsebgp_error_t errs[CHUNK_MAX_MSGS];
+
+  // number of messages in the chunk
+  int msgs_cnt;
+
+  // index of the next message to hand to the caller
+  int next_msg;
+
+  // status of the stream after the last message in this chunk
+  bgpstream_parsebgp_pool_status_t end_status;
+
+  // errno of a failed read (when end_status is READ_ERROR)
+  int read_errno;
+
+} chunk_t;
+
+struct bgpstream_parsebgp_pool {
+
+  // options given to libparsebgp (read-only once the threads start)
+  parsebgp_opts_t opts;
+
+  // decoder threads
+  pthread_t *threads;
+  int threads_cnt;
+
+  // ring of chunks
+  chunk_t *chunks;
+  int chunks_cnt;
+
+  // next chunk to consume (only used by the reading thread)
+  int head;
+
+  // next chunk to fill (only used by the reading thread)
+  int tail;
+
+  // has the reading thread reached the end of the stream?
+  int eos;
+
+  // next chunk for a decoder to pick up (protected by mutex)
+  int next_decode;
+
+  // signal the decoder threads to exit (protected by mutex)
+  int shutdown;
+
+  pthread_mutex_t mutex;
+
+  // signalled when a chunk becomes ready for decoding
+  pthread_cond_t ready_cond;
+
+  // signalled when a chunk has been decoded
+  pthread_cond_t decoded_cond;
+};
+
+/* ========== DECODER THREADS ========== */
+
+static void decode_chunk(bgpstream_parsebgp_pool_t *pool, chunk_t *c)
+{
+  size_t dec_len;
+  int i;
+
+  for (i = 0; i < c->msgs_cnt; i++) {
+    parsebgp_clear_msg(c->msgs[i]);
+    dec_len = c->msg_len[i];
+    c->errs[i] = parsebgp_decode(pool->opts, PARSEBGP_MSG_TYPE_MRT, c->msgs[i],
+                                 c->buf + c->msg_off[i], &dec_len);
+  }
+}
+
+static void *decoder_thread(void *user)
+{
+  bgpstream_parsebgp_pool_t *pool = (bgpstream_parsebgp_pool_t *)user;
+  chunk_t *c;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (1) {
+    // chunks become ready in ring order, so we only need to watch the next one
+    while (pool->shutdown == 0 &&
+           pool->chunks[pool->next_decode].state != CHUNK_READY) {
+      pthread_cond_wait(&pool->ready_cond, &pool->mutex);
+    }
+    if (pool->shutdown != 0) {
+      break;
+    }
+    c = &pool->chunks[pool->next_decode];
+    c->state = CHUNK_DECODING;
+    pool->next_decode = (pool->next_decode + 1) % pool->chunks_cnt;
+    pthread_mutex_unlock(&pool->mutex);
+
+    decode_chunk(pool, c);
+
+    pthread_mutex_lock(&pool->mutex);
+    c->state = CHUNK_DECODED;
+    pthread_cond_broadcast(&pool->decoded_cond);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return NULL;
+}
+
+/* ========== READING THREAD ========== */
+
+/* Read exactly len bytes unless EOF (or an error) is reached first */
+static int64_t read_full(bgpstream_transport_t *transport, uint8_t *buf,
+                         int64_t len)
+{
+  int64_t total = 0;
+  int64_t rc;
+
+  while (total < len) {
+    if ((rc = bgpstream_transport_read(transport, buf + total, len - total)) <
+        0) {
+      return rc;
+    }
+    if (rc == 0) {
+      break;
+    }
+    total += rc;
+  }
+  return total;
+}
+
+/* Split the next part of the stream into messages and add them to the given
+   chunk */
+static void fill_chunk(chunk_t *c, bgpstream_transport_t *transport)
+{
+  uint8_t *hdr;
+  size_t msg_len;
+  int64_t rc;
+
+  c->buf_len = 0;
+  c->msgs_cnt = 0;
+  c->next_msg = 0;
+  c->end_status = BGPSTREAM_PARSEBGP_POOL_OK;
+
+  while (c->msgs_cnt < CHUNK_MAX_MSGS && c->buf_len < CHUNK_TARGET_LEN) {
+    hdr = c->buf + c->buf_len;
+    if ((rc = read_full(transport, hdr, MRT_HDR_LEN)) < 0) {
+      goto read_err;
+    }
+    if (rc == 0) {
+      c->end_status = BGPSTREAM_PARSEBGP_POOL_EOF;
+      return;
+    }
+    if (rc < MRT_HDR_LEN) {
+      c->end_status = BGPSTREAM_PARSEBGP_POOL_TRUNCATED;
+      return;
+    }
+
+    msg_len = MRT_HDR_LEN + (((uint32_t)hdr[MRT_HDR_LEN_OFFSET] << 24) |
+                             ((uint32_t)hdr[MRT_HDR_LEN_OFFSET + 1] << 16) |
+                             ((uint32_t)hdr[MRT_HDR_LEN_OFFSET + 2] << 8) |
+                             (uint32_t)hdr[MRT_HDR_LEN_OFFSET + 3]);
+    if (msg_len > MAX_MSG_LEN) {
+      bgpstream_log(BGPSTREAM_LOG_WARN,
+                    "MRT message length (%zu) exceeds maximum (%d)", msg_len,
+                    MAX_MSG_LEN);
+      c->end_status = BGPSTREAM_PARSEBGP_POOL_TRUNCATED;
+      return;
+    }
+
+    if ((rc = read_full(transport, hdr + MRT_HDR_LEN,
+                        msg_len - MRT_HDR_LEN)) < 0) {
+      goto read_err;
+    }
+    if (rc < (int64_t)(msg_len - MRT_HDR_LEN)) {
+      c->end_status = BGPSTREAM_PARSEBGP_POOL_TRUNCATED;
+      return;
+    }
+
+    c->msg_off[c->msgs_cnt] = c->buf_len;
+    c->msg_len[c->msgs_cnt] = msg_len;
+    c->msgs_cnt++;
+    c->buf_len += msg_len;
+  }
+  return;
+
+read_err:
+  c->end_status = BGPSTREAM_PARSEBGP_POOL_READ_ERROR;
+  c->read_errno = errno;
+}
+
+/* Fill as many free chunks as possible and hand them to the decoders */
+static void fill_chunks(bgpstream_parsebgp_pool_t *pool,
+                        bgpstream_transport_t *transport)
+{
+  chunk_t *c;
+  chunk_state_t state;
+
+  while (pool->eos == 0) {
+    c = &pool->chunks[pool->tail];
+    pthread_mutex_lock(&pool->mutex);
+    state = c->state;
+    pthread_mutex_unlock(&pool->mutex);
+    if (state != CHUNK_FREE) {
+      return;
+    }
+
+    fill_chunk(c, transport);
+    if (c->end_status != BGPSTREAM_PARSEBGP_POOL_OK) {
+      pool->eos = 1;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    c->state = CHUNK_READY;
+    pthread_cond_broadcast(&pool->ready_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    pool->tail = (pool->tail + 1) % pool->chunks_cnt;
+  }
+}
+
+/* ========== PUBLIC API ========== */
+
+bgpstream_parsebgp_pool_t *
+bgpstream_parsebgp_pool_create(const parsebgp_opts_t *opts, int threads_cnt)
+{
+  bgpstream_parsebgp_pool_t *pool;
+  int i, j;
+
+  assert(threads_cnt > 0 && threads_cnt <= BGPSTREAM_PARSEBGP_POOL_MAX_THREADS);
+
+  if ((pool = malloc_zero(sizeof(bgpstream_parsebgp_pool_t))) == NULL) {
+    return NULL;
+  }
+  pool->opts = *opts;
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->ready_cond, NULL);
+  pthread_cond_init(&pool->decoded_cond, NULL);
+
+  pool->chunks_cnt = threads_cnt * CHUNKS_PER_THREAD;
+  if ((pool->chunks = malloc_zero(sizeof(chunk_t) * pool->chunks_cnt)) ==
+      NULL) {
+    goto err;
+  }
+  for (i = 0; i < pool->chunks_cnt; i++) {
+    if ((pool->chunks[i].buf = malloc(CHUNK_BUFLEN)) == NULL) {
+      goto err;
+    }
+    for (j = 0; j < CHUNK_MAX_MSGS; j++) {
+      if ((pool->chunks[i].msgs[j] = parsebgp_create_msg()) == NULL) {
+        goto err;
+      }
+    }
+  }
+
+  if ((pool->threads = malloc_zero(sizeof(pthread_t) * threads_cnt)) == NULL) {
+    goto err;
+  }
+  for (i = 0; i < threads_cnt; i++) {
+    if (pthread_create(&pool->threads[i], NULL, decoder_thread, pool) != 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not start decoder thread");
+      goto err;
+    }
+    pool->threads_cnt++;
+  }
+
+  return pool;
+
+err:
+  bgpstream_parsebgp_pool_destroy(pool);
+  return NULL;
+}
+
+bgpstream_parsebgp_pool_status_t
+bgpstream_parsebgp_pool_next(bgpstream_parsebgp_pool_t *pool,
+                             bgpstream_transport_t *transport,
+                             parsebgp_msg_t **msg, parsebgp_error_t *err)
+{
+  chunk_t *c;
+  parsebgp_msg_t *tmp;
+
+  while (1) {
+    // keep the decoders busy
+    fill_chunks(pool, transport);
+
+    c = &pool->chunks[pool->head];
+    pthread_mutex_lock(&pool->mutex);
+    // the head chunk can only be free if the reader has stopped filling
+    assert(c->state != CHUNK_FREE);
+    while (c->state != CHUNK_DECODED) {
+      pthread_cond_wait(&pool->decoded_cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (c->next_msg < c->msgs_cnt) {
+      // swap the caller's (cleared) message with the decoded one
+      tmp = c->msgs[c->next_msg];
+      c->msgs[c->next_msg] = *msg;
+      *msg = tmp;
+      *err = c->errs[c->next_msg];
+      c->next_msg++;
+      return BGPSTREAM_PARSEBGP_POOL_OK;
+    }
+
+    if (c->end_status != BGPSTREAM_PARSEBGP_POOL_OK) {
+      // leave the chunk in place so that the status is sticky
+      errno = c->read_errno;
+      return c->end_status;
+    }
+
+    // this chunk has been consumed, hand it back to the reader
+    pthread_mutex_lock(&pool->mutex);
+    c->state = CHUNK_FREE;
+    pthread_mutex_unlock(&pool->mutex);
+    pool->head = (pool->head + 1) % pool->chunks_cnt;
+  }
+}
+
+void bgpstream_parsebgp_pool_destroy(bgpstream_parsebgp_pool_t *pool)
+{
+  int i, j;
+
+  if (pool == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->ready_cond);
+  pthread_mutex_unlock(&pool->mutex);
+  for (i = 0; i < pool->threads_cnt; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  free(pool->threads);
+  pool->threads = NULL;
+
+  if (pool->chunks != NULL) {
+    for (i = 0; i < pool->chunks_cnt; i++) {
+      for (j = 0; j < CHUNK_MAX_MSGS; j++) {
+        if (pool->chunks[i].msgs[j] != NULL) {
+          parsebgp_destroy_msg(pool->chunks[i].msgs[j]);
+        }
+      }
+      free(pool->chunks[i].buf);
+    }
+    free(pool->chunks);
+    pool->chunks = NULL;
+  }
+
+  pthread_cond_destroy(&pool->decoded_cond);
+  pthread_cond_destroy(&pool->ready_cond);
+  pthread_mutex_destroy(&pool->mutex);
+
+  free(pool);
+}
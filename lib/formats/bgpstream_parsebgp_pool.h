@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2014 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BGPSTREAM_PARSEBGP_POOL_H
+#define __BGPSTREAM_PARSEBGP_POOL_H
+
+#include "bgpstream_transport.h"
+#include "parsebgp.h"
+
+/** Maximum number of decoder threads that a pool may use */
+#define BGPSTREAM_PARSEBGP_POOL_MAX_THREADS                                    \
+  BGPSTREAM_RESOURCE_DECODE_THREADS_MAX
+
+/** Opaque structure representing a pool of MRT decoder threads.
+ *
+ * A decoder pool splits the (decompressed) stream read from a transport at MRT
+ * record boundaries into chunks of records which are decoded by worker
+ * threads. Decoded messages are handed back to the caller in exactly the same
+ * order that they appear in the stream, so the pool can be used as a drop-in
+ * replacement for sequential decoding of any MRT dump whose records can be
+ * decoded independently (e.g., TABLE_DUMP_V2 RIBs: the PEER_INDEX_TABLE is
+ * only needed when extracting elems, which still happens in order).
+ */
+typedef struct bgpstream_parsebgp_pool bgpstream_parsebgp_pool_t;
+
+/** Status codes returned by bgpstream_parsebgp_pool_next */
+typedef enum {
+
+  /** Failed to read from the transport */
+  BGPSTREAM_PARSEBGP_POOL_READ_ERROR = -1,
+
+  /** A message was returned */
+  BGPSTREAM_PARSEBGP_POOL_OK = 0,
+
+  /** There are no more messages in the stream */
+  BGPSTREAM_PARSEBGP_POOL_EOF = 1,
+
+  /** The stream ended with a partial (or oversized) message */
+  BGPSTREAM_PARSEBGP_POOL_TRUNCATED = 2,
+
+} bgpstream_parsebgp_pool_status_t;
+
+/** Create a new MRT decoder pool
+ *
+ * @param opts          pointer to the libparsebgp options to decode with
+ *                      (copied)
+ * @param threads_cnt   number of decoder threads to start
+ * @return a pointer to a decoder pool if successful, NULL otherwise
+ */
+bgpstream_parsebgp_pool_t *
+bgpstream_parsebgp_pool_create(const parsebgp_opts_t *opts, int threads_cnt);
+
+/** Get the next decoded message from the pool
+ *
+ * @param pool          pointer to the decoder pool
+ * @param transport     pointer to the transport to read raw data from
+ * @param[in,out] msg   pointer to a (cleared) message, replaced with a
+ *                      pointer to the decoded message
+ * @param[out] err      set to the result of decoding the message
+ * @return BGPSTREAM_PARSEBGP_POOL_OK if a message was returned, or one of the
+ * other status codes otherwise. Once the end of the stream (or an error) has
+ * been reached, the same status is returned by all subsequent calls.
+ *
+ * The message given to the pool is swapped with a decoded message owned by the
+ * pool rather than copied, so the caller must always pass the message that the
+ * previous call returned (or a fresh message). If err is neither PARSEBGP_OK
+ * nor PARSEBGP_TRUNCATED_MSG, the message contents are undefined.
+ */
+bgpstream_parsebgp_pool_status_t
+bgpstream_parsebgp_pool_next(bgpstream_parsebgp_pool_t *pool,
+                             bgpstream_transport_t *transport,
+                             parsebgp_msg_t **msg, parsebgp_error_t *err);
+
+/** Stop the decoder threads and destroy the given pool
+ *
+ * @param pool          pointer to the decoder pool to destroy
+ */
+void bgpstream_parsebgp_pool_destroy(bgpstream_parsebgp_pool_t *pool);
+
+#endif /* __BGPSTREAM_PARSEBGP_POOL_H */
@@ -30,7 +30,9 @@
 #include "bgpstream_log.h"
 #include "bgpstream_parsebgp_common.h"
 #include "utils.h"
+#include <arpa/inet.h>
 #include <assert.h>
+#include <string.h>
 
 #define STATE ((state_t *)(format->state))
 
@@ -52,9 +54,15 @@ typedef struct rec_data {
   // state for UPDATE elem extraction
   bgpstream_parsebgp_upd_state_t upd_state;
 
+  // filters and elem options of the stream (set when elems are extracted)
+  bgpstream_filter_mgr_t *filter_mgr;
+
   // reusable parser message structure
   parsebgp_msg_t *msg;
 
+  // undecoded message (only used when decoding lazily)
+  bgpstream_parsebgp_raw_msg_t raw;
+
 } rec_data_t;
 
 typedef struct state {
@@ -68,8 +76,8 @@ static int handle_update(rec_data_t *rd, parsebgp_bgp_msg_t *bgp)
 {
   int rc;
 
-  if ((rc = bgpstream_parsebgp_process_update(&rd->upd_state, rd->elem, bgp)) <
-      0) {
+  if ((rc = bgpstream_parsebgp_process_update(&rd->upd_state, rd->elem, bgp,
+                                              rd->filter_mgr)) < 0) {
     return rc;
   }
   if (rc == 0) {
@@ -115,16 +123,16 @@ static int check_filters(bgpstream_record_t *record,
                          bgpstream_filter_mgr_t *filter_mgr)
 {
   // Collector
-  if (filter_mgr->collectors != NULL) {
-    if (bgpstream_str_set_exists(filter_mgr->collectors,
-                                 record->collector_name) == 0) {
+  if (filter_mgr->collector_ids != NULL) {
+    if (bgpstream_id_set_exists(filter_mgr->collector_ids,
+                                record->collector_id) == 0) {
       return 0;
     }
   }
 
   // Router
-  if (filter_mgr->routers != NULL) {
-    if (bgpstream_str_set_exists(filter_mgr->routers, record->router_name) ==
+  if (filter_mgr->router_ids != NULL) {
+    if (bgpstream_id_set_exists(filter_mgr->router_ids, record->router_id) ==
         0) {
       return 0;
     }
@@ -165,8 +173,8 @@ static int populate_prep_cb(bgpstream_format_t *format, uint8_t *buf,
   size_t len = *lenp, nread = 0;
   int newln = 0;
   uint8_t ver_maj, ver_min, flags, u8;
-  uint16_t u16;
-  uint32_t u32;
+  uint16_t u16, hdr_len;
+  uint32_t u32, msg_len;
   int name_len = 0;
 
   // we want at least a few bytes to do header checks
@@ -216,10 +224,12 @@ static int populate_prep_cb(bgpstream_format_t *format, uint8_t *buf,
     return 0;
   }
 
-  // skip past the header length and the message length (since we'll parse the
-  // entire header anyway).
-  nread += 2 + 4;
-  buf += 2 + 4;
+  // grab the header length and the message length so that we can skip the
+  // entire message if the filters reject it
+  DESERIALIZE_VAL(hdr_len);
+  hdr_len = ntohs(hdr_len);
+  DESERIALIZE_VAL(msg_len);
+  msg_len = ntohl(msg_len);
 
   // read the flags
   DESERIALIZE_VAL(flags);
@@ -262,6 +272,11 @@ static int populate_prep_cb(bgpstream_format_t *format, uint8_t *buf,
   }
   memcpy(record->collector_name, buf, name_len);
   record->collector_name[name_len] = '\0';
+  // the name may contain a NUL, so intern only what users will see
+  record->collector_id = bgpstream_str_intern(record->collector_name);
+  if (record->collector_id == BGPSTREAM_STR_ID_INVALID) {
+    return -1;
+  }
   nread += u16;
   buf += u16;
 
@@ -299,6 +314,10 @@ static int populate_prep_cb(bgpstream_format_t *format, uint8_t *buf,
   }
   memcpy(record->router_name, buf, name_len);
   record->router_name[name_len] = '\0';
+  record->router_id = bgpstream_str_intern(record->router_name);
+  if (record->router_id == BGPSTREAM_STR_ID_INVALID) {
+    return -1;
+  }
   nread += u16;
   buf += u16;
 
@@ -306,6 +325,13 @@ static int populate_prep_cb(bgpstream_format_t *format, uint8_t *buf,
   nread += 4;
   buf += 4;
 
+  // now that we know where this message came from, we can check the
+  // collector/router filters before the BMP message is decoded
+  if (hdr_len >= nread && check_filters(record, format->filter_mgr) == 0) {
+    *lenp = (size_t)hdr_len + msg_len;
+    return 1;
+  }
+
   *lenp = nread;
   return 0;
 }
@@ -355,6 +381,79 @@ populate_filter_cb(bgpstream_format_t *format, bgpstream_record_t *record,
   }
 }
 
+// BMPv3 common header: version (1), message length (4), message type (1)
+#define BMP_HDR_LEN 6
+// the per-peer header that follows the common header
+#define BMP_PEER_HDR_LEN 42
+// offset of the BGP message type in a route monitoring message (after the
+// 16 byte marker and 2 byte length of the BGP header)
+#define BMP_ROUTE_MON_BGP_TYPE_OFFSET (BMP_HDR_LEN + BMP_PEER_HDR_LEN + 18)
+
+static bgpstream_parsebgp_check_filter_rc_t
+populate_scan_cb(bgpstream_format_t *format, bgpstream_record_t *record,
+                 const uint8_t *buf, size_t len, size_t *msg_len)
+{
+  uint32_t bmp_len;
+  uint8_t type;
+  uint32_t ts_sec = record->time_sec;
+
+  if (len < BMP_HDR_LEN) {
+    // need more data
+    return BGPSTREAM_PARSEBGP_SKIP;
+  }
+
+  // older versions of BMP have no length field, so we can't frame them
+  // without decoding
+  if (buf[0] != 3) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Lazy decoding is not supported for BMP version %d", buf[0]);
+    return BGPSTREAM_PARSEBGP_FILTER_ERROR;
+  }
+  memcpy(&bmp_len, buf + 1, sizeof(bmp_len));
+  *msg_len = ntohl(bmp_len);
+  type = buf[5];
+
+  // for now we only care about ROUTE_MON, PEER_DOWN, and PEER_UP messages
+  if (type != PARSEBGP_BMP_TYPE_ROUTE_MON &&
+      type != PARSEBGP_BMP_TYPE_PEER_DOWN &&
+      type != PARSEBGP_BMP_TYPE_PEER_UP) {
+    return BGPSTREAM_PARSEBGP_FILTER_OUT;
+  }
+
+  // and we are only interested in UPDATE messages
+  if (type == PARSEBGP_BMP_TYPE_ROUTE_MON) {
+    if (*msg_len <= BMP_ROUTE_MON_BGP_TYPE_OFFSET) {
+      // too short to be an UPDATE, the decoder would reject it anyway
+      return BGPSTREAM_PARSEBGP_FILTER_OUT;
+    }
+    if (len <= BMP_ROUTE_MON_BGP_TYPE_OFFSET) {
+      // need more data (the caller will refill since msg_len > len)
+      return BGPSTREAM_PARSEBGP_SKIP;
+    }
+    if (buf[BMP_ROUTE_MON_BGP_TYPE_OFFSET] != PARSEBGP_BGP_TYPE_UPDATE) {
+      return BGPSTREAM_PARSEBGP_FILTER_OUT;
+    }
+  }
+
+  // the rest is the same as populate_filter_cb
+
+  if (check_filters(record, format->filter_mgr) == 0) {
+    return BGPSTREAM_PARSEBGP_FILTER_OUT;
+  }
+
+  if (format->TIF != NULL &&
+      format->TIF->end_time != BGPSTREAM_FOREVER &&
+      ts_sec > format->TIF->end_time) {
+    return BGPSTREAM_PARSEBGP_EOS;
+  }
+
+  if (is_wanted_time(ts_sec, format->filter_mgr) != 0) {
+    return BGPSTREAM_PARSEBGP_KEEP;
+  } else {
+    return BGPSTREAM_PARSEBGP_FILTER_OUT;
+  }
+}
+
 /* ==================== PUBLIC API BELOW HERE ==================== */
 
 int bs_format_bmp_create(bgpstream_format_t *format, bgpstream_resource_t *res)
@@ -384,12 +483,21 @@ bgpstream_format_status_t
 bs_format_bmp_populate_record(bgpstream_format_t *format,
                               bgpstream_record_t *record)
 {
-  bgpstream_format_status_t rc = bgpstream_parsebgp_populate_record(
-    &STATE->decoder, RDATA->msg, format, record, populate_prep_cb,
-    populate_filter_cb);
+  bgpstream_format_status_t rc;
+
+  if (format->filter_mgr->lazy_decode != 0) {
+    rc = bgpstream_parsebgp_populate_record_deferred(
+      &STATE->decoder, &RDATA->raw, format, record, populate_prep_cb,
+      populate_scan_cb);
+  } else {
+    rc = bgpstream_parsebgp_populate_record(&STATE->decoder, &RDATA->msg,
+                                            format, record, populate_prep_cb,
+                                            populate_filter_cb);
+  }
 
   if (record->status != BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
     record->router_name[0] = '\0';
+    record->router_id = BGPSTREAM_STR_ID_EMPTY;
     record->router_ip.version = 0;
   }
 
@@ -409,6 +517,16 @@ int bs_format_bmp_get_next_elem(bgpstream_format_t *format,
     return 0;
   }
 
+  RDATA->filter_mgr = format->filter_mgr;
+
+  if (RDATA->raw.len > 0 &&
+      bgpstream_parsebgp_decode_deferred(&STATE->decoder, &RDATA->raw,
+                                         RDATA->msg) != 0) {
+    // the record is corrupted, but all we can do now is return no elems
+    RDATA->end_of_elems = 1;
+    return 0;
+  }
+
   bmp = RDATA->msg->types.bmp;
 
   // assume we'll find at least something juicy, so process the peer header and
@@ -475,6 +593,7 @@ void bs_format_bmp_clear_data(bgpstream_format_t *format, void *data)
   rd->peer_hdr_done = 0;
   bgpstream_parsebgp_upd_state_reset(&rd->upd_state);
   parsebgp_clear_msg(rd->msg);
+  bgpstream_parsebgp_raw_msg_clear(&rd->raw);
 }
 
 void bs_format_bmp_destroy_data(bgpstream_format_t *format, void *data)
@@ -487,6 +606,7 @@ void bs_format_bmp_destroy_data(bgpstream_format_t *format, void *data)
   rd->elem = NULL;
   parsebgp_destroy_msg(rd->msg);
   rd->msg = NULL;
+  bgpstream_parsebgp_raw_msg_destroy(&rd->raw);
   free(data);
 }
 
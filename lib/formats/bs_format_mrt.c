@@ -30,7 +30,10 @@
 #include "bgpstream_log.h"
 #include "bgpstream_parsebgp_common.h"
 #include "utils.h"
+#include <arpa/inet.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define STATE ((state_t *)(format->state))
 
@@ -65,9 +68,15 @@ typedef struct rec_data {
   // state for UPDATE elem extraction
   bgpstream_parsebgp_upd_state_t upd_state;
 
+  // filters and elem options of the stream (set when elems are extracted)
+  bgpstream_filter_mgr_t *filter_mgr;
+
   // reusable parser message structure
   parsebgp_msg_t *msg;
 
+  // undecoded message (only used when decoding lazily)
+  bgpstream_parsebgp_raw_msg_t raw;
+
 } rec_data_t;
 
 typedef struct state {
@@ -78,6 +87,9 @@ typedef struct state {
   // state to store the "peer index table" when reading TABLE_DUMP_V2 records
   khash_t(td2_peer) * peer_table;
 
+  // message used to decode peer index tables when decoding lazily
+  parsebgp_msg_t *peer_index_msg;
+
 } state_t;
 
 static int handle_table_dump(rec_data_t *rd, parsebgp_mrt_msg_t *mrt)
@@ -103,7 +115,8 @@ static int handle_table_dump(rec_data_t *rd, parsebgp_mrt_msg_t *mrt)
     return -1;
   }
 
-  if (bgpstream_parsebgp_process_path_attrs(el, td->path_attrs.attrs) != 0) {
+  if (bgpstream_parsebgp_process_path_attrs(
+        el, td->path_attrs.attrs, rd->filter_mgr->zero_copy_elems) != 0) {
     return -1;
   }
 
@@ -113,6 +126,8 @@ static int handle_table_dump(rec_data_t *rd, parsebgp_mrt_msg_t *mrt)
   return 1;
 }
 
+// returns 1 if the elem was populated, 0 if the entry was filtered out, -1 if
+// an error occurred
 static int handle_td2_rib_entry(rec_data_t *rd, khash_t(td2_peer) * peer_table,
                                 parsebgp_mrt_msg_t *mrt, parsebgp_bgp_afi_t afi,
                                 parsebgp_mrt_table_dump_v2_rib_entry_t *re)
@@ -136,18 +151,25 @@ static int handle_td2_rib_entry(rec_data_t *rd, khash_t(td2_peer) * peer_table,
 
   rd->elem->peer_asn = bs_pie->peer_asn;
 
+  // skip entries from unwanted peers before decoding their attributes
+  if (bgpstream_filter_mgr_check_mask(rd->filter_mgr,
+                                      BGPSTREAM_FILTER_PRED_PEER_MASK,
+                                      rd->elem) == 0) {
+    return 0;
+  }
+
   if (bgpstream_parsebgp_process_next_hop(
         rd->elem, re->path_attrs.attrs, afi == PARSEBGP_BGP_AFI_IPV6 ? 1 : 0) !=
       0) {
     return -1;
   }
 
-  if (bgpstream_parsebgp_process_path_attrs(rd->elem, re->path_attrs.attrs) !=
-      0) {
+  if (bgpstream_parsebgp_process_path_attrs(
+        rd->elem, re->path_attrs.attrs, rd->filter_mgr->zero_copy_elems) != 0) {
     return -1;
   }
 
-  return 0;
+  return 1;
 }
 
 static int
@@ -155,6 +177,8 @@ handle_td2_afi_safi_rib(rec_data_t *rd, khash_t(td2_peer) * peer_table,
                         parsebgp_mrt_msg_t *mrt, parsebgp_bgp_afi_t afi,
                         parsebgp_mrt_table_dump_v2_afi_safi_rib_t *asr)
 {
+  int rc = 0;
+
   // if this is the first time we've been called, prep the elem
   if (rd->next_re == 0) {
     rd->elem->type = BGPSTREAM_ELEM_TYPE_RIB;
@@ -168,21 +192,36 @@ handle_td2_afi_safi_rib(rec_data_t *rd, khash_t(td2_peer) * peer_table,
                     "Missing Peer Index Table, skipping RIB entry");
       return -1;
     }
+
+    // the elem type, IP version and prefix are the same for all entries, so
+    // the whole record can be skipped if they don't match the filters
+    if (bgpstream_filter_mgr_check_mask(
+          rd->filter_mgr,
+          BGPSTREAM_FILTER_PRED_BIT(BGPSTREAM_FILTER_PRED_ELEMTYPE) |
+            BGPSTREAM_FILTER_PRED_BIT(BGPSTREAM_FILTER_PRED_IPVERSION) |
+            BGPSTREAM_FILTER_PRED_BIT(BGPSTREAM_FILTER_PRED_PREFIX),
+          rd->elem) == 0) {
+      rd->end_of_elems = 1;
+      return 0;
+    }
   }
 
-  // since this is a generator, we just process one rib entry each time
-  if (handle_td2_rib_entry(rd, peer_table, mrt, afi,
-                           &asr->entries[rd->next_re]) != 0) {
-    return -1;
+  // since this is a generator, we just process one (wanted) rib entry each
+  // time
+  while (rc == 0 && rd->next_re < asr->entry_count) {
+    if ((rc = handle_td2_rib_entry(rd, peer_table, mrt, afi,
+                                   &asr->entries[rd->next_re])) < 0) {
+      return -1;
+    }
+    // move on to the next rib entry
+    rd->next_re++;
   }
 
-  // move on to the next rib entry
-  rd->next_re++;
-  if (rd->next_re == asr->entry_count) {
+  if (rd->next_re >= asr->entry_count) {
     rd->end_of_elems = 1;
   }
 
-  return 1;
+  return rc;
 }
 
 static int handle_table_dump_v2(rec_data_t *rd, khash_t(td2_peer) * peer_table,
@@ -252,8 +291,8 @@ static int handle_bgp4mp(rec_data_t *rd, parsebgp_mrt_msg_t *mrt)
   case PARSEBGP_MRT_BGP4MP_MESSAGE_AS4:
   case PARSEBGP_MRT_BGP4MP_MESSAGE_LOCAL:
   case PARSEBGP_MRT_BGP4MP_MESSAGE_AS4_LOCAL:
-    rc = bgpstream_parsebgp_process_update(&rd->upd_state, rd->elem,
-                                           bgp4mp->data.bgp_msg);
+    rc = bgpstream_parsebgp_process_update(
+      &rd->upd_state, rd->elem, bgp4mp->data.bgp_msg, rd->filter_mgr);
     if (rc == 0) {
       rd->end_of_elems = 1;
     }
@@ -292,6 +331,13 @@ static int handle_td2_peer_index(bgpstream_format_t *format,
   peer_index_entry_t *bs_pie;
   parsebgp_mrt_table_dump_v2_peer_entry_t *pie;
 
+  // a file may contain several peer index tables (e.g., one per dump), in
+  // which case each one replaces the previous one
+  if (STATE->peer_table != NULL) {
+    kh_destroy(td2_peer, STATE->peer_table);
+    STATE->peer_table = NULL;
+  }
+
   // alloc the table hash
   if ((STATE->peer_table = kh_init(td2_peer)) == NULL) {
     return -1;
@@ -342,6 +388,7 @@ populate_filter_cb(bgpstream_format_t *format, bgpstream_record_t *record,
 
   // ensure the router fields are unset
   record->router_name[0] = '\0';
+  record->router_id = BGPSTREAM_STR_ID_EMPTY;
   record->router_ip.version = 0;
 
   // check the filters
@@ -362,12 +409,100 @@ populate_filter_cb(bgpstream_format_t *format, bgpstream_record_t *record,
   }
 }
 
+#define MRT_HDR_LEN 12
+
+static bgpstream_parsebgp_check_filter_rc_t
+populate_scan_cb(bgpstream_format_t *format, bgpstream_record_t *record,
+                 const uint8_t *buf, size_t len, size_t *msg_len)
+{
+  uint32_t ts_sec, mrt_len;
+  uint16_t type, subtype;
+  size_t dec_len;
+  parsebgp_error_t err;
+
+  if (len < MRT_HDR_LEN) {
+    // need more data
+    return BGPSTREAM_PARSEBGP_SKIP;
+  }
+
+  memcpy(&ts_sec, buf, sizeof(ts_sec));
+  ts_sec = ntohl(ts_sec);
+  memcpy(&type, buf + 4, sizeof(type));
+  type = ntohs(type);
+  memcpy(&subtype, buf + 6, sizeof(subtype));
+  subtype = ntohs(subtype);
+  memcpy(&mrt_len, buf + 8, sizeof(mrt_len));
+  mrt_len = ntohl(mrt_len);
+  *msg_len = MRT_HDR_LEN + (size_t)mrt_len;
+
+  // the peer index table is needed to extract elems from the RIB records that
+  // follow it, so it is always decoded
+  if (type == PARSEBGP_MRT_TYPE_TABLE_DUMP_V2 &&
+      subtype == PARSEBGP_MRT_TABLE_DUMP_V2_PEER_INDEX_TABLE) {
+    if (*msg_len > len) {
+      // wait for the rest of the message
+      return BGPSTREAM_PARSEBGP_SKIP;
+    }
+    if (STATE->peer_index_msg == NULL &&
+        (STATE->peer_index_msg = parsebgp_create_msg()) == NULL) {
+      return BGPSTREAM_PARSEBGP_FILTER_ERROR;
+    }
+    dec_len = *msg_len;
+    err = parsebgp_decode(STATE->decoder.parser_opts, STATE->decoder.msg_type,
+                          STATE->peer_index_msg, buf, &dec_len);
+    if (err != PARSEBGP_OK) {
+      bgpstream_log(BGPSTREAM_LOG_ERR,
+                    "Failed to parse Peer Index Table (%d:%s)", err,
+                    parsebgp_strerror(err));
+      parsebgp_clear_msg(STATE->peer_index_msg);
+      return BGPSTREAM_PARSEBGP_FILTER_ERROR;
+    }
+    if (populate_filter_cb(format, record, STATE->peer_index_msg) !=
+        BGPSTREAM_PARSEBGP_SKIP) {
+      parsebgp_clear_msg(STATE->peer_index_msg);
+      return BGPSTREAM_PARSEBGP_FILTER_ERROR;
+    }
+    parsebgp_clear_msg(STATE->peer_index_msg);
+    return BGPSTREAM_PARSEBGP_SKIP;
+  }
+
+  // set record timestamps (the microseconds are the first field of the
+  // extended timestamp message body)
+  record->time_sec = ts_sec;
+  record->time_usec = 0;
+  if (type == PARSEBGP_MRT_TYPE_BGP4MP_ET && len >= MRT_HDR_LEN + 4) {
+    memcpy(&record->time_usec, buf + MRT_HDR_LEN, sizeof(uint32_t));
+    record->time_usec = ntohl(record->time_usec);
+  }
+
+  // ensure the router fields are unset
+  record->router_name[0] = '\0';
+  record->router_id = BGPSTREAM_STR_ID_EMPTY;
+  record->router_ip.version = 0;
+
+  // check the filters (as in populate_filter_cb)
+  if (format->TIF != NULL &&
+      format->TIF->end_time != BGPSTREAM_FOREVER &&
+      ts_sec > format->TIF->end_time) {
+    return BGPSTREAM_PARSEBGP_EOS;
+  }
+
+  if (is_wanted_time(ts_sec, format->filter_mgr) != 0) {
+    return BGPSTREAM_PARSEBGP_KEEP;
+  } else {
+    return BGPSTREAM_PARSEBGP_FILTER_OUT;
+  }
+}
+
 /* ==================== PUBLIC API BELOW HERE ==================== */
 
 int bs_format_mrt_create(bgpstream_format_t *format, bgpstream_resource_t *res)
 {
   BS_FORMAT_SET_METHODS(mrt, format);
   parsebgp_opts_t *opts = NULL;
+  const char *threads;
+  char *endp;
+  long threads_cnt;
 
   if ((format->state = malloc_zero(sizeof(state_t))) == NULL) {
     return -1;
@@ -379,6 +514,29 @@ int bs_format_mrt_create(bgpstream_format_t *format, bgpstream_resource_t *res)
   parsebgp_opts_init(opts);
   bgpstream_parsebgp_opts_init(opts);
 
+  // TABLE_DUMP_V2 RIB records are independent of each other (the peer index
+  // table is only needed for elem extraction, which happens in order), so
+  // large RIB dumps can be decoded in parallel
+  // (pointless if the payloads are only decoded on demand)
+  if (res->record_type == BGPSTREAM_RIB &&
+      format->filter_mgr->lazy_decode == 0 &&
+      (threads = bgpstream_resource_get_attr(
+         res, BGPSTREAM_RESOURCE_ATTR_DECODE_THREADS)) != NULL) {
+    threads_cnt = strtol(threads, &endp, 10);
+    if (*endp != '\0' || threads_cnt < 0 ||
+        threads_cnt > BGPSTREAM_PARSEBGP_POOL_MAX_THREADS) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Invalid number of decode threads: %s",
+                    threads);
+      return -1;
+    }
+    if (threads_cnt > 0 &&
+        (STATE->decoder.pool =
+           bgpstream_parsebgp_pool_create(opts, threads_cnt)) == NULL) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not create decoder pool");
+      return -1;
+    }
+  }
+
   return 0;
 }
 
@@ -386,8 +544,13 @@ bgpstream_format_status_t
 bs_format_mrt_populate_record(bgpstream_format_t *format,
                               bgpstream_record_t *record)
 {
-  return bgpstream_parsebgp_populate_record(&STATE->decoder, RDATA->msg, format,
-                                            record, NULL, populate_filter_cb);
+  if (format->filter_mgr->lazy_decode != 0) {
+    return bgpstream_parsebgp_populate_record_deferred(
+      &STATE->decoder, &RDATA->raw, format, record, NULL, populate_scan_cb);
+  }
+  return bgpstream_parsebgp_populate_record(&STATE->decoder, &RDATA->msg,
+                                            format, record, NULL,
+                                            populate_filter_cb);
 }
 
 int bs_format_mrt_get_next_elem(bgpstream_format_t *format,
@@ -404,6 +567,16 @@ int bs_format_mrt_get_next_elem(bgpstream_format_t *format,
     return 0;
   }
 
+  RDATA->filter_mgr = format->filter_mgr;
+
+  if (RDATA->raw.len > 0 &&
+      bgpstream_parsebgp_decode_deferred(&STATE->decoder, &RDATA->raw,
+                                         RDATA->msg) != 0) {
+    // the record is corrupted, but all we can do now is return no elems
+    RDATA->end_of_elems = 1;
+    return 0;
+  }
+
   mrt = RDATA->msg->types.mrt;
   switch (mrt->type) {
   case PARSEBGP_MRT_TYPE_TABLE_DUMP:
@@ -466,6 +639,7 @@ void bs_format_mrt_clear_data(bgpstream_format_t *format, void *data)
   rd->next_re = 0;
   bgpstream_parsebgp_upd_state_reset(&rd->upd_state);
   parsebgp_clear_msg(rd->msg);
+  bgpstream_parsebgp_raw_msg_clear(&rd->raw);
 }
 
 void bs_format_mrt_destroy_data(bgpstream_format_t *format, void *data)
@@ -478,16 +652,25 @@ void bs_format_mrt_destroy_data(bgpstream_format_t *format, void *data)
   rd->elem = NULL;
   parsebgp_destroy_msg(rd->msg);
   rd->msg = NULL;
+  bgpstream_parsebgp_raw_msg_destroy(&rd->raw);
   free(data);
 }
 
 void bs_format_mrt_destroy(bgpstream_format_t *format)
 {
+  bgpstream_parsebgp_pool_destroy(STATE->decoder.pool);
+  STATE->decoder.pool = NULL;
+
   if (STATE->peer_table != NULL) {
     kh_destroy(td2_peer, STATE->peer_table);
     STATE->peer_table = NULL;
   }
 
+  if (STATE->peer_index_msg != NULL) {
+    parsebgp_destroy_msg(STATE->peer_index_msg);
+    STATE->peer_index_msg = NULL;
+  }
+
   free(format->state);
   format->state = NULL;
 }
@@ -78,6 +78,9 @@ typedef struct rec_data {
   // state for UPDATE elem extraction
   bgpstream_parsebgp_upd_state_t upd_state;
 
+  // filters and elem options of the stream (set when elems are extracted)
+  bgpstream_filter_mgr_t *filter_mgr;
+
   // reusable parser message structure
   parsebgp_msg_t *msg;
 
@@ -96,7 +99,8 @@ typedef struct state {
   // options
   parsebgp_opts_t opts;
 
-  // json bgp message string buffer
+  // json bgp message string (borrowed from the transport's line buffer, so
+  // only valid until the next readline)
   char *json_string_buffer;
 
   // json bgp message string buffer length
@@ -113,8 +117,6 @@ typedef struct state {
 
 } state_t;
 
-#define JSON_BUFLEN 1024*1024 // 1 MB buffer
-
 /* ======================================================== */
 /* ======================================================== */
 /* ==================== JSON UTILITIES ==================== */
@@ -203,6 +205,11 @@ static int process_common_fields(bgpstream_format_t *format,
   // populate collector name
   memcpy(record->collector_name, FIELDPTR(host), FIELDLEN(host));
   record->collector_name[FIELDLEN(host)] = '\0';
+  record->collector_id =
+    bgpstream_str_intern_len(record->collector_name, FIELDLEN(host));
+  if (record->collector_id == BGPSTREAM_STR_ID_INVALID) {
+    return -1;
+  }
 
   // populate peer asn
   STRTOUL(peer_asn, RDATA->elem->peer_asn);
@@ -300,6 +307,7 @@ process_unsupported_message(bgpstream_format_t *format,
 {
   record->status = BGPSTREAM_RECORD_STATUS_UNSUPPORTED_RECORD;
   record->collector_name[0] = '\0';
+  record->collector_id = BGPSTREAM_STR_ID_EMPTY;
   return BGPSTREAM_FORMAT_UNSUPPORTED_MSG;
 }
 
@@ -311,6 +319,7 @@ process_corrupted_message(bgpstream_format_t *format,
                 STATE->json_string_buffer);
   record->status = BGPSTREAM_RECORD_STATUS_CORRUPTED_RECORD;
   record->collector_name[0] = '\0';
+  record->collector_id = BGPSTREAM_STR_ID_EMPTY;
   return BGPSTREAM_FORMAT_CORRUPTED_MSG;
 }
 
@@ -522,17 +531,17 @@ static bgpstream_parsebgp_check_filter_rc_t
 check_filters(bgpstream_record_t *record, bgpstream_filter_mgr_t *filter_mgr)
 {
   // Collector
-  if (filter_mgr->collectors != NULL) {
-    if (bgpstream_str_set_exists(filter_mgr->collectors,
-                                 record->collector_name) == 0) {
+  if (filter_mgr->collector_ids != NULL) {
+    if (bgpstream_id_set_exists(filter_mgr->collector_ids,
+                                record->collector_id) == 0) {
       return BGPSTREAM_PARSEBGP_FILTER_OUT;
     }
   }
 
   // Project
-  if (filter_mgr->projects != NULL) {
-    if (bgpstream_str_set_exists(filter_mgr->projects,
-                                 record->project_name) == 0) {
+  if (filter_mgr->project_ids != NULL) {
+    if (bgpstream_id_set_exists(filter_mgr->project_ids,
+                                record->project_id) == 0) {
       return BGPSTREAM_PARSEBGP_FILTER_OUT;
     }
   }
@@ -562,10 +571,6 @@ int bs_format_rislive_create(bgpstream_format_t *format,
     return -1;
   }
 
-  if ((STATE->json_string_buffer = malloc(JSON_BUFLEN)) == NULL) {
-    return -1;
-  }
-
   parsebgp_opts_init(&STATE->opts);
   bgpstream_parsebgp_opts_init(&STATE->opts);
   STATE->opts.bgp.marker_omitted = 0;
@@ -580,17 +585,18 @@ bs_format_rislive_populate_record(bgpstream_format_t *format,
 {
   int rc;
   int filter;
+  uint8_t *line;
 
 retry:
-  STATE->json_string_buffer_len = bgpstream_transport_readline(
-    format->transport, STATE->json_string_buffer, BGPSTREAM_PARSEBGP_BUFLEN);
-
-  assert(STATE->json_string_buffer_len < BGPSTREAM_PARSEBGP_BUFLEN);
+  STATE->json_string_buffer_len =
+    bgpstream_transport_readline_zc(format->transport, &line);
+  STATE->json_string_buffer = (char *)line;
 
   if (STATE->json_string_buffer_len < 0) {
     // corrupted record
     record->status = BGPSTREAM_RECORD_STATUS_CORRUPTED_RECORD;
     record->collector_name[0] = '\0';
+    record->collector_id = BGPSTREAM_STR_ID_EMPTY;
     return BGPSTREAM_FORMAT_CORRUPTED_DUMP;
   } else if (STATE->json_string_buffer_len == 0) {
     // end of dump
@@ -627,10 +633,13 @@ int bs_format_rislive_get_next_elem(bgpstream_format_t *format,
     return 0;
   }
 
+  RDATA->filter_mgr = format->filter_mgr;
+
   switch (RDATA->msg_type) {
   case RISLIVE_MSG_TYPE_UPDATE:
     rc = bgpstream_parsebgp_process_update(&RDATA->upd_state, RDATA->elem,
-                                           RDATA->msg->types.bgp);
+                                           RDATA->msg->types.bgp,
+                                           RDATA->filter_mgr);
     if (rc <= 0) {
       return rc;
     }
@@ -701,7 +710,6 @@ void bs_format_rislive_destroy_data(bgpstream_format_t *format, void *data)
 
 void bs_format_rislive_destroy(bgpstream_format_t *format)
 {
-  free(STATE->json_string_buffer);
   free(format->state);
   format->state = NULL;
 }
@@ -272,9 +272,13 @@ int bs_transport_cache_create(bgpstream_transport_t *transport)
 int64_t bs_transport_cache_readline(bgpstream_transport_t *transport,
                                     uint8_t *buffer, int64_t len)
 {
+  return bgpstream_transport_buffered_readline(transport, buffer, len);
+}
 
-  return wandio_generic_fgets(transport, buffer, len, 1,
-                              (read_cb_t *)bs_transport_cache_read);
+int64_t bs_transport_cache_readline_zc(bgpstream_transport_t *transport,
+                                       uint8_t **line)
+{
+  return bgpstream_transport_buffered_readline_zc(transport, line);
 }
 
 static void close_cache_writer(bgpstream_transport_t *transport, int valid)
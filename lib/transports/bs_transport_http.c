@@ -64,7 +64,13 @@ int64_t bs_transport_http_read(bgpstream_transport_t *transport,
 int64_t bs_transport_http_readline(bgpstream_transport_t *transport,
                                    uint8_t *buffer, int64_t len)
 {
-  return wandio_fgets((io_t *)transport->state, buffer, len, 1);
+  return bgpstream_transport_buffered_readline(transport, buffer, len);
+}
+
+int64_t bs_transport_http_readline_zc(bgpstream_transport_t *transport,
+                                      uint8_t **line)
+{
+  return bgpstream_transport_buffered_readline_zc(transport, line);
 }
 
 void bs_transport_http_destroy(bgpstream_transport_t *transport)
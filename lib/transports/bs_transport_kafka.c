@@ -38,6 +38,8 @@
 
 #define POLL_TIMEOUT_MSEC 500
 
+#define LINE_BUFLEN (1024 * 1024)
+
 typedef struct state {
 
   // convenience local copies of attrs
@@ -57,6 +59,9 @@ typedef struct state {
   // has a fatal error occured?
   int fatal_error;
 
+  // buffer for lines handed out by readline_zc
+  uint8_t *line_buf;
+
 } state_t;
 
 static int parse_attrs(bgpstream_transport_t *transport)
@@ -350,6 +355,19 @@ int64_t bs_transport_kafka_readline(bgpstream_transport_t *transport,
   return rc;
 }
 
+int64_t bs_transport_kafka_readline_zc(bgpstream_transport_t *transport,
+                                       uint8_t **line)
+{
+  // kafka messages are already framed, so there is nothing to split, but we
+  // still need somewhere to copy the message to
+  if (STATE->line_buf == NULL &&
+      (STATE->line_buf = malloc(LINE_BUFLEN)) == NULL) {
+    return -1;
+  }
+  *line = STATE->line_buf;
+  return bs_transport_kafka_readline(transport, STATE->line_buf, LINE_BUFLEN);
+}
+
 int64_t bs_transport_kafka_read(bgpstream_transport_t *transport,
                                 uint8_t *buffer, int64_t len)
 {
@@ -406,6 +424,7 @@ void bs_transport_kafka_destroy(bgpstream_transport_t *transport)
   free(STATE->topic);
   free(STATE->group);
   free(STATE->offset);
+  free(STATE->line_buf);
 
   free(transport->state);
   transport->state = NULL;
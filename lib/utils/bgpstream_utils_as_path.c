@@ -398,6 +398,10 @@ int bgpstream_as_path_populate_from_data_zc(bgpstream_as_path_t *path,
 
   bgpstream_as_path_clear(path);
 
+  if (path->data_alloc_len != UINT16_MAX) {
+    free(path->data);
+  }
+
   /* signal that this is external data */
   path->data_alloc_len = UINT16_MAX;
   path->data = data;
@@ -27,10 +27,14 @@
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#include "khash.h"
 #include "utils.h"
 
 #include "bgpstream_utils_as_path_int.h"
@@ -38,6 +42,59 @@
 
 #include "bgpstream_utils_as_path_store.h"
 
+/* Store paths are allocated in fixed-size chunks so that pointers to them
+ * remain valid as the store grows */
+#define SPATH_CHUNK_BITS 12
+#define SPATH_CHUNK_SIZE (1 << SPATH_CHUNK_BITS)
+#define SPATH_CHUNK_MASK (SPATH_CHUNK_SIZE - 1)
+
+/* Path data is copied into arena blocks of this size (which is large enough
+ * for any path, since path lengths are 16 bit) */
+#define ARENA_BLOCK_SIZE (1 << 16)
+
+/* Initial number of buckets in the path index */
+#define INDEX_INIT_SIZE 1024
+
+/* Value of an empty bucket in the path index (buckets hold idx + 1) */
+#define INDEX_EMPTY 0
+
+/* ID used to represent a NULL path */
+#define NULL_PATH_ID UINT32_MAX
+
+/* Snapshot file identification. The version must be bumped whenever the
+ * layout or the path hash function changes */
+#define SNAPSHOT_MAGIC "BSAPSTOR"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+/* Snapshot file header. A snapshot is laid out as:
+ *   - header
+ *   - paths_cnt path records (snapshot_path_t), in path ID order
+ *   - index_size index buckets (uint32_t)
+ *   - data_len bytes of path data
+ * All values are in host byte order, and every section is suitably aligned,
+ * so that the file can be used in place once mapped. */
+typedef struct snapshot_hdr {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t paths_cnt;
+  uint32_t index_size;
+  uint64_t data_len;
+} snapshot_hdr_t;
+
+/* Snapshot path record */
+typedef struct snapshot_path {
+  /* offset of the path data within the data section */
+  uint64_t data_offset;
+  uint32_t hash;
+  uint16_t data_len;
+  uint16_t seg_cnt;
+  uint16_t origin_offset;
+  uint8_t is_core;
+  uint8_t pad[5];
+} snapshot_path_t;
+
 /* wrapper around an AS path */
 struct bgpstream_as_path_store_path {
 
@@ -47,124 +104,243 @@ struct bgpstream_as_path_store_path {
   /** Internal index of this path within the store */
   uint32_t idx;
 
-  /** Underlying AS Path structure */
+  /** Hash of the full path (including is_core) */
+  uint32_t hash;
+
+  /** Underlying AS Path structure (data points into the store arena) */
   bgpstream_as_path_t path;
 };
 
-/** A per-origin set of AS Paths */
-typedef struct pathset {
+struct bgpstream_as_path_store {
 
-  /** Array of AS Paths in the set */
-  bgpstream_as_path_store_path_t *paths;
+  /** Chunks of store paths, indexed by path ID */
+  bgpstream_as_path_store_path_t **spaths;
 
-  /** Number of AS paths in the set */
-  uint16_t paths_cnt;
+  /** Number of allocated chunks */
+  int spaths_chunks_cnt;
 
-} __attribute__((packed)) pathset_t;
+  /** The total number of paths in the store */
+  uint32_t paths_cnt;
 
-KHASH_INIT(pathset, uint32_t, pathset_t, 1, kh_int_hash_func,
-           kh_int_hash_equal)
+  /** Open-addressing (linear probing) index of paths by hash. Each bucket
+   * holds the path ID + 1, or INDEX_EMPTY */
+  uint32_t *index;
 
-struct bgpstream_as_path_store {
+  /** Number of buckets in the index (always a power of 2) */
+  uint32_t index_size;
 
-  khash_t(pathset) * path_set;
+  /** Arena blocks that hold the path data */
+  uint8_t **arena;
 
-  /** The total number of paths in the store */
-  uint32_t paths_cnt;
+  /** Number of arena blocks */
+  int arena_cnt;
+
+  /** Number of bytes used in the last arena block */
+  uint32_t arena_used;
 
-  /** The currently iterated pathset */
-  khiter_t cur_pathset;
+  /** Snapshot mapping that the store was loaded from (or NULL) */
+  void *map;
 
-  /** The current path within the current pathset */
-  int cur_path;
+  /** Length of the snapshot mapping */
+  size_t map_len;
+
+  /** Is the index part of the (read-only) snapshot mapping? */
+  int index_mapped;
+
+  /** The current path of the iterator */
+  uint32_t cur_path;
 };
 
-static void store_path_destroy(bgpstream_as_path_store_path_t *spath)
+#define SPATH(store, id)                                                       \
+  (&(store)->spaths[(id) >> SPATH_CHUNK_BITS][(id)&SPATH_CHUNK_MASK])
+
+/* Hash the full path. bgpstream_as_path_hash only considers the first and the
+ * origin segments, so mix in the rest of the path too */
+static uint32_t store_path_hash(bgpstream_as_path_store_path_t *spath)
 {
-  if (spath == NULL) {
-    return;
+  uint32_t h = bgpstream_as_path_hash(&spath->path) ^ spath->is_core;
+  uint16_t i;
+
+  /* FNV-1a */
+  h ^= 2166136261U;
+  for (i = 0; i < spath->path.data_len; i++) {
+    h = (h ^ spath->path.data[i]) * 16777619U;
+  }
+  return h;
+}
+
+static inline int store_path_equal(bgpstream_as_path_store_path_t *sp1,
+                                   bgpstream_as_path_store_path_t *sp2)
+{
+  return (sp1->hash == sp2->hash) && (sp1->is_core == sp2->is_core) &&
+         bgpstream_as_path_equal(&sp1->path, &sp2->path);
+}
+
+/* Copy len bytes of path data into the arena */
+static uint8_t *arena_dup(bgpstream_as_path_store_t *store, uint8_t *data,
+                          uint16_t len)
+{
+  uint8_t **arena;
+  uint8_t *dst;
+
+  if (store->arena_cnt == 0 || store->arena_used + len > ARENA_BLOCK_SIZE) {
+    if ((arena = realloc(store->arena,
+                         sizeof(uint8_t *) * (store->arena_cnt + 1))) == NULL) {
+      return NULL;
+    }
+    store->arena = arena;
+    if ((store->arena[store->arena_cnt] = malloc(ARENA_BLOCK_SIZE)) == NULL) {
+      return NULL;
+    }
+    store->arena_cnt++;
+    store->arena_used = 0;
   }
 
-  /* destroy the path's data */
-  assert(spath->path.data_alloc_len != UINT16_MAX);
-  free(spath->path.data);
-  spath->path.data = NULL;
-  spath->path.data_alloc_len = 0;
+  dst = store->arena[store->arena_cnt - 1] + store->arena_used;
+  memcpy(dst, data, len);
+  store->arena_used += len;
+  return dst;
 }
 
-static int store_path_dup(bgpstream_as_path_store_path_t *dst,
-                   bgpstream_as_path_store_path_t *src)
+/* Double the size of the index and rehash all the paths */
+static int index_grow(bgpstream_as_path_store_t *store)
 {
-  *dst = *src;
+  uint32_t new_size = (store->index_size == 0) ? INDEX_INIT_SIZE
+                                               : store->index_size * 2;
+  uint32_t mask = new_size - 1;
+  uint32_t *index;
+  uint32_t id, b;
+
+  if (new_size <= store->index_size) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "AS path store index is full");
+    return -1;
+  }
+  if ((index = malloc_zero(sizeof(uint32_t) * new_size)) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not grow AS path store index");
+    return -1;
+  }
 
-  /* copy the path data */
-  dst->path.data_alloc_len = 0;
-  if ((dst->path.data = malloc(src->path.data_len)) == NULL) {
-    goto err;
+  for (id = 0; id < store->paths_cnt; id++) {
+    b = SPATH(store, id)->hash & mask;
+    while (index[b] != INDEX_EMPTY) {
+      b = (b + 1) & mask;
+    }
+    index[b] = id + 1;
   }
-  dst->path.data_alloc_len = src->path.data_len;
-  dst->path.data_len = src->path.data_len;
-  memcpy(dst->path.data, src->path.data, src->path.data_len);
 
+  if (!store->index_mapped) {
+    free(store->index);
+  }
+  store->index = index;
+  store->index_size = new_size;
+  store->index_mapped = 0;
   return 0;
-
-err:
-  store_path_destroy(dst);
-  return -1;
 }
 
-static inline int store_path_equal(bgpstream_as_path_store_path_t *sp1,
-                                   bgpstream_as_path_store_path_t *sp2)
+/* Make a private copy of an index that is still part of a snapshot mapping,
+ * so that it can be updated */
+static int index_unmap(bgpstream_as_path_store_t *store)
 {
-  return (sp1->is_core == sp2->is_core) &&
-         bgpstream_as_path_equal(&sp1->path, &sp2->path);
+  uint32_t *index;
+
+  if (!store->index_mapped) {
+    return 0;
+  }
+  if ((index = malloc(sizeof(uint32_t) * store->index_size)) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not copy AS path store index");
+    return -1;
+  }
+  memcpy(index, store->index, sizeof(uint32_t) * store->index_size);
+  store->index = index;
+  store->index_mapped = 0;
+  return 0;
 }
 
-static void pathset_destroy(pathset_t ps)
+/* Append a copy of the given path to the store */
+static int store_path_add(bgpstream_as_path_store_t *store,
+                          bgpstream_as_path_store_path_t *findme, uint32_t b)
 {
-  int i;
+  bgpstream_as_path_store_path_t **spaths;
+  bgpstream_as_path_store_path_t *spath;
+  uint32_t id = store->paths_cnt;
+  uint8_t *data;
+
+  if (id == NULL_PATH_ID) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "AS path store is full");
+    return -1;
+  }
+
+  if (index_unmap(store) != 0) {
+    return -1;
+  }
+
+  if ((id >> SPATH_CHUNK_BITS) == store->spaths_chunks_cnt) {
+    if ((spaths = realloc(store->spaths,
+                          sizeof(bgpstream_as_path_store_path_t *) *
+                            (store->spaths_chunks_cnt + 1))) == NULL) {
+      return -1;
+    }
+    store->spaths = spaths;
+    if ((store->spaths[store->spaths_chunks_cnt] = malloc(
+           sizeof(bgpstream_as_path_store_path_t) * SPATH_CHUNK_SIZE)) ==
+        NULL) {
+      return -1;
+    }
+    store->spaths_chunks_cnt++;
+  }
 
-  /* destroy each store path */
-  for (i = 0; i < ps.paths_cnt; i++) {
-    store_path_destroy(&ps.paths[i]);
+  if ((data = arena_dup(store, findme->path.data, findme->path.data_len)) ==
+        NULL &&
+      findme->path.data_len > 0) {
+    return -1;
   }
 
-  /* destroy the array of paths */
-  free(ps.paths);
-  ps.paths = NULL;
-  ps.paths_cnt = 0;
+  spath = SPATH(store, id);
+  *spath = *findme;
+  spath->idx = id;
+  spath->path.data = data;
+  /* the data is owned by the arena */
+  spath->path.data_alloc_len = UINT16_MAX;
+
+  store->index[b] = id + 1;
+  store->paths_cnt++;
+  return 0;
 }
 
-static uint16_t pathset_get_path_id(bgpstream_as_path_store_t *store,
-                                    pathset_t *ps,
-                                    bgpstream_as_path_store_path_t *findme)
+static int get_path_id(bgpstream_as_path_store_t *store,
+                       bgpstream_as_path_store_path_t *findme,
+                       bgpstream_as_path_store_path_id_t *id)
 {
-  int i;
-  uint32_t path_id;
+  uint32_t mask, b;
 
-  /* check if it is already in the set */
-  for (i = 0; i < ps->paths_cnt; i++) {
-    if (store_path_equal(&ps->paths[i], findme) != 0) {
-      return i;
-    }
+  /* keep the load factor under 70% */
+  if ((uint64_t)(store->paths_cnt + 1) * 10 > (uint64_t)store->index_size * 7 &&
+      index_grow(store) != 0) {
+    goto err;
   }
 
-  findme->idx = store->paths_cnt++;
+  findme->hash = store_path_hash(findme);
+  mask = store->index_size - 1;
 
-  /* need to append this path */
-  if ((ps->paths = realloc(ps->paths, sizeof(bgpstream_as_path_store_path_t) *
-                                        (ps->paths_cnt + 1))) == NULL) {
-    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not realloc paths");
-    return UINT16_MAX;
+  for (b = findme->hash & mask; store->index[b] != INDEX_EMPTY;
+       b = (b + 1) & mask) {
+    if (store_path_equal(SPATH(store, store->index[b] - 1), findme) != 0) {
+      id->path_id = store->index[b] - 1;
+      return 0;
+    }
   }
-  if (store_path_dup(&ps->paths[ps->paths_cnt], findme) != 0) {
-    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not create store path");
-    return UINT16_MAX;
+
+  /* b is the empty bucket at the end of the probe sequence */
+  id->path_id = store->paths_cnt;
+  if (store_path_add(store, findme, b) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not add path to the store");
+    goto err;
   }
-  path_id = ps->paths_cnt++;
-  assert(ps->paths_cnt <= UINT16_MAX);
 
-  return path_id;
+  return 0;
+
+err:
+  return -1;
 }
 
 /* ==================== PUBLIC FUNCTIONS ==================== */
@@ -177,11 +353,10 @@ bgpstream_as_path_store_t *bgpstream_as_path_store_create()
     return NULL;
   }
 
-  if ((store->path_set = kh_init(pathset)) == NULL) {
+  /* the index grows as paths are added */
+  if (index_grow(store) != 0) {
     goto err;
   }
-  /* pre-allocate to minimize resize events */
-  kh_resize(pathset, store->path_set, 1 << 24); /* 2^24 = 16.8M buckets */
 
   return store;
 
@@ -192,55 +367,311 @@ err:
 
 void bgpstream_as_path_store_destroy(bgpstream_as_path_store_t *store)
 {
+  int i;
+
   if (store == NULL) {
     return;
   }
 
-  if (store->path_set != NULL) {
-    kh_free_vals(pathset, store->path_set, pathset_destroy);
-    kh_destroy(pathset, store->path_set);
-    store->path_set = NULL;
+  for (i = 0; i < store->spaths_chunks_cnt; i++) {
+    free(store->spaths[i]);
+  }
+  free(store->spaths);
+  store->spaths = NULL;
+
+  for (i = 0; i < store->arena_cnt; i++) {
+    free(store->arena[i]);
+  }
+  free(store->arena);
+  store->arena = NULL;
+
+  if (!store->index_mapped) {
+    free(store->index);
+  }
+  store->index = NULL;
+
+  if (store->map != NULL) {
+    munmap(store->map, store->map_len);
+    store->map = NULL;
   }
 
   free(store);
 }
 
-uint32_t bgpstream_as_path_store_get_size(bgpstream_as_path_store_t *store)
+int bgpstream_as_path_store_save(bgpstream_as_path_store_t *store,
+                                 const char *filename)
 {
-  return store->paths_cnt;
+  FILE *fp = NULL;
+  snapshot_hdr_t hdr;
+  snapshot_path_t rec;
+  bgpstream_as_path_store_path_t *spath;
+  uint64_t offset = 0;
+  uint32_t id;
+
+  if ((fp = fopen(filename, "wb")) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not open %s for writing: %s",
+                  filename, strerror(errno));
+    goto err;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+  hdr.version = SNAPSHOT_VERSION;
+  hdr.byte_order = SNAPSHOT_BYTE_ORDER;
+  hdr.paths_cnt = store->paths_cnt;
+  hdr.index_size = store->index_size;
+  for (id = 0; id < store->paths_cnt; id++) {
+    hdr.data_len += SPATH(store, id)->path.data_len;
+  }
+  if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+    goto write_err;
+  }
+
+  memset(&rec, 0, sizeof(rec));
+  for (id = 0; id < store->paths_cnt; id++) {
+    spath = SPATH(store, id);
+    rec.data_offset = offset;
+    rec.hash = spath->hash;
+    rec.data_len = spath->path.data_len;
+    rec.seg_cnt = spath->path.seg_cnt;
+    rec.origin_offset = spath->path.origin_offset;
+    rec.is_core = spath->is_core;
+    if (fwrite(&rec, sizeof(rec), 1, fp) != 1) {
+      goto write_err;
+    }
+    offset += spath->path.data_len;
+  }
+
+  if (fwrite(store->index, sizeof(uint32_t), store->index_size, fp) !=
+      store->index_size) {
+    goto write_err;
+  }
+
+  for (id = 0; id < store->paths_cnt; id++) {
+    spath = SPATH(store, id);
+    if (spath->path.data_len > 0 &&
+        fwrite(spath->path.data, spath->path.data_len, 1, fp) != 1) {
+      goto write_err;
+    }
+  }
+
+  if (fclose(fp) != 0) {
+    fp = NULL;
+    goto write_err;
+  }
+  return 0;
+
+write_err:
+  bgpstream_log(BGPSTREAM_LOG_ERR, "Could not write AS path store to %s: %s",
+                filename, strerror(errno));
+err:
+  if (fp != NULL) {
+    fclose(fp);
+  }
+  return -1;
 }
 
-static int get_path_id(bgpstream_as_path_store_t *store,
-                       bgpstream_as_path_store_path_t *findme,
-                       bgpstream_as_path_store_path_id_t *id)
+/* Check that the segments of a snapshot path fit within its data and agree
+ * with its seg_cnt and origin_offset, since the path iterators trust them */
+static int snapshot_path_valid(const uint8_t *data, const snapshot_path_t *rec)
+{
+  const bgpstream_as_path_seg_t *seg;
+  uint32_t offset = 0, origin_offset = 0, seg_len;
+  uint16_t seg_cnt = 0;
+
+  while (offset < rec->data_len) {
+    seg = (const bgpstream_as_path_seg_t *)(data + offset);
+    if (seg->type == BGPSTREAM_AS_PATH_SEG_ASN) {
+      seg_len = sizeof(bgpstream_as_path_seg_asn_t);
+    } else if (rec->data_len - offset < sizeof(bgpstream_as_path_seg_set_t)) {
+      return 0;
+    } else {
+      seg_len = sizeof(bgpstream_as_path_seg_set_t) +
+                sizeof(uint32_t) * seg->set.asn_cnt;
+    }
+    if (rec->data_len - offset < seg_len || seg_cnt == UINT16_MAX) {
+      return 0;
+    }
+    origin_offset = offset;
+    offset += seg_len;
+    seg_cnt++;
+  }
+  return seg_cnt == rec->seg_cnt &&
+         (seg_cnt == 0 || origin_offset == rec->origin_offset);
+}
+
+/* Check that a snapshot index refers to every path exactly once, and that
+ * every path can be found by probing from its hash (so that lookups always
+ * reach either the path or an empty bucket) */
+static int snapshot_index_valid(const uint32_t *index, uint32_t index_size,
+                                const snapshot_path_t *recs,
+                                uint32_t paths_cnt)
 {
-  khiter_t k;
-  int khret;
-
-  id->path_hash = bgpstream_as_path_hash(&findme->path);
-
-  k = kh_put(pathset, store->path_set, id->path_hash, &khret);
-  if (khret == 1) {
-    /* just added this pathset */
-    /* clear the pathset fields */
-    kh_val(store->path_set, k).paths = NULL;
-    kh_val(store->path_set, k).paths_cnt = 0;
-  } else if (khret != 0) {
-    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not add path set to the store");
+  uint8_t *seen;
+  uint32_t mask = index_size - 1;
+  uint32_t b, i, id, run, cnt = 0, empty = 0;
+  int valid = 0;
+
+  if ((seen = malloc_zero((paths_cnt + 7) / 8 + 1)) == NULL) {
+    return 0;
+  }
+  for (b = 0; b < index_size; b++) {
+    if (index[b] == INDEX_EMPTY) {
+      empty = b;
+      continue;
+    }
+    if (index[b] > paths_cnt) {
+      goto done;
+    }
+    id = index[b] - 1;
+    if (seen[id / 8] & (1 << (id % 8))) {
+      goto done;
+    }
+    seen[id / 8] |= 1 << (id % 8);
+    cnt++;
+  }
+  /* the caller checked that paths_cnt < index_size, so there is at least one
+   * empty bucket */
+  if (cnt != paths_cnt) {
+    goto done;
+  }
+
+  /* walk the buckets starting after an empty one, so that run is the number
+   * of consecutive full buckets up to (and including) the current one, and
+   * each path must be at most that far from its home bucket */
+  run = 0;
+  for (i = 1; i <= index_size; i++) {
+    b = (empty + i) & mask;
+    if (index[b] == INDEX_EMPTY) {
+      run = 0;
+      continue;
+    }
+    run++;
+    if (((b - recs[index[b] - 1].hash) & mask) >= run) {
+      goto done;
+    }
+  }
+  valid = 1;
+
+done:
+  free(seen);
+  return valid;
+}
+
+bgpstream_as_path_store_t *bgpstream_as_path_store_load(const char *filename)
+{
+  bgpstream_as_path_store_t *store = NULL;
+  bgpstream_as_path_store_path_t *spath;
+  const snapshot_hdr_t *hdr;
+  const snapshot_path_t *recs;
+  uint8_t *data;
+  struct stat st;
+  int fd = -1;
+  int chunks_cnt;
+  uint32_t id;
+  uint64_t len;
+
+  if ((store = malloc_zero(sizeof(bgpstream_as_path_store_t))) == NULL) {
     goto err;
   }
 
-  /* now get the path id from the origin set */
-  if ((id->path_id = pathset_get_path_id(store, &kh_val(store->path_set, k),
-                                         findme)) == UINT16_MAX) {
-    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not add path to origin set");
+  if ((fd = open(filename, O_RDONLY)) == -1 || fstat(fd, &st) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not open %s: %s", filename,
+                  strerror(errno));
     goto err;
   }
+  if ((size_t)st.st_size < sizeof(snapshot_hdr_t)) {
+    goto corrupt;
+  }
+  store->map_len = st.st_size;
+  if ((store->map = mmap(NULL, store->map_len, PROT_READ, MAP_SHARED, fd, 0)) ==
+      MAP_FAILED) {
+    store->map = NULL;
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not map %s: %s", filename,
+                  strerror(errno));
+    goto err;
+  }
+  close(fd);
+  fd = -1;
+
+  hdr = store->map;
+  if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != SNAPSHOT_VERSION ||
+      hdr->byte_order != SNAPSHOT_BYTE_ORDER) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "%s is not a compatible AS path store snapshot", filename);
+    goto err;
+  }
+  len = sizeof(snapshot_hdr_t) + sizeof(snapshot_path_t) * hdr->paths_cnt +
+        sizeof(uint32_t) * (uint64_t)hdr->index_size + hdr->data_len;
+  if (len != store->map_len || hdr->index_size == 0 ||
+      (hdr->index_size & (hdr->index_size - 1)) != 0 ||
+      hdr->paths_cnt >= hdr->index_size) {
+    goto corrupt;
+  }
 
-  return 0;
+  recs = (const snapshot_path_t *)(hdr + 1);
+  store->index = (uint32_t *)(recs + hdr->paths_cnt);
+  store->index_size = hdr->index_size;
+  store->index_mapped = 1;
+  data = (uint8_t *)(store->index + hdr->index_size);
+  if (!snapshot_index_valid(store->index, store->index_size, recs,
+                            hdr->paths_cnt)) {
+    goto corrupt;
+  }
 
+  /* the store paths hold pointers, so they are rebuilt rather than mapped
+   * (but their data is used in place) */
+  chunks_cnt = (hdr->paths_cnt + SPATH_CHUNK_SIZE - 1) >> SPATH_CHUNK_BITS;
+  if (chunks_cnt > 0 &&
+      (store->spaths = malloc_zero(sizeof(bgpstream_as_path_store_path_t *) *
+                                   chunks_cnt)) == NULL) {
+    goto err;
+  }
+  for (store->spaths_chunks_cnt = 0; store->spaths_chunks_cnt < chunks_cnt;
+       store->spaths_chunks_cnt++) {
+    if ((store->spaths[store->spaths_chunks_cnt] = malloc(
+           sizeof(bgpstream_as_path_store_path_t) * SPATH_CHUNK_SIZE)) ==
+        NULL) {
+      goto err;
+    }
+  }
+
+  for (id = 0; id < hdr->paths_cnt; id++) {
+    if (recs[id].data_offset > hdr->data_len ||
+        hdr->data_len - recs[id].data_offset < recs[id].data_len ||
+        !snapshot_path_valid(data + recs[id].data_offset, &recs[id])) {
+      goto corrupt;
+    }
+    spath = SPATH(store, id);
+    spath->is_core = recs[id].is_core;
+    spath->idx = id;
+    spath->hash = recs[id].hash;
+    spath->path.data = data + recs[id].data_offset;
+    spath->path.data_len = recs[id].data_len;
+    /* the data is owned by the mapping */
+    spath->path.data_alloc_len = UINT16_MAX;
+    spath->path.seg_cnt = recs[id].seg_cnt;
+    spath->path.origin_offset = recs[id].origin_offset;
+  }
+  store->paths_cnt = hdr->paths_cnt;
+
+  return store;
+
+corrupt:
+  bgpstream_log(BGPSTREAM_LOG_ERR, "AS path store snapshot %s is corrupt",
+                filename);
 err:
-  return -1;
+  if (fd != -1) {
+    close(fd);
+  }
+  bgpstream_as_path_store_destroy(store);
+  return NULL;
+}
+
+uint32_t bgpstream_as_path_store_get_size(bgpstream_as_path_store_t *store)
+{
+  return store->paths_cnt;
 }
 
 int bgpstream_as_path_store_get_path_id(bgpstream_as_path_store_t *store,
@@ -255,8 +686,7 @@ int bgpstream_as_path_store_get_path_id(bgpstream_as_path_store_t *store,
 
   /* special case for empty path */
   if (path == NULL) {
-    id->path_hash = UINT32_MAX;
-    id->path_id = UINT16_MAX;
+    id->path_id = NULL_PATH_ID;
     return 0;
   }
 
@@ -302,46 +732,25 @@ int bgpstream_as_path_store_insert_path(bgpstream_as_path_store_t *store,
 
 void bgpstream_as_path_store_iter_first_path(bgpstream_as_path_store_t *store)
 {
-  store->cur_pathset = kh_begin(store->path_set);
-
-  while (!kh_exist(store->path_set, store->cur_pathset) &&
-         store->cur_pathset < kh_end(store->path_set)) {
-    store->cur_pathset++;
-  }
-
   store->cur_path = 0;
 }
 
 void bgpstream_as_path_store_iter_next_path(bgpstream_as_path_store_t *store)
 {
-  pathset_t *pathset;
-
-  if (store->cur_pathset >= kh_end(store->path_set)) {
-    return;
-  }
-
-  pathset = &kh_val(store->path_set, store->cur_pathset);
-  if (store->cur_path >= pathset->paths_cnt) {
-    /* move to the next pathset */
-    do {
-      store->cur_pathset++;
-    } while (store->cur_pathset < kh_end(store->path_set) &&
-             !kh_exist(store->path_set, store->cur_pathset));
-    store->cur_path = 0;
+  if (store->cur_path < store->paths_cnt) {
+    store->cur_path++;
   }
 }
 
 int bgpstream_as_path_store_iter_has_more_path(bgpstream_as_path_store_t *store)
 {
-  return (store->cur_pathset < kh_end(store->path_set)) &&
-         (store->cur_path <
-          kh_val(store->path_set, store->cur_pathset).paths_cnt);
+  return store->cur_path < store->paths_cnt;
 }
 
 bgpstream_as_path_store_path_t *
 bgpstream_as_path_store_iter_get_path(bgpstream_as_path_store_t *store)
 {
-  return &kh_val(store->path_set, store->cur_pathset).paths[store->cur_path++];
+  return SPATH(store, store->cur_path);
 }
 
 bgpstream_as_path_store_path_id_t
@@ -349,7 +758,6 @@ bgpstream_as_path_store_iter_get_path_id(bgpstream_as_path_store_t *store)
 {
   bgpstream_as_path_store_path_id_t id;
 
-  id.path_hash = kh_key(store->path_set, store->cur_pathset);
   id.path_id = store->cur_path;
 
   return id;
@@ -359,23 +767,12 @@ bgpstream_as_path_store_path_t *
 bgpstream_as_path_store_get_store_path(bgpstream_as_path_store_t *store,
                                        bgpstream_as_path_store_path_id_t id)
 {
-  khiter_t k;
-
-  /* special case for NULL path */
-  if (id.path_hash == UINT32_MAX && id.path_id == UINT16_MAX) {
-    return NULL;
-  }
-
-  if ((k = kh_get(pathset, store->path_set, id.path_hash)) ==
-      kh_end(store->path_set)) {
-    return NULL;
-  }
-
-  if (id.path_id > kh_val(store->path_set, k).paths_cnt - 1) {
+  /* special case for NULL path (which is also >= paths_cnt) */
+  if (id.path_id >= store->paths_cnt) {
     return NULL;
   }
 
-  return &kh_val(store->path_set, k).paths[id.path_id];
+  return SPATH(store, id.path_id);
 }
 
 bgpstream_as_path_t *bgpstream_as_path_store_path_get_path(
@@ -72,17 +72,16 @@ typedef struct bgpstream_as_path_store_path bgpstream_as_path_store_path_t;
 
 /** Represents a single path in the store
  *
- * A path ID should be treated as an opaque identifier.
+ * A path ID should be treated as an opaque identifier. IDs are assigned in
+ * insertion order, so inserting the paths of a store into a new store in the
+ * same order (e.g., when deserializing) yields the same IDs.
  */
 typedef struct bgpstream_as_path_store_path_id {
 
-  /** An internal hash of the origin ASN segment of the path */
-  uint32_t path_hash;
+  /** ID of the path within the store (UINT32_MAX for a NULL path) */
+  uint32_t path_id;
 
-  /** ID of the path within the origin pathset */
-  uint16_t path_id;
-
-} __attribute__((packed)) bgpstream_as_path_store_path_id_t;
+} bgpstream_as_path_store_path_id_t;
 
 /** Store path iterator structure */
 typedef struct bgpstream_as_path_store_path_iter {
@@ -117,6 +116,32 @@ bgpstream_as_path_store_t *bgpstream_as_path_store_create(void);
  */
 void bgpstream_as_path_store_destroy(bgpstream_as_path_store_t *store);
 
+/** Save a snapshot of the given AS Path Store to a file
+ *
+ * @param store         pointer to the store to save
+ * @param filename      name of the file to write the snapshot to
+ * @return 0 if the snapshot was written successfully, -1 otherwise
+ *
+ * The snapshot is a flat binary image of the store (in host byte order) that
+ * can be loaded back using bgpstream_as_path_store_load. Path IDs (and store
+ * path indexes) are preserved.
+ */
+int bgpstream_as_path_store_save(bgpstream_as_path_store_t *store,
+                                 const char *filename);
+
+/** Load an AS Path Store from a snapshot file
+ *
+ * @param filename      name of the snapshot file to load
+ * @return pointer to the loaded store if successful, NULL otherwise
+ *
+ * The snapshot is mapped read-only and used in place, so loading is fast and
+ * the path data is shared between all processes that load the same
+ * snapshot. Paths may still be added to the loaded store, in which case they
+ * (and the path index) are kept in private memory. The snapshot file must not
+ * be modified while the store is in use.
+ */
+bgpstream_as_path_store_t *bgpstream_as_path_store_load(const char *filename);
+
 /** Get the number of paths in the store
  *
  * @param store         pointer to the store
@@ -167,6 +192,8 @@ int bgpstream_as_path_store_get_path_id(bgpstream_as_path_store_t *store,
  * @param id            ID of the path to retrieve
  * @return borrowed pointer to the Store Path, NULL if no path exists
  *
+ * The returned pointer remains valid until the store is destroyed.
+ *
  * If a native BGPStream path is required, use the
  * bgpstream_as_path_store_path_get_path function.
  */
@@ -264,7 +291,8 @@ bgpstream_as_path_seg_t *bgpstream_as_path_store_path_get_next_seg(
  *
  * This function is designed to be used when serializing the entire store, and
  * should be considered internal. The returned index is guaranteed to be in the
- * range [0 -> bgpstream_as_path_store_get_size).
+ * range [0 -> bgpstream_as_path_store_get_size), and is the same as the path
+ * ID of the path.
  */
 uint32_t bgpstream_as_path_store_path_get_idx(
   bgpstream_as_path_store_path_t *store_path);
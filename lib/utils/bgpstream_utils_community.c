@@ -34,13 +34,21 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define COMMUNITY_MAX_STR_LEN 16
 
+/* Sets up to this size are matched with a vector scan rather than a binary
+ * search */
+#define COMMUNITY_SCAN_MAX 32
+
 /** Set of community values */
 struct bgpstream_community_set {
 
-  /** Array of community values */
+  /** Array of community values, sorted by ASN and value, with no
+   * duplicates */
   bgpstream_community_t *communities;
 
   /** Number of communities in the set */
@@ -54,6 +62,97 @@ struct bgpstream_community_set {
   bgpstream_community_t communities_hash;
 };
 
+/* ========== PRIVATE FUNCTIONS ========== */
+
+/* Sort key of a community (ASN, then value) */
+#define COMM_KEY(c) (((uint32_t)(c)->asn << 16) | (c)->value)
+
+static int comm_cmp(const void *a, const void *b)
+{
+  uint32_t ka = COMM_KEY((const bgpstream_community_t *)a);
+  uint32_t kb = COMM_KEY((const bgpstream_community_t *)b);
+  return (ka > kb) - (ka < kb);
+}
+
+static int comms_sorted(const bgpstream_community_t *comms, int cnt)
+{
+  int i;
+  for (i = 1; i < cnt; i++) {
+    if (COMM_KEY(&comms[i - 1]) >= COMM_KEY(&comms[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Sort and deduplicate the given array in place, returning the new count */
+static int comms_sort(bgpstream_community_t *comms, int cnt)
+{
+  int i, j;
+
+  /* communities usually arrive sorted already */
+  if (comms_sorted(comms, cnt)) {
+    return cnt;
+  }
+  qsort(comms, cnt, sizeof(bgpstream_community_t), comm_cmp);
+  for (i = 1, j = 1; i < cnt; i++) {
+    if (COMM_KEY(&comms[i]) != COMM_KEY(&comms[j - 1])) {
+      comms[j++] = comms[i];
+    }
+  }
+  return j;
+}
+
+static void set_update_hash(bgpstream_community_set_t *set)
+{
+  int i;
+  set->communities_hash.ui32 = 0;
+  for (i = 0; i < set->communities_cnt; i++) {
+    set->communities_hash.ui32 |= set->communities[i].ui32;
+  }
+}
+
+/* Index of the first community in the set that is not less than key */
+static int set_lower_bound(const bgpstream_community_set_t *set, uint32_t key)
+{
+  int lo = 0, hi = set->communities_cnt, mid;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (COMM_KEY(&set->communities[mid]) < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Check if any of the communities, with the bits that are not in lane_mask
+ * cleared, is equal to want. The communities are compared four at a time. */
+static int comms_scan(const bgpstream_community_t *comms, int cnt,
+                      uint32_t want, uint32_t lane_mask)
+{
+  int i = 0;
+
+#ifdef __SSE2__
+  __m128i w = _mm_set1_epi32((int)want);
+  __m128i m = _mm_set1_epi32((int)lane_mask);
+  __m128i c;
+  for (; i + 4 <= cnt; i += 4) {
+    c = _mm_loadu_si128((const __m128i *)&comms[i]);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(c, m), w)) != 0) {
+      return 1;
+    }
+  }
+#endif
+  for (; i < cnt; i++) {
+    if ((comms[i].ui32 & lane_mask) == want) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 /* ========== PUBLIC FUNCTIONS ========== */
 
 int bgpstream_community_snprintf(char *buf, size_t len,
@@ -199,6 +298,11 @@ void bgpstream_community_set_destroy(bgpstream_community_set_t *set)
 int bgpstream_community_set_copy(bgpstream_community_set_t *dst,
                                  const bgpstream_community_set_t *src)
 {
+  if (dst->communities_alloc_cnt < 0) {
+    /* no longer points to external memory */
+    dst->communities = NULL;
+    dst->communities_alloc_cnt = 0;
+  }
   if (dst->communities_alloc_cnt < src->communities_cnt) {
     if ((dst->communities =
            realloc(dst->communities, sizeof(bgpstream_community_t) *
@@ -231,16 +335,42 @@ int bgpstream_community_set_size(const bgpstream_community_set_t *set)
 int bgpstream_community_set_insert(bgpstream_community_set_t *set,
                                    bgpstream_community_t *comm)
 {
+  bgpstream_community_t *comms;
+  int alloc_cnt;
+  int i = set_lower_bound(set, COMM_KEY(comm));
+
+  if (i < set->communities_cnt &&
+      COMM_KEY(&set->communities[i]) == COMM_KEY(comm)) {
+    /* already in the set */
+    return 0;
+  }
+
+  if (set->communities_alloc_cnt < 0) {
+    /* no longer points to external memory */
+    alloc_cnt = set->communities_cnt + 1;
+    if ((comms = malloc(sizeof(bgpstream_community_t) * alloc_cnt)) == NULL) {
+      return -1;
+    }
+    memcpy(comms, set->communities,
+           sizeof(bgpstream_community_t) * set->communities_cnt);
+    set->communities = comms;
+    set->communities_alloc_cnt = alloc_cnt;
+  }
   if (set->communities_cnt == set->communities_alloc_cnt) {
-    if ((set->communities = realloc(
-           set->communities, sizeof(bgpstream_community_t) *
-                               (set->communities_alloc_cnt + 1))) == NULL) {
+    alloc_cnt = (set->communities_alloc_cnt == 0)
+                  ? 8
+                  : set->communities_alloc_cnt * 2;
+    if ((comms = realloc(set->communities,
+                         sizeof(bgpstream_community_t) * alloc_cnt)) == NULL) {
       return -1;
     }
-    set->communities_alloc_cnt++;
+    set->communities = comms;
+    set->communities_alloc_cnt = alloc_cnt;
   }
 
-  set->communities[set->communities_cnt] = *comm;
+  memmove(&set->communities[i + 1], &set->communities[i],
+          sizeof(bgpstream_community_t) * (set->communities_cnt - i));
+  set->communities[i] = *comm;
   set->communities_cnt++;
   set->communities_hash.ui32 |= comm->ui32;
   return 0;
@@ -250,25 +380,45 @@ int bgpstream_community_set_populate_from_array(bgpstream_community_set_t *set,
                                                 bgpstream_community_t *comms,
                                                 int comms_cnt)
 {
-  bgpstream_community_set_t tmp;
-  if (bgpstream_community_set_populate_from_array_zc(&tmp, comms, comms_cnt) !=
-      0) {
-    return -1;
+  if (set->communities_alloc_cnt < 0) {
+    /* no longer points to external memory */
+    set->communities = NULL;
+    set->communities_alloc_cnt = 0;
   }
-  return bgpstream_community_set_copy(set, &tmp);
+  if (set->communities_alloc_cnt < comms_cnt) {
+    if ((set->communities = realloc(
+           set->communities, sizeof(bgpstream_community_t) * comms_cnt)) ==
+        NULL) {
+      set->communities_alloc_cnt = 0;
+      set->communities_cnt = 0;
+      return -1;
+    }
+    set->communities_alloc_cnt = comms_cnt;
+  }
+
+  if (comms_cnt > 0) {
+    memcpy(set->communities, comms, sizeof(bgpstream_community_t) * comms_cnt);
+  }
+  set->communities_cnt = comms_sort(set->communities, comms_cnt);
+  set_update_hash(set);
+  return 0;
 }
 
 int bgpstream_community_set_populate_from_array_zc(
   bgpstream_community_set_t *set, bgpstream_community_t *comms, int comms_cnt)
 {
+  if (!comms_sorted(comms, comms_cnt)) {
+    /* the set must be sorted, and the caller's array must not be modified */
+    return bgpstream_community_set_populate_from_array(set, comms, comms_cnt);
+  }
+
+  if (set->communities_alloc_cnt > 0) {
+    free(set->communities);
+  }
   set->communities_alloc_cnt = -1; /* signal that memory is not owned by us */
   set->communities = comms;
   set->communities_cnt = comms_cnt;
-  set->communities_hash.ui32 = 0;
-  int i;
-  for (i = 0; i < bgpstream_community_set_size(set); i++) {
-    set->communities_hash.ui32 |= set->communities[i].ui32;
-  }
+  set_update_hash(set);
   return 0;
 }
 
@@ -297,8 +447,9 @@ int bgpstream_community_set_equal(const bgpstream_community_set_t *set1,
 {
   return (set1->communities_hash.ui32 == set2->communities_hash.ui32) &&
          (set1->communities_cnt == set2->communities_cnt) &&
-         memcmp(set1->communities, set2->communities,
-              sizeof(bgpstream_community_t) * set1->communities_cnt);
+         (set1->communities_cnt == 0 ||
+          memcmp(set1->communities, set2->communities,
+                 sizeof(bgpstream_community_t) * set1->communities_cnt) == 0);
 }
 
 /* ========== PROTECTED FUNCTIONS ========== */
@@ -318,6 +469,12 @@ int bgpstream_community_set_populate(bgpstream_community_set_t *set,
 
   cnt = len / sizeof(uint32_t);
 
+  if (set->communities_alloc_cnt < 0) {
+    /* the data is not owned by us */
+    set->communities = NULL;
+    set->communities_alloc_cnt = 0;
+  }
+
   if (set->communities_alloc_cnt < cnt) {
     if ((set->communities = realloc(
            set->communities, sizeof(bgpstream_community_t) * cnt)) == NULL) {
@@ -332,14 +489,49 @@ int bgpstream_community_set_populate(bgpstream_community_set_t *set,
     buf += sizeof(uint16_t);
     c->value = nptohs(buf);
     buf += sizeof(uint16_t);
-    set->communities_hash.ui32 |= c->ui32;
   }
 
-  set->communities_cnt = cnt;
+  set->communities_cnt = comms_sort(set->communities, cnt);
+  set_update_hash(set);
 
   return 0;
 }
 
+int bgpstream_community_set_populate_zc(bgpstream_community_set_t *set,
+                                        uint8_t *buf, size_t len)
+{
+  int cnt;
+  int i;
+  bgpstream_community_t c;
+  uint8_t *p = buf;
+
+  /* the raw attribute may start at any offset within the message, which is
+     fine as long as communities are packed (and so accessed bytewise) */
+  assert(__alignof__(bgpstream_community_t) == 1 &&
+         sizeof(bgpstream_community_t) == sizeof(uint32_t));
+
+  if (buf == NULL || len == 0) {
+    return bgpstream_community_set_populate_from_array_zc(set, NULL, 0);
+  }
+
+  cnt = len / sizeof(uint32_t);
+
+  /* a community is as big as its wire encoding, so convert each one in
+     place and point the set at the converted buffer */
+  for (i = 0; i < cnt; i++) {
+    c.asn = nptohs(p);
+    c.value = nptohs(p + sizeof(uint16_t));
+    memcpy(p, &c, sizeof(c));
+    p += sizeof(uint32_t);
+  }
+
+  /* the buffer is ours to overwrite, so sort it in place */
+  cnt = comms_sort((bgpstream_community_t *)buf, cnt);
+
+  return bgpstream_community_set_populate_from_array_zc(
+    set, (bgpstream_community_t *)buf, cnt);
+}
+
 int bgpstream_community_set_exists(const bgpstream_community_set_t *set,
                                    const bgpstream_community_t *com)
 {
@@ -351,32 +543,37 @@ int bgpstream_community_set_match(const bgpstream_community_set_t *set,
                                   const bgpstream_community_t *com, uint8_t mask)
 {
   const bgpstream_community_t *hash = &set->communities_hash;
+  bgpstream_community_t lane_mask;
+  int n = set->communities_cnt;
+  int i;
 
   /* first we verify if the hash is compatible */
-  if ((!(mask & BGPSTREAM_COMMUNITY_FILTER_ASN) ||
-       (hash->asn & com->asn) == com->asn) &&
-      (!(mask & BGPSTREAM_COMMUNITY_FILTER_VALUE) ||
-       (hash->value & com->value) == com->value)) {
-    const bgpstream_community_t *c;
-    int i;
-    int n = bgpstream_community_set_size(set);
-    for (i = 0; i < n; i++) {
-      c = bgpstream_community_set_get(set, i);
-      /* checking if asn match is requested and compatible */
-      if (mask & BGPSTREAM_COMMUNITY_FILTER_ASN) {
-        if (c->asn != com->asn) {
-          continue;
-        }
-      }
-      /* checking if value match is requested and compatible */
-      if (mask & BGPSTREAM_COMMUNITY_FILTER_VALUE) {
-        if (c->value != com->value) {
-          continue;
-        }
-      }
+  if ((mask & BGPSTREAM_COMMUNITY_FILTER_ASN) &&
+      (hash->asn & com->asn) != com->asn) {
+    return 0;
+  }
+  if ((mask & BGPSTREAM_COMMUNITY_FILTER_VALUE) &&
+      (hash->value & com->value) != com->value) {
+    return 0;
+  }
+  if (!(mask & BGPSTREAM_COMMUNITY_FILTER_EXACT)) {
+    return n > 0;
+  }
 
-      return 1;
-    }
+  if (n > COMMUNITY_SCAN_MAX && (mask & BGPSTREAM_COMMUNITY_FILTER_ASN)) {
+    /* the set is sorted by ASN, so the first candidate can be found with a
+     * binary search */
+    i = set_lower_bound(set, (mask & BGPSTREAM_COMMUNITY_FILTER_VALUE)
+                               ? COMM_KEY(com)
+                               : (uint32_t)com->asn << 16);
+    return i < n && set->communities[i].asn == com->asn &&
+           (!(mask & BGPSTREAM_COMMUNITY_FILTER_VALUE) ||
+            set->communities[i].value == com->value);
   }
-  return 0;
+
+  /* compare only the requested fields */
+  lane_mask.asn = (mask & BGPSTREAM_COMMUNITY_FILTER_ASN) ? UINT16_MAX : 0;
+  lane_mask.value = (mask & BGPSTREAM_COMMUNITY_FILTER_VALUE) ? UINT16_MAX : 0;
+  return comms_scan(set->communities, n, com->ui32 & lane_mask.ui32,
+                    lane_mask.ui32);
 }
@@ -230,6 +230,10 @@ int bgpstream_community_set_copy(bgpstream_community_set_t *dst,
  * @param i             index of the community value to get
  * @return **borrowed** pointer to the community, NULL if index is out of bounds
  *
+ * @note communities in a set are kept sorted by ASN and then by value, and
+ * each community appears at most once, regardless of the order (and
+ * repetitions) in which they were added.
+ *
  * @note the returned pointer is owned **by the set**. It MUST NOT be destroyed
  * using bgpstream_community_destroy. Also, it is only valid as long as the set
  * is valid.
@@ -248,7 +252,8 @@ int bgpstream_community_set_size(const bgpstream_community_set_t *set);
  *
  * @param set           pointer to the set to populate
  * @param comm          pointer to the community
- * @return 0 if the set was populated successfully, -1 otherwise
+ * @return 0 if the set was populated successfully (or the community was
+ * already in the set), -1 otherwise
  */
 int bgpstream_community_set_insert(bgpstream_community_set_t *set,
                                    bgpstream_community_t *comm);
@@ -273,6 +278,8 @@ int bgpstream_community_set_populate_from_array(bgpstream_community_set_t *set,
  *
  * @note this function **does not** copy the data into the set. The set is
  * only valid as long as the comms array passed to this function is valid.
+ * If the array is not sorted, or contains duplicates, the communities are
+ * copied into the set instead (the array is never modified).
  */
 int bgpstream_community_set_populate_from_array_zc(
   bgpstream_community_set_t *set, bgpstream_community_t *comms, int comms_cnt);
@@ -290,9 +297,6 @@ bgpstream_community_set_hash(const bgpstream_community_set_t *set);
  * @param set1          pointer to the first community set to compare
  * @param set2          pointer to the second community set to compare
  * @return 0 if the sets are not equal, non-zero if they are equal
- *
- * @note this is not a true check for set equality. For this function to return
- * true, the ordering within the sets must also be identical.
  */
 int bgpstream_community_set_equal(const bgpstream_community_set_t *set1,
                                   const bgpstream_community_set_t *set2);
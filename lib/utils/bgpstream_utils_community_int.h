@@ -83,6 +83,23 @@
 int bgpstream_community_set_populate(bgpstream_community_set_t *set,
                                      uint8_t *buf, size_t len);
 
+/** Populate a community set structure by converting the raw data from a BGP
+ * COMMUNITIES attribute in place
+ *
+ * @param set           pointer to the community set to populate
+ * @param buf           pointer to the raw COMMUNITIES attribute data
+ * @param len           length of the raw COMMUNITIES attribute
+ * @return 0 if the set was populated successfully, -1 otherwise
+ *
+ * The set references (rather than copies) the given buffer, so the buffer must
+ * remain valid for as long as the set is in use. The buffer is overwritten
+ * with the decoded communities and so MUST NOT be passed to this function (or
+ * interpreted as raw attribute data) again. The buffer need not be aligned,
+ * since bgpstream_community_t is packed.
+ */
+int bgpstream_community_set_populate_zc(bgpstream_community_set_t *set,
+                                        uint8_t *buf, size_t len);
+
 /** @} */
 
 #endif /* __BGPSTREAM_UTILS_COMMUNITY_INT_H */
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2014 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+
+#include "utils.h"
+
+#include "bgpstream_utils_id_index.h"
+
+#define SLOT(hash, id) (((uint64_t)(hash) << 32) | (id))
+#define SLOT_HASH(slot) ((uint32_t)((slot) >> 32))
+#define SLOT_ID(slot) ((uint32_t)(slot))
+
+/* ========== PRIVATE FUNCTIONS ========== */
+
+static void index_put(bgpstream_id_index_t *index, uint64_t slot)
+{
+  uint32_t mask = index->size - 1;
+  uint32_t i;
+
+  for (i = SLOT_HASH(slot) & mask; index->slots[i] != 0; i = (i + 1) & mask)
+    ;
+  __atomic_store_n(&index->slots[i], slot, __ATOMIC_RELEASE);
+}
+
+/* Find the chunk and offset of the given ID */
+static void **id_chunk(bgpstream_id_chunks_t *chunks, uint32_t id,
+                       uint32_t *offset)
+{
+  /* the first chunk starts at position 1 << BGPSTREAM_ID_CHUNK0_BITS */
+  uint64_t pos =
+    (uint64_t)id - chunks->base - 1 + (1 << BGPSTREAM_ID_CHUNK0_BITS);
+  int k = 63 - __builtin_clzll(pos);
+  *offset = (uint32_t)(pos - ((uint64_t)1 << k));
+  return &chunks->chunks[k - BGPSTREAM_ID_CHUNK0_BITS];
+}
+
+/* ========== PROTECTED FUNCTIONS ========== */
+
+uint32_t bgpstream_id_index_hash(uint32_t hash, const void *buf, size_t len)
+{
+  const unsigned char *c = buf;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    hash = (hash ^ c[i]) * 16777619U;
+  }
+  return hash;
+}
+
+uint32_t bgpstream_id_index_lookup(bgpstream_id_index_t **indexp, uint32_t hash,
+                                   bgpstream_id_index_match_cb_t *match,
+                                   void *user)
+{
+  bgpstream_id_index_t *index = __atomic_load_n(indexp, __ATOMIC_ACQUIRE);
+  uint32_t mask;
+  uint32_t i;
+  uint64_t slot;
+
+  if (index == NULL) {
+    return 0;
+  }
+  mask = index->size - 1;
+  for (i = hash & mask;; i = (i + 1) & mask) {
+    slot = __atomic_load_n(&index->slots[i], __ATOMIC_ACQUIRE);
+    if (SLOT_ID(slot) == 0) {
+      return 0;
+    }
+    if (SLOT_HASH(slot) == hash && match(SLOT_ID(slot), user)) {
+      return SLOT_ID(slot);
+    }
+  }
+}
+
+int bgpstream_id_index_reserve(bgpstream_id_index_t **indexp, uint32_t cnt,
+                               uint32_t init_size)
+{
+  bgpstream_id_index_t *old = *indexp;
+  bgpstream_id_index_t *index;
+  uint32_t i;
+
+  /* keep the load factor below 70% */
+  if (old != NULL && (uint64_t)cnt * 10 <= (uint64_t)old->size * 7) {
+    return 0;
+  }
+
+  if ((index = malloc_zero(sizeof(bgpstream_id_index_t))) == NULL) {
+    return -1;
+  }
+  index->size = (old == NULL) ? init_size : old->size * 2;
+  if ((index->slots = malloc_zero(sizeof(uint64_t) * index->size)) == NULL) {
+    free(index);
+    return -1;
+  }
+  if (old != NULL) {
+    for (i = 0; i < old->size; i++) {
+      if (old->slots[i] != 0) {
+        index_put(index, old->slots[i]);
+      }
+    }
+  }
+  index->prev = old;
+  __atomic_store_n(indexp, index, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void bgpstream_id_index_put(bgpstream_id_index_t *index, uint32_t hash,
+                            uint32_t id)
+{
+  index_put(index, SLOT(hash, id));
+}
+
+void bgpstream_id_index_free(bgpstream_id_index_t *index)
+{
+  bgpstream_id_index_t *prev;
+
+  while (index != NULL) {
+    prev = index->prev;
+    free(index->slots);
+    free(index);
+    index = prev;
+  }
+}
+
+void *bgpstream_id_chunks_get(bgpstream_id_chunks_t *chunks, uint32_t id)
+{
+  uint32_t offset;
+  char *chunk =
+    __atomic_load_n(id_chunk(chunks, id, &offset), __ATOMIC_ACQUIRE);
+  return (chunk == NULL) ? NULL : chunk + chunks->entry_size * offset;
+}
+
+void *bgpstream_id_chunks_alloc(bgpstream_id_chunks_t *chunks, uint32_t id)
+{
+  uint32_t offset;
+  void **chunkp = id_chunk(chunks, id, &offset);
+  char *chunk = __atomic_load_n(chunkp, __ATOMIC_ACQUIRE);
+  void *expected = NULL;
+  size_t chunk_size =
+    (size_t)1 << (chunkp - chunks->chunks + BGPSTREAM_ID_CHUNK0_BITS);
+
+  if (chunk == NULL) {
+    if ((chunk = malloc_zero(chunks->entry_size * chunk_size)) == NULL) {
+      return NULL;
+    }
+    /* another writer may have allocated it in the meantime */
+    if (!__atomic_compare_exchange_n(chunkp, &expected, chunk, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      free(chunk);
+      chunk = expected;
+    }
+  }
+  return chunk + chunks->entry_size * offset;
+}
+
+void bgpstream_id_chunks_clear(bgpstream_id_chunks_t *chunks, uint32_t base)
+{
+  int i;
+
+  for (i = 0; i < BGPSTREAM_ID_CHUNK_CNT; i++) {
+    free(chunks->chunks[i]);
+    chunks->chunks[i] = NULL;
+  }
+  chunks->base = base;
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2014 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BGPSTREAM_UTILS_ID_INDEX_H
+#define __BGPSTREAM_UTILS_ID_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @file
+ *
+ * @brief Header file that exposes the private interface of the ID index used
+ * by the maps that assign IDs to values (e.g., the string intern table and
+ * the peer signature map)
+ *
+ * Such a map stores each value in a chunk array, at a position given by its
+ * ID, and finds the ID of a value with a hash index. Both structures may be
+ * read without locking while a single writer (holding a lock of the map)
+ * modifies them: chunks never move, and an index that is replaced by a larger
+ * one is kept until it is freed, since readers may still be probing it. IDs
+ * start from 1, and 0 is never a valid ID.
+ *
+ */
+
+/**
+ * @name Private Constants
+ *
+ * @{ */
+
+/** Initial value of a hash computed with bgpstream_id_index_hash */
+#define BGPSTREAM_ID_INDEX_HASH_INIT 2166136261U
+
+/** Number of entries in the first chunk (log2). Each chunk is twice as large
+ * as the previous one. */
+#define BGPSTREAM_ID_CHUNK0_BITS 6
+
+/** Enough chunks to hold UINT32_MAX entries */
+#define BGPSTREAM_ID_CHUNK_CNT (32 - BGPSTREAM_ID_CHUNK0_BITS + 1)
+
+/** @} */
+
+/**
+ * @name Private Data Structures
+ *
+ * @{ */
+
+/** Open-addressing (linear probing) index from hash to ID */
+typedef struct bgpstream_id_index {
+
+  /** Array of slots, each packing a hash (upper 32 bits) and an ID (lower 32
+   * bits) so that readers can load both atomically. Empty slots are 0. */
+  uint64_t *slots;
+
+  /** Number of slots (a power of two) */
+  uint32_t size;
+
+  /** Index that this one replaced */
+  struct bgpstream_id_index *prev;
+
+} bgpstream_id_index_t;
+
+/** Array of fixed-size entries addressed by ID */
+typedef struct bgpstream_id_chunks {
+
+  /** Chunks of entries, allocated on demand */
+  void *chunks[BGPSTREAM_ID_CHUNK_CNT];
+
+  /** Size of an entry */
+  size_t entry_size;
+
+  /** Number of IDs that precede the first entry of the first chunk (i.e.,
+   * the first chunk holds IDs base + 1 onwards) */
+  uint32_t base;
+
+} bgpstream_id_chunks_t;
+
+/** Callback that checks whether the value with the given ID is the one being
+ * looked up
+ *
+ * @param id            ID of a value whose hash matches
+ * @param user          user data passed to bgpstream_id_index_lookup
+ * @return non-zero if the value matches, 0 otherwise
+ */
+typedef int(bgpstream_id_index_match_cb_t)(uint32_t id, void *user);
+
+/** @} */
+
+/**
+ * @name Private API Functions
+ *
+ * @{ */
+
+/** Add the given bytes to a hash (32 bit FNV-1a)
+ *
+ * @param hash          hash so far (BGPSTREAM_ID_INDEX_HASH_INIT to start)
+ * @param buf           pointer to the bytes to hash
+ * @param len           number of bytes to hash
+ * @return the updated hash
+ */
+uint32_t bgpstream_id_index_hash(uint32_t hash, const void *buf, size_t len);
+
+/** Find the ID of a value in an index
+ *
+ * @param indexp        pointer to the (published) index, which may be NULL
+ * @param hash          hash of the value
+ * @param match         callback that compares a candidate with the value
+ * @param user          user data to pass to the callback
+ * @return the ID of the value, 0 if it is not in the index
+ *
+ * May be called concurrently with a writer.
+ */
+uint32_t bgpstream_id_index_lookup(bgpstream_id_index_t **indexp, uint32_t hash,
+                                   bgpstream_id_index_match_cb_t *match,
+                                   void *user);
+
+/** Make sure that an index has room for the given number of IDs, replacing it
+ * with a larger one if needed
+ *
+ * @param indexp        pointer to the (published) index, which may be NULL
+ * @param cnt           number of IDs that the index must hold
+ * @param init_size     number of slots of a new index (a power of two)
+ * @return 0 if successful, -1 otherwise
+ *
+ * The caller must be the only writer.
+ */
+int bgpstream_id_index_reserve(bgpstream_id_index_t **indexp, uint32_t cnt,
+                               uint32_t init_size);
+
+/** Add an ID to an index that has room for it
+ *
+ * @param index         pointer to the index
+ * @param hash          hash of the value with the given ID
+ * @param id            ID to add
+ *
+ * The caller must be the only writer, and must have written the value before
+ * calling this function.
+ */
+void bgpstream_id_index_put(bgpstream_id_index_t *index, uint32_t hash,
+                            uint32_t id);
+
+/** Free an index, and all the indexes that it replaced
+ *
+ * @param index         pointer to the index to free (may be NULL)
+ *
+ * Must not be called while other threads may be using the index.
+ */
+void bgpstream_id_index_free(bgpstream_id_index_t *index);
+
+/** Get the entry with the given ID
+ *
+ * @param chunks        pointer to the chunk array
+ * @param id            ID of the entry (greater than chunks->base)
+ * @return pointer to the entry, NULL if its chunk has not been allocated
+ *
+ * May be called concurrently with a writer.
+ */
+void *bgpstream_id_chunks_get(bgpstream_id_chunks_t *chunks, uint32_t id);
+
+/** Get the entry with the given ID, allocating (and zeroing) its chunk if
+ * needed
+ *
+ * @param chunks        pointer to the chunk array
+ * @param id            ID of the entry (greater than chunks->base)
+ * @return pointer to the entry, NULL if its chunk could not be allocated
+ *
+ * May be called concurrently from several writers.
+ */
+void *bgpstream_id_chunks_alloc(bgpstream_id_chunks_t *chunks, uint32_t id);
+
+/** Free all the chunks, so that the first chunk holds IDs from base + 1
+ *
+ * @param chunks        pointer to the chunk array
+ * @param base          number of IDs that the chunks will no longer hold
+ *
+ * Must not be called while other threads may be using the chunks.
+ */
+void bgpstream_id_chunks_clear(bgpstream_id_chunks_t *chunks, uint32_t base);
+
+/** @} */
+
+#endif /* __BGPSTREAM_UTILS_ID_INDEX_H */
@@ -26,78 +26,478 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-#include "khash.h"
 #include "utils.h"
 
 #include "bgpstream_utils_id_set.h"
 
 /* PRIVATE */
 
-/** set of unique ids
- *  this structure maintains a set of unique
- *  ids (using a uint32 type)
+/** The set is a compressed bitmap (similar to a "roaring" bitmap): IDs are
+ *  split into their high and low 16 bits, and the low bits of all IDs that
+ *  share the same high bits are stored in a container. Sparse containers are
+ *  sorted arrays of 16-bit values, and dense containers are 64K-bit bitmaps.
+ *
+ *  Containers are kept sorted by their high bits, so the container for 16-bit
+ *  IDs (e.g., 16-bit ASNs), if any, is always the first one.
  */
-KHASH_INIT(bgpstream_id_set /* name */, uint32_t /* khkey_t */,
-           char /* khval_t */, 0 /* kh_is_set */,
-           kh_int_hash_func /*__hash_func */,
-           kh_int_hash_equal /* __hash_equal */)
+
+/** Maximum cardinality of an array container (at which point the array uses
+ * as much memory as a bitmap) */
+#define ARRAY_MAX_CARD 4096
+
+/** Number of 64-bit words in a bitmap container */
+#define BITMAP_WORDS 1024
+
+/** Size of a serialized container header (key, type and cardinality) */
+#define SER_HDR_LEN 8
+
+#define HIGH(id) ((uint16_t)((id) >> 16))
+#define LOW(id) ((uint16_t)((id)&0xFFFF))
+
+typedef struct container {
+
+  /** The high 16 bits shared by all IDs in the container */
+  uint16_t key;
+
+  /** Is this a bitmap container? (otherwise it is an array) */
+  uint8_t is_bitmap;
+
+  /** Number of IDs in the container */
+  uint32_t card;
+
+  /** Number of entries allocated for the array */
+  uint32_t alloc;
+
+  union {
+    /** Sorted array of low 16 bits */
+    uint16_t *array;
+
+    /** Bitmap of low 16 bits */
+    uint64_t *bitmap;
+  } u;
+
+} container_t;
 
 struct bgpstream_id_set {
-  khiter_t k;
-  khash_t(bgpstream_id_set) * hash;
+
+  /** Containers, sorted by key */
+  container_t *containers;
+  int containers_cnt;
+  int containers_alloc;
+
+  /** Total number of IDs in the set */
+  uint64_t size;
+
+  /** Iterator state */
+  int iter_c;
+  uint32_t iter_i;
+  uint32_t iter_val;
 };
 
+static void container_free(container_t *c)
+{
+  if (c->is_bitmap) {
+    free(c->u.bitmap);
+  } else {
+    free(c->u.array);
+  }
+  memset(c, 0, sizeof(container_t));
+}
+
+/* returns the index of the given value in the array, or -(insertion point)-1
+ * if it is not in the array */
+static int array_search(const uint16_t *array, uint32_t card, uint16_t val)
+{
+  int lo = 0, hi = (int)card - 1, mid;
+  while (lo <= hi) {
+    mid = (lo + hi) >> 1;
+    if (array[mid] < val) {
+      lo = mid + 1;
+    } else if (array[mid] > val) {
+      hi = mid - 1;
+    } else {
+      return mid;
+    }
+  }
+  return -(lo + 1);
+}
+
+static int container_contains(const container_t *c, uint16_t low)
+{
+  if (c->is_bitmap) {
+    return (c->u.bitmap[low >> 6] >> (low & 63)) & 1;
+  }
+  return array_search(c->u.array, c->card, low) >= 0;
+}
+
+static int container_to_bitmap(container_t *c)
+{
+  uint64_t *bitmap;
+  uint32_t i;
+
+  if ((bitmap = calloc(BITMAP_WORDS, sizeof(uint64_t))) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < c->card; i++) {
+    bitmap[c->u.array[i] >> 6] |= (uint64_t)1 << (c->u.array[i] & 63);
+  }
+  free(c->u.array);
+  c->u.bitmap = bitmap;
+  c->is_bitmap = 1;
+  c->alloc = 0;
+  return 0;
+}
+
+/* convert a bitmap container back to an array if it has become sparse */
+static int container_shrink(container_t *c)
+{
+  uint16_t *array;
+  uint32_t i, j = 0;
+  uint64_t w;
+
+  if (!c->is_bitmap || c->card > ARRAY_MAX_CARD) {
+    return 0;
+  }
+  if ((array = malloc(sizeof(uint16_t) * (c->card > 0 ? c->card : 1))) ==
+      NULL) {
+    return -1;
+  }
+  for (i = 0; i < BITMAP_WORDS; i++) {
+    for (w = c->u.bitmap[i]; w != 0; w &= w - 1) {
+      array[j++] = (uint16_t)(i * 64 + __builtin_ctzll(w));
+    }
+  }
+  free(c->u.bitmap);
+  c->u.array = array;
+  c->is_bitmap = 0;
+  c->alloc = c->card > 0 ? c->card : 1;
+  return 0;
+}
+
+static void bitmap_recount(container_t *c)
+{
+  uint32_t i;
+  c->card = 0;
+  for (i = 0; i < BITMAP_WORDS; i++) {
+    c->card += __builtin_popcountll(c->u.bitmap[i]);
+  }
+}
+
+/* returns 1 if added, 0 if already present, -1 on error */
+static int container_add(container_t *c, uint16_t low)
+{
+  uint64_t bit;
+  uint16_t *tmp;
+  int idx;
+
+  if (c->is_bitmap) {
+    bit = (uint64_t)1 << (low & 63);
+    if (c->u.bitmap[low >> 6] & bit) {
+      return 0;
+    }
+    c->u.bitmap[low >> 6] |= bit;
+    c->card++;
+    return 1;
+  }
+
+  if ((idx = array_search(c->u.array, c->card, low)) >= 0) {
+    return 0;
+  }
+  idx = -idx - 1;
+
+  if (c->card == ARRAY_MAX_CARD) {
+    if (container_to_bitmap(c) != 0) {
+      return -1;
+    }
+    return container_add(c, low);
+  }
+
+  if (c->card == c->alloc) {
+    c->alloc = c->alloc == 0 ? 4 : c->alloc * 2;
+    if (c->alloc > ARRAY_MAX_CARD) {
+      c->alloc = ARRAY_MAX_CARD;
+    }
+    if ((tmp = realloc(c->u.array, sizeof(uint16_t) * c->alloc)) == NULL) {
+      return -1;
+    }
+    c->u.array = tmp;
+  }
+  memmove(&c->u.array[idx + 1], &c->u.array[idx],
+          sizeof(uint16_t) * (c->card - idx));
+  c->u.array[idx] = low;
+  c->card++;
+  return 1;
+}
+
+/* returns the index of the container with the given key, or
+ * -(insertion point)-1 if there is no such container */
+static int find_container(const bgpstream_id_set_t *set, uint16_t key)
+{
+  int lo = 0, hi = set->containers_cnt - 1, mid;
+
+  // fast path for 16-bit IDs
+  if (key == 0) {
+    return (set->containers_cnt > 0 && set->containers[0].key == 0) ? 0 : -1;
+  }
+
+  while (lo <= hi) {
+    mid = (lo + hi) >> 1;
+    if (set->containers[mid].key < key) {
+      lo = mid + 1;
+    } else if (set->containers[mid].key > key) {
+      hi = mid - 1;
+    } else {
+      return mid;
+    }
+  }
+  return -(lo + 1);
+}
+
+/* get the container for the given key, creating it if needed */
+static container_t *get_container(bgpstream_id_set_t *set, uint16_t key)
+{
+  container_t *tmp;
+  int idx;
+
+  if ((idx = find_container(set, key)) >= 0) {
+    return &set->containers[idx];
+  }
+  idx = -idx - 1;
+
+  if (set->containers_cnt == set->containers_alloc) {
+    set->containers_alloc =
+      set->containers_alloc == 0 ? 1 : set->containers_alloc * 2;
+    if ((tmp = realloc(set->containers,
+                       sizeof(container_t) * set->containers_alloc)) == NULL) {
+      return NULL;
+    }
+    set->containers = tmp;
+  }
+  memmove(&set->containers[idx + 1], &set->containers[idx],
+          sizeof(container_t) * (set->containers_cnt - idx));
+  set->containers_cnt++;
+  memset(&set->containers[idx], 0, sizeof(container_t));
+  set->containers[idx].key = key;
+  return &set->containers[idx];
+}
+
+/* remove empty containers and recompute the set size */
+static void compact(bgpstream_id_set_t *set)
+{
+  int i, j = 0;
+
+  set->size = 0;
+  for (i = 0; i < set->containers_cnt; i++) {
+    if (set->containers[i].card == 0) {
+      container_free(&set->containers[i]);
+      continue;
+    }
+    set->size += set->containers[i].card;
+    set->containers[j++] = set->containers[i];
+  }
+  set->containers_cnt = j;
+}
+
+/* keep (if keep is set) or remove (otherwise) the values of dst that are in
+ * src */
+static int container_filter(container_t *dst, const container_t *src,
+                            int keep)
+{
+  uint64_t *bitmap;
+  uint32_t i, j = 0;
+
+  if (!dst->is_bitmap) {
+    for (i = 0; i < dst->card; i++) {
+      if (container_contains(src, dst->u.array[i]) == keep) {
+        dst->u.array[j++] = dst->u.array[i];
+      }
+    }
+    dst->card = j;
+    return 0;
+  }
+
+  if (src->is_bitmap) {
+    for (i = 0; i < BITMAP_WORDS; i++) {
+      dst->u.bitmap[i] &= keep ? src->u.bitmap[i] : ~src->u.bitmap[i];
+    }
+  } else if (keep) {
+    if ((bitmap = calloc(BITMAP_WORDS, sizeof(uint64_t))) == NULL) {
+      return -1;
+    }
+    for (i = 0; i < src->card; i++) {
+      if (container_contains(dst, src->u.array[i])) {
+        bitmap[src->u.array[i] >> 6] |= (uint64_t)1 << (src->u.array[i] & 63);
+      }
+    }
+    free(dst->u.bitmap);
+    dst->u.bitmap = bitmap;
+  } else {
+    for (i = 0; i < src->card; i++) {
+      dst->u.bitmap[src->u.array[i] >> 6] &=
+        ~((uint64_t)1 << (src->u.array[i] & 63));
+    }
+  }
+  bitmap_recount(dst);
+  return container_shrink(dst);
+}
+
+static void put_u16(uint8_t *buf, uint16_t v)
+{
+  buf[0] = v >> 8;
+  buf[1] = v & 0xFF;
+}
+
+static void put_u32(uint8_t *buf, uint32_t v)
+{
+  put_u16(buf, v >> 16);
+  put_u16(buf + 2, v & 0xFFFF);
+}
+
+static uint16_t get_u16(const uint8_t *buf)
+{
+  return ((uint16_t)buf[0] << 8) | buf[1];
+}
+
+static uint32_t get_u32(const uint8_t *buf)
+{
+  return ((uint32_t)get_u16(buf) << 16) | get_u16(buf + 2);
+}
+
+static size_t container_serialized_size(const container_t *c)
+{
+  return SER_HDR_LEN +
+         (c->is_bitmap ? BITMAP_WORDS * 8 : c->card * sizeof(uint16_t));
+}
+
 /* PUBLIC FUNCTIONS */
 
 bgpstream_id_set_t *bgpstream_id_set_create()
 {
   bgpstream_id_set_t *set;
 
-  if ((set = (bgpstream_id_set_t *)malloc(sizeof(bgpstream_id_set_t))) ==
+  if ((set = (bgpstream_id_set_t *)malloc_zero(sizeof(bgpstream_id_set_t))) ==
       NULL) {
     return NULL;
   }
 
-  if ((set->hash = kh_init(bgpstream_id_set)) == NULL) {
-    bgpstream_id_set_destroy(set);
-    return NULL;
-  }
   bgpstream_id_set_rewind(set);
   return set;
 }
 
 int bgpstream_id_set_insert(bgpstream_id_set_t *set, uint32_t id)
 {
-  int khret;
-  khiter_t k;
-  if ((k = kh_get(bgpstream_id_set, set->hash, id)) == kh_end(set->hash)) {
-    k = kh_put(bgpstream_id_set, set->hash, id, &khret);
-    return 1;
+  container_t *c;
+  int rc;
+
+  if ((c = get_container(set, HIGH(id))) == NULL) {
+    return -1;
   }
-  return 0;
+  if ((rc = container_add(c, LOW(id))) == 1) {
+    set->size++;
+  }
+  return rc;
+}
+
+int bgpstream_id_set_insert_bulk(bgpstream_id_set_t *set, const uint32_t *ids,
+                                 int ids_cnt)
+{
+  container_t *c = NULL;
+  int i, rc, inserted = 0;
+
+  for (i = 0; i < ids_cnt; i++) {
+    // consecutive IDs usually share a container (especially if sorted)
+    if (c == NULL || c->key != HIGH(ids[i])) {
+      if ((c = get_container(set, HIGH(ids[i]))) == NULL) {
+        return -1;
+      }
+    }
+    if ((rc = container_add(c, LOW(ids[i]))) < 0) {
+      return -1;
+    }
+    inserted += rc;
+  }
+  set->size += inserted;
+  return inserted;
 }
 
 int bgpstream_id_set_exists(bgpstream_id_set_t *set, uint32_t id)
 {
-  khiter_t k;
-  if ((k = kh_get(bgpstream_id_set, set->hash, id)) == kh_end(set->hash)) {
+  int idx;
+  if ((idx = find_container(set, HIGH(id))) < 0) {
     return 0;
   }
-  return 1;
+  return container_contains(&set->containers[idx], LOW(id));
 }
 
 int bgpstream_id_set_merge(bgpstream_id_set_t *dst_set,
                            bgpstream_id_set_t *src_set)
 {
-  khiter_t k;
-  for (k = kh_begin(src_set->hash); k != kh_end(src_set->hash); ++k) {
-    if (kh_exist(src_set->hash, k)) {
-      if (bgpstream_id_set_insert(dst_set, kh_key(src_set->hash, k)) < 0) {
+  container_t *src, *dst;
+  uint32_t i;
+  int j;
+
+  for (j = 0; j < src_set->containers_cnt; j++) {
+    src = &src_set->containers[j];
+    if ((dst = get_container(dst_set, src->key)) == NULL) {
+      return -1;
+    }
+    if (src->is_bitmap) {
+      if (!dst->is_bitmap && container_to_bitmap(dst) != 0) {
         return -1;
       }
+      for (i = 0; i < BITMAP_WORDS; i++) {
+        dst->u.bitmap[i] |= src->u.bitmap[i];
+      }
+      bitmap_recount(dst);
+    } else {
+      for (i = 0; i < src->card; i++) {
+        if (container_add(dst, src->u.array[i]) < 0) {
+          return -1;
+        }
+      }
     }
   }
+  compact(dst_set);
+  bgpstream_id_set_rewind(dst_set);
+  bgpstream_id_set_rewind(src_set);
+  return 0;
+}
+
+int bgpstream_id_set_intersect(bgpstream_id_set_t *dst_set,
+                               bgpstream_id_set_t *src_set)
+{
+  int j, idx;
+
+  for (j = 0; j < dst_set->containers_cnt; j++) {
+    if ((idx = find_container(src_set, dst_set->containers[j].key)) < 0) {
+      dst_set->containers[j].card = 0;
+    } else if (container_filter(&dst_set->containers[j],
+                                &src_set->containers[idx], 1) != 0) {
+      return -1;
+    }
+  }
+  compact(dst_set);
+  bgpstream_id_set_rewind(dst_set);
+  bgpstream_id_set_rewind(src_set);
+  return 0;
+}
+
+int bgpstream_id_set_subtract(bgpstream_id_set_t *dst_set,
+                              bgpstream_id_set_t *src_set)
+{
+  int j, idx;
+
+  for (j = 0; j < dst_set->containers_cnt; j++) {
+    if ((idx = find_container(src_set, dst_set->containers[j].key)) >= 0 &&
+        container_filter(&dst_set->containers[j], &src_set->containers[idx],
+                         0) != 0) {
+      return -1;
+    }
+  }
+  compact(dst_set);
   bgpstream_id_set_rewind(dst_set);
   bgpstream_id_set_rewind(src_set);
   return 0;
@@ -105,17 +505,34 @@ int bgpstream_id_set_merge(bgpstream_id_set_t *dst_set,
 
 void bgpstream_id_set_rewind(bgpstream_id_set_t *set)
 {
-  set->k = kh_begin(set->hash);
+  set->iter_c = 0;
+  set->iter_i = 0;
 }
 
 uint32_t *bgpstream_id_set_next(bgpstream_id_set_t *set)
 {
-  uint32_t *v = NULL;
-  for (; set->k != kh_end(set->hash); ++set->k) {
-    if (kh_exist(set->hash, set->k)) {
-      v = &kh_key(set->hash, set->k);
-      set->k++;
-      return v;
+  container_t *c;
+  uint64_t w;
+
+  for (; set->iter_c < set->containers_cnt; set->iter_c++, set->iter_i = 0) {
+    c = &set->containers[set->iter_c];
+    if (!c->is_bitmap) {
+      if (set->iter_i < c->card) {
+        set->iter_val = ((uint32_t)c->key << 16) | c->u.array[set->iter_i++];
+        return &set->iter_val;
+      }
+      continue;
+    }
+    // iter_i is the next bit to look at
+    while (set->iter_i < BITMAP_WORDS * 64) {
+      w = c->u.bitmap[set->iter_i >> 6] >> (set->iter_i & 63);
+      if (w == 0) {
+        set->iter_i = (set->iter_i | 63) + 1;
+        continue;
+      }
+      set->iter_i += __builtin_ctzll(w);
+      set->iter_val = ((uint32_t)c->key << 16) | set->iter_i++;
+      return &set->iter_val;
     }
   }
   return NULL;
@@ -123,17 +540,147 @@ uint32_t *bgpstream_id_set_next(bgpstream_id_set_t *set)
 
 int bgpstream_id_set_size(bgpstream_id_set_t *set)
 {
-  return kh_size(set->hash);
+  return (int)set->size;
+}
+
+size_t bgpstream_id_set_serialized_size(bgpstream_id_set_t *set)
+{
+  size_t len = 4;
+  int j;
+  for (j = 0; j < set->containers_cnt; j++) {
+    len += container_serialized_size(&set->containers[j]);
+  }
+  return len;
+}
+
+size_t bgpstream_id_set_serialize(uint8_t *buf, size_t len,
+                                  bgpstream_id_set_t *set)
+{
+  size_t written = 4;
+  container_t *c;
+  uint32_t i;
+  int j, b;
+
+  if (len < bgpstream_id_set_serialized_size(set)) {
+    return 0;
+  }
+
+  put_u32(buf, set->containers_cnt);
+  for (j = 0; j < set->containers_cnt; j++) {
+    c = &set->containers[j];
+    put_u16(buf + written, c->key);
+    put_u16(buf + written + 2, c->is_bitmap);
+    put_u32(buf + written + 4, c->card);
+    written += SER_HDR_LEN;
+    if (c->is_bitmap) {
+      // byte k holds bits 8k to 8k+7 (independent of host byte order)
+      for (i = 0; i < BITMAP_WORDS; i++) {
+        for (b = 0; b < 8; b++) {
+          buf[written++] = (c->u.bitmap[i] >> (b * 8)) & 0xFF;
+        }
+      }
+    } else {
+      for (i = 0; i < c->card; i++) {
+        put_u16(buf + written, c->u.array[i]);
+        written += 2;
+      }
+    }
+  }
+
+  return written;
+}
+
+size_t bgpstream_id_set_deserialize(bgpstream_id_set_t *set,
+                                    const uint8_t *buf, size_t len)
+{
+  size_t nread = 4;
+  container_t *c;
+  uint32_t cnt, i;
+  int j, b;
+
+  bgpstream_id_set_clear(set);
+
+  if (len < 4) {
+    return 0;
+  }
+  cnt = get_u32(buf);
+  if (cnt > UINT16_MAX + 1) {
+    return 0;
+  }
+
+  for (j = 0; j < (int)cnt; j++) {
+    if (len - nread < SER_HDR_LEN) {
+      goto err;
+    }
+    // containers must be sorted by key (so this always appends)
+    if (set->containers_cnt > 0 &&
+        set->containers[set->containers_cnt - 1].key >= get_u16(buf + nread)) {
+      goto err;
+    }
+    if ((c = get_container(set, get_u16(buf + nread))) == NULL) {
+      goto err;
+    }
+    c->card = get_u32(buf + nread + 4);
+    if (get_u16(buf + nread + 2) != 0) {
+      nread += SER_HDR_LEN;
+      if (len - nread < BITMAP_WORDS * 8 ||
+          (c->u.bitmap = calloc(BITMAP_WORDS, sizeof(uint64_t))) == NULL) {
+        c->card = 0;
+        goto err;
+      }
+      c->is_bitmap = 1;
+      for (i = 0; i < BITMAP_WORDS; i++) {
+        for (b = 0; b < 8; b++) {
+          c->u.bitmap[i] |= (uint64_t)buf[nread++] << (b * 8);
+        }
+      }
+      // don't trust the serialized cardinality
+      bitmap_recount(c);
+    } else {
+      nread += SER_HDR_LEN;
+      if (c->card == 0 || c->card > ARRAY_MAX_CARD ||
+          len - nread < c->card * sizeof(uint16_t) ||
+          (c->u.array = malloc(sizeof(uint16_t) * c->card)) == NULL) {
+        c->card = 0;
+        goto err;
+      }
+      c->alloc = c->card;
+      for (i = 0; i < c->card; i++) {
+        c->u.array[i] = get_u16(buf + nread);
+        nread += 2;
+        if (i > 0 && c->u.array[i] <= c->u.array[i - 1]) {
+          c->card = i;
+          goto err;
+        }
+      }
+    }
+  }
+  compact(set);
+
+  return nread;
+
+err:
+  bgpstream_id_set_clear(set);
+  return 0;
 }
 
 void bgpstream_id_set_destroy(bgpstream_id_set_t *set)
 {
-  kh_destroy(bgpstream_id_set, set->hash);
+  if (set == NULL) {
+    return;
+  }
+  bgpstream_id_set_clear(set);
+  free(set->containers);
   free(set);
 }
 
 void bgpstream_id_set_clear(bgpstream_id_set_t *set)
 {
+  int j;
   bgpstream_id_set_rewind(set);
-  kh_clear(bgpstream_id_set, set->hash);
+  for (j = 0; j < set->containers_cnt; j++) {
+    container_free(&set->containers[j]);
+  }
+  set->containers_cnt = 0;
+  set->size = 0;
 }
@@ -32,6 +32,10 @@
  * @brief Header file that exposes the public interface of the BGP Stream ID
  * Set.
  *
+ * IDs are stored in a compressed bitmap, so sets of 32-bit IDs that are
+ * clustered (e.g., ASNs) use much less memory than a hash table would, and
+ * membership tests are a binary search over 16-bit values at worst.
+ *
  * @author Chiara Orsini
  *
  */
@@ -66,6 +70,20 @@ bgpstream_id_set_t *bgpstream_id_set_create(void);
  */
 int bgpstream_id_set_insert(bgpstream_id_set_t *set, uint32_t id);
 
+/** Insert an array of IDs into the given set.
+ *
+ * @param set           pointer to the id set
+ * @param ids           array of ids to insert in the set
+ * @param ids_cnt       number of ids in the array
+ * @return the number of ids that were inserted (i.e., that did not already
+ * exist), -1 if an error occurred
+ *
+ * This is faster than inserting the IDs one at a time, especially if the
+ * array is sorted.
+ */
+int bgpstream_id_set_insert_bulk(bgpstream_id_set_t *set, const uint32_t *ids,
+                                 int ids_cnt);
+
 /** Check whether an ID exists in the set
  *
  * @param set           pointer to the ID set
@@ -90,6 +108,25 @@ int bgpstream_id_set_size(bgpstream_id_set_t *set);
 int bgpstream_id_set_merge(bgpstream_id_set_t *dst_set,
                            bgpstream_id_set_t *src_set);
 
+/** Intersect two ID sets
+ *
+ * @param dst_set      pointer to the set to intersect with src (only the IDs
+ *                     that are also in src are kept)
+ * @param src_set      pointer to the set to intersect dst with
+ * @return 0 if the sets were intersected successfully, -1 otherwise
+ */
+int bgpstream_id_set_intersect(bgpstream_id_set_t *dst_set,
+                               bgpstream_id_set_t *src_set);
+
+/** Subtract an ID set from another
+ *
+ * @param dst_set      pointer to the set to remove the IDs in src from
+ * @param src_set      pointer to the set of IDs to remove
+ * @return 0 if the IDs were removed successfully, -1 otherwise
+ */
+int bgpstream_id_set_subtract(bgpstream_id_set_t *dst_set,
+                              bgpstream_id_set_t *src_set);
+
 /** Reset the internal iterator
  *
  * @param set           pointer to the id set
@@ -105,6 +142,36 @@ void bgpstream_id_set_rewind(bgpstream_id_set_t *set);
  */
 uint32_t *bgpstream_id_set_next(bgpstream_id_set_t *set);
 
+/** Get the number of bytes needed to serialize the given set
+ *
+ * @param set           pointer to the id set
+ * @return the size of the serialized set
+ */
+size_t bgpstream_id_set_serialized_size(bgpstream_id_set_t *set);
+
+/** Serialize the given set into a buffer
+ *
+ * @param buf           pointer to the buffer to write the set into
+ * @param len           length of the buffer
+ * @param set           pointer to the id set to serialize
+ * @return the number of bytes written, or 0 if the buffer is too small
+ *
+ * The serialized format does not depend on the host byte order.
+ */
+size_t bgpstream_id_set_serialize(uint8_t *buf, size_t len,
+                                  bgpstream_id_set_t *set);
+
+/** Replace the contents of the given set with a serialized set
+ *
+ * @param set           pointer to the id set to populate
+ * @param buf           pointer to the serialized set
+ * @param len           length of the buffer
+ * @return the number of bytes read, or 0 if the serialized set is invalid (in
+ * which case the set is left empty)
+ */
+size_t bgpstream_id_set_deserialize(bgpstream_id_set_t *set,
+                                    const uint8_t *buf, size_t len);
+
 /** Destroy the given ID set
  *
  * @param set           pointer to the ID set to destroy
@@ -24,6 +24,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+
 #include "bgpstream_utils_ip_counter.h"
 #include "bgpstream_log.h"
 #include "bgpstream_utils_addr.h"
@@ -31,14 +32,17 @@
 #include "utils.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-/* static char buffer[INET6_ADDRSTRLEN]; */
+/* Minimum number of intervals that are buffered before being sorted and
+ * merged into the interval array. The buffer may also grow as large as the
+ * array itself, so that the cost of merging is amortized over the adds. */
+#define IPC_PENDING_MIN 4096
 
 typedef struct struct_v4pfx_int_t {
   uint32_t start;
   uint32_t end;
-  struct struct_v4pfx_int_t *next;
 } v4pfx_int_t;
 
 typedef struct struct_v6pfx_int_t {
@@ -46,376 +50,381 @@ typedef struct struct_v6pfx_int_t {
   uint64_t start_ls;
   uint64_t end_ms;
   uint64_t end_ls;
-  struct struct_v6pfx_int_t *next;
 } v6pfx_int_t;
 
-/* IP Counter Linked List */
+/* Sorted array of disjoint intervals, along with the intervals that have been
+ * added but not yet merged into it */
+typedef struct struct_v4pfx_list_t {
+  /* sorted, non-overlapping intervals */
+  v4pfx_int_t *ints;
+  /* cum[i] is the number of IPs covered by ints[0..i] */
+  uint64_t *cum;
+  int cnt;
+
+  /* unsorted intervals waiting to be merged */
+  v4pfx_int_t *pending;
+  int pending_cnt;
+  int pending_alloc_cnt;
+} v4pfx_list_t;
+
+typedef struct struct_v6pfx_list_t {
+  /* sorted, non-overlapping intervals */
+  v6pfx_int_t *ints;
+  /* cum[i] is the number of unique /64s covered by ints[0..i] */
+  uint64_t *cum;
+  int cnt;
+
+  /* unsorted intervals waiting to be merged */
+  v6pfx_int_t *pending;
+  int pending_cnt;
+  int pending_alloc_cnt;
+} v6pfx_list_t;
+
+/* IP Counter */
 struct bgpstream_ip_counter {
-  v4pfx_int_t *v4list;
-  v6pfx_int_t *v6list;
+  v4pfx_list_t v4;
+  v6pfx_list_t v6;
 };
 
-/* static void */
-/* print_pfx_int_list(bgpstream_ip_counter_t *ipc) */
-/*  {  */
-/*    v4pfx_int_t *current4 = ipc->v4list; */
-/*    bgpstream_ipv4_addr_t ip4; */
-
-/*    ip4.version = BGPSTREAM_ADDR_VERSION_IPV4;  */
-/*    while(current4 != NULL)  */
-/*      {  */
-/*        ip4.addr.s_addr = htonl(current4->start);  */
-/*        bgpstream_addr_ntop(buffer, INET_ADDRSTRLEN, &ip4);  */
-/*        printf("IP space:\t%s\t", buffer);  */
-/*        ip4.addr.s_addr = htonl(current4->end);  */
-/*        bgpstream_addr_ntop(buffer, INET_ADDRSTRLEN, &ip4);  */
-/*        printf("%s\n", buffer);  */
-/*        current4 = current4->next;  */
-/*      } */
-
-/*    v6pfx_int_t *current6 = ipc->v6list;  */
-/*    bgpstream_ipv6_addr_t ip6; */
-/*    uint64_t tmp; */
-/*    ip6.version = BGPSTREAM_ADDR_VERSION_IPV6; */
-
-/*    while(current6 != NULL)  */
-/*      { */
-/*        tmp = htonll(current6->start_ms); */
-/*        memcpy(&ip6.addr.s6_addr[0], &tmp, sizeof(uint64_t)); */
-/*        tmp = htonll(current6->start_ls); */
-/*        memcpy(&ip6.addr.s6_addr[8], &tmp, sizeof(uint64_t)); */
-/*        bgpstream_addr_ntop(buffer, INET6_ADDRSTRLEN, &ip6);  */
-/*        printf("IP space:\t%s\t", buffer); */
-/*        tmp = htonll(current6->end_ms); */
-/*        memcpy(&ip6.addr.s6_addr[0], &tmp, sizeof(uint64_t)); */
-/*        tmp = htonll(current6->end_ls); */
-/*        memcpy(&ip6.addr.s6_addr[8],&tmp, sizeof(uint64_t)); */
-/*        bgpstream_addr_ntop(buffer, INET6_ADDRSTRLEN, &ip6);  */
-/*        printf("%s\n", buffer); */
-/*        current6 = current6->next;  */
-/*      } */
-/*  }  */
-
-static void one_step_merge4(v4pfx_int_t *pil)
+/* a < b, for 128 bit values split in most/least significant halves */
+#define LT6(a_ms, a_ls, b_ms, b_ls)                                            \
+  ((a_ms) < (b_ms) || ((a_ms) == (b_ms) && (a_ls) < (b_ls)))
+
+#define IPC_MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define IPC_MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+/* Make sure arr has room for at least cnt elements */
+static int grow_array(void **arr, int *alloc_cnt, int cnt, size_t elem_size)
 {
-  v4pfx_int_t *current = pil;
-  v4pfx_int_t *previous = pil;
-  if (current->next == NULL) {
-    return;
+  void *tmp;
+  int new_cnt;
+
+  if (cnt <= *alloc_cnt) {
+    return 0;
+  }
+  new_cnt = (*alloc_cnt == 0) ? 64 : *alloc_cnt;
+  while (new_cnt < cnt) {
+    new_cnt *= 2;
+  }
+  if ((tmp = realloc(*arr, elem_size * new_cnt)) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "can't realloc IP counter array");
+    return -1;
+  }
+  *arr = tmp;
+  *alloc_cnt = new_cnt;
+  return 0;
+}
+
+static void pfx_range4(const bgpstream_ipv4_pfx_t *pfx, uint32_t *start,
+                       uint32_t *end)
+{
+  uint32_t mask = ~(uint32_t)(((uint64_t)1 << (32 - pfx->mask_len)) - 1);
+  *start = ntohl(pfx->address.addr.s_addr) & mask;
+  *end = *start | ~mask;
+}
+
+static void pfx_range6(const bgpstream_ipv6_pfx_t *pfx, uint64_t *start_ms,
+                       uint64_t *start_ls, uint64_t *end_ms, uint64_t *end_ls)
+{
+  uint64_t mask_ms;
+  uint64_t mask_ls;
+
+  if (pfx->mask_len > 64) {
+    mask_ms = ~(uint64_t)0;
+    mask_ls = (pfx->mask_len == 128)
+                ? ~(uint64_t)0
+                : ~(((uint64_t)1 << (128 - pfx->mask_len)) - 1);
+  } else {
+    mask_ms = (pfx->mask_len == 0)
+                ? 0
+                : ~(((uint64_t)1 << (64 - pfx->mask_len)) - 1);
+    mask_ls = 0;
   }
-  current = current->next;
 
-  while (current != NULL) {
-    if (current->start <= previous->end) {
-      if (current->end > previous->end) {
-        previous->end = current->end;
+  *start_ms = nptohll(&pfx->address.addr.s6_addr[0]) & mask_ms;
+  *start_ls = nptohll(&pfx->address.addr.s6_addr[8]) & mask_ls;
+  *end_ms = *start_ms | ~mask_ms;
+  *end_ls = *start_ls | ~mask_ls;
+}
+
+/* ========== IPv4 ========== */
+
+static int int4_cmp(const void *a, const void *b)
+{
+  const v4pfx_int_t *ia = a;
+  const v4pfx_int_t *ib = b;
+  return (ia->start > ib->start) - (ia->start < ib->start);
+}
+
+/* Sort the pending intervals and merge them into the interval array */
+static int flush4(v4pfx_list_t *l)
+{
+  v4pfx_int_t *out = NULL;
+  uint64_t *cum = NULL;
+  v4pfx_int_t *next;
+  int i = 0, j = 0, n = 0;
+  int alloc_cnt = l->cnt + l->pending_cnt;
+
+  if (l->pending_cnt == 0) {
+    return 0;
+  }
+  qsort(l->pending, l->pending_cnt, sizeof(v4pfx_int_t), int4_cmp);
+
+  if ((out = malloc(sizeof(v4pfx_int_t) * alloc_cnt)) == NULL ||
+      (cum = realloc(l->cum, sizeof(uint64_t) * alloc_cnt)) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "can't malloc IP counter intervals");
+    free(out);
+    return -1;
+  }
+  l->cum = cum;
+
+  /* both inputs are sorted by start, so an interval can only overlap with the
+   * last one that was written out */
+  while (i < l->cnt || j < l->pending_cnt) {
+    if (j == l->pending_cnt ||
+        (i < l->cnt && l->ints[i].start <= l->pending[j].start)) {
+      next = &l->ints[i++];
+    } else {
+      next = &l->pending[j++];
+    }
+    if (n > 0 && next->start <= out[n - 1].end) {
+      if (next->end > out[n - 1].end) {
+        out[n - 1].end = next->end;
       }
-      previous->next = current->next;
-      free(current);
-      current = previous->next;
     } else {
-      break;
+      out[n++] = *next;
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    cum[i] = (uint64_t)(out[i].end - out[i].start) + 1;
+    if (i > 0) {
+      cum[i] += cum[i - 1];
     }
   }
+
+  free(l->ints);
+  l->ints = out;
+  l->cnt = n;
+  l->pending_cnt = 0;
+  return 0;
 }
 
-static void one_step_merge6(v6pfx_int_t *pil)
+static int add4(v4pfx_list_t *l, uint32_t start, uint32_t end)
 {
-  v6pfx_int_t *current = pil;
-  v6pfx_int_t *previous = pil;
-  if (current->next == NULL) {
-    return;
+  if (grow_array((void **)&l->pending, &l->pending_alloc_cnt,
+                 l->pending_cnt + 1, sizeof(v4pfx_int_t)) != 0) {
+    return -1;
   }
-  current = current->next;
+  l->pending[l->pending_cnt].start = start;
+  l->pending[l->pending_cnt].end = end;
+  l->pending_cnt++;
 
-  while (current != NULL) {
+  if (l->pending_cnt >= IPC_PENDING_MIN && l->pending_cnt >= l->cnt) {
+    return flush4(l);
+  }
+  return 0;
+}
 
-    /* current->start <= previous->end */
-    if (current->start_ms < previous->end_ms ||
-        (current->start_ms == previous->end_ms &&
-         current->start_ls <= previous->end_ls)) {
-      /* current->end > previous->end */
-      if (current->end_ms > previous->end_ms ||
-          (current->end_ms == previous->end_ms &&
-           current->end_ls > previous->end_ls)) {
-        previous->end_ms = current->end_ms;
-        previous->end_ls = current->end_ls;
-      }
-      previous->next = current->next;
-      free(current);
-      current = previous->next;
+/* Index of the first interval that ends at or after addr */
+static int first_ending_after4(const v4pfx_list_t *l, uint32_t addr)
+{
+  int lo = 0, hi = l->cnt, mid;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (l->ints[mid].end < addr) {
+      lo = mid + 1;
     } else {
-      break;
+      hi = mid;
     }
   }
+  return lo;
 }
 
-static int merge_in_sorted_queue4(v4pfx_int_t **pil, uint32_t start,
-                                  uint32_t end)
+/* Index of the last interval that starts at or before addr */
+static int last_starting_before4(const v4pfx_list_t *l, uint32_t addr)
 {
-  // create new v4pfx_int_t
-  v4pfx_int_t *p = NULL;
-  v4pfx_int_t *previous = *pil;
-  v4pfx_int_t *current = *pil;
-
-  while (current != NULL) {
-    if (start > current->end) {
-      previous = current;
-      current = current->next;
-      continue;
-    }
-    if (end < current->start) {
-      /* found a position where to insert  */
-      if ((p = (v4pfx_int_t *)malloc_zero(sizeof(v4pfx_int_t))) == NULL) {
-        bgpstream_log(BGPSTREAM_LOG_ERR,
-                      "can't malloc v4pfx_int_t structure");
-        return -1;
-      }
-      p->start = start;
-      p->end = end;
-      p->next = NULL;
-      if (previous != current) {
-        previous->next = p;
-      } else {
-        *pil = p;
-      }
-      p->next = current;
-      return 0;
-    }
-    /* At this point S <= cE and E >= cS
-     * so we can merge them */
-    if (current->start > start) {
-      current->start = start;
-    }
-    if (current->end < end) {
-      current->end = end;
+  int lo = 0, hi = l->cnt, mid;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (l->ints[mid].start <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
-    /* Now check from here on if there are other things
-     * to merge */
-    one_step_merge4(current);
+  }
+  return lo - 1;
+}
+
+static uint64_t bgpstream_ip_counter_is_overlapping4(
+    bgpstream_ip_counter_t *ipc,
+    bgpstream_ipv4_pfx_t *pfx,
+    uint8_t *more_specific)
+{
+  v4pfx_list_t *l = &ipc->v4;
+  uint32_t start, end;
+  int i, j;
+
+  *more_specific = 0;
+  if (flush4(l) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_WARN,
+                  "IP counter overlap computed on partial data");
+  }
+  pfx_range4(pfx, &start, &end);
+
+  /* intervals i..j are the ones that overlap with the prefix */
+  i = first_ending_after4(l, start);
+  j = last_starting_before4(l, end);
+  if (i > j) {
     return 0;
   }
 
-  /*   if here we didn't find a place where to insert the
-   * interval, it is either the first position or the last */
-  if ((p = (v4pfx_int_t *)malloc_zero(sizeof(v4pfx_int_t))) == NULL) {
-    bgpstream_log(BGPSTREAM_LOG_ERR, "can't malloc v4pfx_int_t structure");
+  if (l->ints[i].start <= start && l->ints[i].end >= end) {
+    /* a single interval covers the whole prefix */
+    *more_specific = 1;
+    return (uint64_t)(end - start) + 1;
+  }
+  if (i == j) {
+    return (uint64_t)(IPC_MIN(l->ints[i].end, end) -
+                      IPC_MAX(l->ints[i].start, start)) +
+           1;
+  }
+  /* only the first and last interval can be partially covered */
+  return (uint64_t)(l->ints[i].end - IPC_MAX(l->ints[i].start, start)) + 1 +
+         (l->cum[j - 1] - l->cum[i]) +
+         (uint64_t)(IPC_MIN(l->ints[j].end, end) - l->ints[j].start) + 1;
+}
+
+/* ========== IPv6 ========== */
+
+static int int6_cmp(const void *a, const void *b)
+{
+  const v6pfx_int_t *ia = a;
+  const v6pfx_int_t *ib = b;
+  if (LT6(ia->start_ms, ia->start_ls, ib->start_ms, ib->start_ls)) {
     return -1;
   }
-  p->start = start;
-  p->end = end;
-  p->next = NULL;
-  /* adding at the beginning of the queue */
-  if (previous == current) {
-    *pil = p;
-    return 0;
+  if (LT6(ib->start_ms, ib->start_ls, ia->start_ms, ia->start_ls)) {
+    return 1;
   }
-  // adding at the end of the queue
-  previous->next = p;
   return 0;
 }
 
-static int merge_in_sorted_queue6(v6pfx_int_t **pil, uint64_t start_ms,
-                                  uint64_t start_ls, uint64_t end_ms,
-                                  uint64_t end_ls)
+/* Sort the pending intervals and merge them into the interval array */
+static int flush6(v6pfx_list_t *l)
 {
-  // create new v4pfx_int_t
-  v6pfx_int_t *p = NULL;
-  v6pfx_int_t *previous = *pil;
-  v6pfx_int_t *current = *pil;
-
-  while (current != NULL) {
-    /* start > current->end */
-    if (start_ms > current->end_ms ||
-        (start_ms == current->end_ms && start_ls > current->end_ls)) {
-      previous = current;
-      current = current->next;
-      continue;
+  v6pfx_int_t *out = NULL;
+  uint64_t *cum = NULL;
+  v6pfx_int_t *next, *last;
+  int i = 0, j = 0, n = 0;
+  int alloc_cnt = l->cnt + l->pending_cnt;
+
+  if (l->pending_cnt == 0) {
+    return 0;
+  }
+  qsort(l->pending, l->pending_cnt, sizeof(v6pfx_int_t), int6_cmp);
+
+  if ((out = malloc(sizeof(v6pfx_int_t) * alloc_cnt)) == NULL ||
+      (cum = realloc(l->cum, sizeof(uint64_t) * alloc_cnt)) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "can't malloc IP counter intervals");
+    free(out);
+    return -1;
+  }
+  l->cum = cum;
+
+  /* both inputs are sorted by start, so an interval can only overlap with the
+   * last one that was written out */
+  while (i < l->cnt || j < l->pending_cnt) {
+    if (j == l->pending_cnt ||
+        (i < l->cnt && !LT6(l->pending[j].start_ms, l->pending[j].start_ls,
+                            l->ints[i].start_ms, l->ints[i].start_ls))) {
+      next = &l->ints[i++];
+    } else {
+      next = &l->pending[j++];
     }
-    /* end < current->start */
-    if (end_ms < current->start_ms ||
-        (end_ms == current->start_ms && end_ls < current->start_ls)) {
-      /* found a position where to insert  */
-      if ((p = (v6pfx_int_t *)malloc_zero(sizeof(v6pfx_int_t))) == NULL) {
-        bgpstream_log(BGPSTREAM_LOG_ERR,
-                      "can't malloc v6pfx_int_t structure");
-        return -1;
-      }
-      p->start_ms = start_ms;
-      p->start_ls = start_ls;
-      p->end_ms = end_ms;
-      p->end_ls = end_ls;
-      p->next = NULL;
-      if (previous != current) {
-        previous->next = p;
-      } else {
-        *pil = p;
+    last = (n > 0) ? &out[n - 1] : NULL;
+    if (last != NULL &&
+        !LT6(last->end_ms, last->end_ls, next->start_ms, next->start_ls)) {
+      if (LT6(last->end_ms, last->end_ls, next->end_ms, next->end_ls)) {
+        last->end_ms = next->end_ms;
+        last->end_ls = next->end_ls;
       }
-      p->next = current;
-      return 0;
-    }
-    /* At this point S <= cE and E >= cS
-     * so we can merge them */
-    /* current->start > start */
-    if (current->start_ms > start_ms ||
-        (current->start_ms == start_ms && current->start_ls > start_ls)) {
-      current->start_ms = start_ms;
-      current->start_ls = start_ls;
+    } else {
+      out[n++] = *next;
     }
-    /* current->end < end */
-    if (current->end_ms < end_ms ||
-        (current->end_ms == end_ms && current->end_ls < end_ls)) {
-      current->end_ms = end_ms;
-      current->end_ls = end_ls;
+  }
+
+  /* several disjoint intervals may fall within the same /64, which must only
+   * be counted once */
+  for (i = 0; i < n; i++) {
+    cum[i] = out[i].end_ms - out[i].start_ms + 1;
+    if (i > 0) {
+      if (out[i].start_ms == out[i - 1].end_ms) {
+        cum[i]--;
+      }
+      cum[i] += cum[i - 1];
     }
-    /* Now check from here on if there are other things
-     * to merge */
-    one_step_merge6(current);
-    return 0;
   }
 
-  /*   if here we didn't find a place where to insert the
-   * interval, it is either the first position or the last */
-  if ((p = (v6pfx_int_t *)malloc_zero(sizeof(v6pfx_int_t))) == NULL) {
-    bgpstream_log(BGPSTREAM_LOG_ERR, "can't malloc v6pfx_int_t structure");
+  free(l->ints);
+  l->ints = out;
+  l->cnt = n;
+  l->pending_cnt = 0;
+  return 0;
+}
+
+static int add6(v6pfx_list_t *l, uint64_t start_ms, uint64_t start_ls,
+                uint64_t end_ms, uint64_t end_ls)
+{
+  v6pfx_int_t *p;
+
+  if (grow_array((void **)&l->pending, &l->pending_alloc_cnt,
+                 l->pending_cnt + 1, sizeof(v6pfx_int_t)) != 0) {
     return -1;
   }
+  p = &l->pending[l->pending_cnt++];
   p->start_ms = start_ms;
   p->start_ls = start_ls;
   p->end_ms = end_ms;
   p->end_ls = end_ls;
-  p->next = NULL;
-  /* adding at the beginning of the queue */
-  if (previous == current) {
-    *pil = p;
-    return 0;
-  }
-  // adding at the end of the queue
-  previous->next = p;
-  return 0;
-}
 
-bgpstream_ip_counter_t *bgpstream_ip_counter_create()
-{
-  bgpstream_ip_counter_t *ipc;
-  if ((ipc = (bgpstream_ip_counter_t *)malloc_zero(
-         sizeof(bgpstream_ip_counter_t))) == NULL) {
-    bgpstream_log(BGPSTREAM_LOG_ERR,
-                  "can't malloc bgpstream_ip_counter_t structure");
-    return NULL;
+  if (l->pending_cnt >= IPC_PENDING_MIN && l->pending_cnt >= l->cnt) {
+    return flush6(l);
   }
-  ipc->v4list = NULL;
-  ipc->v6list = NULL;
-  return ipc;
+  return 0;
 }
 
-int bgpstream_ip_counter_add(bgpstream_ip_counter_t *ipc, bgpstream_pfx_t *pfx)
+/* Index of the first interval that ends at or after addr */
+static int first_ending_after6(const v6pfx_list_t *l, uint64_t addr_ms,
+                               uint64_t addr_ls)
 {
-  uint32_t start;
-  uint32_t end;
-  uint32_t mask;
-  unsigned char *tmp;
-  uint64_t start_ms = 0;
-  uint64_t start_ls = 0;
-  uint64_t end_ms = 0;
-  uint64_t end_ls = 0;
-  uint64_t mask_ms;
-  uint64_t mask_ls;
-
-  if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
-    mask = ~(((uint64_t)1 << (32 - pfx->mask_len)) - 1);
-    start = ntohl(pfx->address.bs_ipv4.addr.s_addr);
-    start = start & mask;
-    end = start | (~mask);
-    return merge_in_sorted_queue4(&ipc->v4list, start, end);
-  } else {
-    if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV6) {
-      tmp = &pfx->address.bs_ipv6.addr.s6_addr[0];
-      start_ms = nptohll(tmp);
-      tmp = &pfx->address.bs_ipv6.addr.s6_addr[8];
-      start_ls = nptohll(tmp);
-      /* printf("+++++++++  %"PRIu64" %"PRIu64"\n", start_ms, start_ls); */
-      if (pfx->mask_len > 64) {
-        /* len_ms = 0 */
-        mask_ms = ~((uint64_t)0);
-        /* len_ls = 64 - (pfx->mask_len - 64); */
-        mask_ls = ~(((uint64_t)1 << (64 - (pfx->mask_len - 64))) - 1);
-      } else {
-        /* len_ms = 64 - pfx->mask_len; */
-        mask_ms = ~(((uint64_t)1 << (64 - pfx->mask_len)) - 1);
-        /* len_ls = 64; */
-        /* mask_ls = ~( ((uint64_t)1 << 64) - 1); */
-        mask_ls = 0;
-      }
-
-      /* printf("MASKS:  %"PRIu64" %"PRIu64"\n", mask_ms, mask_ls); */
-
-      /* most significant */
-      start_ms = start_ms & mask_ms;
-      end_ms = start_ms | (~mask_ms);
-      /* printf("MS:  %"PRIu64" %"PRIu64"\n", start_ms, end_ms); */
-
-      /* least significant */
-      start_ls = start_ls & mask_ls;
-      end_ls = start_ls | (~mask_ls);
-      /* printf("LS:  %"PRIu64" %"PRIu64"\n", start_ls, end_ls); */
-
-      return merge_in_sorted_queue6(&ipc->v6list, start_ms, start_ls, end_ms,
-                                    end_ls);
+  int lo = 0, hi = l->cnt, mid;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (LT6(l->ints[mid].end_ms, l->ints[mid].end_ls, addr_ms, addr_ls)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
   }
-  /* print_pfx_int_list(ipc); */
-  return 0;
+  return lo;
 }
 
-static uint32_t bgpstream_ip_counter_is_overlapping4(
-    bgpstream_ip_counter_t *ipc,
-    bgpstream_ipv4_pfx_t *pfx,
-    uint8_t *more_specific)
+/* Index of the last interval that starts at or before addr */
+static int last_starting_before6(const v6pfx_list_t *l, uint64_t addr_ms,
+                                 uint64_t addr_ls)
 {
-  v4pfx_int_t *current = ipc->v4list;
-  uint32_t start = 0;
-  uint32_t end = 0;
-  uint32_t len = 0;
-  uint32_t pfx_size;
-  uint32_t overlap_count = 0;
-  *more_specific = 0;
-  len = 32 - pfx->mask_len;
-  start = ntohl(pfx->address.addr.s_addr);
-  start = (start >> len) << len;
-  end = 0;
-  end = ~end;
-  end = (end >> len) << len;
-  end = start | (~end);
-  pfx_size = end - start + 1;
-  /* intersection endpoints */
-  uint32_t int_start;
-  uint32_t int_end;
-  while (current != NULL) {
-    if (current->start > end) {
-      break;
-    }
-    if (current->end < start) {
-      current = current->next;
-      continue;
-    }
-    /* there is some overlap
-     * max(start) and min(end) */
-    int_start = current->start;
-    int_end = current->end;
-    if (current->start < start) {
-      int_start = start;
-    }
-    if (current->end > end) {
-      int_end = end;
-    }
-    if ((int_end - int_start + 1) == pfx_size) {
-      *more_specific = 1;
+  int lo = 0, hi = l->cnt, mid;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (!LT6(addr_ms, addr_ls, l->ints[mid].start_ms,
+             l->ints[mid].start_ls)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
-    overlap_count += int_end - int_start + 1;
-    current = current->next;
   }
-  return overlap_count;
+  return lo - 1;
 }
 
 static uint64_t bgpstream_ip_counter_is_overlapping6(
@@ -423,107 +432,117 @@ static uint64_t bgpstream_ip_counter_is_overlapping6(
     bgpstream_ipv6_pfx_t *pfx,
     uint8_t *more_specific)
 {
-  v6pfx_int_t *current = ipc->v6list;
-  v6pfx_int_t *previous = ipc->v6list;
+  v6pfx_list_t *l = &ipc->v6;
+  uint64_t start_ms, start_ls, end_ms, end_ls;
+  uint64_t first_ms, last_ms;
+  int i, j, p, q;
 
-  uint64_t start_ms = 0;
-  uint64_t start_ls = 0;
-  uint64_t end_ms = 0;
-  uint64_t end_ls = 0;
-  uint64_t mask_ms;
-  uint64_t mask_ls;
-  unsigned char *tmp;
-  uint64_t overlap_count = 0;
-  uint64_t pfx_size;
   *more_specific = 0;
+  if (flush6(l) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_WARN,
+                  "IP counter overlap computed on partial data");
+  }
+  pfx_range6(pfx, &start_ms, &start_ls, &end_ms, &end_ls);
 
-  tmp = &(pfx->address.addr.s6_addr[0]);
-  start_ms = nptohll(tmp);
-  tmp = &(pfx->address.addr.s6_addr[8]);
-  start_ls = nptohll(tmp);
+  /* intervals i..j are the ones that overlap with the prefix */
+  i = first_ending_after6(l, start_ms, start_ls);
+  j = last_starting_before6(l, end_ms, end_ls);
+  if (i > j) {
+    return 0;
+  }
 
-  /* printf("+++++++++  %"PRIu64" %"PRIu64"\n", start_ms, start_ls); */
-  if (pfx->mask_len > 64) {
-    /* len_ms = 0 */
-    mask_ms = ~((uint64_t)0);
-    /* len_ls = 64 - (pfx->mask_len - 64); */
-    mask_ls = ~(((uint64_t)1 << (64 - (pfx->mask_len - 64))) - 1);
-  } else {
-    /* len_ms = 64 - pfx->mask_len; */
-    mask_ms = ~(((uint64_t)1 << (64 - pfx->mask_len)) - 1);
-    /* len_ls = 64; */
-    /* mask_ls = ~( ((uint64_t)1 << 64) - 1); */
-    mask_ls = 0;
+  /* the prefix is a more specific (at /64 granularity) if one of the
+   * overlapping intervals spans all of its /64s, i.e., if one of them both
+   * starts in or before the first /64 (p is the last such interval) and ends
+   * in or after the last /64 (q is the first such interval) */
+  p = last_starting_before6(l, start_ms, ~(uint64_t)0);
+  q = first_ending_after6(l, end_ms, 0);
+  if (IPC_MAX(q, i) <= IPC_MIN(p, j)) {
+    *more_specific = 1;
+    return end_ms - start_ms + 1;
   }
 
-  /* printf("MASKS:  %"PRIu64" %"PRIu64"\n", mask_ms, mask_ls); */
+  first_ms = IPC_MAX(l->ints[i].start_ms, start_ms);
+  if (i == j) {
+    return IPC_MIN(l->ints[i].end_ms, end_ms) - first_ms + 1;
+  }
+  /* only the first and last interval can be partially covered */
+  last_ms = IPC_MIN(l->ints[j].end_ms, end_ms);
+  return (l->ints[i].end_ms - first_ms + 1) + (l->cum[j - 1] - l->cum[i]) +
+         (last_ms - l->ints[j].start_ms + 1) -
+         (l->ints[j].start_ms == l->ints[j - 1].end_ms);
+}
 
-  /* most significant */
-  start_ms = start_ms & mask_ms;
-  end_ms = start_ms | (~mask_ms);
-  /* printf("MS:  %"PRIu64" %"PRIu64"\n", start_ms, end_ms); */
+/* ========== PUBLIC FUNCTIONS ========== */
 
-  /* least significant */
-  start_ls = start_ls & mask_ls;
-  end_ls = start_ls | (~mask_ls);
-  /* printf("LS:  %"PRIu64" %"PRIu64"\n", start_ls, end_ls); */
+bgpstream_ip_counter_t *bgpstream_ip_counter_create()
+{
+  bgpstream_ip_counter_t *ipc;
+  if ((ipc = (bgpstream_ip_counter_t *)malloc_zero(
+         sizeof(bgpstream_ip_counter_t))) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "can't malloc bgpstream_ip_counter_t structure");
+    return NULL;
+  }
+  return ipc;
+}
 
-  pfx_size = end_ms - start_ms + 1;
+int bgpstream_ip_counter_add(bgpstream_ip_counter_t *ipc, bgpstream_pfx_t *pfx)
+{
+  uint32_t start, end;
+  uint64_t start_ms, start_ls, end_ms, end_ls;
 
-  /* intersection endpoints
-   * (only most significant)*/
-  uint64_t int_start_ms;
-  uint64_t int_end_ms;
+  if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+    pfx_range4(&pfx->bs_ipv4, &start, &end);
+    return add4(&ipc->v4, start, end);
+  } else if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV6) {
+    pfx_range6(&pfx->bs_ipv6, &start_ms, &start_ls, &end_ms, &end_ls);
+    return add6(&ipc->v6, start_ms, start_ls, end_ms, end_ls);
+  }
+  return 0;
+}
 
-  while (current != NULL) {
-    /* current->start > end */
-    if (current->start_ms > end_ms ||
-        (current->start_ms == end_ms && current->start_ls > end_ls)) {
-      break;
-    }
-    /* current->end < start */
-    if (current->end_ms < start_ms ||
-        (current->end_ms == start_ms && current->end_ms < start_ls)) {
-      previous = current;
-      current = current->next;
-      continue;
-    }
-    /* there is some overlap
-     * max(start) and min(end) */
-    int_start_ms = current->start_ms;
-    int_end_ms = current->end_ms;
-    /* int_start_ls = current->start_ls; */
-    /* int_end_ls = current->end_ls; */
-    /* current->start < start */
-    if (current->start_ms < start_ms ||
-        (current->start_ms == start_ms && current->start_ms < start_ls)) {
-      int_start_ms = start_ms;
-      /* int_start_ls = start_ls; */
-    }
-    /* current->end > end */
-    if (current->end_ms > end_ms ||
-        (current->end_ms == end_ms && current->end_ls > end_ls)) {
-      int_end_ms = end_ms;
-      /* int_end_ls = end_ls; */
+int bgpstream_ip_counter_add_bulk(bgpstream_ip_counter_t *ipc,
+                                  const bgpstream_pfx_t *pfxs, int pfxs_cnt)
+{
+  v4pfx_list_t *l4 = &ipc->v4;
+  v6pfx_list_t *l6 = &ipc->v6;
+  v6pfx_int_t *p;
+  int v4_cnt = 0, v6_cnt = 0;
+  int i;
+
+  for (i = 0; i < pfxs_cnt; i++) {
+    if (pfxs[i].address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+      v4_cnt++;
+    } else if (pfxs[i].address.version == BGPSTREAM_ADDR_VERSION_IPV6) {
+      v6_cnt++;
     }
-    if (previous != current) {
-      if (current->start_ms != previous->start_ms ||
-          current->end_ms != previous->end_ms) {
-        if ((int_end_ms - int_start_ms + 1) == pfx_size) {
-          *more_specific = 1;
-        }
-        overlap_count += int_end_ms - int_start_ms + 1;
-      }
-    } else {
-      if ((int_end_ms - int_start_ms + 1) == pfx_size) {
-        *more_specific = 1;
-      }
-      overlap_count += int_end_ms - int_start_ms + 1;
+  }
+
+  /* make room for all the prefixes up front, then merge everything at once */
+  if (grow_array((void **)&l4->pending, &l4->pending_alloc_cnt,
+                 l4->pending_cnt + v4_cnt, sizeof(v4pfx_int_t)) != 0 ||
+      grow_array((void **)&l6->pending, &l6->pending_alloc_cnt,
+                 l6->pending_cnt + v6_cnt, sizeof(v6pfx_int_t)) != 0) {
+    return -1;
+  }
+
+  for (i = 0; i < pfxs_cnt; i++) {
+    if (pfxs[i].address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+      pfx_range4(&pfxs[i].bs_ipv4, &l4->pending[l4->pending_cnt].start,
+                 &l4->pending[l4->pending_cnt].end);
+      l4->pending_cnt++;
+    } else if (pfxs[i].address.version == BGPSTREAM_ADDR_VERSION_IPV6) {
+      p = &l6->pending[l6->pending_cnt++];
+      pfx_range6(&pfxs[i].bs_ipv6, &p->start_ms, &p->start_ls, &p->end_ms,
+                 &p->end_ls);
     }
-    previous = current;
-    current = current->next;
   }
-  return overlap_count;
+
+  if (flush4(l4) != 0 || flush6(l6) != 0) {
+    return -1;
+  }
+  return 0;
 }
 
 uint64_t bgpstream_ip_counter_is_overlapping(bgpstream_ip_counter_t *ipc,
@@ -546,63 +565,39 @@ uint64_t bgpstream_ip_counter_is_overlapping(bgpstream_ip_counter_t *ipc,
 uint64_t bgpstream_ip_counter_get_ipcount(bgpstream_ip_counter_t *ipc,
                                           bgpstream_addr_version_t v)
 {
-  uint64_t ip_count = 0;
-
-  v4pfx_int_t *current4 = ipc->v4list;
-  v6pfx_int_t *current6 = ipc->v6list;
-  v6pfx_int_t *previous6 = ipc->v6list;
-
   if (v == BGPSTREAM_ADDR_VERSION_IPV4) {
-    while (current4 != NULL) {
-      ip_count += (current4->end - current4->start) + 1;
-      current4 = current4->next;
+    if (flush4(&ipc->v4) != 0) {
+      bgpstream_log(BGPSTREAM_LOG_WARN, "IP count computed on partial data");
     }
-  } else {
-    if (v == BGPSTREAM_ADDR_VERSION_IPV6) {
-      while (current6 != NULL) {
-
-        if (previous6 != current6) {
-          /* add a new /64 to the count if the previous one
-           * was different (it could have been a /64+ */
-          if (current6->start_ms != previous6->start_ms ||
-              current6->end_ms != previous6->end_ms) {
-            ip_count += (current6->end_ms - current6->start_ms) + 1;
-          }
-        } else { /* if it is the first interval, than we always add it */
-          ip_count += (current6->end_ms - current6->start_ms) + 1;
-        }
-        previous6 = current6;
-        current6 = current6->next;
-      }
+    return (ipc->v4.cnt == 0) ? 0 : ipc->v4.cum[ipc->v4.cnt - 1];
+  } else if (v == BGPSTREAM_ADDR_VERSION_IPV6) {
+    if (flush6(&ipc->v6) != 0) {
+      bgpstream_log(BGPSTREAM_LOG_WARN, "IP count computed on partial data");
     }
+    return (ipc->v6.cnt == 0) ? 0 : ipc->v6.cum[ipc->v6.cnt - 1];
   }
-  return ip_count;
+  return 0;
 }
 
 void bgpstream_ip_counter_clear(bgpstream_ip_counter_t *ipc)
 {
-  v4pfx_int_t *current4 = ipc->v4list;
-  v4pfx_int_t *tmp4 = ipc->v4list;
-  v6pfx_int_t *current6 = ipc->v6list;
-  v6pfx_int_t *tmp6 = ipc->v6list;
-
-  while (tmp4 != NULL) {
-    current4 = tmp4;
-    tmp4 = tmp4->next;
-    free(current4);
-  }
-  ipc->v4list = NULL;
-
-  while (tmp6 != NULL) {
-    current6 = tmp6;
-    tmp6 = tmp6->next;
-    free(current6);
-  }
-  ipc->v6list = NULL;
+  /* keep the arrays around for reuse */
+  ipc->v4.cnt = 0;
+  ipc->v4.pending_cnt = 0;
+  ipc->v6.cnt = 0;
+  ipc->v6.pending_cnt = 0;
 }
 
 void bgpstream_ip_counter_destroy(bgpstream_ip_counter_t *ipc)
 {
-  bgpstream_ip_counter_clear(ipc);
+  if (ipc == NULL) {
+    return;
+  }
+  free(ipc->v4.ints);
+  free(ipc->v4.cum);
+  free(ipc->v4.pending);
+  free(ipc->v6.ints);
+  free(ipc->v6.cum);
+  free(ipc->v6.pending);
   free(ipc);
 }
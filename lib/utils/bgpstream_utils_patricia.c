@@ -43,6 +43,8 @@
 #include <assert.h>
 #include <limits.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -59,6 +61,18 @@
 
 #define BGPSTREAM_PATRICIA_MAXBITS 128
 
+/* smallest number of prefixes worth handing to a sorting thread */
+#define BPT_SORT_MIN_RUN 65536
+
+/* number of retired objects that triggers a reclamation attempt */
+#define BPT_RECLAIM_BATCH 1024
+
+/* Links that concurrent readers follow are read with acquire and published
+ * with release semantics, so that a reader never sees a node before it has
+ * been fully initialized */
+#define BPT_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define BPT_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
 // Test the n'th bit in the array of bytes starting at *p.
 // In byte 0, most significant bit is 0, least is 7.
 #define BIT_ARRAY_TEST(p, n) (((p)[(n) >> 3]) & (0x80 >> ((n) & 0x07)))
@@ -84,32 +98,121 @@ static int comp_with_mask(const void *addr, const void *dest, u_int mask)
   return (0);
 }
 
+/* Nodes are not individually malloc'd: each IP version has its own pool of
+ * fixed-size chunks, and nodes refer to each other by 32-bit index into that
+ * pool rather than by pointer. Chunks are never moved once allocated, so the
+ * node pointers handed out by the public API stay valid until the node is
+ * removed (or the tree cleared). */
+
+/* index 0 is never handed out, so it doubles as the NULL index */
+#define BPT_NIL 0
+
+/* the parent index shares a 32-bit word with the actual flag */
+#define BPT_MAX_NODES 0x7fffffff
+#define BPT_ACTUAL_FLAG 0x80000000
+
+/* number of nodes per pool chunk */
+#define BPT_CHUNK_BITS 12
+#define BPT_CHUNK_SIZE (1 << BPT_CHUNK_BITS)
+#define BPT_CHUNK_MASK (BPT_CHUNK_SIZE - 1)
+
+/* The IPv6 node layout. IPv4 nodes use the same layout, but only have room
+ * for a bgpstream_ipv4_pfx_t (see bpt_node4_t), which is fine since all the
+ * pfx/addr utility functions only touch the bytes used by the prefix
+ * version. */
 struct bgpstream_patricia_node {
 
-  /* flag: 0 = glue node, 1 = actual prefix */
-  uint8_t actual;
+  /* pointer to user data */
+  void *user;
+
+  /* left and right children */
+  uint32_t l;
+  uint32_t r;
+
+  /* parent node (low 31 bits) and flag (top bit): 0 = glue node, 1 = actual
+   * prefix. Use BPT_PARENT/BPT_ACTUAL and bpt_set_parent/bpt_set_actual. */
+  uint32_t parent_actual;
 
   /* who we are in patricia tree */
   bgpstream_pfx_t prefix;
+};
 
-  /* left and right children */
-  bgpstream_patricia_node_t *l;
-  bgpstream_patricia_node_t *r;
+/* Compact IPv4 node layout (32 bytes rather than 48) */
+typedef struct bpt_node4 {
+  void *user;
+  uint32_t l;
+  uint32_t r;
+  uint32_t parent_actual;
+  bgpstream_ipv4_pfx_t prefix;
+} bpt_node4_t;
 
-  /* parent node */
-  bgpstream_patricia_node_t *parent;
+/* Pool of nodes for one IP version */
+typedef struct bpt_pool {
 
-  /* pointer to user data */
-  void *user;
+  /* array of chunks of BPT_CHUNK_SIZE nodes each */
+  uint8_t **chunks;
+
+  /* number of chunks allocated */
+  uint32_t chunks_cnt;
+
+  /* allocated length of the chunks array */
+  uint32_t chunks_alloc_cnt;
+
+  /* size of a single node in this pool */
+  size_t node_size;
+
+  /* index of the first node that has never been used */
+  uint32_t used;
+
+  /* head of the list of removed nodes (linked through their l index) */
+  uint32_t free_head;
+
+  /* index of the root of the tree */
+  uint32_t head;
+
+} bpt_pool_t;
+
+typedef enum {
+  BPT_RETIRED_NODE4,
+  BPT_RETIRED_NODE6,
+  BPT_RETIRED_USER,
+  BPT_RETIRED_MEM,
+} bpt_retired_type_t;
+
+/* Something that was removed from the tree while in concurrent mode, and
+ * that cannot be released until no reader can be using it any more */
+typedef struct bpt_retired {
+
+  /* global epoch at the time the object was retired */
+  uint64_t epoch;
+
+  bpt_retired_type_t type;
+
+  /* node index (for nodes) */
+  uint32_t idx;
+
+  /* user data or memory to free */
+  void *ptr;
+
+} bpt_retired_t;
+
+struct bgpstream_patricia_tree_reader {
+
+  /* global epoch when the reader entered its current read-side critical
+   * section, or 0 if it is not in one */
+  uint64_t epoch;
+
+  /* tree this reader is registered with */
+  bgpstream_patricia_tree_t *pt;
 };
 
 struct bgpstream_patricia_tree {
 
   /* IPv4 tree */
-  bgpstream_patricia_node_t *head4;
+  bpt_pool_t pool4;
 
   /* IPv6 tree */
-  bgpstream_patricia_node_t *head6;
+  bpt_pool_t pool6;
 
   /* Number of nodes per tree */
   uint64_t ipv4_active_nodes;
@@ -118,6 +221,28 @@ struct bgpstream_patricia_tree {
   /** Pointer to a function that destroys the user structure
    *  in the bgpstream_patricia_node_t structure */
   bgpstream_patricia_tree_destroy_user_t *node_user_destructor;
+
+  /* Concurrent mode: one writer and any number of lock-free readers. Objects
+   * removed by the writer are retired, and only released once every reader
+   * has left the critical section it was in at the time (epoch-based
+   * reclamation) */
+  int concurrent;
+
+  /* global epoch, starts at 1 */
+  uint64_t epoch;
+
+  /* objects waiting to be released */
+  bpt_retired_t *retired;
+  int retired_cnt;
+  int retired_alloc_cnt;
+
+  /* registered readers */
+  bgpstream_patricia_tree_reader_t **readers;
+  int readers_cnt;
+  int readers_alloc_cnt;
+
+  /* protects the readers array (not the readers' epochs) */
+  pthread_mutex_t readers_mutex;
 };
 
 /** Data structure containing a list of pointers to Patricia Tree nodes
@@ -135,12 +260,284 @@ struct bgpstream_patricia_tree_result_set {
 
 /* ======================= UTILITY FUNCTIONS ======================= */
 
+#define BPT_PARENT(n) (BPT_LOAD((n)->parent_actual) & ~BPT_ACTUAL_FLAG)
+#define BPT_ACTUAL(n) ((BPT_LOAD((n)->parent_actual) & BPT_ACTUAL_FLAG) != 0)
+
+/* Only the writer changes these, with a single store of the word so that
+ * concurrent readers of the flag see either the old or the new value */
+static inline void bpt_set_parent(bgpstream_patricia_node_t *node,
+                                  uint32_t parent)
+{
+  BPT_STORE(node->parent_actual,
+            (node->parent_actual & BPT_ACTUAL_FLAG) | parent);
+}
+
+static inline void bpt_set_actual(bgpstream_patricia_node_t *node, int actual)
+{
+  BPT_STORE(node->parent_actual,
+            actual ? (node->parent_actual | BPT_ACTUAL_FLAG)
+                   : (node->parent_actual & ~BPT_ACTUAL_FLAG));
+}
+
 static inline const unsigned char *bgpstream_pfx_get_first_byte(
     const bgpstream_pfx_t *pfx)
 {
   return (const unsigned char *)&pfx->address.addr;
 }
 
+/* ======================= NODE POOL FUNCTIONS ======================= */
+
+#define BPT_POOL(pt, v)                                                        \
+  ((v) == BGPSTREAM_ADDR_VERSION_IPV4 ? &(pt)->pool4 : &(pt)->pool6)
+
+static inline bgpstream_patricia_node_t *bpt_node(const bpt_pool_t *pool,
+                                                  uint32_t idx)
+{
+  if (idx == BPT_NIL) {
+    return NULL;
+  }
+  uint8_t **chunks = BPT_LOAD(pool->chunks);
+  return (bgpstream_patricia_node_t *)(chunks[idx >> BPT_CHUNK_BITS] +
+                                       (size_t)(idx & BPT_CHUNK_MASK) *
+                                         pool->node_size);
+}
+
+/* Nodes do not store their own index, but it can be recovered from the link
+ * that points at them */
+static uint32_t bpt_node_idx(const bpt_pool_t *pool,
+                             const bgpstream_patricia_node_t *node)
+{
+  const bgpstream_patricia_node_t *parent = bpt_node(pool, BPT_PARENT(node));
+  if (parent == NULL) {
+    return pool->head;
+  }
+  return (bpt_node(pool, parent->l) == node) ? parent->l : parent->r;
+}
+
+static void bpt_pool_init(bpt_pool_t *pool, size_t node_size)
+{
+  pool->chunks = NULL;
+  pool->chunks_cnt = 0;
+  pool->chunks_alloc_cnt = 0;
+  pool->node_size = node_size;
+  pool->used = 1; /* skip BPT_NIL */
+  pool->free_head = BPT_NIL;
+  pool->head = BPT_NIL;
+}
+
+static void bpt_pool_free(bpt_pool_t *pool, uint32_t idx)
+{
+  bgpstream_patricia_node_t *node = bpt_node(pool, idx);
+  node->user = NULL;
+  bpt_set_actual(node, 0);
+  node->l = pool->free_head;
+  pool->free_head = idx;
+}
+
+/* Release every node in the pool at once. The chunks are kept for reuse. */
+static void bpt_pool_clear(bpt_pool_t *pool,
+                           bgpstream_patricia_tree_destroy_user_t *destructor)
+{
+  bgpstream_patricia_node_t *node;
+  uint32_t i;
+
+  /* user data is the only thing that has to be visited node by node (removed
+   * nodes have a NULL user) */
+  if (destructor != NULL) {
+    for (i = 1; i < pool->used; i++) {
+      node = bpt_node(pool, i);
+      if (node->user != NULL) {
+        destructor(node->user);
+      }
+    }
+  }
+  pool->used = 1;
+  pool->free_head = BPT_NIL;
+  BPT_STORE(pool->head, BPT_NIL);
+}
+
+static void bpt_pool_destroy(bpt_pool_t *pool)
+{
+  uint32_t i;
+  for (i = 0; i < pool->chunks_cnt; i++) {
+    free(pool->chunks[i]);
+  }
+  free(pool->chunks);
+  pool->chunks = NULL;
+  pool->chunks_cnt = 0;
+  pool->chunks_alloc_cnt = 0;
+}
+
+/* ======================= CONCURRENCY FUNCTIONS ======================= */
+
+/* Smallest epoch of any reader currently in a read-side critical section, or
+ * UINT64_MAX if there is none */
+static uint64_t bpt_min_reader_epoch(bgpstream_patricia_tree_t *pt)
+{
+  uint64_t min = UINT64_MAX;
+  uint64_t e;
+  int i;
+
+  pthread_mutex_lock(&pt->readers_mutex);
+  for (i = 0; i < pt->readers_cnt; i++) {
+    e = __atomic_load_n(&pt->readers[i]->epoch, __ATOMIC_SEQ_CST);
+    if (e != 0 && e < min) {
+      min = e;
+    }
+  }
+  pthread_mutex_unlock(&pt->readers_mutex);
+  return min;
+}
+
+static void bpt_release(bgpstream_patricia_tree_t *pt, bpt_retired_t *r)
+{
+  switch (r->type) {
+  case BPT_RETIRED_NODE4:
+    bpt_pool_free(&pt->pool4, r->idx);
+    break;
+  case BPT_RETIRED_NODE6:
+    bpt_pool_free(&pt->pool6, r->idx);
+    break;
+  case BPT_RETIRED_USER:
+    pt->node_user_destructor(r->ptr);
+    break;
+  case BPT_RETIRED_MEM:
+    free(r->ptr);
+    break;
+  }
+}
+
+/* Release the retired objects that no reader can still be using */
+static void bpt_reclaim(bgpstream_patricia_tree_t *pt)
+{
+  uint64_t min;
+  int i, j = 0;
+
+  /* readers that start from now on cannot see anything retired so far */
+  __atomic_add_fetch(&pt->epoch, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  min = bpt_min_reader_epoch(pt);
+
+  for (i = 0; i < pt->retired_cnt; i++) {
+    if (pt->retired[i].epoch < min) {
+      bpt_release(pt, &pt->retired[i]);
+    } else {
+      pt->retired[j++] = pt->retired[i];
+    }
+  }
+  pt->retired_cnt = j;
+}
+
+/* Wait until every reader has left the critical section it was in (if any) */
+static void bpt_synchronize(bgpstream_patricia_tree_t *pt)
+{
+  uint64_t epoch = __atomic_add_fetch(&pt->epoch, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  while (bpt_min_reader_epoch(pt) < epoch) {
+    sched_yield();
+  }
+}
+
+static void bpt_retire(bgpstream_patricia_tree_t *pt, bpt_retired_type_t type,
+                       uint32_t idx, void *ptr)
+{
+  bpt_retired_t r = {pt->epoch, type, idx, ptr};
+  bpt_retired_t *retired;
+
+  if (!pt->concurrent) {
+    bpt_release(pt, &r);
+    return;
+  }
+
+  if (pt->retired_cnt == pt->retired_alloc_cnt) {
+    int alloc_cnt = (pt->retired_alloc_cnt == 0) ? BPT_RECLAIM_BATCH
+                                                  : pt->retired_alloc_cnt * 2;
+    if ((retired = realloc(pt->retired, sizeof(bpt_retired_t) * alloc_cnt)) ==
+        NULL) {
+      /* no room to defer this one, so wait for the readers instead */
+      bpt_synchronize(pt);
+      bpt_release(pt, &r);
+      return;
+    }
+    pt->retired = retired;
+    pt->retired_alloc_cnt = alloc_cnt;
+  }
+  pt->retired[pt->retired_cnt++] = r;
+
+  if (pt->retired_cnt >= BPT_RECLAIM_BATCH) {
+    bpt_reclaim(pt);
+  }
+}
+
+static void bpt_free_node(bgpstream_patricia_tree_t *pt, bpt_pool_t *pool,
+                          uint32_t idx)
+{
+  bpt_retire(pt,
+             (pool == &pt->pool4) ? BPT_RETIRED_NODE4 : BPT_RETIRED_NODE6,
+             idx, NULL);
+}
+
+static void bpt_destroy_user(bgpstream_patricia_tree_t *pt, void *user)
+{
+  if (user != NULL && pt->node_user_destructor != NULL) {
+    bpt_retire(pt, BPT_RETIRED_USER, BPT_NIL, user);
+  }
+}
+
+static uint32_t bpt_pool_alloc(bgpstream_patricia_tree_t *pt, bpt_pool_t *pool)
+{
+  uint32_t idx;
+  uint8_t **chunks;
+
+  if (pool->free_head != BPT_NIL) {
+    idx = pool->free_head;
+    pool->free_head = bpt_node(pool, idx)->l;
+  } else {
+    if (pool->used == BPT_MAX_NODES) {
+      return BPT_NIL;
+    }
+    idx = pool->used;
+    if ((idx >> BPT_CHUNK_BITS) == pool->chunks_cnt) {
+      if (pool->chunks_cnt == pool->chunks_alloc_cnt) {
+        uint32_t alloc_cnt =
+          (pool->chunks_alloc_cnt == 0) ? 8 : pool->chunks_alloc_cnt * 2;
+        if (!pt->concurrent) {
+          if ((chunks = realloc(pool->chunks,
+                                sizeof(uint8_t *) * alloc_cnt)) == NULL) {
+            return BPT_NIL;
+          }
+          pool->chunks = chunks;
+        } else {
+          /* readers may still be using the old array */
+          uint8_t **old_chunks = pool->chunks;
+          if ((chunks = malloc(sizeof(uint8_t *) * alloc_cnt)) == NULL) {
+            return BPT_NIL;
+          }
+          if (pool->chunks_cnt > 0) {
+            memcpy(chunks, old_chunks, sizeof(uint8_t *) * pool->chunks_cnt);
+          }
+          BPT_STORE(pool->chunks, chunks);
+          bpt_retire(pt, BPT_RETIRED_MEM, BPT_NIL, old_chunks);
+        }
+        pool->chunks_alloc_cnt = alloc_cnt;
+      }
+      /* the tail slack means that reading a whole bgpstream_pfx_t from the
+       * last IPv4 node of a chunk stays within the allocation */
+      if ((pool->chunks[pool->chunks_cnt] =
+             malloc(pool->node_size * BPT_CHUNK_SIZE +
+                    sizeof(bgpstream_patricia_node_t) - pool->node_size)) ==
+          NULL) {
+        return BPT_NIL;
+      }
+      pool->chunks_cnt++;
+    }
+    pool->used++;
+  }
+
+  memset(bpt_node(pool, idx), 0, pool->node_size);
+  return idx;
+}
+
 /* ======================= RESULT SET FUNCTIONS  ======================= */
 
 static int bgpstream_patricia_tree_result_set_add_node(
@@ -174,19 +571,21 @@ static inline void bgpstream_patricia_tree_result_set_clear(
 
 /* ======================= PATRICIA NODE FUNCTIONS ======================= */
 
-static bgpstream_patricia_node_t *
-bgpstream_patricia_node_create(bgpstream_patricia_tree_t *pt,
-                               const bgpstream_pfx_t *pfx)
+static uint32_t bgpstream_patricia_node_create(bgpstream_patricia_tree_t *pt,
+                                               bpt_pool_t *pool,
+                                               const bgpstream_pfx_t *pfx)
 {
   bgpstream_patricia_node_t *node;
+  uint32_t idx;
 
   assert(pfx);
   assert(pfx->mask_len <= BGPSTREAM_PATRICIA_MAXBITS);
   assert(pfx->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
 
-  if ((node = malloc_zero(sizeof(bgpstream_patricia_node_t))) == NULL) {
-    return NULL;
+  if ((idx = bpt_pool_alloc(pt, pool)) == BPT_NIL) {
+    return BPT_NIL;
   }
+  node = bpt_node(pool, idx);
 
   if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
     pt->ipv4_active_nodes++;
@@ -196,57 +595,47 @@ bgpstream_patricia_node_create(bgpstream_patricia_tree_t *pt,
 
   bgpstream_pfx_copy(&node->prefix, pfx);
 
-  node->parent = NULL;
-  node->actual = 1;
-  node->l = NULL;
-  node->r = NULL;
+  node->parent_actual = BPT_NIL | BPT_ACTUAL_FLAG;
+  node->l = BPT_NIL;
+  node->r = BPT_NIL;
   node->user = NULL;
-  return node;
+  return idx;
 }
 
-static bgpstream_patricia_node_t *bgpstream_patricia_gluenode_create(
-  const bgpstream_pfx_t *pfx, uint8_t mask_len)
+static uint32_t
+bgpstream_patricia_gluenode_create(bgpstream_patricia_tree_t *pt,
+                                   bpt_pool_t *pool, const bgpstream_pfx_t *pfx,
+                                   uint8_t mask_len)
 {
   bgpstream_patricia_node_t *node;
+  uint32_t idx;
 
-  if ((node = malloc_zero(sizeof(bgpstream_patricia_node_t))) == NULL) {
-    return NULL;
+  if ((idx = bpt_pool_alloc(pt, pool)) == BPT_NIL) {
+    return BPT_NIL;
   }
+  node = bpt_node(pool, idx);
+
   bgpstream_addr_copy(&node->prefix.address, &pfx->address);
   bgpstream_addr_mask(&node->prefix.address, mask_len);
   node->prefix.mask_len = mask_len;
-  node->parent = NULL;
-  node->actual = 0;
-  node->l = NULL;
-  node->r = NULL;
-  return node;
+  node->parent_actual = BPT_NIL;
+  node->l = BPT_NIL;
+  node->r = BPT_NIL;
+  return idx;
 }
 
 /* ======================= PATRICIA TREE FUNCTIONS ======================= */
 
-#define bgpstream_patricia_get_head(pt, v)          \
-  ((v) == BGPSTREAM_ADDR_VERSION_IPV4 ? pt->head4 : \
-   (v) == BGPSTREAM_ADDR_VERSION_IPV6 ? pt->head6 : \
-   NULL)
-
-static void bgpstream_patricia_set_head(bgpstream_patricia_tree_t *pt,
-                                        bgpstream_addr_version_t v,
-                                        bgpstream_patricia_node_t *n)
-{
-  switch (v) {
-  case BGPSTREAM_ADDR_VERSION_IPV4:
-    pt->head4 = n;
-    break;
-  case BGPSTREAM_ADDR_VERSION_IPV6:
-    pt->head6 = n;
-    break;
-  default:
-    assert(0);
-  }
-}
+#define bgpstream_patricia_get_head(pt, v)                                     \
+  ((v) == BGPSTREAM_ADDR_VERSION_IPV4 ?                                        \
+     bpt_node(&(pt)->pool4, BPT_LOAD((pt)->pool4.head)) :                      \
+   (v) == BGPSTREAM_ADDR_VERSION_IPV6 ?                                        \
+     bpt_node(&(pt)->pool6, BPT_LOAD((pt)->pool6.head)) :                      \
+     NULL)
 
 static uint64_t
-bgpstream_patricia_tree_count_subnets(const bgpstream_patricia_node_t *node,
+bgpstream_patricia_tree_count_subnets(const bpt_pool_t *pool,
+                                      const bgpstream_patricia_node_t *node,
                                       uint64_t subnet_size)
 {
   if (node == NULL) {
@@ -255,15 +644,17 @@ bgpstream_patricia_tree_count_subnets(const bgpstream_patricia_node_t *node,
   /* if the node is a glue node, then the /subnet_size subnets are the sum of
    * the
    * /24 subnets contained in its left and right subtrees */
-  if (!node->actual) {
+  if (!BPT_ACTUAL(node)) {
     /* if the glue node is already a /subnet_size, then just return 1 (even
      * though
      * the subnetworks below could be a non complete /subnet_size */
     if (node->prefix.mask_len >= subnet_size) {
       return 1;
     } else {
-      return bgpstream_patricia_tree_count_subnets(node->l, subnet_size) +
-             bgpstream_patricia_tree_count_subnets(node->r, subnet_size);
+      return bgpstream_patricia_tree_count_subnets(
+               pool, bpt_node(pool, node->l), subnet_size) +
+             bgpstream_patricia_tree_count_subnets(
+               pool, bpt_node(pool, node->r), subnet_size);
     }
   } else {
     /* otherwise we just count the subnet for the given network and return
@@ -286,8 +677,8 @@ bgpstream_patricia_tree_count_subnets(const bgpstream_patricia_node_t *node,
 
 /* depth pecifies how many "children" to explore for each node */
 static int bgpstream_patricia_tree_add_more_specifics(
-  bgpstream_patricia_tree_result_set_t *set, bgpstream_patricia_node_t *node,
-  const uint8_t depth)
+  bgpstream_patricia_tree_result_set_t *set, const bpt_pool_t *pool,
+  bgpstream_patricia_node_t *node, const uint8_t depth)
 {
   if (node == NULL || depth == 0) {
     return 0;
@@ -295,7 +686,7 @@ static int bgpstream_patricia_tree_add_more_specifics(
   uint8_t d = depth;
   /* if it is a node containing a real prefix, then copy the address to a new
    * result node */
-  if (node->actual) {
+  if (BPT_ACTUAL(node)) {
     if (bgpstream_patricia_tree_result_set_add_node(set, node) != 0) {
       return -1;
     }
@@ -303,10 +694,12 @@ static int bgpstream_patricia_tree_add_more_specifics(
   }
 
   /* using pre-order R - Left - Right */
-  if (bgpstream_patricia_tree_add_more_specifics(set, node->l, d) != 0) {
+  if (bgpstream_patricia_tree_add_more_specifics(
+        set, pool, bpt_node(pool, BPT_LOAD(node->l)), d) != 0) {
     return -1;
   }
-  if (bgpstream_patricia_tree_add_more_specifics(set, node->r, d) != 0) {
+  if (bgpstream_patricia_tree_add_more_specifics(
+        set, pool, bpt_node(pool, BPT_LOAD(node->r)), d) != 0) {
     return -1;
   }
   return 0;
@@ -314,8 +707,8 @@ static int bgpstream_patricia_tree_add_more_specifics(
 
 /* depth pecifies how many "children" to explore for each node */
 static int bgpstream_patricia_tree_add_less_specifics(
-  bgpstream_patricia_tree_result_set_t *set, bgpstream_patricia_node_t *node,
-  const uint8_t depth)
+  bgpstream_patricia_tree_result_set_t *set, const bpt_pool_t *pool,
+  bgpstream_patricia_node_t *node, const uint8_t depth)
 {
   if (node == NULL) {
     return 0;
@@ -324,47 +717,86 @@ static int bgpstream_patricia_tree_add_less_specifics(
   while (node != NULL && d > 0) {
     /* if it is a node containing a real prefix, then copy the address to a new
      * result node */
-    if (node->actual) {
+    if (BPT_ACTUAL(node)) {
       if (bgpstream_patricia_tree_result_set_add_node(set, node) != 0) {
         return -1;
       }
       d--;
     }
-    node = node->parent;
+    node = bpt_node(pool, BPT_PARENT(node));
   }
   return 0;
 }
 
-static int
-bgpstream_patricia_tree_find_more_specific(const bgpstream_patricia_node_t *node)
+/* Same as bgpstream_patricia_tree_add_less_specifics, but finds the less
+ * specifics of node by searching down from the root rather than following
+ * parent links, so that concurrent readers only report nodes that are still
+ * linked into the tree */
+static int bgpstream_patricia_tree_add_less_specifics_from_root(
+  bgpstream_patricia_tree_result_set_t *set, const bpt_pool_t *pool,
+  const bgpstream_patricia_node_t *node, const uint8_t depth)
+{
+  bgpstream_patricia_node_t *path[BGPSTREAM_PATRICIA_MAXBITS + 1];
+  bgpstream_patricia_node_t *it;
+  const unsigned char *addr = bgpstream_pfx_get_first_byte(&node->prefix);
+  int path_cnt = 0;
+  uint8_t d = depth;
+
+  it = bpt_node(pool, BPT_LOAD(pool->head));
+  while (it != NULL && it->prefix.mask_len < node->prefix.mask_len &&
+         comp_with_mask(bgpstream_pfx_get_first_byte(&it->prefix), addr,
+                        it->prefix.mask_len)) {
+    if (BPT_ACTUAL(it)) {
+      path[path_cnt++] = it;
+    }
+    it = bpt_node(pool, BIT_ARRAY_TEST(addr, it->prefix.mask_len) ?
+                          BPT_LOAD(it->r) : BPT_LOAD(it->l));
+  }
+
+  /* most specific first, as when walking up the parents */
+  while (path_cnt > 0 && d > 0) {
+    if (bgpstream_patricia_tree_result_set_add_node(set, path[--path_cnt]) !=
+        0) {
+      return -1;
+    }
+    d--;
+  }
+  return 0;
+}
+
+static int bgpstream_patricia_tree_find_more_specific(
+  const bpt_pool_t *pool, const bgpstream_patricia_node_t *node)
 {
   if (node == NULL) {
     return 0;
   }
 
   /* Does this node or one of its descendants contains a real prefix? */
-  return node->actual ||
-    bgpstream_patricia_tree_find_more_specific(node->l) ||
-    bgpstream_patricia_tree_find_more_specific(node->r);
+  return BPT_ACTUAL(node) ||
+    bgpstream_patricia_tree_find_more_specific(
+      pool, bpt_node(pool, BPT_LOAD(node->l))) ||
+    bgpstream_patricia_tree_find_more_specific(
+      pool, bpt_node(pool, BPT_LOAD(node->r)));
 }
 
 static void bgpstream_patricia_tree_merge_tree(bgpstream_patricia_tree_t *dst,
-    const bgpstream_patricia_node_t *node)
+    const bpt_pool_t *pool, const bgpstream_patricia_node_t *node)
 {
   if (node == NULL) {
     return;
   }
   /* Add the current node, if it is not a glue node */
-  if (node->actual) {
+  if (BPT_ACTUAL(node)) {
     bgpstream_patricia_tree_insert(dst, &node->prefix);
   }
   /* Recursively add left and right node */
-  bgpstream_patricia_tree_merge_tree(dst, node->l);
-  bgpstream_patricia_tree_merge_tree(dst, node->r);
+  bgpstream_patricia_tree_merge_tree(dst, pool, bpt_node(pool, node->l));
+  bgpstream_patricia_tree_merge_tree(dst, pool, bpt_node(pool, node->r));
 }
 
 static bgpstream_patricia_walk_cb_result_t bpt_walk_children(
-  const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node,
+  const bgpstream_patricia_tree_t *pt, const bpt_pool_t *pool,
+  const bgpstream_patricia_node_t *node,
   bgpstream_patricia_tree_process_node_t *fun, void *data)
 {
   bgpstream_patricia_walk_cb_result_t rc;
@@ -375,29 +807,32 @@ static bgpstream_patricia_walk_cb_result_t bpt_walk_children(
   /* In order traversal: Left - Node - Right */
 
   /* Left */
-  rc = bpt_walk_children(pt, node->l, fun, data);
+  rc = bpt_walk_children(pt, pool, bpt_node(pool, BPT_LOAD(node->l)), fun,
+                         data);
   if (rc != BGPSTREAM_PATRICIA_WALK_CONTINUE) return rc;
 
   /* Node */
-  if (node->actual) {
+  if (BPT_ACTUAL(node)) {
     rc = fun(pt, node, data);
     if (rc != BGPSTREAM_PATRICIA_WALK_CONTINUE) return rc;
   }
 
   /* Right */
-  rc = bpt_walk_children(pt, node->r, fun, data);
+  rc = bpt_walk_children(pt, pool, bpt_node(pool, BPT_LOAD(node->r)), fun,
+                         data);
   if (rc != BGPSTREAM_PATRICIA_WALK_CONTINUE) return rc;
 
   return BGPSTREAM_PATRICIA_WALK_CONTINUE;
 }
 
 static bgpstream_patricia_walk_cb_result_t bpt_walk_parents(
-  const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node,
+  const bgpstream_patricia_tree_t *pt, const bpt_pool_t *pool,
+  const bgpstream_patricia_node_t *node,
   bgpstream_patricia_tree_process_node_t *fun, void *data)
 {
   bgpstream_patricia_walk_cb_result_t rc;
-  for ( ; node; node = node->parent) {
-    if (node->actual) {
+  for ( ; node; node = bpt_node(pool, BPT_PARENT(node))) {
+    if (BPT_ACTUAL(node)) {
       rc = fun(pt, node, data);
       if (rc != BGPSTREAM_PATRICIA_WALK_CONTINUE) return rc;
     }
@@ -406,38 +841,22 @@ static bgpstream_patricia_walk_cb_result_t bpt_walk_parents(
 }
 
 static void bgpstream_patricia_tree_print_tree(
-    const bgpstream_patricia_node_t *node)
+    const bpt_pool_t *pool, const bgpstream_patricia_node_t *node)
 {
   if (node == NULL) {
     return;
   }
-  bgpstream_patricia_tree_print_tree(node->l);
+  bgpstream_patricia_tree_print_tree(pool, bpt_node(pool, node->l));
 
   char buffer[INET6_ADDRSTRLEN+4];
 
   /* if node is not a glue node, print the prefix */
-  if (node->actual) {
+  if (BPT_ACTUAL(node)) {
     bgpstream_pfx_snprintf(buffer, sizeof(buffer), &node->prefix);
     fprintf(stdout, "%*s%s\n", node->prefix.mask_len, "", buffer);
   }
 
-  bgpstream_patricia_tree_print_tree(node->r);
-}
-
-static void
-bgpstream_patricia_tree_destroy_tree(bgpstream_patricia_tree_t *pt,
-                                     bgpstream_patricia_node_t *head)
-{
-  if (head != NULL) {
-    bgpstream_patricia_node_t *l = head->l;
-    bgpstream_patricia_node_t *r = head->r;
-    bgpstream_patricia_tree_destroy_tree(pt, l);
-    bgpstream_patricia_tree_destroy_tree(pt, r);
-    if (head->user != NULL && pt->node_user_destructor != NULL) {
-      pt->node_user_destructor(head->user);
-    }
-    free(head);
-  }
+  bgpstream_patricia_tree_print_tree(pool, bpt_node(pool, node->r));
 }
 
 /* ======================= PUBLIC API FUNCTIONS ======================= */
@@ -521,14 +940,104 @@ bgpstream_patricia_tree_t *bgpstream_patricia_tree_create(
   if ((pt = malloc_zero(sizeof(bgpstream_patricia_tree_t))) == NULL) {
     return NULL;
   }
-  pt->head4 = NULL;
-  pt->head6 = NULL;
+  bpt_pool_init(&pt->pool4, sizeof(bpt_node4_t));
+  bpt_pool_init(&pt->pool6, sizeof(bgpstream_patricia_node_t));
   pt->ipv4_active_nodes = 0;
   pt->ipv6_active_nodes = 0;
   pt->node_user_destructor = bspt_user_destructor;
+  pt->concurrent = 0;
+  pt->epoch = 1;
   return pt;
 }
 
+int bgpstream_patricia_tree_set_concurrent(bgpstream_patricia_tree_t *pt)
+{
+  assert(pt);
+  if (pt->concurrent) {
+    return 0;
+  }
+  if (pthread_mutex_init(&pt->readers_mutex, NULL) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "could not initialize readers mutex");
+    return -1;
+  }
+  pt->concurrent = 1;
+  return 0;
+}
+
+bgpstream_patricia_tree_reader_t *
+bgpstream_patricia_tree_reader_create(bgpstream_patricia_tree_t *pt)
+{
+  bgpstream_patricia_tree_reader_t *reader = NULL;
+  bgpstream_patricia_tree_reader_t **readers;
+
+  assert(pt);
+  if (!pt->concurrent) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "patricia tree is not in concurrent mode");
+    return NULL;
+  }
+  if ((reader = malloc_zero(sizeof(bgpstream_patricia_tree_reader_t))) ==
+      NULL) {
+    return NULL;
+  }
+  reader->pt = pt;
+
+  pthread_mutex_lock(&pt->readers_mutex);
+  if (pt->readers_cnt == pt->readers_alloc_cnt) {
+    int alloc_cnt =
+      (pt->readers_alloc_cnt == 0) ? 8 : pt->readers_alloc_cnt * 2;
+    if ((readers = realloc(pt->readers, sizeof(*readers) * alloc_cnt)) ==
+        NULL) {
+      pthread_mutex_unlock(&pt->readers_mutex);
+      free(reader);
+      return NULL;
+    }
+    pt->readers = readers;
+    pt->readers_alloc_cnt = alloc_cnt;
+  }
+  pt->readers[pt->readers_cnt++] = reader;
+  pthread_mutex_unlock(&pt->readers_mutex);
+
+  return reader;
+}
+
+void bgpstream_patricia_tree_reader_destroy(
+  bgpstream_patricia_tree_reader_t *reader)
+{
+  bgpstream_patricia_tree_t *pt;
+  int i;
+
+  if (reader == NULL) {
+    return;
+  }
+  pt = reader->pt;
+
+  pthread_mutex_lock(&pt->readers_mutex);
+  for (i = 0; i < pt->readers_cnt; i++) {
+    if (pt->readers[i] == reader) {
+      pt->readers[i] = pt->readers[--pt->readers_cnt];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pt->readers_mutex);
+  free(reader);
+}
+
+void bgpstream_patricia_tree_read_lock(
+  bgpstream_patricia_tree_reader_t *reader)
+{
+  __atomic_store_n(&reader->epoch,
+                   __atomic_load_n(&reader->pt->epoch, __ATOMIC_SEQ_CST),
+                   __ATOMIC_SEQ_CST);
+  /* make the epoch visible to the writer before reading the tree */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void bgpstream_patricia_tree_read_unlock(
+  bgpstream_patricia_tree_reader_t *reader)
+{
+  __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
 /* Search below node for another node with the same branching bits as pfx, and
  * return
  *   - a node with the same len, if one exists
@@ -538,31 +1047,35 @@ bgpstream_patricia_tree_t *bgpstream_patricia_tree_create(
  * returned.
  */
 static const bgpstream_patricia_node_t *
-bpt_search_node(const bgpstream_patricia_node_t *node,
+bpt_search_node(const bpt_pool_t *pool, const bgpstream_patricia_node_t *node,
                 const bgpstream_pfx_t *pfx)
 {
   const unsigned char *addr = bgpstream_pfx_get_first_byte(pfx);
+  uint32_t next;
   while (node->prefix.mask_len < pfx->mask_len) {
     if (BIT_ARRAY_TEST(addr, node->prefix.mask_len)) {
       /* patricia_lookup: take right at node */
-      if (!node->r) return node;
-      node = node->r;
+      if ((next = BPT_LOAD(node->r)) == BPT_NIL) return node;
     } else {
       /* patricia_lookup: take left at node */
-      if (!node->l) return node;
-      node = node->l;
+      if ((next = BPT_LOAD(node->l)) == BPT_NIL) return node;
     }
+    node = bpt_node(pool, next);
   }
   return node;
 }
 
+/* Given a node that shares the longest possible run of leading bits with pfx
+ * (e.g. as found by bpt_search_node), walk back up to the point where pfx
+ * should be inserted, and find how pfx relates to the node there */
 static const bgpstream_patricia_node_t *
-bpt_find_insert_point_const(const bgpstream_patricia_node_t *node_it,
-                            const bgpstream_pfx_t *pfx,
-                            int *relation,
-                            uint8_t *differ_bit_p)
+bpt_climb_insert_point_const(const bpt_pool_t *pool,
+                             const bgpstream_patricia_node_t *node_it,
+                             const bgpstream_pfx_t *pfx,
+                             int *relation,
+                             uint8_t *differ_bit_p)
 {
-  node_it = bpt_search_node(node_it, pfx);
+  const bgpstream_patricia_node_t *parent;
 
   uint8_t bitlen = pfx->mask_len;
   const unsigned char *paddr = bgpstream_pfx_get_first_byte(pfx);
@@ -595,8 +1108,9 @@ bpt_find_insert_point_const(const bgpstream_patricia_node_t *node_it,
   }
 
   /* go back up until we find the parent with all the same leading bits */
-  while (node_it->parent && node_it->parent->prefix.mask_len >= differ_bit) {
-    node_it = node_it->parent;
+  while ((parent = bpt_node(pool, BPT_PARENT(node_it))) != NULL &&
+         parent->prefix.mask_len >= differ_bit) {
+    node_it = parent;
   }
 
   if (differ_bit == bitlen && node_it->prefix.mask_len == bitlen) {
@@ -619,55 +1133,44 @@ bpt_find_insert_point_const(const bgpstream_patricia_node_t *node_it,
   return node_it;
 }
 
+static const bgpstream_patricia_node_t *
+bpt_find_insert_point_const(const bpt_pool_t *pool,
+                            const bgpstream_patricia_node_t *node_it,
+                            const bgpstream_pfx_t *pfx,
+                            int *relation,
+                            uint8_t *differ_bit_p)
+{
+  return bpt_climb_insert_point_const(pool, bpt_search_node(pool, node_it, pfx),
+                                      pfx, relation, differ_bit_p);
+}
+
 static inline bgpstream_patricia_node_t *
-bpt_find_insert_point(bgpstream_patricia_node_t *node_it,
+bpt_find_insert_point(const bpt_pool_t *pool,
+                      bgpstream_patricia_node_t *node_it,
                       const bgpstream_pfx_t *pfx,
                       int *relation,
                       uint8_t *differ_bit_p)
 {
   return bgpstream_nonconst_node(bpt_find_insert_point_const(
-    node_it, pfx, relation, differ_bit_p));
+    pool, node_it, pfx, relation, differ_bit_p));
 }
 
-bgpstream_patricia_node_t *
-bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
-                               const bgpstream_pfx_t *pfx)
+/* Insert pfx at the insertion point found by bpt_(find|climb)_insert_point */
+static bgpstream_patricia_node_t *
+bpt_insert_at(bgpstream_patricia_tree_t *pt, bpt_pool_t *pool,
+              bgpstream_patricia_node_t *node_it, const bgpstream_pfx_t *pfx,
+              int relation, uint8_t differ_bit)
 {
-  assert(pt);
-  assert(pfx);
-  assert(pfx->mask_len <= BGPSTREAM_PATRICIA_MAXBITS);
-  assert(pfx->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
-
-  /* DEBUG   char buffer[1024];
-   * bgpstream_pfx_snprintf(buffer, 1024, pfx); */
-
   bgpstream_patricia_node_t *new_node = NULL;
+  bgpstream_patricia_node_t *parent;
+  uint32_t new_idx, it_idx;
   bgpstream_addr_version_t v = pfx->address.version;
-  bgpstream_patricia_node_t *node_it = bgpstream_patricia_get_head(pt, v);
-
-  /* if Patricia Tree is empty, then insert new node */
-  if (node_it == NULL) {
-    if ((new_node = bgpstream_patricia_node_create(pt, pfx)) == NULL) {
-      bgpstream_log(BGPSTREAM_LOG_ERR, "Error creating pt node");
-      return NULL;
-    }
-    /* attach first node in Tree */
-    bgpstream_patricia_set_head(pt, v, new_node);
-    /* DEBUG       fprintf(stderr, "Adding %s to HEAD\n", buffer); */
-    return new_node;
-  }
-
-  /* Find insertion point */
-  int relation;
-  uint8_t differ_bit;
-
-  node_it = bpt_find_insert_point(node_it, pfx, &relation, &differ_bit);
 
   uint8_t bitlen = pfx->mask_len;
   if (relation == BGPSTREAM_PATRICIA_SELF) {
     /* check the node contains an actual prefix,
      * i.e. it is not a glue node */
-    if (node_it->actual) {
+    if (BPT_ACTUAL(node_it)) {
       /* Exact node found */
       /* DEBUG  fprintf(stderr, "Prefix %s already in tree\n", buffer); */
       return node_it;
@@ -675,7 +1178,7 @@ bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
     /* otherwise replace the info in the glue node with proper
      * prefix information and increment the right counter*/
     assert(bgpstream_pfx_equal(&node_it->prefix, pfx));
-    node_it->actual = 1;
+    bpt_set_actual(node_it, 1);
     if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
       pt->ipv4_active_nodes++;
     } else {
@@ -688,23 +1191,25 @@ bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
   }
 
   /* Create a new node */
-  if ((new_node = bgpstream_patricia_node_create(pt, pfx)) == NULL) {
+  if ((new_idx = bgpstream_patricia_node_create(pt, pool, pfx)) == BPT_NIL) {
     bgpstream_log(BGPSTREAM_LOG_ERR, "Error creating pt node");
     return NULL;
   }
+  new_node = bpt_node(pool, new_idx);
+  it_idx = bpt_node_idx(pool, node_it);
 
   /* Insert the new node in the Patricia Tree: CHILD */
   if (relation == BGPSTREAM_PATRICIA_PARENT) {
     /* appending the new node as a child of node_it */
     const unsigned char *paddr = bgpstream_pfx_get_first_byte(pfx);
-    new_node->parent = node_it;
+    bpt_set_parent(new_node, it_idx);
     if (node_it->prefix.mask_len < BGPSTREAM_PATRICIA_MAXBITS &&
         BIT_ARRAY_TEST(paddr, node_it->prefix.mask_len)) {
-      assert(node_it->r == NULL);
-      node_it->r = new_node;
+      assert(node_it->r == BPT_NIL);
+      BPT_STORE(node_it->r, new_idx);
     } else {
-      assert(node_it->l == NULL);
-      node_it->l = new_node;
+      assert(node_it->l == BPT_NIL);
+      BPT_STORE(node_it->l, new_idx);
     }
     /* patricia_lookup: new_node #2 (child) */
     /* DEBUG  fprintf(stderr, "Adding %s as a CHILD node\n", buffer); */
@@ -717,22 +1222,22 @@ bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
     const unsigned char *naddr = bgpstream_pfx_get_first_byte(&node_it->prefix);
     if (bitlen < BGPSTREAM_PATRICIA_MAXBITS &&
         BIT_ARRAY_TEST(naddr, bitlen)) {
-      new_node->r = node_it;
+      new_node->r = it_idx;
     } else {
-      new_node->l = node_it;
+      new_node->l = it_idx;
     }
-    new_node->parent = node_it->parent;
-    if (node_it->parent == NULL) {
-      assert(bgpstream_patricia_get_head(pt, v) == node_it);
-      bgpstream_patricia_set_head(pt, v, new_node);
+    bpt_set_parent(new_node, BPT_PARENT(node_it));
+    if ((parent = bpt_node(pool, BPT_PARENT(node_it))) == NULL) {
+      assert(pool->head == it_idx);
+      BPT_STORE(pool->head, new_idx);
     } else {
-      if (node_it->parent->r == node_it) {
-        node_it->parent->r = new_node;
+      if (parent->r == it_idx) {
+        BPT_STORE(parent->r, new_idx);
       } else {
-        node_it->parent->l = new_node;
+        BPT_STORE(parent->l, new_idx);
       }
     }
-    node_it->parent = new_node;
+    bpt_set_parent(node_it, new_idx);
     /* patricia_lookup: new_node #3 (parent) */
     /* DEBUG fprintf(stderr, "Adding %s as a PARENT node\n", buffer); */
     return new_node;
@@ -741,33 +1246,44 @@ bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
     /* Insert the new node in the Patricia Tree: CREATE A GLUE NODE AND APPEND
      * TO IT*/
 
-    bgpstream_patricia_node_t *glue_node =
-      bgpstream_patricia_gluenode_create(pfx, differ_bit);
+    uint32_t glue_idx =
+      bgpstream_patricia_gluenode_create(pt, pool, pfx, differ_bit);
+    if (glue_idx == BPT_NIL) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Error creating pt glue node");
+      bpt_free_node(pt, pool, new_idx);
+      if (v == BGPSTREAM_ADDR_VERSION_IPV4) {
+        pt->ipv4_active_nodes--;
+      } else {
+        pt->ipv6_active_nodes--;
+      }
+      return NULL;
+    }
+    bgpstream_patricia_node_t *glue_node = bpt_node(pool, glue_idx);
 
-    glue_node->parent = node_it->parent;
+    bpt_set_parent(glue_node, BPT_PARENT(node_it));
 
     const unsigned char *paddr = bgpstream_pfx_get_first_byte(pfx);
     if (differ_bit < BGPSTREAM_PATRICIA_MAXBITS &&
         BIT_ARRAY_TEST(paddr, differ_bit)) {
-      glue_node->r = new_node;
-      glue_node->l = node_it;
+      glue_node->r = new_idx;
+      glue_node->l = it_idx;
     } else {
-      glue_node->r = node_it;
-      glue_node->l = new_node;
+      glue_node->r = it_idx;
+      glue_node->l = new_idx;
     }
-    new_node->parent = glue_node;
+    bpt_set_parent(new_node, glue_idx);
 
-    if (node_it->parent == NULL) {
-      assert(bgpstream_patricia_get_head(pt, v) == node_it);
-      bgpstream_patricia_set_head(pt, v, glue_node);
+    if ((parent = bpt_node(pool, BPT_PARENT(node_it))) == NULL) {
+      assert(pool->head == it_idx);
+      BPT_STORE(pool->head, glue_idx);
     } else {
-      if (node_it->parent->r == node_it) {
-        node_it->parent->r = glue_node;
+      if (parent->r == it_idx) {
+        BPT_STORE(parent->r, glue_idx);
       } else {
-        node_it->parent->l = glue_node;
+        BPT_STORE(parent->l, glue_idx);
       }
     }
-    node_it->parent = glue_node;
+    bpt_set_parent(node_it, glue_idx);
     /* "patricia_lookup: new_node #4 (glue+node) */
     /* DEBUG fprintf(stderr, "Adding %s as a CHILD of a NEW GLUE node\n",
      * buffer); */
@@ -778,6 +1294,245 @@ bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
   /* return new_node; */
 }
 
+bgpstream_patricia_node_t *
+bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
+                               const bgpstream_pfx_t *pfx)
+{
+  assert(pt);
+  assert(pfx);
+  assert(pfx->mask_len <= BGPSTREAM_PATRICIA_MAXBITS);
+  assert(pfx->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
+
+  /* DEBUG   char buffer[1024];
+   * bgpstream_pfx_snprintf(buffer, 1024, pfx); */
+
+  uint32_t new_idx;
+  bgpstream_addr_version_t v = pfx->address.version;
+  bpt_pool_t *pool = BPT_POOL(pt, v);
+  bgpstream_patricia_node_t *node_it = bpt_node(pool, pool->head);
+
+  /* if Patricia Tree is empty, then insert new node */
+  if (node_it == NULL) {
+    if ((new_idx = bgpstream_patricia_node_create(pt, pool, pfx)) == BPT_NIL) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Error creating pt node");
+      return NULL;
+    }
+    /* attach first node in Tree */
+    BPT_STORE(pool->head, new_idx);
+    /* DEBUG       fprintf(stderr, "Adding %s to HEAD\n", buffer); */
+    return bpt_node(pool, new_idx);
+  }
+
+  /* Find insertion point */
+  int relation;
+  uint8_t differ_bit;
+
+  node_it = bpt_find_insert_point(pool, node_it, pfx, &relation, &differ_bit);
+
+  return bpt_insert_at(pt, pool, node_it, pfx, relation, differ_bit);
+}
+
+/* Lexicographic order of the prefixes as bit strings (a prefix sorts right
+ * before its more specifics). This is the same as ordering by version, then
+ * (masked) address, then mask length. */
+static int bpt_pfx_cmp(const bgpstream_pfx_t *a, const bgpstream_pfx_t *b)
+{
+  if (a->address.version != b->address.version) {
+    return a->address.version < b->address.version ? -1 : 1;
+  }
+
+  const unsigned char *aaddr = bgpstream_pfx_get_first_byte(a);
+  const unsigned char *baddr = bgpstream_pfx_get_first_byte(b);
+  uint8_t len = (a->mask_len < b->mask_len) ? a->mask_len : b->mask_len;
+  int r;
+
+  if ((r = memcmp(aaddr, baddr, len / 8)) != 0) {
+    return r;
+  }
+  if (len % 8 != 0) {
+    unsigned char m = 0xff << (8 - (len % 8));
+    if ((aaddr[len / 8] & m) != (baddr[len / 8] & m)) {
+      return (aaddr[len / 8] & m) < (baddr[len / 8] & m) ? -1 : 1;
+    }
+  }
+  if (a->mask_len != b->mask_len) {
+    return a->mask_len < b->mask_len ? -1 : 1;
+  }
+  return 0;
+}
+
+static int bpt_pfx_qsort_cmp(const void *a, const void *b)
+{
+  return bpt_pfx_cmp(a, b);
+}
+
+/* The lexicographically greatest prefix in the tree (i.e. its last node in
+ * pre-order), or NULL if the tree is empty */
+static bgpstream_patricia_node_t *bpt_last_node(const bpt_pool_t *pool)
+{
+  bgpstream_patricia_node_t *node = bpt_node(pool, pool->head);
+  while (node != NULL) {
+    if (node->r != BPT_NIL) {
+      node = bpt_node(pool, node->r);
+    } else if (node->l != BPT_NIL) {
+      node = bpt_node(pool, node->l);
+    } else {
+      break;
+    }
+  }
+  return node;
+}
+
+int bgpstream_patricia_tree_build_sorted(bgpstream_patricia_tree_t *pt,
+                                         const bgpstream_pfx_t *pfxs,
+                                         int pfxs_cnt)
+{
+  bgpstream_patricia_node_t *last4, *last6, **last;
+  bgpstream_patricia_node_t *node;
+  bpt_pool_t *pool;
+  int relation;
+  uint8_t differ_bit;
+  int i;
+
+  assert(pt);
+
+  last4 = bpt_last_node(&pt->pool4);
+  last6 = bpt_last_node(&pt->pool6);
+
+  for (i = 0; i < pfxs_cnt; i++) {
+    assert(pfxs[i].mask_len <= BGPSTREAM_PATRICIA_MAXBITS);
+    assert(pfxs[i].address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
+
+    pool = BPT_POOL(pt, pfxs[i].address.version);
+    last = (pfxs[i].address.version == BGPSTREAM_ADDR_VERSION_IPV4) ? &last4
+                                                                     : &last6;
+
+    /* the previous prefix shares the longest run of leading bits with this
+     * one, so there is no need to search down from the root. Prefixes that
+     * are out of order (or the first one in an empty tree) take the slow
+     * path, which leaves the last node unchanged */
+    if (*last == NULL || bpt_pfx_cmp(&pfxs[i], &(*last)->prefix) <= 0) {
+      if ((node = bgpstream_patricia_tree_insert(pt, &pfxs[i])) == NULL) {
+        return -1;
+      }
+      if (*last == NULL) {
+        *last = node;
+      }
+      continue;
+    }
+
+    node = bgpstream_nonconst_node(bpt_climb_insert_point_const(
+      pool, *last, &pfxs[i], &relation, &differ_bit));
+    if ((node = bpt_insert_at(pt, pool, node, &pfxs[i], relation,
+                              differ_bit)) == NULL) {
+      return -1;
+    }
+    *last = node;
+  }
+
+  return 0;
+}
+
+typedef struct bpt_sort_run {
+  bgpstream_pfx_t *pfxs;
+  int cnt;
+  pthread_t tid;
+  int started;
+} bpt_sort_run_t;
+
+static void *bpt_sort_run_thread(void *data)
+{
+  bpt_sort_run_t *run = data;
+  qsort(run->pfxs, run->cnt, sizeof(bgpstream_pfx_t), bpt_pfx_qsort_cmp);
+  return NULL;
+}
+
+/* Sort pfxs using up to the given number of threads: each thread sorts one
+ * run, and the runs are then merged pairwise */
+static int bpt_sort_pfxs(bgpstream_pfx_t *pfxs, int pfxs_cnt, int threads)
+{
+  bpt_sort_run_t *runs = NULL;
+  bgpstream_pfx_t *tmp = NULL;
+  int runs_cnt;
+  int i, width, a, b, mid, end, k;
+  int rc = -1;
+
+  if (threads > pfxs_cnt / BPT_SORT_MIN_RUN) {
+    threads = pfxs_cnt / BPT_SORT_MIN_RUN;
+  }
+  if (threads <= 1) {
+    qsort(pfxs, pfxs_cnt, sizeof(bgpstream_pfx_t), bpt_pfx_qsort_cmp);
+    return 0;
+  }
+  runs_cnt = threads;
+
+  if ((runs = malloc(sizeof(bpt_sort_run_t) * runs_cnt)) == NULL ||
+      (tmp = malloc(sizeof(bgpstream_pfx_t) * pfxs_cnt)) == NULL) {
+    goto err;
+  }
+
+  for (i = 0; i < runs_cnt; i++) {
+    runs[i].pfxs = pfxs + (int64_t)pfxs_cnt * i / runs_cnt;
+    runs[i].cnt = (int64_t)pfxs_cnt * (i + 1) / runs_cnt -
+                  (int64_t)pfxs_cnt * i / runs_cnt;
+    runs[i].started =
+      pthread_create(&runs[i].tid, NULL, bpt_sort_run_thread, &runs[i]) == 0;
+    if (!runs[i].started) {
+      /* just sort this run in the calling thread */
+      bpt_sort_run_thread(&runs[i]);
+    }
+  }
+  for (i = 0; i < runs_cnt; i++) {
+    if (runs[i].started) {
+      pthread_join(runs[i].tid, NULL);
+    }
+  }
+
+  /* merge neighbouring runs until there is only one left */
+  for (width = 1; width < runs_cnt; width *= 2) {
+    for (i = 0; i + width < runs_cnt; i += 2 * width) {
+      a = runs[i].pfxs - pfxs;
+      mid = runs[i + width].pfxs - pfxs;
+      end = (i + 2 * width < runs_cnt) ? (runs[i + 2 * width].pfxs - pfxs)
+                                       : pfxs_cnt;
+      b = mid;
+      k = a;
+      while (a < mid && b < end) {
+        if (bpt_pfx_cmp(&pfxs[b], &pfxs[a]) < 0) {
+          tmp[k++] = pfxs[b++];
+        } else {
+          tmp[k++] = pfxs[a++];
+        }
+      }
+      while (a < mid) {
+        tmp[k++] = pfxs[a++];
+      }
+      while (b < end) {
+        tmp[k++] = pfxs[b++];
+      }
+      a = runs[i].pfxs - pfxs;
+      memcpy(pfxs + a, tmp + a, sizeof(bgpstream_pfx_t) * (end - a));
+    }
+  }
+  rc = 0;
+
+err:
+  free(runs);
+  free(tmp);
+  return rc;
+}
+
+int bgpstream_patricia_tree_build(bgpstream_patricia_tree_t *pt,
+                                  bgpstream_pfx_t *pfxs, int pfxs_cnt,
+                                  int threads)
+{
+  if (bpt_sort_pfxs(pfxs, pfxs_cnt, threads) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "could not sort prefixes");
+    return -1;
+  }
+  return bgpstream_patricia_tree_build_sorted(pt, pfxs, pfxs_cnt);
+}
+
 void bgpstream_patricia_tree_walk_up_down(
     const bgpstream_patricia_tree_t *pt,
     const bgpstream_pfx_t *pfx,
@@ -793,68 +1548,77 @@ void bgpstream_patricia_tree_walk_up_down(
     // Tree is empty
     return;
   }
+  const bpt_pool_t *pool = BPT_POOL(pt, v);
 
   // Find insertion point
   int relation;
   uint8_t differ_bit; // unused
-  node_it = bpt_find_insert_point_const(node_it, pfx, &relation, &differ_bit);
+  node_it =
+    bpt_find_insert_point_const(pool, node_it, pfx, &relation, &differ_bit);
   bgpstream_patricia_walk_cb_result_t rc;
 
   // Walk parents and/or children of the insertion point
   if (relation == BGPSTREAM_PATRICIA_SELF) {
-    if (node_it->actual) {
+    if (BPT_ACTUAL(node_it)) {
       if (exact_fun) {
         rc = exact_fun(pt, node_it, data);
         if (rc == BGPSTREAM_PATRICIA_WALK_END_ALL) return;
       }
     }
     if (parent_fun) {
-      rc = bpt_walk_parents(pt, node_it->parent, parent_fun, data);
+      rc = bpt_walk_parents(pt, pool, bpt_node(pool, BPT_PARENT(node_it)),
+                            parent_fun, data);
       if (rc == BGPSTREAM_PATRICIA_WALK_END_ALL) return;
     }
     if (child_fun) {
-      rc = bpt_walk_children(pt, node_it->l, child_fun, data);
+      rc = bpt_walk_children(pt, pool, bpt_node(pool, BPT_LOAD(node_it->l)),
+                             child_fun, data);
       if (rc != BGPSTREAM_PATRICIA_WALK_CONTINUE) return;
-      rc = bpt_walk_children(pt, node_it->r, child_fun, data);
+      rc = bpt_walk_children(pt, pool, bpt_node(pool, BPT_LOAD(node_it->r)),
+                             child_fun, data);
     }
 
   } else if (relation == BGPSTREAM_PATRICIA_PARENT) {
     if (parent_fun) {
-      bpt_walk_parents(pt, node_it, parent_fun, data);
+      bpt_walk_parents(pt, pool, node_it, parent_fun, data);
     }
 
   } else if (relation == BGPSTREAM_PATRICIA_CHILD) {
     if (parent_fun) {
-      rc = bpt_walk_parents(pt, node_it->parent, parent_fun, data);
+      rc = bpt_walk_parents(pt, pool, bpt_node(pool, BPT_PARENT(node_it)),
+                            parent_fun, data);
       if (rc == BGPSTREAM_PATRICIA_WALK_END_ALL) return;
     }
     if (child_fun) {
-      bpt_walk_children(pt, node_it, child_fun, data);
+      bpt_walk_children(pt, pool, node_it, child_fun, data);
     }
 
   } else if (relation == BGPSTREAM_PATRICIA_SIBLING) {
     if (parent_fun) {
-      bpt_walk_parents(pt, node_it->parent, parent_fun, data);
+      bpt_walk_parents(pt, pool, bpt_node(pool, BPT_PARENT(node_it)),
+                       parent_fun, data);
     }
   }
 }
 
 void *bgpstream_patricia_tree_get_user(bgpstream_patricia_node_t *node)
 {
-  return node->user;
+  return BPT_LOAD(node->user);
 }
 
 int bgpstream_patricia_tree_set_user(bgpstream_patricia_tree_t *pt,
                                      bgpstream_patricia_node_t *node,
                                      void *user)
 {
+  void *old;
+
   if (node->user == user) {
     return 0;
   }
-  if (node->user != NULL && pt->node_user_destructor != NULL) {
-    pt->node_user_destructor(node->user);
-  }
-  node->user = user;
+  old = node->user;
+  /* unpublish the old user data before it is (eventually) destroyed */
+  BPT_STORE(node->user, user);
+  bpt_destroy_user(pt, old);
   return 1;
 }
 
@@ -902,36 +1666,39 @@ void bgpstream_patricia_tree_remove(bgpstream_patricia_tree_t *pt,
 void bgpstream_patricia_tree_remove_node(bgpstream_patricia_tree_t *pt,
                                          bgpstream_patricia_node_t *node)
 {
+  void *old;
+
   assert(pt);
   if (node == NULL) {
     return;
   }
 
   bgpstream_addr_version_t v = node->prefix.address.version;
+  bpt_pool_t *pool = BPT_POOL(pt, v);
   bgpstream_patricia_node_t *parent;
-  bgpstream_patricia_node_t *child;
+  bgpstream_patricia_node_t *grandparent;
+  uint32_t node_idx, parent_idx, child_idx;
 
   uint64_t *num_active_node = (v == BGPSTREAM_ADDR_VERSION_IPV6) ?
     &pt->ipv6_active_nodes : &pt->ipv4_active_nodes;
 
   /* we do not allow for explicit removal of glue nodes */
-  if (!node->actual) {
+  if (!BPT_ACTUAL(node)) {
     return;
   }
 
-  if (node->user != NULL) {
-    if (pt->node_user_destructor != NULL) {
-      pt->node_user_destructor(node->user);
-    }
-    node->user = NULL;
+  if ((old = node->user) != NULL) {
+    BPT_STORE(node->user, NULL);
+    bpt_destroy_user(pt, old);
   }
 
   /* if node has both children */
-  if (node->r != NULL && node->l != NULL) {
+  if (node->r != BPT_NIL && node->l != BPT_NIL) {
     /* if it is a glue node, there is nothing to remove,
      * if it is node with a valid prefix, then it becomes a glue node
      */
-    node->actual = 0;
+    bpt_set_actual(node, 0);
+    (*num_active_node) = (*num_active_node) - 1;
     /* node data remains, unless we decide to pass a destroy function somewehere
      */
     /* node->user = NULL; */
@@ -939,32 +1706,36 @@ void bgpstream_patricia_tree_remove_node(bgpstream_patricia_tree_t *pt,
     return;
   }
 
+  node_idx = bpt_node_idx(pool, node);
+  parent_idx = BPT_PARENT(node);
+
   /* if node has no children */
-  if (node->r == NULL && node->l == NULL) {
-    parent = node->parent;
-    free(node);
+  if (node->r == BPT_NIL && node->l == BPT_NIL) {
     (*num_active_node) = (*num_active_node) - 1;
 
     /* removing head of tree */
-    if (parent == NULL) {
-      assert(node == bgpstream_patricia_get_head(pt, v));
-      bgpstream_patricia_set_head(pt, v, NULL);
+    if (parent_idx == BPT_NIL) {
+      assert(node_idx == pool->head);
+      BPT_STORE(pool->head, BPT_NIL);
+      bpt_free_node(pt, pool, node_idx);
       /* DEBUG fprintf(stderr, "Removing head (that had no children)\n"); */
       return;
     }
 
     /* check if the node was the right or the left child */
-    if (parent->r == node) {
-      parent->r = NULL;
-      child = parent->l;
+    parent = bpt_node(pool, parent_idx);
+    if (parent->r == node_idx) {
+      BPT_STORE(parent->r, BPT_NIL);
+      child_idx = parent->l;
     } else {
-      assert(parent->l == node);
-      parent->l = NULL;
-      child = parent->r;
+      assert(parent->l == node_idx);
+      BPT_STORE(parent->l, BPT_NIL);
+      child_idx = parent->r;
     }
+    bpt_free_node(pt, pool, node_idx);
 
     /* if the current parent was a valid prefix, return */
-    if (parent->actual) {
+    if (BPT_ACTUAL(parent)) {
       /* DEBUG fprintf(stderr, "Removing node with no children\n"); */
       return;
     }
@@ -972,52 +1743,53 @@ void bgpstream_patricia_tree_remove_node(bgpstream_patricia_tree_t *pt,
     /* otherwise it makes no sense to have a glue node
      * with only one child, the parent has to be removed */
 
-    if (parent->parent == NULL) { /* if the parent parent is the head, then
-                                   * attach the only child directly */
-      assert(parent == bgpstream_patricia_get_head(pt, v));
-      bgpstream_patricia_set_head(pt, v, child);
+    if (BPT_PARENT(parent) == BPT_NIL) { /* if the parent parent is the head,
+                                          * then attach the only child
+                                          * directly */
+      assert(parent_idx == pool->head);
+      BPT_STORE(pool->head, child_idx);
     } else {
-      if (parent->parent->r == parent) { /* if the parent is a right child */
-        parent->parent->r = child;
+      grandparent = bpt_node(pool, BPT_PARENT(parent));
+      if (grandparent->r == parent_idx) { /* if the parent is a right child */
+        BPT_STORE(grandparent->r, child_idx);
       } else { /* if the parent is a left child */
-        assert(parent->parent->l == parent);
-        parent->parent->l = child;
+        assert(grandparent->l == parent_idx);
+        BPT_STORE(grandparent->l, child_idx);
       }
     }
     /* the child parent, is now the grand-parent */
-    child->parent = parent->parent;
-    free(parent);
+    bpt_set_parent(bpt_node(pool, child_idx), BPT_PARENT(parent));
+    bpt_free_node(pt, pool, parent_idx);
     return;
   }
 
   /* if node has only one child */
-  if (node->r) {
-    child = node->r;
+  if (node->r != BPT_NIL) {
+    child_idx = node->r;
   } else {
-    assert(node->l);
-    child = node->l;
+    assert(node->l != BPT_NIL);
+    child_idx = node->l;
   }
   /* the child parent, is now the grand-parent */
-  parent = node->parent;
-  child->parent = parent;
+  bpt_set_parent(bpt_node(pool, child_idx), parent_idx);
 
-  free(node);
-  (*num_active_node) = (*num_active_node) - 1;
-
-  if (parent == NULL) { /* if the parent is the head, then attach
-                         * the only child directly */
-    assert(node == bgpstream_patricia_get_head(pt, v));
-    bgpstream_patricia_set_head(pt, v, child);
-    return;
+  if (parent_idx == BPT_NIL) { /* if the parent is the head, then attach
+                                * the only child directly */
+    assert(node_idx == pool->head);
+    BPT_STORE(pool->head, child_idx);
   } else {
     /* attach child node to the correct parent child pointer */
-    if (parent->r == node) { /* if node was a right child */
-      parent->r = child;
+    parent = bpt_node(pool, parent_idx);
+    if (parent->r == node_idx) { /* if node was a right child */
+      BPT_STORE(parent->r, child_idx);
     } else { /* if node was a left child */
-      assert(parent->l == node);
-      parent->l = child;
+      assert(parent->l == node_idx);
+      BPT_STORE(parent->l, child_idx);
     }
   }
+
+  bpt_free_node(pt, pool, node_idx);
+  (*num_active_node) = (*num_active_node) - 1;
 }
 
 const bgpstream_patricia_node_t *
@@ -1038,10 +1810,10 @@ bgpstream_patricia_tree_search_exact_const(const bgpstream_patricia_tree_t *pt,
   }
   uint8_t bitlen = pfx->mask_len;
 
-  node = bpt_search_node(node, pfx);
+  node = bpt_search_node(BPT_POOL(pt, v), node, pfx);
 
   // if node has the wrong length, or is a glue node, then no exact match
-  if (node->prefix.mask_len != bitlen || !node->actual) {
+  if (node->prefix.mask_len != bitlen || !BPT_ACTUAL(node)) {
     return NULL;
   }
 
@@ -1055,6 +1827,39 @@ bgpstream_patricia_tree_search_exact_const(const bgpstream_patricia_tree_t *pt,
   return NULL;
 }
 
+const bgpstream_patricia_node_t *
+bgpstream_patricia_tree_search_best_const(const bgpstream_patricia_tree_t *pt,
+                                          const bgpstream_pfx_t *pfx)
+{
+  assert(pt);
+  assert(pfx);
+  assert(pfx->mask_len <= BGPSTREAM_PATRICIA_MAXBITS);
+  assert(pfx->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
+
+  const bpt_pool_t *pool = BPT_POOL(pt, pfx->address.version);
+  const bgpstream_patricia_node_t *node = bpt_node(pool, BPT_LOAD(pool->head));
+  const bgpstream_patricia_node_t *best = NULL;
+  const unsigned char *addr = bgpstream_pfx_get_first_byte(pfx);
+
+  /* walk down towards pfx, remembering the last actual prefix that
+   * contains it */
+  while (node != NULL && node->prefix.mask_len <= pfx->mask_len) {
+    if (!comp_with_mask(bgpstream_pfx_get_first_byte(&node->prefix), addr,
+                        node->prefix.mask_len)) {
+      break;
+    }
+    if (BPT_ACTUAL(node)) {
+      best = node;
+    }
+    if (node->prefix.mask_len == pfx->mask_len) {
+      break;
+    }
+    node = bpt_node(pool, BIT_ARRAY_TEST(addr, node->prefix.mask_len) ?
+                            BPT_LOAD(node->r) : BPT_LOAD(node->l));
+  }
+  return best;
+}
+
 uint64_t bgpstream_patricia_prefix_count(const bgpstream_patricia_tree_t *pt,
                                          bgpstream_addr_version_t v)
 {
@@ -1071,13 +1876,15 @@ uint64_t bgpstream_patricia_prefix_count(const bgpstream_patricia_tree_t *pt,
 uint64_t bgpstream_patricia_tree_count_24subnets(
     const bgpstream_patricia_tree_t *pt)
 {
-  return bgpstream_patricia_tree_count_subnets(pt->head4, 24);
+  return bgpstream_patricia_tree_count_subnets(
+    &pt->pool4, bpt_node(&pt->pool4, pt->pool4.head), 24);
 }
 
 uint64_t bgpstream_patricia_tree_count_64subnets(
     const bgpstream_patricia_tree_t *pt)
 {
-  return bgpstream_patricia_tree_count_subnets(pt->head6, 64);
+  return bgpstream_patricia_tree_count_subnets(
+    &pt->pool6, bpt_node(&pt->pool6, pt->pool6.head), 64);
 }
 
 int bgpstream_patricia_tree_get_more_specifics(
@@ -1087,12 +1894,15 @@ int bgpstream_patricia_tree_get_more_specifics(
   bgpstream_patricia_tree_result_set_clear(results);
 
   if (node != NULL) { /* we do not return the node itself */
+    const bpt_pool_t *pool = BPT_POOL(pt, node->prefix.address.version);
     if (bgpstream_patricia_tree_add_more_specifics(
-          results, node->l, BGPSTREAM_PATRICIA_MAXBITS + 1) != 0) {
+          results, pool, bpt_node(pool, BPT_LOAD(node->l)),
+          BGPSTREAM_PATRICIA_MAXBITS + 1) != 0) {
       return -1;
     }
     if (bgpstream_patricia_tree_add_more_specifics(
-          results, node->r, BGPSTREAM_PATRICIA_MAXBITS + 1) != 0) {
+          results, pool, bpt_node(pool, BPT_LOAD(node->r)),
+          BGPSTREAM_PATRICIA_MAXBITS + 1) != 0) {
       return -1;
     }
   }
@@ -1108,8 +1918,14 @@ int bgpstream_patricia_tree_get_mincovering_prefix(
   if (node == NULL) {
     return 0;
   }
+  const bpt_pool_t *pool = BPT_POOL(pt, node->prefix.address.version);
+  if (pt->concurrent) {
+    return bgpstream_patricia_tree_add_less_specifics_from_root(results, pool,
+                                                                node, 1);
+  }
   /* we do not return the node itself (that's why we pass the parent node) */
-  return bgpstream_patricia_tree_add_less_specifics(results, node->parent, 1);
+  return bgpstream_patricia_tree_add_less_specifics(
+    results, pool, bpt_node(pool, BPT_PARENT(node)), 1);
 }
 
 int bgpstream_patricia_tree_get_less_specifics(
@@ -1121,9 +1937,15 @@ int bgpstream_patricia_tree_get_less_specifics(
   if (node == NULL) {
     return 0;
   }
+  const bpt_pool_t *pool = BPT_POOL(pt, node->prefix.address.version);
+  if (pt->concurrent) {
+    return bgpstream_patricia_tree_add_less_specifics_from_root(
+      results, pool, node, BGPSTREAM_PATRICIA_MAXBITS + 1);
+  }
   /* we do not return the node itself (that's why we pass the parent node) */
   return bgpstream_patricia_tree_add_less_specifics(
-    results, node->parent, BGPSTREAM_PATRICIA_MAXBITS + 1);
+    results, pool, bpt_node(pool, BPT_PARENT(node)),
+    BGPSTREAM_PATRICIA_MAXBITS + 1);
 }
 
 int bgpstream_patricia_tree_get_minimum_coverage(
@@ -1132,8 +1954,12 @@ int bgpstream_patricia_tree_get_minimum_coverage(
 {
   bgpstream_patricia_tree_result_set_clear(results);
   bgpstream_patricia_node_t *head = bgpstream_patricia_get_head(pt, v);
+  if (head == NULL) {
+    return 0;
+  }
   /* we stop at the first layer, hence depth = 1 */
-  return bgpstream_patricia_tree_add_more_specifics(results, head, 1);
+  return bgpstream_patricia_tree_add_more_specifics(results, BPT_POOL(pt, v),
+                                                    head, 1);
 }
 
 uint8_t
@@ -1141,21 +1967,24 @@ bgpstream_patricia_tree_get_node_overlap_info(
     const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node)
 {
   uint8_t mask = BGPSTREAM_PATRICIA_EXACT_MATCH;
+  const bpt_pool_t *pool = BPT_POOL(pt, node->prefix.address.version);
 
-  const bgpstream_patricia_node_t *node_it = node->parent;
+  const bgpstream_patricia_node_t *node_it = bpt_node(pool, BPT_PARENT(node));
   while (node_it != NULL) {
-    if (node_it->actual) {
+    if (BPT_ACTUAL(node_it)) {
       /* one less specific found */
       mask = mask | BGPSTREAM_PATRICIA_LESS_SPECIFICS;
       break;
     }
-    node_it = node_it->parent;
+    node_it = bpt_node(pool, BPT_PARENT(node_it));
   }
 
   node_it = node;
   if (node_it != NULL) { /* we do not consider the node itself */
-    if (bgpstream_patricia_tree_find_more_specific(node->l) ||
-        bgpstream_patricia_tree_find_more_specific(node->r)) {
+    if (bgpstream_patricia_tree_find_more_specific(
+          pool, bpt_node(pool, BPT_LOAD(node->l))) ||
+        bgpstream_patricia_tree_find_more_specific(
+          pool, bpt_node(pool, BPT_LOAD(node->r)))) {
         mask = mask | BGPSTREAM_PATRICIA_MORE_SPECIFICS;
     }
   }
@@ -1170,30 +1999,36 @@ void bgpstream_patricia_tree_merge(bgpstream_patricia_tree_t *dst,
     return;
   }
   /* Merge IPv4 */
-  bgpstream_patricia_tree_merge_tree(dst, src->head4);
+  bgpstream_patricia_tree_merge_tree(dst, &src->pool4,
+                                     bpt_node(&src->pool4, src->pool4.head));
   /* Merge IPv6 */
-  bgpstream_patricia_tree_merge_tree(dst, src->head6);
+  bgpstream_patricia_tree_merge_tree(dst, &src->pool6,
+                                     bpt_node(&src->pool6, src->pool6.head));
 }
 
 void bgpstream_patricia_tree_walk(const bgpstream_patricia_tree_t *pt,
                                   bgpstream_patricia_tree_process_node_t *fun,
                                   void *data)
 {
-  bpt_walk_children(pt, pt->head4, fun, data);
-  bpt_walk_children(pt, pt->head6, fun, data);
+  bpt_walk_children(pt, &pt->pool4, bpt_node(&pt->pool4, pt->pool4.head), fun,
+                    data);
+  bpt_walk_children(pt, &pt->pool6, bpt_node(&pt->pool6, pt->pool6.head), fun,
+                    data);
 }
 
 void bgpstream_patricia_tree_print(const bgpstream_patricia_tree_t *pt)
 {
-  bgpstream_patricia_tree_print_tree(pt->head4);
-  bgpstream_patricia_tree_print_tree(pt->head6);
+  bgpstream_patricia_tree_print_tree(&pt->pool4,
+                                     bpt_node(&pt->pool4, pt->pool4.head));
+  bgpstream_patricia_tree_print_tree(&pt->pool6,
+                                     bpt_node(&pt->pool6, pt->pool6.head));
 }
 
 const bgpstream_pfx_t *
 bgpstream_patricia_tree_get_pfx(const bgpstream_patricia_node_t *node)
 {
   assert(node);
-  if (node->actual) {
+  if (BPT_ACTUAL(node)) {
     return &node->prefix;
   }
   return NULL;
@@ -1201,21 +2036,44 @@ bgpstream_patricia_tree_get_pfx(const bgpstream_patricia_node_t *node)
 
 void bgpstream_patricia_tree_clear(bgpstream_patricia_tree_t *pt)
 {
+  int i;
+
   assert(pt);
 
-  bgpstream_patricia_tree_destroy_tree(pt, pt->head4);
+  if (pt->concurrent) {
+    /* detach both trees and wait until no reader can be in them */
+    BPT_STORE(pt->pool4.head, BPT_NIL);
+    BPT_STORE(pt->pool6.head, BPT_NIL);
+    bpt_synchronize(pt);
+    /* retired nodes go along with the rest of the pool */
+    for (i = 0; i < pt->retired_cnt; i++) {
+      if (pt->retired[i].type != BPT_RETIRED_NODE4 &&
+          pt->retired[i].type != BPT_RETIRED_NODE6) {
+        bpt_release(pt, &pt->retired[i]);
+      }
+    }
+    pt->retired_cnt = 0;
+  }
+
+  bpt_pool_clear(&pt->pool4, pt->node_user_destructor);
   pt->ipv4_active_nodes = 0;
-  pt->head4 = NULL;
 
-  bgpstream_patricia_tree_destroy_tree(pt, pt->head6);
+  bpt_pool_clear(&pt->pool6, pt->node_user_destructor);
   pt->ipv6_active_nodes = 0;
-  pt->head6 = NULL;
 }
 
 void bgpstream_patricia_tree_destroy(bgpstream_patricia_tree_t *pt)
 {
   if (pt != NULL) {
     bgpstream_patricia_tree_clear(pt);
+    bpt_pool_destroy(&pt->pool4);
+    bpt_pool_destroy(&pt->pool6);
+    if (pt->concurrent) {
+      assert(pt->readers_cnt == 0);
+      free(pt->readers);
+      free(pt->retired);
+      pthread_mutex_destroy(&pt->readers_mutex);
+    }
     free(pt);
   }
 }
@@ -70,6 +70,10 @@ typedef struct bgpstream_patricia_tree bgpstream_patricia_tree_t;
 typedef struct bgpstream_patricia_tree_result_set
   bgpstream_patricia_tree_result_set_t;
 
+/** Opaque structure containing a concurrent Patricia Tree reader */
+typedef struct bgpstream_patricia_tree_reader
+  bgpstream_patricia_tree_reader_t;
+
 /** @} */
 
 /**
@@ -180,6 +184,65 @@ void bgpstream_patricia_tree_result_set_print(
 bgpstream_patricia_tree_t *bgpstream_patricia_tree_create(
   bgpstream_patricia_tree_destroy_user_t *bspt_user_destructor);
 
+/** Switch the given Patricia Tree to concurrent mode
+ *
+ * @param pt           pointer to the patricia tree
+ * @return 0 if the tree is now in concurrent mode, -1 otherwise
+ *
+ * In concurrent mode, one thread at a time may modify the tree while any
+ * number of reader threads look up prefixes without taking a lock. Each
+ * reader thread needs its own reader handle (see
+ * bgpstream_patricia_tree_reader_create) and must bracket its lookups with
+ * bgpstream_patricia_tree_read_lock and bgpstream_patricia_tree_read_unlock.
+ *
+ * Inside a read-side critical section the following functions are safe to
+ * call concurrently with the writer: search_exact, search_best,
+ * get_more_specifics, get_less_specifics, get_mincovering_prefix,
+ * get_pfx_overlap_info, get_node_overlap_info, walk_up_down, get_pfx and
+ * get_user. Nodes (and their user data) that the writer removes are only
+ * released once every reader has left the critical section it was in at the
+ * time, so node pointers stay usable until read_unlock.
+ *
+ * This function must be called before the tree is shared between threads.
+ */
+int bgpstream_patricia_tree_set_concurrent(bgpstream_patricia_tree_t *pt);
+
+/** Register a new reader for the given concurrent Patricia Tree
+ *
+ * @param pt           pointer to the patricia tree
+ * @return a pointer to the reader, or NULL if an error occurred
+ *
+ * A reader must only be used by one thread at a time.
+ */
+bgpstream_patricia_tree_reader_t *
+bgpstream_patricia_tree_reader_create(bgpstream_patricia_tree_t *pt);
+
+/** Unregister and destroy the given reader
+ *
+ * @param reader       pointer to the reader to destroy
+ *
+ * All readers must be destroyed before the tree is.
+ */
+void bgpstream_patricia_tree_reader_destroy(
+  bgpstream_patricia_tree_reader_t *reader);
+
+/** Enter a read-side critical section
+ *
+ * @param reader       pointer to the reader
+ */
+void bgpstream_patricia_tree_read_lock(
+  bgpstream_patricia_tree_reader_t *reader);
+
+/** Leave a read-side critical section
+ *
+ * @param reader       pointer to the reader
+ *
+ * Node pointers obtained in the critical section must not be used after
+ * this call.
+ */
+void bgpstream_patricia_tree_read_unlock(
+  bgpstream_patricia_tree_reader_t *reader);
+
 /** Insert a new prefix, if it does not exist
  *
  * @param pt           pointer to the patricia tree to lookup in
@@ -191,6 +254,37 @@ bgpstream_patricia_node_t *
 bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
                                const bgpstream_pfx_t *pfx);
 
+/** Insert an array of prefixes that is already sorted
+ *
+ * @param pt           pointer to the patricia tree to insert into
+ * @param pfxs         array of prefixes to insert
+ * @param pfxs_cnt     number of prefixes in the array
+ * @return 0 if the prefixes were inserted successfully, -1 otherwise
+ *
+ * The prefixes should be sorted by IP version, then by (masked) address and
+ * then by mask length, so that each prefix comes right before its more
+ * specifics. Each prefix is then inserted next to the previous one, without
+ * searching down from the root of the tree. Prefixes that are out of order
+ * (or duplicates) are still inserted correctly, just more slowly.
+ */
+int bgpstream_patricia_tree_build_sorted(bgpstream_patricia_tree_t *pt,
+                                         const bgpstream_pfx_t *pfxs,
+                                         int pfxs_cnt);
+
+/** Sort an array of prefixes and insert them into the tree
+ *
+ * @param pt           pointer to the patricia tree to insert into
+ * @param pfxs         array of prefixes to insert (sorted in place)
+ * @param pfxs_cnt     number of prefixes in the array
+ * @param threads      maximum number of threads to sort with
+ * @return 0 if the prefixes were inserted successfully, -1 otherwise
+ *
+ * @see bgpstream_patricia_tree_build_sorted
+ */
+int bgpstream_patricia_tree_build(bgpstream_patricia_tree_t *pt,
+                                  bgpstream_pfx_t *pfxs, int pfxs_cnt,
+                                  int threads);
+
 /** Get the user pointer associated with the node
  *
  * @param node        pointer to a node
@@ -260,6 +354,34 @@ bgpstream_patricia_tree_search_exact(bgpstream_patricia_tree_t *pt,
     pt, pfx));
 }
 
+/** Return the most specific prefix in the Patricia Tree that contains the
+ * given prefix (i.e. a longest prefix match)
+ *
+ * @param pt           pointer to the patricia tree
+ * @param pfx          pointer to the prefix to search for
+ * @return a pointer to the node of the longest matching prefix, or NULL if no
+ * prefix in the tree contains pfx
+ */
+const bgpstream_patricia_node_t *
+bgpstream_patricia_tree_search_best_const(const bgpstream_patricia_tree_t *pt,
+                                          const bgpstream_pfx_t *pfx);
+
+/** Return the most specific prefix in the Patricia Tree that contains the
+ * given prefix (i.e. a longest prefix match)
+ *
+ * @param pt           pointer to the patricia tree
+ * @param pfx          pointer to the prefix to search for
+ * @return a pointer to the node of the longest matching prefix, or NULL if no
+ * prefix in the tree contains pfx
+ */
+static inline bgpstream_patricia_node_t *
+bgpstream_patricia_tree_search_best(bgpstream_patricia_tree_t *pt,
+                                    const bgpstream_pfx_t *pfx)
+{
+  return bgpstream_nonconst_node(bgpstream_patricia_tree_search_best_const(
+    pt, pfx));
+}
+
 /** Count the number of prefixes in the Patricia Tree
  *
  * @param pt         pointer to the patricia tree
@@ -358,6 +480,9 @@ bgpstream_patricia_tree_get_pfx_overlap_info(
  *
  * @param node         pointer to the node
  * @return a pointer to the node's prefix , or NULL if an error occurred
+ *
+ * IPv4 nodes only have room for an IPv4 prefix, so use bgpstream_pfx_copy
+ * rather than a structure assignment to take a copy of the returned prefix.
  */
 const bgpstream_pfx_t *
 bgpstream_patricia_tree_get_pfx(const bgpstream_patricia_node_t *node);
@@ -399,6 +524,10 @@ void bgpstream_patricia_tree_print(const bgpstream_patricia_tree_t *pt);
 /** Clear the given Patricia Tree (i.e. remove all prefixes)
  *
  * @param pt           pointer to the patricia tree to clear
+ *
+ * All nodes are released at once and their memory is kept for reuse by later
+ * insertions. If the tree has a user destructor, it is still called for each
+ * node that has user data.
  */
 void bgpstream_patricia_tree_clear(bgpstream_patricia_tree_t *pt);
 
@@ -25,128 +25,100 @@
  */
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 
-#include "khash.h"
 #include "utils.h"
 
+#include "bgpstream_utils_id_index.h"
 #include "bgpstream_utils_peer_sig_map.h"
 
-#define IPV4_ID_OFFSET 1
-#define IPV6_ID_OFFSET 1
+/* Number of independently locked stripes of the signature index */
+#define STRIPE_BITS 4
+#define STRIPE_CNT (1 << STRIPE_BITS)
 
-/** Hash a peer signature into a 64bit number
- *
- * @param ps            the peer signature to hash
- * @return 64bit hash of the given peer signature
- */
-khint64_t bgpstream_peer_sig_hash(bgpstream_peer_sig_t *ps);
+/* Initial number of slots in the index of each stripe */
+#define STRIPE_INIT_SIZE 64
 
-/** Check if two peer signatures are equal
- *
- * @param ps1           pointer to the first peer signature
- * @param ps2           pointer to the second peer signature
- * @return 0 if the signatures are not equal, non-zero if they are equal
- */
-int bgpstream_peer_sig_equal(bgpstream_peer_sig_t *ps1,
-                             bgpstream_peer_sig_t *ps2);
+/** A stripe of the signature index */
+typedef struct stripe {
 
-/** Set the peer ID for the given collector/peer
- *
- * @param map           peer sig map to set peer ID for
- * @param peer_id       peer id to set
- * @param collector_str name of the collector the peer is associated with
- * @param peer_ip_addr  pointer to the peer IP address
- * @param peer_asnumber  AS number of the peer
- * @return 0 if the ID was associated successfully, -1 otherwise
- *
- * @note the peer sig map expects to be able to allocate IDs internally. This
- * function must be used with care.
- */
-int bgpstream_peer_sig_map_set(bgpstream_peer_sig_map_t *map,
-                               bgpstream_peer_id_t peer_id, char *collector_str,
-                               bgpstream_ip_addr_t *peer_ip_addr,
-                               uint32_t peer_asnumber);
+  /** Lock held by writers */
+  pthread_mutex_t mutex;
+
+  /** Index from signature to ID */
+  bgpstream_id_index_t *index;
+
+  /** Number of signatures in this stripe */
+  uint32_t cnt;
+
+} stripe_t;
+
+/** A signature slot in a chunk */
+typedef struct sig_entry {
+
+  /** The signature (must be the first field) */
+  bgpstream_peer_sig_t sig;
+
+  /** Set once the signature has been written */
+  uint8_t ready;
 
-/** Map from peer signature to peer ID */
-KHASH_INIT(bgpstream_peer_sig_id_map, bgpstream_peer_sig_t *,
-           bgpstream_peer_id_t, 1, bgpstream_peer_sig_hash,
-           bgpstream_peer_sig_equal)
+} sig_entry_t;
 
-/** Map from peer ID to signature */
-KHASH_INIT(bgpstream_peer_id_sig_map, bgpstream_peer_id_t,
-           bgpstream_peer_sig_t *, 1, kh_int_hash_func, kh_int_hash_equal)
+/** A signature being looked up */
+typedef struct sig_key {
+
+  /** The map to look the signature up in */
+  bgpstream_peer_sig_map_t *map;
+
+  /** Name of the collector */
+  const char *collector_str;
+
+  /** IP address of the peer */
+  bgpstream_ip_addr_t *peer_ip_addr;
+
+} sig_key_t;
 
 /** Structure representing an instance of a Peer Signature Map */
 struct bgpstream_peer_sig_map {
-  khash_t(bgpstream_peer_sig_id_map) * ps_id;
-  khash_t(bgpstream_peer_id_sig_map) * id_ps;
-  bgpstream_peer_id_t v4_next_id;
-  bgpstream_peer_id_t v6_next_id;
-};
-
-/* PRIVATE FUNCTIONS (static) */
 
-static void sig_free(bgpstream_peer_sig_t *sig)
-{
-  free(sig);
-}
+  /** Index from signature to ID */
+  stripe_t stripes[STRIPE_CNT];
 
-static bgpstream_peer_id_t
-bgpstream_peer_sig_map_set_and_get_ps(bgpstream_peer_sig_map_t *map,
-                                      bgpstream_peer_sig_t *ps)
-{
-  khiter_t k;
-  int khret;
-  bgpstream_peer_id_t new_id;
-
-  if ((k = kh_get(bgpstream_peer_sig_id_map, map->ps_id, ps)) ==
-      kh_end(map->ps_id)) {
-    /* was not already in the map */
-    /* what ID should we use? */
-    if (map->v4_next_id >= IPV6_ID_OFFSET) {
-      /* v4 peers are in v6 range */
-      /* regardless of the version, use the v6 id */
-      new_id = map->v6_next_id++;
-    } else if (ps->peer_ip_addr.version == BGPSTREAM_ADDR_VERSION_IPV6) {
-      assert(map->v4_next_id < IPV6_ID_OFFSET);
-      new_id = map->v6_next_id++;
-    } else {
-      new_id = map->v4_next_id++;
-    }
+  /** Signatures, by ID. The chunks only hold the IDs assigned since the map
+   * was last cleared. */
+  bgpstream_id_chunks_t sigs;
 
-    /* insert into both maps */
-    k = kh_put(bgpstream_peer_sig_id_map, map->ps_id, ps, &khret);
-    kh_value(map->ps_id, k) = new_id;
-    k = kh_put(bgpstream_peer_id_sig_map, map->id_ps, new_id, &khret);
-    kh_value(map->id_ps, k) = ps;
-
-    return new_id;
-  } else {
-    /* already exists... */
-    free(ps); /* it was mallocd for us...*/
-    return kh_value(map->ps_id, k);
-  }
-}
+  /** Next ID to assign */
+  uint32_t next_id;
+};
 
-/* PROTECTED FUNCTIONS (_int.h) */
+/* PRIVATE FUNCTIONS (static) */
 
-khint64_t bgpstream_peer_sig_hash(bgpstream_peer_sig_t *ps)
+static uint32_t sig_hash(const char *collector_str,
+                         bgpstream_ip_addr_t *peer_ip_addr)
 {
-  /* assuming that the number of peers that have the same ip and belong to two
-   * different collectors is low (in this specific case there will be a
-   * collision in terms of hash). */
-  return bgpstream_addr_hash(&ps->peer_ip_addr);
+  /* peers with the same IP on different collectors (e.g., BMP routers
+   * sharing a private peering address) must not all collide */
+  uint32_t h = bgpstream_id_index_hash(BGPSTREAM_ID_INDEX_HASH_INIT,
+                                       collector_str, strlen(collector_str));
+  h ^= (uint32_t)bgpstream_addr_hash(peer_ip_addr);
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  return h;
 }
 
-/** @note we do not need to take into account the peer AS number
- *  to check whether a peer differs or not */
-int bgpstream_peer_sig_equal(bgpstream_peer_sig_t *ps1,
-                             bgpstream_peer_sig_t *ps2)
+static int sig_match(uint32_t id, void *user)
 {
-  return (
-    bgpstream_addr_equal(&ps1->peer_ip_addr, &ps2->peer_ip_addr) &&
-    (strcmp(ps1->collector_str, ps2->collector_str) == 0));
+  sig_key_t *key = user;
+  bgpstream_peer_sig_t *ps = bgpstream_id_chunks_get(&key->map->sigs, id);
+
+  /* we do not need to take into account the peer AS number to check whether
+   * a peer differs or not */
+  return bgpstream_addr_equal(&ps->peer_ip_addr, key->peer_ip_addr) &&
+         strcmp(ps->collector_str, key->collector_str) == 0;
 }
 
 /* PUBLIC FUNCTIONS */
@@ -154,21 +126,23 @@ int bgpstream_peer_sig_equal(bgpstream_peer_sig_t *ps1,
 bgpstream_peer_sig_map_t *bgpstream_peer_sig_map_create()
 {
   bgpstream_peer_sig_map_t *map = NULL;
+  int i;
+
   if ((map = (bgpstream_peer_sig_map_t *)malloc_zero(
          sizeof(bgpstream_peer_sig_map_t))) == NULL) {
     return NULL;
   }
 
-  if ((map->ps_id = kh_init(bgpstream_peer_sig_id_map)) == NULL) {
-    goto err;
-  }
-
-  if ((map->id_ps = kh_init(bgpstream_peer_id_sig_map)) == NULL) {
-    goto err;
+  for (i = 0; i < STRIPE_CNT; i++) {
+    pthread_mutex_init(&map->stripes[i].mutex, NULL);
+    if (bgpstream_id_index_reserve(&map->stripes[i].index, 0,
+                                   STRIPE_INIT_SIZE) != 0) {
+      goto err;
+    }
   }
 
-  map->v4_next_id = IPV4_ID_OFFSET;
-  map->v6_next_id = IPV6_ID_OFFSET;
+  map->sigs.entry_size = sizeof(sig_entry_t);
+  map->next_id = 1;
 
   return map;
 
@@ -181,58 +155,116 @@ bgpstream_peer_id_t bgpstream_peer_sig_map_get_id(
   bgpstream_peer_sig_map_t *map, const char *collector_str,
   bgpstream_ip_addr_t *peer_ip_addr, uint32_t peer_asnumber)
 {
-  bgpstream_peer_sig_t *new_ps;
-  if ((new_ps = malloc(sizeof(bgpstream_peer_sig_t))) == NULL) {
-    return -1;
+  uint32_t hash = sig_hash(collector_str, peer_ip_addr);
+  stripe_t *stripe = &map->stripes[hash >> (32 - STRIPE_BITS)];
+  sig_key_t key = {map, collector_str, peer_ip_addr};
+  bgpstream_peer_id_t id;
+  sig_entry_t *entry;
+
+  /* fast path: the peer is already known */
+  if ((id = bgpstream_id_index_lookup(&stripe->index, hash, sig_match,
+                                      &key)) != 0) {
+    return id;
+  }
+
+  pthread_mutex_lock(&stripe->mutex);
+
+  /* another thread may have added it since we looked */
+  if ((id = bgpstream_id_index_lookup(&stripe->index, hash, sig_match,
+                                      &key)) != 0) {
+    goto done;
   }
 
-  bgpstream_addr_copy(&new_ps->peer_ip_addr, peer_ip_addr);
-  strcpy(new_ps->collector_str, collector_str);
-  new_ps->peer_asnumber = peer_asnumber;
+  if (bgpstream_id_index_reserve(&stripe->index, stripe->cnt + 1,
+                                 STRIPE_INIT_SIZE) != 0) {
+    goto done;
+  }
 
-  return bgpstream_peer_sig_map_set_and_get_ps(map, new_ps);
+  /* writers to other stripes may be taking IDs concurrently, so the counter
+   * must never be incremented past the last ID (or it would wrap to 0) */
+  id = __atomic_load_n(&map->next_id, __ATOMIC_RELAXED);
+  do {
+    if (id == UINT32_MAX) {
+      /* out of IDs */
+      id = 0;
+      goto done;
+    }
+  } while (!__atomic_compare_exchange_n(&map->next_id, &id, id + 1, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  if ((entry = bgpstream_id_chunks_alloc(&map->sigs, id)) == NULL) {
+    /* the ID is lost, but it will never be handed out */
+    id = 0;
+    goto done;
+  }
+
+  bgpstream_addr_copy(&entry->sig.peer_ip_addr, peer_ip_addr);
+  strncpy(entry->sig.collector_str, collector_str,
+          BGPSTREAM_UTILS_STR_NAME_LEN - 1);
+  entry->sig.peer_asnumber = peer_asnumber;
+  __atomic_store_n(&entry->ready, 1, __ATOMIC_RELEASE);
+
+  bgpstream_id_index_put(stripe->index, hash, id);
+  stripe->cnt++;
+
+done:
+  pthread_mutex_unlock(&stripe->mutex);
+  return id;
 }
 
 bgpstream_peer_sig_t *
 bgpstream_peer_sig_map_get_sig(bgpstream_peer_sig_map_t *map,
                                bgpstream_peer_id_t id)
 {
-  bgpstream_peer_sig_t *ps = NULL;
-  khiter_t k;
-  if ((k = kh_get(bgpstream_peer_id_sig_map, map->id_ps, id)) !=
-      kh_end(map->id_ps)) {
-    ps = kh_value(map->id_ps, k);
+  sig_entry_t *entry;
+
+  if (id <= map->sigs.base ||
+      id >= __atomic_load_n(&map->next_id, __ATOMIC_ACQUIRE) ||
+      (entry = bgpstream_id_chunks_get(&map->sigs, id)) == NULL ||
+      __atomic_load_n(&entry->ready, __ATOMIC_ACQUIRE) == 0) {
+    return NULL;
   }
-  return ps;
+  return &entry->sig;
 }
 
 int bgpstream_peer_sig_map_get_size(bgpstream_peer_sig_map_t *map)
 {
-  assert(kh_size(map->id_ps) == kh_size(map->ps_id));
-  return kh_size(map->id_ps);
+  int size = 0;
+  int i;
+  for (i = 0; i < STRIPE_CNT; i++) {
+    pthread_mutex_lock(&map->stripes[i].mutex);
+    size += map->stripes[i].cnt;
+    pthread_mutex_unlock(&map->stripes[i].mutex);
+  }
+  return size;
 }
 
 void bgpstream_peer_sig_map_destroy(bgpstream_peer_sig_map_t *map)
 {
-  if (map != NULL) {
-    if (map->ps_id != NULL) {
-      kh_destroy(bgpstream_peer_sig_id_map, map->ps_id);
-      map->ps_id = NULL;
-    }
-    if (map->id_ps != NULL) {
-      /* only call free vals on ONE map, they are shared */
-      kh_free_vals(bgpstream_peer_id_sig_map, map->id_ps, sig_free);
-      kh_destroy(bgpstream_peer_id_sig_map, map->id_ps);
-      map->id_ps = NULL;
-    }
-    free(map);
+  int i;
+
+  if (map == NULL) {
+    return;
+  }
+  for (i = 0; i < STRIPE_CNT; i++) {
+    bgpstream_id_index_free(map->stripes[i].index);
+    pthread_mutex_destroy(&map->stripes[i].mutex);
   }
+  bgpstream_id_chunks_clear(&map->sigs, 0);
+  free(map);
 }
 
 void bgpstream_peer_sig_map_clear(bgpstream_peer_sig_map_t *map)
 {
-  /* only call free vals on ONE map, they are shared */
-  kh_free_vals(bgpstream_peer_id_sig_map, map->id_ps, sig_free);
-  kh_clear(bgpstream_peer_id_sig_map, map->id_ps);
-  kh_clear(bgpstream_peer_sig_id_map, map->ps_id);
+  int i;
+
+  for (i = 0; i < STRIPE_CNT; i++) {
+    bgpstream_id_index_free(map->stripes[i].index);
+    map->stripes[i].index = NULL;
+    map->stripes[i].cnt = 0;
+    /* if this fails, the next insertion into the stripe will retry */
+    bgpstream_id_index_reserve(&map->stripes[i].index, 0, STRIPE_INIT_SIZE);
+  }
+  /* IDs are not reused, so that stale IDs do not refer to other peers, but
+   * the chunks only need to hold the IDs assigned from now on */
+  bgpstream_id_chunks_clear(&map->sigs, map->next_id - 1);
 }
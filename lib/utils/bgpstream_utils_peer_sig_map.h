@@ -37,6 +37,12 @@
  *
  * @author Chiara Orsini
  *
+ * A peer signature map may be shared between threads: get_id, get_sig and
+ * get_size may be called concurrently, so that threads processing different
+ * collectors obtain consistent peer IDs. Lookups of known peers do not take
+ * any lock. The map must not be cleared or destroyed while other threads are
+ * using it.
+ *
  */
 
 /**
@@ -44,8 +50,8 @@
  *
  * @{ */
 
-/** Type of a peer ID */
-typedef uint16_t bgpstream_peer_id_t;
+/** Type of a peer ID (0 is never a valid ID) */
+typedef uint32_t bgpstream_peer_id_t;
 
 /** Opaque structure containing a peer signature map instance */
 typedef struct bgpstream_peer_sig_map bgpstream_peer_sig_map_t;
@@ -92,6 +98,8 @@ bgpstream_peer_sig_map_t *bgpstream_peer_sig_map_create(void);
  * @param peer_asnumber  AS number of the peer
  * @return the peer ID for this peer signature, 0 if an error occurred
  *
+ * IDs are assigned in increasing order starting from 1, and are not reused
+ * after the map is cleared.
  */
 bgpstream_peer_id_t bgpstream_peer_sig_map_get_id(
   bgpstream_peer_sig_map_t *map, const char *collector_str,
@@ -103,6 +111,9 @@ bgpstream_peer_id_t bgpstream_peer_sig_map_get_id(
  * @param peer_id       peer ID to retrieve signature for
  * @return pointer to the peer signature for the given peer ID, NULL if it was
  * not found
+ *
+ * @note the returned signature is owned by the map and remains valid until
+ * the map is cleared or destroyed.
  */
 bgpstream_peer_sig_t *
 bgpstream_peer_sig_map_get_sig(bgpstream_peer_sig_map_t *map,
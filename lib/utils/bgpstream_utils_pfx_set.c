@@ -25,101 +25,660 @@
  */
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#include "khash.h"
 #include "utils.h"
 
 #include "bgpstream_utils_pfx_set.h"
 
-/* ipv4 specific set */
+/* Prefix sets are open-addressing hash tables split into independent shards
+ * (selected by the top bits of the hash), so that two sets can be merged one
+ * shard at a time by several threads.
+ *
+ * Within a shard, slots are organized in groups of PFX_SET_GROUP_SIZE. Each
+ * slot has a control byte that is 0 if the slot is empty, or 0x80 plus 7 bits
+ * of the hash otherwise, so that a whole group can be probed with one vector
+ * compare before any key is looked at. Sets never remove prefixes, so there
+ * are no tombstones, and a lookup stops at the first group with an empty
+ * slot.
+ *
+ * Keys are packed: an IPv4 prefix is stored as (address << 8 | mask_len) in
+ * a uint64_t, and an IPv6 prefix as two uint64_t plus a separate mask length
+ * byte. The allowed_matches of each prefix is kept in another byte array, so
+ * that iteration returns prefixes as they were inserted.
+ */
 
-KHASH_INIT(bgpstream_ipv4_pfx_set /* name */,
-           bgpstream_ipv4_pfx_t /* khkey_t */, char /* khval_t */,
-           0 /* kh_is_map */,
-           bgpstream_ipv4_pfx_hash_val /*__hash_func */,
-           bgpstream_ipv4_pfx_equal_val /* __hash_equal */)
+#define PFX_SET_SHARD_BITS 4
+#define PFX_SET_SHARDS (1 << PFX_SET_SHARD_BITS)
 
-struct bgpstream_ipv4_pfx_set {
-  khash_t(bgpstream_ipv4_pfx_set) *hash;
-};
+#define PFX_SET_GROUP_SIZE 16
 
-static inline int v4hash_insert(khash_t(bgpstream_ipv4_pfx_set) *hash,
-                                bgpstream_ipv4_pfx_t *pfx);
-static inline int v4hash_merge(khash_t(bgpstream_ipv4_pfx_set) *dst_hash,
-                               khash_t(bgpstream_ipv4_pfx_set) *src_hash);
+/* Number of prefixes that bulk operations hash (and prefetch) at once */
+#define PFX_SET_BATCH 16
 
-/* ipv6 specific set */
+/* Minimum number of prefixes in the source set for a merge to be done using
+ * multiple threads */
+#define PFX_SET_PARALLEL_MIN 65536
 
-KHASH_INIT(bgpstream_ipv6_pfx_set /* name */,
-           bgpstream_ipv6_pfx_t /* khkey_t */, char /* khval_t */,
-           0 /* kh_is_map */,
-           bgpstream_ipv6_pfx_hash_val /*__hash_func */,
-           bgpstream_ipv6_pfx_equal_val /* __hash_equal */)
+/* Maximum number of threads used by a merge */
+#define PFX_SET_MAX_THREADS 8
 
-struct bgpstream_ipv6_pfx_set {
-  khash_t(bgpstream_ipv6_pfx_set) *hash;
+#define CTRL_EMPTY 0
+#define CTRL_TAG(h) ((uint8_t)(0x80 | ((h)&0x7f)))
+#define SHARD_IDX(h) ((h) >> (64 - PFX_SET_SHARD_BITS))
+
+typedef struct v6key {
+  uint64_t hi;
+  uint64_t lo;
+} v6key_t;
+
+typedef struct pfx_set_shard {
+
+  /* one control byte per slot */
+  uint8_t *ctrl;
+
+  /* packed keys (uint64_t for IPv4, v6key_t for IPv6) */
+  void *keys;
+
+  /* mask lengths (IPv6 only) */
+  uint8_t *masks;
+
+  /* allowed_matches of each prefix (as given when it was first inserted) */
+  uint8_t *matches;
+
+  /* number of slots (0, or a power of 2 >= PFX_SET_GROUP_SIZE) */
+  uint32_t capacity;
+
+  /* number of prefixes in the shard */
+  uint32_t size;
+
+} pfx_set_shard_t;
+
+struct bgpstream_ipv4_pfx_set {
+  pfx_set_shard_t shards[PFX_SET_SHARDS];
 };
 
-static inline int v6hash_insert(khash_t(bgpstream_ipv6_pfx_set) *hash,
-                                bgpstream_ipv6_pfx_t *pfx);
-static inline int v6hash_merge(khash_t(bgpstream_ipv6_pfx_set) *dst_hash,
-                               khash_t(bgpstream_ipv6_pfx_set) *src_hash);
+struct bgpstream_ipv6_pfx_set {
+  pfx_set_shard_t shards[PFX_SET_SHARDS];
+};
 
 /** set of unique IP prefixes
- *  We store v4 and v6 in separate hashes, because it would be unsafe for the
- *  khash functions in _pfx_set_insert() and _pfx_set_exists() to dereference
- *  pfx if it points to a ipv4_pfx.
- *  This also has the advantage of using less memory for the v4 hash.
+ *  We store v4 and v6 in separate tables, because it would be unsafe to
+ *  dereference an IPv6 address if pfx points to a ipv4_pfx.
+ *  This also has the advantage of using less memory for the v4 table.
  */
 struct bgpstream_pfx_set {
-  khash_t(bgpstream_ipv4_pfx_set) * v4hash;
-  khash_t(bgpstream_ipv6_pfx_set) * v6hash;
+  bgpstream_ipv4_pfx_set_t v4;
+  bgpstream_ipv6_pfx_set_t v6;
 };
 
-/* STORAGE */
+/* ========== KEYS AND HASHES ========== */
 
-bgpstream_pfx_set_t *bgpstream_pfx_set_create()
+/* 64 bit finalizer from MurmurHash3 */
+static inline uint64_t fmix64(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+static inline uint64_t v4key(const bgpstream_ipv4_pfx_t *pfx)
+{
+  return ((uint64_t)ntohl(pfx->address.addr.s_addr) << 8) | pfx->mask_len;
+}
+
+static inline uint64_t v4hash(uint64_t key)
+{
+  return fmix64(key);
+}
+
+static inline void v6key(const bgpstream_ipv6_pfx_t *pfx, v6key_t *key)
+{
+  memcpy(key, &pfx->address.addr, sizeof(v6key_t));
+}
+
+static inline uint64_t v6hash(const v6key_t *key, uint8_t mask_len)
+{
+  return fmix64(key->hi ^ fmix64(key->lo ^ mask_len));
+}
+
+/* ========== GROUP PROBING ========== */
+
+/* Bitmask of the slots in the group whose control byte is ctrl */
+static inline uint32_t group_match(const uint8_t *group, uint8_t ctrl)
+{
+#ifdef __SSE2__
+  __m128i g = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(
+    _mm_cmpeq_epi8(g, _mm_set1_epi8((char)ctrl)));
+#else
+  uint32_t m = 0;
+  int i;
+  for (i = 0; i < PFX_SET_GROUP_SIZE; i++) {
+    m |= (uint32_t)(group[i] == ctrl) << i;
+  }
+  return m;
+#endif
+}
+
+/* Group of the shard where the probe sequence for hash h starts */
+static inline uint32_t home_group(const pfx_set_shard_t *s, uint64_t h)
+{
+  return (uint32_t)(h >> 7) & ((s->capacity / PFX_SET_GROUP_SIZE) - 1);
+}
+
+static inline uint32_t next_group(const pfx_set_shard_t *s, uint32_t g)
+{
+  return (g + 1) & ((s->capacity / PFX_SET_GROUP_SIZE) - 1);
+}
+
+static inline void shard_prefetch(const pfx_set_shard_t *s, uint64_t h,
+                                  size_t key_size)
+{
+  uint32_t slot;
+  if (s->capacity != 0) {
+    slot = home_group(s, h) * PFX_SET_GROUP_SIZE;
+    __builtin_prefetch(&s->ctrl[slot]);
+    __builtin_prefetch((const uint8_t *)s->keys + slot * key_size);
+  }
+}
+
+/* Find key in the shard. Returns 1 if found, or 0 and the slot where the key
+ * should be inserted otherwise */
+static int shard_find4(const pfx_set_shard_t *s, uint64_t key, uint64_t h,
+                       uint32_t *slot)
+{
+  const uint64_t *keys = s->keys;
+  uint8_t tag = CTRL_TAG(h);
+  uint32_t g, base, m;
+
+  if (s->capacity == 0) {
+    return 0;
+  }
+  for (g = home_group(s, h);; g = next_group(s, g)) {
+    base = g * PFX_SET_GROUP_SIZE;
+    for (m = group_match(&s->ctrl[base], tag); m != 0; m &= m - 1) {
+      if (keys[base + __builtin_ctz(m)] == key) {
+        *slot = base + __builtin_ctz(m);
+        return 1;
+      }
+    }
+    if ((m = group_match(&s->ctrl[base], CTRL_EMPTY)) != 0) {
+      *slot = base + __builtin_ctz(m);
+      return 0;
+    }
+  }
+}
+
+static int shard_find6(const pfx_set_shard_t *s, const v6key_t *key,
+                       uint8_t mask_len, uint64_t h, uint32_t *slot)
+{
+  const v6key_t *keys = s->keys;
+  uint8_t tag = CTRL_TAG(h);
+  uint32_t g, base, m, i;
+
+  if (s->capacity == 0) {
+    return 0;
+  }
+  for (g = home_group(s, h);; g = next_group(s, g)) {
+    base = g * PFX_SET_GROUP_SIZE;
+    for (m = group_match(&s->ctrl[base], tag); m != 0; m &= m - 1) {
+      i = base + __builtin_ctz(m);
+      if (keys[i].hi == key->hi && keys[i].lo == key->lo &&
+          s->masks[i] == mask_len) {
+        *slot = i;
+        return 1;
+      }
+    }
+    if ((m = group_match(&s->ctrl[base], CTRL_EMPTY)) != 0) {
+      *slot = base + __builtin_ctz(m);
+      return 0;
+    }
+  }
+}
+
+/* ========== SHARD MANAGEMENT ========== */
+
+static void shard_free(pfx_set_shard_t *s)
+{
+  free(s->ctrl);
+  free(s->keys);
+  free(s->masks);
+  free(s->matches);
+  memset(s, 0, sizeof(*s));
+}
+
+/* Grow the shard (if needed) so that it can hold cnt prefixes while keeping
+ * the load factor under 7/8 */
+static int shard_reserve(pfx_set_shard_t *s, uint32_t cnt, int is_v6)
+{
+  pfx_set_shard_t new_s;
+  uint32_t capacity = (s->capacity == 0) ? PFX_SET_GROUP_SIZE : s->capacity;
+  size_t key_size = is_v6 ? sizeof(v6key_t) : sizeof(uint64_t);
+  uint64_t h;
+  uint32_t i, slot;
+
+  while ((uint64_t)cnt * 8 > (uint64_t)capacity * 7) {
+    capacity *= 2;
+  }
+  if (capacity == s->capacity) {
+    return 0;
+  }
+
+  memset(&new_s, 0, sizeof(new_s));
+  new_s.capacity = capacity;
+  if ((new_s.ctrl = malloc_zero(capacity)) == NULL ||
+      (new_s.keys = malloc(key_size * capacity)) == NULL ||
+      (new_s.matches = malloc(capacity)) == NULL ||
+      (is_v6 && (new_s.masks = malloc(capacity)) == NULL)) {
+    shard_free(&new_s);
+    return -1;
+  }
+
+  /* rehash (no need to compare keys, they are all unique) */
+  for (i = 0; i < s->capacity; i++) {
+    if (s->ctrl[i] == CTRL_EMPTY) {
+      continue;
+    }
+    if (is_v6) {
+      h = v6hash(&((v6key_t *)s->keys)[i], s->masks[i]);
+      shard_find6(&new_s, &((v6key_t *)s->keys)[i], s->masks[i], h, &slot);
+      ((v6key_t *)new_s.keys)[slot] = ((v6key_t *)s->keys)[i];
+      new_s.masks[slot] = s->masks[i];
+    } else {
+      h = v4hash(((uint64_t *)s->keys)[i]);
+      shard_find4(&new_s, ((uint64_t *)s->keys)[i], h, &slot);
+      ((uint64_t *)new_s.keys)[slot] = ((uint64_t *)s->keys)[i];
+    }
+    new_s.ctrl[slot] = CTRL_TAG(h);
+    new_s.matches[slot] = s->matches[i];
+  }
+  new_s.size = s->size;
+
+  shard_free(s);
+  *s = new_s;
+  return 0;
+}
+
+static int shard_insert4(pfx_set_shard_t *s, uint64_t key, uint8_t matches,
+                         uint64_t h)
 {
-  bgpstream_pfx_set_t *set;
+  uint32_t slot;
 
-  if ((set = malloc(sizeof(bgpstream_pfx_set_t))) == NULL) {
-    return NULL;
+  if (shard_find4(s, key, h, &slot) != 0) {
+    return 0;
+  }
+  if ((uint64_t)(s->size + 1) * 8 > (uint64_t)s->capacity * 7) {
+    if (shard_reserve(s, s->size + 1, 0) != 0) {
+      return -1;
+    }
+    shard_find4(s, key, h, &slot);
+  }
+  s->ctrl[slot] = CTRL_TAG(h);
+  ((uint64_t *)s->keys)[slot] = key;
+  s->matches[slot] = matches;
+  s->size++;
+  return 1;
+}
+
+static int shard_insert6(pfx_set_shard_t *s, const v6key_t *key,
+                         uint8_t mask_len, uint8_t matches, uint64_t h)
+{
+  uint32_t slot;
+
+  if (shard_find6(s, key, mask_len, h, &slot) != 0) {
+    return 0;
+  }
+  if ((uint64_t)(s->size + 1) * 8 > (uint64_t)s->capacity * 7) {
+    if (shard_reserve(s, s->size + 1, 1) != 0) {
+      return -1;
+    }
+    shard_find6(s, key, mask_len, h, &slot);
+  }
+  s->ctrl[slot] = CTRL_TAG(h);
+  ((v6key_t *)s->keys)[slot] = *key;
+  s->masks[slot] = mask_len;
+  s->matches[slot] = matches;
+  s->size++;
+  return 1;
+}
+
+static int shard_merge(pfx_set_shard_t *dst, const pfx_set_shard_t *src,
+                       int is_v6)
+{
+  uint32_t i;
+  uint64_t h;
+
+  if (src->size == 0) {
+    return 0;
+  }
+  /* size for the worst case (no common prefixes) so there is no rehashing */
+  if (shard_reserve(dst, dst->size + src->size, is_v6) != 0) {
+    return -1;
   }
+  for (i = 0; i < src->capacity; i++) {
+    if (src->ctrl[i] == CTRL_EMPTY) {
+      continue;
+    }
+    if (is_v6) {
+      h = v6hash(&((v6key_t *)src->keys)[i], src->masks[i]);
+      if (shard_insert6(dst, &((v6key_t *)src->keys)[i], src->masks[i],
+                        src->matches[i], h) < 0) {
+        return -1;
+      }
+    } else {
+      h = v4hash(((uint64_t *)src->keys)[i]);
+      if (shard_insert4(dst, ((uint64_t *)src->keys)[i], src->matches[i], h) <
+          0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
 
-  if ((set->v4hash = kh_init(bgpstream_ipv4_pfx_set)) == NULL ||
-      (set->v6hash = kh_init(bgpstream_ipv6_pfx_set)) == NULL) {
-    bgpstream_pfx_set_destroy(set);
-    return NULL;
+static void shard_clear(pfx_set_shard_t *s)
+{
+  if (s->capacity != 0) {
+    memset(s->ctrl, CTRL_EMPTY, s->capacity);
   }
-  return set;
+  s->size = 0;
+}
+
+/* ========== SHARDED TABLES ========== */
+
+static uint32_t shards_size(const pfx_set_shard_t *shards)
+{
+  uint32_t size = 0;
+  int i;
+  for (i = 0; i < PFX_SET_SHARDS; i++) {
+    size += shards[i].size;
+  }
+  return size;
+}
+
+static void shards_free(pfx_set_shard_t *shards)
+{
+  int i;
+  for (i = 0; i < PFX_SET_SHARDS; i++) {
+    shard_free(&shards[i]);
+  }
+}
+
+static void shards_clear(pfx_set_shard_t *shards)
+{
+  int i;
+  for (i = 0; i < PFX_SET_SHARDS; i++) {
+    shard_clear(&shards[i]);
+  }
+}
+
+static inline int v4set_insert(bgpstream_ipv4_pfx_set_t *set,
+                               const bgpstream_ipv4_pfx_t *pfx)
+{
+  uint64_t key = v4key(pfx);
+  uint64_t h = v4hash(key);
+  return shard_insert4(&set->shards[SHARD_IDX(h)], key, pfx->allowed_matches,
+                       h);
+}
+
+static inline int v4set_exists(const bgpstream_ipv4_pfx_set_t *set,
+                               const bgpstream_ipv4_pfx_t *pfx)
+{
+  uint64_t key = v4key(pfx);
+  uint64_t h = v4hash(key);
+  uint32_t slot;
+  return shard_find4(&set->shards[SHARD_IDX(h)], key, h, &slot);
+}
+
+static inline int v6set_insert(bgpstream_ipv6_pfx_set_t *set,
+                               const bgpstream_ipv6_pfx_t *pfx)
+{
+  v6key_t key;
+  uint64_t h;
+  v6key(pfx, &key);
+  h = v6hash(&key, pfx->mask_len);
+  return shard_insert6(&set->shards[SHARD_IDX(h)], &key, pfx->mask_len,
+                       pfx->allowed_matches, h);
+}
+
+static inline int v6set_exists(const bgpstream_ipv6_pfx_set_t *set,
+                               const bgpstream_ipv6_pfx_t *pfx)
+{
+  v6key_t key;
+  uint64_t h;
+  uint32_t slot;
+  v6key(pfx, &key);
+  h = v6hash(&key, pfx->mask_len);
+  return shard_find6(&set->shards[SHARD_IDX(h)], &key, pfx->mask_len, h,
+                     &slot);
+}
+
+/* Merge state shared by the merge threads. Shards are numbered 0 ..
+ * PFX_SET_SHARDS - 1 for IPv4 and PFX_SET_SHARDS .. 2 * PFX_SET_SHARDS - 1 for
+ * IPv6 */
+typedef struct merge_job {
+  pfx_set_shard_t *dst4;
+  const pfx_set_shard_t *src4;
+  pfx_set_shard_t *dst6;
+  const pfx_set_shard_t *src6;
+  int threads_cnt;
+} merge_job_t;
+
+typedef struct merge_thread {
+  merge_job_t *job;
+  int id;
+  int ret;
+  pthread_t tid;
+} merge_thread_t;
+
+static void *merge_thread(void *user)
+{
+  merge_thread_t *t = user;
+  merge_job_t *job = t->job;
+  int i;
+
+  for (i = t->id; i < 2 * PFX_SET_SHARDS && t->ret == 0;
+       i += job->threads_cnt) {
+    if (i < PFX_SET_SHARDS) {
+      if (job->src4 != NULL &&
+          shard_merge(&job->dst4[i], &job->src4[i], 0) != 0) {
+        t->ret = -1;
+      }
+    } else {
+      if (job->src6 != NULL &&
+          shard_merge(&job->dst6[i - PFX_SET_SHARDS],
+                      &job->src6[i - PFX_SET_SHARDS], 1) != 0) {
+        t->ret = -1;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Merge the given v4 and/or v6 shards. Since both sets use the same hash, a
+ * source shard only ever merges into the matching destination shard, so
+ * shards can be merged in parallel without locking */
+static int shards_merge(pfx_set_shard_t *dst4, const pfx_set_shard_t *src4,
+                        pfx_set_shard_t *dst6, const pfx_set_shard_t *src6)
+{
+  merge_job_t job = {dst4, src4, dst6, src6, 1};
+  merge_thread_t threads[PFX_SET_MAX_THREADS];
+  uint32_t src_size = 0;
+  long cpus;
+  int i, started = 0, ret = 0;
+
+  if (src4 != NULL) {
+    src_size += shards_size(src4);
+  }
+  if (src6 != NULL) {
+    src_size += shards_size(src6);
+  }
+  if (src_size >= PFX_SET_PARALLEL_MIN &&
+      (cpus = sysconf(_SC_NPROCESSORS_ONLN)) > 1) {
+    job.threads_cnt = (cpus > PFX_SET_MAX_THREADS) ? PFX_SET_MAX_THREADS : cpus;
+  }
+
+  memset(threads, 0, sizeof(threads));
+  for (i = 0; i < job.threads_cnt; i++) {
+    threads[i].job = &job;
+    threads[i].id = i;
+  }
+  /* the calling thread does the first share of the work */
+  for (i = 1; i < job.threads_cnt; i++) {
+    if (pthread_create(&threads[i].tid, NULL, merge_thread, &threads[i]) !=
+        0) {
+      break;
+    }
+    started++;
+  }
+  if (started != job.threads_cnt - 1) {
+    /* could not start all the threads, so do the rest here */
+    for (i = started + 1; i < job.threads_cnt; i++) {
+      merge_thread(&threads[i]);
+    }
+  }
+  merge_thread(&threads[0]);
+  for (i = 1; i <= started; i++) {
+    pthread_join(threads[i].tid, NULL);
+  }
+
+  for (i = 0; i < job.threads_cnt; i++) {
+    if (threads[i].ret != 0) {
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+/* STORAGE */
+
+bgpstream_pfx_set_t *bgpstream_pfx_set_create()
+{
+  /* tables are allocated on first insert */
+  return malloc_zero(sizeof(bgpstream_pfx_set_t));
 }
 
 int bgpstream_pfx_set_insert(bgpstream_pfx_set_t *set,
                              bgpstream_pfx_t *pfx)
 {
   if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
-    return v4hash_insert(set->v4hash, &pfx->bs_ipv4);
+    return v4set_insert(&set->v4, &pfx->bs_ipv4);
   } else {
-    return v6hash_insert(set->v6hash, &pfx->bs_ipv6);
+    return v6set_insert(&set->v6, &pfx->bs_ipv6);
   }
 }
 
+int bgpstream_pfx_set_insert_bulk(bgpstream_pfx_set_t *set,
+                                  const bgpstream_pfx_t *pfxs, int pfxs_cnt)
+{
+  uint64_t h[PFX_SET_BATCH];
+  uint64_t k4[PFX_SET_BATCH];
+  v6key_t k6[PFX_SET_BATCH];
+  int i, j, n, rc, inserted = 0;
+
+  for (i = 0; i < pfxs_cnt; i += PFX_SET_BATCH) {
+    n = (pfxs_cnt - i < PFX_SET_BATCH) ? pfxs_cnt - i : PFX_SET_BATCH;
+
+    /* hash the whole batch and start fetching the groups... */
+    for (j = 0; j < n; j++) {
+      if (pfxs[i + j].address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+        k4[j] = v4key(&pfxs[i + j].bs_ipv4);
+        h[j] = v4hash(k4[j]);
+        shard_prefetch(&set->v4.shards[SHARD_IDX(h[j])], h[j],
+                       sizeof(uint64_t));
+      } else {
+        v6key(&pfxs[i + j].bs_ipv6, &k6[j]);
+        h[j] = v6hash(&k6[j], pfxs[i + j].mask_len);
+        shard_prefetch(&set->v6.shards[SHARD_IDX(h[j])], h[j],
+                       sizeof(v6key_t));
+      }
+    }
+
+    /* ...then probe */
+    for (j = 0; j < n; j++) {
+      if (pfxs[i + j].address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+        rc = shard_insert4(&set->v4.shards[SHARD_IDX(h[j])], k4[j],
+                           pfxs[i + j].allowed_matches, h[j]);
+      } else {
+        rc = shard_insert6(&set->v6.shards[SHARD_IDX(h[j])], &k6[j],
+                           pfxs[i + j].mask_len, pfxs[i + j].allowed_matches,
+                           h[j]);
+      }
+      if (rc < 0) {
+        return -1;
+      }
+      inserted += rc;
+    }
+  }
+  return inserted;
+}
+
 int bgpstream_pfx_set_exists(bgpstream_pfx_set_t *set,
                              bgpstream_pfx_t *pfx)
 {
   if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
-    return kh_get(bgpstream_ipv4_pfx_set, set->v4hash, pfx->bs_ipv4) !=
-      kh_end(set->v4hash);
+    return v4set_exists(&set->v4, &pfx->bs_ipv4);
   } else {
-    return kh_get(bgpstream_ipv6_pfx_set, set->v6hash, pfx->bs_ipv6) !=
-      kh_end(set->v6hash);
+    return v6set_exists(&set->v6, &pfx->bs_ipv6);
   }
 }
 
+int bgpstream_pfx_set_exists_bulk(bgpstream_pfx_set_t *set,
+                                  const bgpstream_pfx_t *pfxs, int pfxs_cnt,
+                                  uint8_t *results)
+{
+  uint64_t h[PFX_SET_BATCH];
+  uint64_t k4[PFX_SET_BATCH];
+  v6key_t k6[PFX_SET_BATCH];
+  uint32_t slot;
+  int i, j, n, rc, found = 0;
+
+  for (i = 0; i < pfxs_cnt; i += PFX_SET_BATCH) {
+    n = (pfxs_cnt - i < PFX_SET_BATCH) ? pfxs_cnt - i : PFX_SET_BATCH;
+
+    for (j = 0; j < n; j++) {
+      if (pfxs[i + j].address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+        k4[j] = v4key(&pfxs[i + j].bs_ipv4);
+        h[j] = v4hash(k4[j]);
+        shard_prefetch(&set->v4.shards[SHARD_IDX(h[j])], h[j],
+                       sizeof(uint64_t));
+      } else {
+        v6key(&pfxs[i + j].bs_ipv6, &k6[j]);
+        h[j] = v6hash(&k6[j], pfxs[i + j].mask_len);
+        shard_prefetch(&set->v6.shards[SHARD_IDX(h[j])], h[j],
+                       sizeof(v6key_t));
+      }
+    }
+
+    for (j = 0; j < n; j++) {
+      if (pfxs[i + j].address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+        rc = shard_find4(&set->v4.shards[SHARD_IDX(h[j])], k4[j], h[j], &slot);
+      } else {
+        rc = shard_find6(&set->v6.shards[SHARD_IDX(h[j])], &k6[j],
+                         pfxs[i + j].mask_len, h[j], &slot);
+      }
+      if (results != NULL) {
+        results[i + j] = rc;
+      }
+      found += rc;
+    }
+  }
+  return found;
+}
+
 int bgpstream_pfx_set_size(bgpstream_pfx_set_t *set)
 {
-  return kh_size(set->v4hash) + kh_size(set->v6hash);
+  return shards_size(set->v4.shards) + shards_size(set->v6.shards);
 }
 
 int bgpstream_pfx_set_version_size(bgpstream_pfx_set_t *set,
@@ -127,9 +686,9 @@ int bgpstream_pfx_set_version_size(bgpstream_pfx_set_t *set,
 {
   switch (v) {
   case BGPSTREAM_ADDR_VERSION_IPV4:
-    return kh_size(set->v4hash);
+    return shards_size(set->v4.shards);
   case BGPSTREAM_ADDR_VERSION_IPV6:
-    return kh_size(set->v6hash);
+    return shards_size(set->v6.shards);
   default:
     return -1;
   }
@@ -138,36 +697,31 @@ int bgpstream_pfx_set_version_size(bgpstream_pfx_set_t *set,
 int bgpstream_pfx_set_merge(bgpstream_pfx_set_t *dst_set,
                             bgpstream_pfx_set_t *src_set)
 {
-  if (v4hash_merge(dst_set->v4hash, src_set->v4hash) < 0 ||
-      v6hash_merge(dst_set->v6hash, src_set->v6hash) < 0) {
-    return -1;
-  }
-  return 0;
+  return shards_merge(dst_set->v4.shards, src_set->v4.shards,
+                      dst_set->v6.shards, src_set->v6.shards);
 }
 
 void bgpstream_pfx_set_destroy(bgpstream_pfx_set_t *set)
 {
-  if (set->v4hash) kh_destroy(bgpstream_ipv4_pfx_set, set->v4hash);
-  if (set->v6hash) kh_destroy(bgpstream_ipv6_pfx_set, set->v6hash);
+  if (set == NULL) {
+    return;
+  }
+  shards_free(set->v4.shards);
+  shards_free(set->v6.shards);
   free(set);
 }
 
 void bgpstream_pfx_set_clear(bgpstream_pfx_set_t *set)
 {
-  kh_clear(bgpstream_ipv4_pfx_set, set->v4hash);
-  kh_clear(bgpstream_ipv6_pfx_set, set->v6hash);
+  shards_clear(set->v4.shards);
+  shards_clear(set->v6.shards);
 }
 
 int bgpstream_pfx_set_iterate(bgpstream_pfx_set_t *set,
     void (*callback)(bgpstream_pfx_t *, void *), void *userdata)
 {
-  bgpstream_ipv4_pfx_set_t v4set;
-  bgpstream_ipv6_pfx_set_t v6set;
-
-  v4set.hash = set->v4hash;
-  v6set.hash = set->v6hash;
-  if (bgpstream_ipv4_pfx_set_iterate(&v4set, callback, userdata) < 0 ||
-      bgpstream_ipv6_pfx_set_iterate(&v6set, callback, userdata) < 0) {
+  if (bgpstream_ipv4_pfx_set_iterate(&set->v4, callback, userdata) < 0 ||
+      bgpstream_ipv6_pfx_set_iterate(&set->v6, callback, userdata) < 0) {
     return -1;
   }
   return 0;
@@ -177,89 +731,67 @@ int bgpstream_pfx_set_iterate(bgpstream_pfx_set_t *set,
 
 bgpstream_ipv4_pfx_set_t *bgpstream_ipv4_pfx_set_create()
 {
-  bgpstream_ipv4_pfx_set_t *set;
-
-  if ((set = (bgpstream_ipv4_pfx_set_t *)malloc(
-         sizeof(bgpstream_ipv4_pfx_set_t))) == NULL) {
-    return NULL;
-  }
-
-  if ((set->hash = kh_init(bgpstream_ipv4_pfx_set)) == NULL) {
-    bgpstream_ipv4_pfx_set_destroy(set);
-    return NULL;
-  }
-
-  return set;
-}
-
-static inline int v4hash_insert(khash_t(bgpstream_ipv4_pfx_set) *hash,
-                                bgpstream_ipv4_pfx_t *pfx)
-{
-  int khret;
-  if (kh_get(bgpstream_ipv4_pfx_set, hash, *pfx) != kh_end(hash))
-    return 0;
-  kh_put(bgpstream_ipv4_pfx_set, hash, *pfx, &khret);
-  return (khret < 0) ? -1 : 1;
+  return malloc_zero(sizeof(bgpstream_ipv4_pfx_set_t));
 }
 
 int bgpstream_ipv4_pfx_set_insert(bgpstream_ipv4_pfx_set_t *set,
                                   bgpstream_ipv4_pfx_t *pfx)
 {
-  return v4hash_insert(set->hash, pfx);
+  return v4set_insert(set, pfx);
 }
 
 int bgpstream_ipv4_pfx_set_exists(bgpstream_ipv4_pfx_set_t *set,
                                   bgpstream_ipv4_pfx_t *pfx)
 {
-  return kh_get(bgpstream_ipv4_pfx_set, set->hash, *pfx) != kh_end(set->hash);
+  return v4set_exists(set, pfx);
 }
 
 int bgpstream_ipv4_pfx_set_size(bgpstream_ipv4_pfx_set_t *set)
 {
-  return kh_size(set->hash);
-}
-
-static inline int v4hash_merge(khash_t(bgpstream_ipv4_pfx_set) *dst_hash,
-                               khash_t(bgpstream_ipv4_pfx_set) *src_hash)
-{
-  khiter_t k;
-  for (k = kh_begin(src_hash); k != kh_end(src_hash); ++k) {
-    if (kh_exist(src_hash, k)) {
-      if (v4hash_insert(dst_hash, &(kh_key(src_hash, k))) < 0) {
-        return -1;
-      }
-    }
-  }
-  return 0;
+  return shards_size(set->shards);
 }
 
 int bgpstream_ipv4_pfx_set_merge(bgpstream_ipv4_pfx_set_t *dst_set,
                                  bgpstream_ipv4_pfx_set_t *src_set)
 {
-  return v4hash_merge(dst_set->hash, src_set->hash);
+  return shards_merge(dst_set->shards, src_set->shards, NULL, NULL);
 }
 
 void bgpstream_ipv4_pfx_set_destroy(bgpstream_ipv4_pfx_set_t *set)
 {
-  kh_destroy(bgpstream_ipv4_pfx_set, set->hash);
+  if (set == NULL) {
+    return;
+  }
+  shards_free(set->shards);
   free(set);
 }
 
 void bgpstream_ipv4_pfx_set_clear(bgpstream_ipv4_pfx_set_t *set)
 {
-  kh_clear(bgpstream_ipv4_pfx_set, set->hash);
+  shards_clear(set->shards);
 }
 
 int bgpstream_ipv4_pfx_set_iterate(bgpstream_ipv4_pfx_set_t *set,
         void (*callback)(bgpstream_pfx_t *, void *), void *userdata)
 {
-  khiter_t k;
+  const pfx_set_shard_t *s;
   bgpstream_pfx_t pfx;
-  for (k = kh_begin(set->hash); k != kh_end(set->hash); ++k) {
-    if (kh_exist(set->hash, k)) {
-      pfx.bs_ipv4 = kh_key(set->hash, k);
-      pfx.address.version = BGPSTREAM_ADDR_VERSION_IPV4;
-      callback(&pfx, userdata);
+  uint64_t key;
+  uint32_t i;
+  int j;
+
+  memset(&pfx, 0, sizeof(pfx));
+  pfx.address.version = BGPSTREAM_ADDR_VERSION_IPV4;
+  for (j = 0; j < PFX_SET_SHARDS; j++) {
+    s = &set->shards[j];
+    for (i = 0; i < s->capacity; i++) {
+      if (s->ctrl[i] != CTRL_EMPTY) {
+        key = ((uint64_t *)s->keys)[i];
+        pfx.bs_ipv4.address.addr.s_addr = htonl((uint32_t)(key >> 8));
+        pfx.mask_len = key & 0xff;
+        pfx.allowed_matches = s->matches[i];
+        callback(&pfx, userdata);
+      }
     }
   }
   return 0;
@@ -269,92 +801,67 @@ int bgpstream_ipv4_pfx_set_iterate(bgpstream_ipv4_pfx_set_t *set,
 
 bgpstream_ipv6_pfx_set_t *bgpstream_ipv6_pfx_set_create()
 {
-  bgpstream_ipv6_pfx_set_t *set;
-
-  if ((set = (bgpstream_ipv6_pfx_set_t *)malloc(
-         sizeof(bgpstream_ipv6_pfx_set_t))) == NULL) {
-    return NULL;
-  }
-
-  if ((set->hash = kh_init(bgpstream_ipv6_pfx_set)) == NULL) {
-    bgpstream_ipv6_pfx_set_destroy(set);
-    return NULL;
-  }
-
-  return set;
-}
-
-static inline int v6hash_insert(khash_t(bgpstream_ipv6_pfx_set) *hash,
-                                bgpstream_ipv6_pfx_t *pfx)
-{
-  int khret;
-  if (kh_get(bgpstream_ipv6_pfx_set, hash, *pfx) != kh_end(hash))
-    return 0;
-  kh_put(bgpstream_ipv6_pfx_set, hash, *pfx, &khret);
-  return (khret < 0) ? -1 : 1;
+  return malloc_zero(sizeof(bgpstream_ipv6_pfx_set_t));
 }
 
 int bgpstream_ipv6_pfx_set_insert(bgpstream_ipv6_pfx_set_t *set,
                                   bgpstream_ipv6_pfx_t *pfx)
 {
-  return v6hash_insert(set->hash, pfx);
+  return v6set_insert(set, pfx);
 }
 
 int bgpstream_ipv6_pfx_set_exists(bgpstream_ipv6_pfx_set_t *set,
                                   bgpstream_ipv6_pfx_t *pfx)
 {
-  return kh_get(bgpstream_ipv6_pfx_set, set->hash, *pfx) != kh_end(set->hash);
+  return v6set_exists(set, pfx);
 }
 
 int bgpstream_ipv6_pfx_set_size(bgpstream_ipv6_pfx_set_t *set)
 {
-  return kh_size(set->hash);
-}
-
-static inline int v6hash_merge(khash_t(bgpstream_ipv6_pfx_set) *dst_hash,
-                               khash_t(bgpstream_ipv6_pfx_set) *src_hash)
-{
-  khiter_t k;
-  for (k = kh_begin(src_hash); k != kh_end(src_hash); ++k) {
-    if (kh_exist(src_hash, k)) {
-      if (v6hash_insert(dst_hash, &(kh_key(src_hash, k))) < 0) {
-        return -1;
-      }
-    }
-  }
-  return 0;
+  return shards_size(set->shards);
 }
 
 int bgpstream_ipv6_pfx_set_merge(bgpstream_ipv6_pfx_set_t *dst_set,
                                  bgpstream_ipv6_pfx_set_t *src_set)
 {
-  return v6hash_merge(dst_set->hash, src_set->hash);
+  return shards_merge(NULL, NULL, dst_set->shards, src_set->shards);
 }
 
 void bgpstream_ipv6_pfx_set_destroy(bgpstream_ipv6_pfx_set_t *set)
 {
-  kh_destroy(bgpstream_ipv6_pfx_set, set->hash);
+  if (set == NULL) {
+    return;
+  }
+  shards_free(set->shards);
   free(set);
 }
 
 void bgpstream_ipv6_pfx_set_clear(bgpstream_ipv6_pfx_set_t *set)
 {
-  kh_clear(bgpstream_ipv6_pfx_set, set->hash);
+  shards_clear(set->shards);
 }
 
 int bgpstream_ipv6_pfx_set_iterate(bgpstream_ipv6_pfx_set_t *set,
         void (*callback)(bgpstream_pfx_t *, void *), void *userdata)
 {
-  khiter_t k;
+  const pfx_set_shard_t *s;
   bgpstream_pfx_t pfx;
-  for (k = kh_begin(set->hash); k != kh_end(set->hash); ++k) {
-    if (kh_exist(set->hash, k)) {
-      pfx.bs_ipv6 = kh_key(set->hash, k);
-      pfx.address.version = BGPSTREAM_ADDR_VERSION_IPV6;
-      callback(&pfx, userdata);
+  uint32_t i;
+  int j;
+
+  memset(&pfx, 0, sizeof(pfx));
+  pfx.address.version = BGPSTREAM_ADDR_VERSION_IPV6;
+  for (j = 0; j < PFX_SET_SHARDS; j++) {
+    s = &set->shards[j];
+    for (i = 0; i < s->capacity; i++) {
+      if (s->ctrl[i] != CTRL_EMPTY) {
+        memcpy(&pfx.bs_ipv6.address.addr, &((v6key_t *)s->keys)[i],
+               sizeof(v6key_t));
+        pfx.mask_len = s->masks[i];
+        pfx.allowed_matches = s->matches[i];
+        callback(&pfx, userdata);
+      }
     }
   }
   return 0;
 }
-
-
@@ -82,6 +82,20 @@ bgpstream_pfx_set_t *bgpstream_pfx_set_create(void);
 int bgpstream_pfx_set_insert(bgpstream_pfx_set_t *set,
                              bgpstream_pfx_t *pfx);
 
+/** Insert an array of prefixes into the given set.
+ *
+ * @param set           pointer to the prefix set
+ * @param pfxs          array of prefixes to insert in the set
+ * @param pfxs_cnt      number of prefixes in the array
+ * @return the number of prefixes that were inserted (i.e., that did not
+ * already exist), -1 if an error occurred
+ *
+ * This is faster than inserting the prefixes one at a time, since the
+ * prefixes are hashed (and their buckets fetched) in batches.
+ */
+int bgpstream_pfx_set_insert_bulk(bgpstream_pfx_set_t *set,
+                                  const bgpstream_pfx_t *pfxs, int pfxs_cnt);
+
 /** Check whether a prefix exists in the set
  *
  * @param set           pointer to the prefix set
@@ -94,6 +108,20 @@ int bgpstream_pfx_set_insert(bgpstream_pfx_set_t *set,
 int bgpstream_pfx_set_exists(bgpstream_pfx_set_t *set,
                              bgpstream_pfx_t *pfx);
 
+/** Check whether each prefix of an array exists in the set
+ *
+ * @param set           pointer to the prefix set
+ * @param pfxs          array of prefixes to look up
+ * @param pfxs_cnt      number of prefixes in the array
+ * @param[out] results  array of pfxs_cnt elements that is set to 1 for each
+ *                      prefix that is in the set and 0 for the others (may be
+ *                      NULL)
+ * @return the number of prefixes that are in the set
+ */
+int bgpstream_pfx_set_exists_bulk(bgpstream_pfx_set_t *set,
+                                  const bgpstream_pfx_t *pfxs, int pfxs_cnt,
+                                  uint8_t *results);
+
 /** Get the number of prefixes in the given set
  *
  * @param set           pointer to the prefix set
@@ -115,6 +143,8 @@ int bgpstream_pfx_set_version_size(bgpstream_pfx_set_t *set,
  * @param dst_set      pointer to the set to merge src into
  * @param src_set      pointer to the set to merge into dst
  * @return 0 if the sets were merged succsessfully, -1 otherwise
+ *
+ * Large sets are merged using multiple threads.
  */
 int bgpstream_pfx_set_merge(bgpstream_pfx_set_t *dst_set,
                             bgpstream_pfx_set_t *src_set);
@@ -142,6 +172,9 @@ void bgpstream_pfx_set_clear(bgpstream_pfx_set_t *set);
  *                      variables that may be required by the callback function.
  *
  *  @return 0 if the iteration completes successfully, -1 otherwise.
+ *
+ *  Each prefix is passed with the allowed_matches it had when it was first
+ *  inserted (inserting an existing prefix does not change it).
  */
 int bgpstream_pfx_set_iterate(bgpstream_pfx_set_t *set,
     void (*callback)(bgpstream_pfx_t *, void *), void *userdata);
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2014 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+#include "bgpstream_utils_id_index.h"
+#include "bgpstream_utils_str_intern.h"
+
+/* Initial number of slots in the index */
+#define INDEX_INIT_SIZE 256
+
+/** An interned string */
+typedef struct intern_str {
+
+  /** The (nul-terminated) string */
+  char *str;
+
+  /** Length of the string */
+  size_t len;
+
+} intern_str_t;
+
+/** A string being looked up */
+typedef struct intern_key {
+
+  /** Pointer to the characters of the string */
+  const char *str;
+
+  /** Length of the string */
+  size_t len;
+
+} intern_key_t;
+
+/** The process-wide intern table */
+static struct {
+
+  /** Lock held by writers */
+  pthread_mutex_t mutex;
+
+  /** Index from string to ID (the empty string is not stored in it) */
+  bgpstream_id_index_t *index;
+
+  /** Strings, by ID */
+  bgpstream_id_chunks_t strs;
+
+  /** Next ID to assign (IDs below this one are readable) */
+  bgpstream_str_id_t next_id;
+
+} table = {PTHREAD_MUTEX_INITIALIZER, NULL, {{NULL}, sizeof(intern_str_t), 0},
+           1};
+
+/* ========== PRIVATE FUNCTIONS ========== */
+
+static int str_match(uint32_t id, void *user)
+{
+  intern_key_t *key = user;
+  intern_str_t *entry = bgpstream_id_chunks_get(&table.strs, id);
+  return entry->len == key->len && memcmp(entry->str, key->str, key->len) == 0;
+}
+
+/* Add a string that is not in the table. The caller must hold the lock. */
+static bgpstream_str_id_t intern_add(uint32_t hash, const char *str,
+                                     size_t len)
+{
+  bgpstream_str_id_t id = table.next_id;
+  intern_str_t *entry;
+  char *copy;
+
+  if (id == BGPSTREAM_STR_ID_INVALID ||
+      bgpstream_id_index_reserve(&table.index, id, INDEX_INIT_SIZE) != 0 ||
+      (entry = bgpstream_id_chunks_alloc(&table.strs, id)) == NULL ||
+      (copy = malloc(len + 1)) == NULL) {
+    return BGPSTREAM_STR_ID_INVALID;
+  }
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+
+  entry->str = copy;
+  entry->len = len;
+
+  /* the string must be readable before the ID is published */
+  __atomic_store_n(&table.next_id, id + 1, __ATOMIC_RELEASE);
+  bgpstream_id_index_put(table.index, hash, id);
+  return id;
+}
+
+/* ========== PUBLIC FUNCTIONS ========== */
+
+bgpstream_str_id_t bgpstream_str_intern(const char *str)
+{
+  return bgpstream_str_intern_len(str, strlen(str));
+}
+
+bgpstream_str_id_t bgpstream_str_intern_len(const char *str, size_t len)
+{
+  intern_key_t key = {str, len};
+  uint32_t hash;
+  bgpstream_str_id_t id;
+
+  if (len == 0) {
+    return BGPSTREAM_STR_ID_EMPTY;
+  }
+  hash = bgpstream_id_index_hash(BGPSTREAM_ID_INDEX_HASH_INIT, str, len);
+
+  /* fast path: the string is already interned */
+  if ((id = bgpstream_id_index_lookup(&table.index, hash, str_match, &key)) !=
+      0) {
+    return id;
+  }
+
+  pthread_mutex_lock(&table.mutex);
+  /* another thread may have added it since we looked */
+  if ((id = bgpstream_id_index_lookup(&table.index, hash, str_match, &key)) ==
+      0) {
+    id = intern_add(hash, str, len);
+  }
+  pthread_mutex_unlock(&table.mutex);
+
+  return id;
+}
+
+const char *bgpstream_str_intern_get(bgpstream_str_id_t id)
+{
+  if (id == BGPSTREAM_STR_ID_EMPTY) {
+    return "";
+  }
+  if (id >= __atomic_load_n(&table.next_id, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return ((intern_str_t *)bgpstream_id_chunks_get(&table.strs, id))->str;
+}
+
+void bgpstream_str_intern_destroy(void)
+{
+  bgpstream_str_id_t id;
+
+  for (id = 1; id < table.next_id; id++) {
+    free(((intern_str_t *)bgpstream_id_chunks_get(&table.strs, id))->str);
+  }
+  bgpstream_id_chunks_clear(&table.strs, 0);
+  bgpstream_id_index_free(table.index);
+  table.index = NULL;
+  table.next_id = 1;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2014 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BGPSTREAM_UTILS_STR_INTERN_H
+#define __BGPSTREAM_UTILS_STR_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @file
+ *
+ * @brief Header file that exposes the public interface of the BGP Stream
+ * String Intern table.
+ *
+ * The intern table is a single, process-wide mapping between strings (e.g.,
+ * project, collector and router names) and small integer IDs. A string is
+ * always given the same ID, so IDs can be compared, hashed and used as array
+ * indexes in place of the strings themselves. Interned strings are not
+ * removed until the table is destroyed, so the memory used by the table grows
+ * with the number of distinct strings ever interned. It is meant for names,
+ * which are few, rather than for arbitrary data.
+ *
+ * All functions may be called concurrently from multiple threads. Looking up
+ * a string that is already interned does not take any lock.
+ *
+ */
+
+/**
+ * @name Public Constants
+ *
+ * @{ */
+
+/** ID of the empty string */
+#define BGPSTREAM_STR_ID_EMPTY 0
+
+/** Returned when a string could not be interned */
+#define BGPSTREAM_STR_ID_INVALID UINT32_MAX
+
+/** @} */
+
+/**
+ * @name Public Data Structures
+ *
+ * @{ */
+
+/** Type of an interned string ID */
+typedef uint32_t bgpstream_str_id_t;
+
+/** @} */
+
+/**
+ * @name Public API Functions
+ *
+ * @{ */
+
+/** Get the ID of the given string, interning it if needed
+ *
+ * @param str           the string to intern
+ * @return the ID of the string, or BGPSTREAM_STR_ID_INVALID if an error
+ * occurred
+ *
+ * @note this function copies the provided string
+ */
+bgpstream_str_id_t bgpstream_str_intern(const char *str);
+
+/** Get the ID of the given (not necessarily nul-terminated) string, interning
+ * it if needed
+ *
+ * @param str           pointer to the characters of the string
+ * @param len           number of characters in the string
+ * @return the ID of the string, or BGPSTREAM_STR_ID_INVALID if an error
+ * occurred
+ */
+bgpstream_str_id_t bgpstream_str_intern_len(const char *str, size_t len);
+
+/** Get the string with the given ID
+ *
+ * @param id            ID of the string to get
+ * @return **borrowed** pointer to the (nul-terminated) string, NULL if no
+ * string has the given ID
+ *
+ * @note the returned string remains valid until the table is destroyed.
+ */
+const char *bgpstream_str_intern_get(bgpstream_str_id_t id);
+
+/** Free all the interned strings
+ *
+ * After this call, IDs and strings obtained earlier are no longer valid, and
+ * IDs are assigned from 1 again. This is mainly useful to release memory
+ * before the process exits (e.g., for tests and leak checkers).
+ *
+ * @note this function must not be called while other threads may be using
+ * the table, or while records that hold interned IDs are in use.
+ */
+void bgpstream_str_intern_destroy(void);
+
+/** @} */
+
+#endif /* __BGPSTREAM_UTILS_STR_INTERN_H */
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+#include "bgpstream_resource.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define RIB_FILE "routeviews.route-views.jinx.ribs.1427846400.bz2"
+
+#define DECODE_THREADS "4"
+
+#define ELEM_BUF_LEN 65536
+
+#ifdef WITH_DATA_INTERFACE_SINGLEFILE
+static bgpstream_t *create_stream(const char *threads)
+{
+  bgpstream_t *bs;
+  bgpstream_data_interface_id_t di_id;
+  bgpstream_data_interface_option_t *option;
+
+  if ((bs = bgpstream_create()) == NULL ||
+      (di_id = bgpstream_get_data_interface_id_by_name(bs, "singlefile")) ==
+        0) {
+    goto err;
+  }
+  bgpstream_set_data_interface(bs, di_id);
+  if ((option = bgpstream_get_data_interface_option_by_name(
+         bs, di_id, "rib-file")) == NULL ||
+      bgpstream_set_data_interface_option(bs, option, RIB_FILE) != 0) {
+    goto err;
+  }
+  if (threads != NULL &&
+      ((option = bgpstream_get_data_interface_option_by_name(
+          bs, di_id, "rib-decode-threads")) == NULL ||
+       bgpstream_set_data_interface_option(bs, option, threads) != 0)) {
+    goto err;
+  }
+  if (bgpstream_start(bs) != 0) {
+    goto err;
+  }
+  return bs;
+
+err:
+  bgpstream_destroy(bs);
+  return NULL;
+}
+
+static int test_decode_pool_options()
+{
+  bgpstream_t *bs;
+  bgpstream_data_interface_id_t di_id;
+  bgpstream_data_interface_option_t *option;
+  char buf[16];
+
+  CHECK("BGPStream create", (bs = bgpstream_create()) != NULL);
+  CHECK("get data interface ID (singlefile)",
+        (di_id = bgpstream_get_data_interface_id_by_name(bs, "singlefile")) !=
+          0);
+  CHECK("get option (rib-decode-threads)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "rib-decode-threads")) != NULL);
+
+  CHECK("rib-decode-threads 1",
+        bgpstream_set_data_interface_option(bs, option, "1") == 0);
+  snprintf(buf, sizeof(buf), "%d", BGPSTREAM_RESOURCE_DECODE_THREADS_MAX);
+  CHECK("rib-decode-threads max",
+        bgpstream_set_data_interface_option(bs, option, buf) == 0);
+  snprintf(buf, sizeof(buf), "%d", BGPSTREAM_RESOURCE_DECODE_THREADS_MAX + 1);
+  CHECK("rib-decode-threads max+1",
+        bgpstream_set_data_interface_option(bs, option, buf) != 0);
+  CHECK("rib-decode-threads 0",
+        bgpstream_set_data_interface_option(bs, option, "0") != 0);
+  CHECK("rib-decode-threads negative",
+        bgpstream_set_data_interface_option(bs, option, "-1") != 0);
+  CHECK("rib-decode-threads empty",
+        bgpstream_set_data_interface_option(bs, option, "") != 0);
+
+  bgpstream_destroy(bs);
+  return 0;
+}
+
+static int test_decode_pool_compare()
+{
+  bgpstream_t *seq, *pool;
+  bgpstream_record_t *seq_rec, *pool_rec;
+  bgpstream_elem_t *seq_elem, *pool_elem;
+  static char seq_buf[ELEM_BUF_LEN], pool_buf[ELEM_BUF_LEN];
+  int seq_ret, pool_ret, seq_elem_ret, pool_elem_ret;
+  int rec_cnt = 0, elem_cnt = 0, diff_cnt = 0;
+
+  CHECK("sequential stream start", (seq = create_stream(NULL)) != NULL);
+  CHECK("decode pool stream start",
+        (pool = create_stream(DECODE_THREADS)) != NULL);
+
+  // both streams must produce exactly the same records and elems
+  while (1) {
+    seq_ret = bgpstream_get_next_record(seq, &seq_rec);
+    pool_ret = bgpstream_get_next_record(pool, &pool_rec);
+    if (seq_ret != pool_ret) {
+      diff_cnt++;
+      break;
+    }
+    if (seq_ret <= 0) {
+      break;
+    }
+    rec_cnt++;
+    if (seq_rec->status != pool_rec->status ||
+        seq_rec->type != pool_rec->type ||
+        seq_rec->time_sec != pool_rec->time_sec) {
+      diff_cnt++;
+      continue;
+    }
+    if (seq_rec->status != BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+      continue;
+    }
+    while (1) {
+      seq_elem_ret = bgpstream_record_get_next_elem(seq_rec, &seq_elem);
+      pool_elem_ret = bgpstream_record_get_next_elem(pool_rec, &pool_elem);
+      if (seq_elem_ret != pool_elem_ret) {
+        diff_cnt++;
+        break;
+      }
+      if (seq_elem_ret <= 0) {
+        break;
+      }
+      elem_cnt++;
+      if (bgpstream_record_elem_snprintf(seq_buf, ELEM_BUF_LEN, seq_rec,
+                                         seq_elem) == NULL ||
+          bgpstream_record_elem_snprintf(pool_buf, ELEM_BUF_LEN, pool_rec,
+                                         pool_elem) == NULL ||
+          strcmp(seq_buf, pool_buf) != 0) {
+        diff_cnt++;
+      }
+    }
+  }
+
+  CHECK("final return code", seq_ret == 0 && pool_ret == 0);
+  CHECK("records read", rec_cnt > 0);
+  CHECK("elems read", elem_cnt > 0);
+  CHECK("sequential and decode pool elems match", diff_cnt == 0);
+
+  bgpstream_destroy(seq);
+  bgpstream_destroy(pool);
+  return 0;
+}
+#endif
+
+int main()
+{
+#ifdef WITH_DATA_INTERFACE_SINGLEFILE
+  CHECK_SECTION("decode pool options", test_decode_pool_options() == 0);
+  CHECK_SECTION("decode pool", test_decode_pool_compare() == 0);
+#else
+  SKIPPED_SECTION("decode pool options");
+  SKIPPED_SECTION("decode pool");
+#endif
+
+  ENDTEST;
+  return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+#include "bgpstream_mrt_writer.h"
+#include "bgpstream_utils_as_path_int.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MRT_FILE "mrt-writer-test.mrt"
+
+/* more peers than a single PEER_INDEX_TABLE can hold */
+#define PEERS_CNT 70000
+
+/* announcements written after the RIB */
+#define UPDATES_CNT 100
+
+#define DUMP_TIME 1427846400
+
+static void peer_ip(int i, bgpstream_ip_addr_t *ip)
+{
+  memset(ip, 0, sizeof(*ip));
+  ip->version = BGPSTREAM_ADDR_VERSION_IPV4;
+  ip->bs_ipv4.addr.s_addr = htonl(0x0a000000 + i);
+}
+
+/* the peer ASN is a function of the peer index */
+#define PEER_ASN(i) (64512 + ((i) % 1000))
+
+static int write_file()
+{
+  bgpstream_mrt_writer_t *writer;
+  bgpstream_record_t record;
+  bgpstream_elem_t *elem;
+  uint32_t asns[2];
+  int i, err = 0;
+
+  memset(&record, 0, sizeof(record));
+  record.time_sec = DUMP_TIME;
+  record.dump_time_sec = DUMP_TIME;
+  strcpy(record.collector_name, "test");
+  record.collector_id = bgpstream_str_intern(record.collector_name);
+
+  CHECK("MRT writer create", (writer = bgpstream_mrt_writer_create(MRT_FILE)) !=
+                               NULL);
+  elem = bgpstream_elem_create();
+
+  // every peer has the same route to one of two prefixes
+  elem->type = BGPSTREAM_ELEM_TYPE_RIB;
+  for (i = 0; i < PEERS_CNT; i++) {
+    peer_ip(i, &elem->peer_ip);
+    elem->peer_asn = PEER_ASN(i);
+    bgpstream_str2pfx(i < PEERS_CNT / 2 ? "192.0.2.0/24" : "198.51.100.0/24",
+                      &elem->prefix);
+    bgpstream_as_path_clear(elem->as_path);
+    asns[0] = elem->peer_asn;
+    asns[1] = 3356;
+    bgpstream_as_path_append(elem->as_path, BGPSTREAM_AS_PATH_SEG_ASN, asns, 2);
+    if (bgpstream_mrt_writer_write_elem(writer, &record, elem) != 0) {
+      err = 1;
+    }
+  }
+  CHECK("MRT writer write RIB elems", err == 0);
+
+  elem->type = BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT;
+  for (i = 0; i < UPDATES_CNT; i++) {
+    record.time_sec = DUMP_TIME + 1 + i;
+    peer_ip(i, &elem->peer_ip);
+    elem->peer_asn = PEER_ASN(i);
+    // IPv4 prefixes with an IPv6 next-hop go in MP_REACH_NLRI only
+    bgpstream_str2addr(i % 2 ? "2001:db8::1" : "192.0.2.1", &elem->nexthop);
+    if (bgpstream_mrt_writer_write_elem(writer, &record, elem) != 0) {
+      err = 1;
+    }
+  }
+  CHECK("MRT writer write announcements", err == 0);
+
+  bgpstream_elem_destroy(elem);
+  bgpstream_mrt_writer_destroy(writer);
+  return 0;
+}
+
+#ifdef WITH_DATA_INTERFACE_SINGLEFILE
+static int read_file()
+{
+  bgpstream_t *bs;
+  bgpstream_record_t *rec;
+  bgpstream_elem_t *elem;
+  bgpstream_data_interface_id_t di_id;
+  bgpstream_data_interface_option_t *option;
+  uint8_t *seen;
+  uint32_t origin;
+  int rib_cnt = 0, upd_cnt = 0, bad_cnt = 0;
+  int ret, i;
+
+  seen = calloc(PEERS_CNT, 1);
+  CHECK("BGPStream create", (bs = bgpstream_create()) != NULL);
+  CHECK("get data interface ID (singlefile)",
+        (di_id = bgpstream_get_data_interface_id_by_name(bs, "singlefile")) !=
+          0);
+  bgpstream_set_data_interface(bs, di_id);
+  CHECK("get option (rib-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "rib-file")) != NULL);
+  CHECK("set option (rib-file)",
+        bgpstream_set_data_interface_option(bs, option, MRT_FILE) == 0);
+  CHECK("stream start", bgpstream_start(bs) == 0);
+
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    if (rec->status != BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+      bad_cnt++;
+      continue;
+    }
+    while (bgpstream_record_get_next_elem(rec, &elem) > 0) {
+      i = ntohl(elem->peer_ip.bs_ipv4.addr.s_addr) - 0x0a000000;
+      if (i < 0 || i >= PEERS_CNT || elem->peer_asn != PEER_ASN(i) ||
+          bgpstream_as_path_get_origin_val(elem->as_path, &origin) != 0 ||
+          origin != 3356) {
+        bad_cnt++;
+        continue;
+      }
+      if (elem->type == BGPSTREAM_ELEM_TYPE_RIB) {
+        if (seen[i]++ != 0) {
+          bad_cnt++;
+        }
+        rib_cnt++;
+      } else if (elem->type == BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT) {
+        if (elem->nexthop.version != (i % 2 ? BGPSTREAM_ADDR_VERSION_IPV6
+                                            : BGPSTREAM_ADDR_VERSION_IPV4)) {
+          bad_cnt++;
+        }
+        upd_cnt++;
+      }
+    }
+  }
+  CHECK("final return code", ret == 0);
+  CHECK("read back RIB elems", rib_cnt == PEERS_CNT && bad_cnt == 0);
+  CHECK("read back announcements", upd_cnt == UPDATES_CNT && bad_cnt == 0);
+
+  bgpstream_destroy(bs);
+  free(seen);
+  return 0;
+}
+#endif
+
+int main()
+{
+  CHECK_SECTION("MRT writer", write_file() == 0);
+#ifdef WITH_DATA_INTERFACE_SINGLEFILE
+  CHECK_SECTION("MRT writer round trip", read_file() == 0);
+#else
+  SKIPPED_SECTION("MRT writer round trip");
+#endif
+
+  unlink(MRT_FILE);
+
+  ENDTEST;
+  return 0;
+}
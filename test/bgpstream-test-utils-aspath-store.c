@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+#include "bgpstream_utils_as_path_int.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SNAPSHOT_FILE "aspath-store-test.snap"
+
+/* number of paths added before the snapshot is saved */
+#define PATHS_CNT 20000
+
+/* Offsets into the snapshot file (see snapshot_hdr_t and snapshot_path_t in
+ * bgpstream_utils_as_path_store.c) */
+#define SNAPSHOT_HDR_LEN 32
+#define SNAPSHOT_HDR_INDEX_SIZE 20
+#define SNAPSHOT_PATH_LEN 24
+#define SNAPSHOT_PATH_DATA_OFFSET 0
+#define SNAPSHOT_PATH_HASH 8
+#define SNAPSHOT_PATH_SEG_CNT 14
+
+/* Build the i-th test path, and pick a peer ASN that is prepended to half of
+ * the non-empty paths (so that both core and full paths are stored) */
+static bgpstream_as_path_t *test_path(int i, uint32_t *peer_asn)
+{
+  bgpstream_as_path_t *path = bgpstream_as_path_create();
+  uint32_t asns[8];
+  uint32_t set[3] = {64500, 64501, 64502};
+  int len = i % 9;
+  int k;
+
+  for (k = 0; k < len; k++) {
+    asns[k] = 1 + (i / 9 * 7 + k * 13) % 5000;
+  }
+  *peer_asn = (len > 0 && i % 2) ? asns[0] : 9999;
+  if (len > 0) {
+    bgpstream_as_path_append(path, BGPSTREAM_AS_PATH_SEG_ASN, asns, len);
+  }
+  if (i % 17 == 0) {
+    bgpstream_as_path_append(path, BGPSTREAM_AS_PATH_SEG_SET, set, 3);
+  }
+  return path;
+}
+
+/* Look up every test path and check that the store returns it unchanged.
+ * IDs that are already known must not change. */
+static int check_paths(bgpstream_as_path_store_t *store,
+                       bgpstream_as_path_store_path_id_t *ids, int known_cnt,
+                       int cnt)
+{
+  bgpstream_as_path_store_path_id_t id;
+  bgpstream_as_path_store_path_t *spath;
+  bgpstream_as_path_t *path, *stored;
+  uint32_t peer_asn;
+  int i, ok = 1;
+
+  for (i = 0; i < cnt; i++) {
+    path = test_path(i, &peer_asn);
+    if (bgpstream_as_path_store_get_path_id(store, path, peer_asn, &id) != 0 ||
+        (i < known_cnt && memcmp(&id, &ids[i], sizeof(id)) != 0)) {
+      ok = 0;
+    }
+    ids[i] = id;
+    spath = bgpstream_as_path_store_get_store_path(store, id);
+    stored = bgpstream_as_path_store_path_get_path(spath, peer_asn);
+    if (stored == NULL || !bgpstream_as_path_equal(path, stored)) {
+      ok = 0;
+    }
+    bgpstream_as_path_destroy(path);
+    bgpstream_as_path_destroy(stored);
+  }
+  return ok;
+}
+
+/* Copy the snapshot, overwrite len bytes at the given offset, and check
+ * whether the copy loads */
+static int corrupt_and_load(const char *src, off_t offset, const void *buf,
+                            size_t len)
+{
+  bgpstream_as_path_store_t *store;
+  char copy[] = SNAPSHOT_FILE ".corrupt";
+  char data[4096];
+  ssize_t n;
+  int in, out, loaded;
+
+  in = open(src, O_RDONLY);
+  out = open(copy, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  while ((n = read(in, data, sizeof(data))) > 0) {
+    if (write(out, data, n) != n) {
+      break;
+    }
+  }
+  close(in);
+  if (offset < 0) {
+    // truncate rather than overwrite
+    loaded = ftruncate(out, lseek(out, 0, SEEK_END) + offset);
+  } else {
+    loaded = pwrite(out, buf, len, offset);
+  }
+  close(out);
+
+  store = bgpstream_as_path_store_load(copy);
+  loaded = (store != NULL);
+  if (store != NULL) {
+    bgpstream_as_path_store_destroy(store);
+  }
+  unlink(copy);
+  return loaded;
+}
+
+static int test_as_path_store_snapshot()
+{
+  bgpstream_as_path_store_t *store;
+  bgpstream_as_path_store_path_id_t *ids;
+  uint32_t size;
+
+  ids = malloc(sizeof(bgpstream_as_path_store_path_id_t) * PATHS_CNT * 2);
+
+  CHECK("AS path store create",
+        (store = bgpstream_as_path_store_create()) != NULL);
+  CHECK("AS path store insert", check_paths(store, ids, 0, PATHS_CNT));
+  size = bgpstream_as_path_store_get_size(store);
+
+  CHECK("AS path store save",
+        bgpstream_as_path_store_save(store, SNAPSHOT_FILE) == 0);
+  bgpstream_as_path_store_destroy(store);
+
+  CHECK("AS path store load",
+        (store = bgpstream_as_path_store_load(SNAPSHOT_FILE)) != NULL &&
+          bgpstream_as_path_store_get_size(store) == size);
+  CHECK("AS path store loaded paths",
+        check_paths(store, ids, PATHS_CNT, PATHS_CNT) &&
+          bgpstream_as_path_store_get_size(store) == size);
+
+  // new paths go to private memory, next to the mapped ones
+  CHECK("AS path store insert after load",
+        check_paths(store, ids, PATHS_CNT, PATHS_CNT * 2) &&
+          bgpstream_as_path_store_get_size(store) > size);
+  bgpstream_as_path_store_destroy(store);
+
+  free(ids);
+  return 0;
+}
+
+static int test_as_path_store_corrupt()
+{
+  bgpstream_as_path_store_t *store;
+  bgpstream_as_path_store_path_id_t id;
+  bgpstream_as_path_t *path;
+  uint64_t offset = UINT64_MAX - 1;
+  uint16_t seg_cnt = 3;
+  uint32_t peer_asn, index_size, hash, b;
+  uint32_t *index;
+  off_t index_offset = SNAPSHOT_HDR_LEN + SNAPSHOT_PATH_LEN;
+  FILE *fp;
+  int fd;
+
+  // a single path, with two segments
+  store = bgpstream_as_path_store_create();
+  path = test_path(1, &peer_asn);
+  bgpstream_as_path_store_get_path_id(store, path, 9999, &id);
+  bgpstream_as_path_destroy(path);
+  bgpstream_as_path_store_save(store, SNAPSHOT_FILE);
+  bgpstream_as_path_store_destroy(store);
+
+  fd = open(SNAPSHOT_FILE, O_RDONLY);
+  CHECK("AS path store snapshot header",
+        pread(fd, &index_size, sizeof(index_size), SNAPSHOT_HDR_INDEX_SIZE) ==
+            sizeof(index_size) &&
+          pread(fd, &hash, sizeof(hash),
+                SNAPSHOT_HDR_LEN + SNAPSHOT_PATH_HASH) == sizeof(hash));
+  close(fd);
+  index = malloc(sizeof(uint32_t) * index_size);
+
+  CHECK("AS path store load intact",
+        corrupt_and_load(SNAPSHOT_FILE, 0, NULL, 0));
+  CHECK("AS path store load truncated",
+        !corrupt_and_load(SNAPSHOT_FILE, -1, NULL, 0));
+  CHECK("AS path store load bad data offset",
+        !corrupt_and_load(SNAPSHOT_FILE,
+                          SNAPSHOT_HDR_LEN + SNAPSHOT_PATH_DATA_OFFSET,
+                          &offset, sizeof(offset)));
+  CHECK("AS path store load bad segment count",
+        !corrupt_and_load(SNAPSHOT_FILE,
+                          SNAPSHOT_HDR_LEN + SNAPSHOT_PATH_SEG_CNT, &seg_cnt,
+                          sizeof(seg_cnt)));
+
+  // every bucket refers to the only path (so lookups never find an empty one)
+  for (b = 0; b < index_size; b++) {
+    index[b] = 1;
+  }
+  CHECK("AS path store load full index",
+        !corrupt_and_load(SNAPSHOT_FILE, index_offset, index,
+                          sizeof(uint32_t) * index_size));
+  // no bucket refers to the path
+  memset(index, 0, sizeof(uint32_t) * index_size);
+  CHECK("AS path store load empty index",
+        !corrupt_and_load(SNAPSHOT_FILE, index_offset, index,
+                          sizeof(uint32_t) * index_size));
+  // the path is in the bucket just before its home bucket
+  index[(hash - 1) & (index_size - 1)] = 1;
+  CHECK("AS path store load misplaced index entry",
+        !corrupt_and_load(SNAPSHOT_FILE, index_offset, index,
+                          sizeof(uint32_t) * index_size));
+  // the path is in its home bucket
+  memset(index, 0, sizeof(uint32_t) * index_size);
+  index[hash & (index_size - 1)] = 1;
+  CHECK("AS path store load rewritten index",
+        corrupt_and_load(SNAPSHOT_FILE, index_offset, index,
+                         sizeof(uint32_t) * index_size));
+  free(index);
+
+  fp = fopen(SNAPSHOT_FILE, "w");
+  fputs("garbage", fp);
+  fclose(fp);
+  CHECK("AS path store load garbage",
+        bgpstream_as_path_store_load(SNAPSHOT_FILE) == NULL);
+
+  unlink(SNAPSHOT_FILE);
+  CHECK("AS path store load missing",
+        bgpstream_as_path_store_load(SNAPSHOT_FILE) == NULL);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("AS path store snapshot",
+                test_as_path_store_snapshot() == 0);
+  CHECK_SECTION("AS path store corrupt snapshot",
+                test_as_path_store_corrupt() == 0);
+  ENDTEST;
+  return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* largest set in the match test, well beyond the size up to which sets are
+ * scanned (four communities at a time) rather than binary searched */
+#define MATCH_SET_MAX 70
+
+/* The i-th of a sequence of distinct communities. Some share their ASN or
+ * their value with the next one so that masked matches are not trivial. */
+static void test_comm(int i, bgpstream_community_t *c)
+{
+  c->asn = 64500 + i / 2;
+  c->value = 100 + i * 3;
+}
+
+static int comm_is(const bgpstream_community_t *c, uint16_t asn,
+                   uint16_t value)
+{
+  return c != NULL && c->asn == asn && c->value == value;
+}
+
+static int test_community_set_insert()
+{
+  bgpstream_community_set_t *set;
+  bgpstream_community_t c;
+  int order[] = {5, 1, 9, 1, 3, 5, 0, 9, 7};
+  int i, failed = 0;
+
+  CHECK("Community set create",
+        (set = bgpstream_community_set_create()) != NULL);
+
+  // out of order, with duplicates
+  for (i = 0; i < (int)(sizeof(order) / sizeof(order[0])); i++) {
+    test_comm(order[i], &c);
+    if (bgpstream_community_set_insert(set, &c) != 0) {
+      failed++;
+    }
+  }
+  CHECK("Community set insert", failed == 0);
+  CHECK("Community set size after duplicate inserts",
+        bgpstream_community_set_size(set) == 6);
+
+  // the set is kept sorted
+  CHECK("Community set order",
+        comm_is(bgpstream_community_set_get(set, 0), 64500, 100) &&
+          comm_is(bgpstream_community_set_get(set, 1), 64500, 103) &&
+          comm_is(bgpstream_community_set_get(set, 2), 64501, 109) &&
+          comm_is(bgpstream_community_set_get(set, 3), 64502, 115) &&
+          comm_is(bgpstream_community_set_get(set, 4), 64503, 121) &&
+          comm_is(bgpstream_community_set_get(set, 5), 64504, 127));
+
+  for (i = 0; i < 10; i++) {
+    test_comm(i, &c);
+    if (bgpstream_community_set_exists(set, &c) !=
+        (i == 0 || i == 1 || i == 3 || i == 5 || i == 7 || i == 9)) {
+      break;
+    }
+  }
+  CHECK("Community set exists", i == 10);
+
+  bgpstream_community_set_destroy(set);
+  return 0;
+}
+
+static int test_community_set_equal()
+{
+  bgpstream_community_set_t *set1, *set2;
+  bgpstream_community_t comms[8], rev[8];
+  int i;
+
+  set1 = bgpstream_community_set_create();
+  set2 = bgpstream_community_set_create();
+
+  CHECK("Community set equal (empty)",
+        bgpstream_community_set_equal(set1, set2));
+
+  for (i = 0; i < 8; i++) {
+    test_comm(i, &comms[i]);
+    rev[7 - i] = comms[i];
+  }
+
+  // same communities, inserted in opposite orders
+  for (i = 0; i < 8; i++) {
+    bgpstream_community_set_insert(set1, &comms[i]);
+    bgpstream_community_set_insert(set2, &rev[i]);
+  }
+  CHECK("Community set equal (insert order)",
+        bgpstream_community_set_equal(set1, set2) &&
+          bgpstream_community_set_hash(set1) ==
+            bgpstream_community_set_hash(set2));
+
+  // populated from an unsorted array with duplicates
+  rev[0] = rev[1];
+  bgpstream_community_set_populate_from_array(set2, rev, 8);
+  bgpstream_community_set_insert(set2, &comms[7]);
+  CHECK("Community set equal (populate from array)",
+        bgpstream_community_set_equal(set1, set2));
+
+  // an unsorted array is copied (and sorted) by the zero-copy populate too
+  CHECK("Community set equal (populate from array zc)",
+        bgpstream_community_set_populate_from_array_zc(set2, rev, 8) == 0 &&
+          bgpstream_community_set_size(set2) == 7 &&
+          comm_is(&rev[0], comms[6].asn, comms[6].value));
+  bgpstream_community_set_insert(set2, &comms[7]);
+  CHECK("Community set equal (populate from array zc, insert)",
+        bgpstream_community_set_equal(set1, set2));
+
+  bgpstream_community_set_populate_from_array_zc(set2, comms, 8);
+  CHECK("Community set equal (populate from sorted array zc)",
+        bgpstream_community_set_equal(set1, set2));
+
+  // one community differs
+  bgpstream_community_set_populate_from_array(set2, comms, 7);
+  test_comm(8, &comms[0]);
+  bgpstream_community_set_insert(set2, &comms[0]);
+  CHECK("Community set not equal",
+        !bgpstream_community_set_equal(set1, set2));
+
+  bgpstream_community_set_destroy(set1);
+  bgpstream_community_set_destroy(set2);
+  return 0;
+}
+
+/* Check the matches of a set against a linear search of its array */
+static int check_match(bgpstream_community_set_t *set,
+                       const bgpstream_community_t *comms, int cnt)
+{
+  uint8_t masks[] = {BGPSTREAM_COMMUNITY_FILTER_EXACT,
+                     BGPSTREAM_COMMUNITY_FILTER_ASN,
+                     BGPSTREAM_COMMUNITY_FILTER_VALUE};
+  bgpstream_community_t c;
+  int i, j, m, want;
+
+  for (m = 0; m < (int)sizeof(masks); m++) {
+    // all the communities in the set, and some that are not (or only share
+    // their ASN or value with one that is)
+    for (i = 0; i < MATCH_SET_MAX + 2; i++) {
+      test_comm(i, &c);
+      if (i % 5 == 4) {
+        c.value++;
+      }
+      want = 0;
+      for (j = 0; j < cnt; j++) {
+        if (((masks[m] & BGPSTREAM_COMMUNITY_FILTER_ASN) == 0 ||
+             comms[j].asn == c.asn) &&
+            ((masks[m] & BGPSTREAM_COMMUNITY_FILTER_VALUE) == 0 ||
+             comms[j].value == c.value)) {
+          want = 1;
+          break;
+        }
+      }
+      if (bgpstream_community_set_match(set, &c, masks[m]) != want) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+static int test_community_set_match()
+{
+  bgpstream_community_set_t *set;
+  bgpstream_community_t comms[MATCH_SET_MAX];
+  int cnt, i, failed = 0;
+
+  set = bgpstream_community_set_create();
+
+  for (i = 0; i < MATCH_SET_MAX; i++) {
+    test_comm(i, &comms[i]);
+  }
+
+  // every size, so that sets both smaller and larger than the vector width
+  // and the scan limit are matched (with every community as the last one)
+  for (cnt = 0; cnt <= MATCH_SET_MAX; cnt++) {
+    bgpstream_community_set_populate_from_array(set, comms, cnt);
+    if (!check_match(set, comms, cnt)) {
+      failed++;
+    }
+  }
+  CHECK("Community set match", failed == 0);
+
+  bgpstream_community_set_destroy(set);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("Community set insert", test_community_set_insert() == 0);
+  CHECK_SECTION("Community set equal", test_community_set_equal() == 0);
+  CHECK_SECTION("Community set match", test_community_set_match() == 0);
+  ENDTEST;
+  return 0;
+}
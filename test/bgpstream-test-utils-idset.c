@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* enough IDs in one 64K block to force a bitmap container */
+#define DENSE_CNT 10000
+
+static int test_id_set_basic()
+{
+  bgpstream_id_set_t *set;
+  uint32_t *id;
+  uint32_t prev = 0;
+  int cnt = 0, sorted = 1;
+
+  CHECK("ID set create", (set = bgpstream_id_set_create()) != NULL);
+
+  CHECK("ID set insert 16-bit", bgpstream_id_set_insert(set, 3356) == 1);
+  CHECK("ID set insert 32-bit", bgpstream_id_set_insert(set, 4200000000) == 1);
+  CHECK("ID set insert duplicate", bgpstream_id_set_insert(set, 3356) == 0);
+  CHECK("ID set insert zero", bgpstream_id_set_insert(set, 0) == 1);
+
+  CHECK("ID set exists", bgpstream_id_set_exists(set, 3356) &&
+                           bgpstream_id_set_exists(set, 4200000000) &&
+                           bgpstream_id_set_exists(set, 0));
+  CHECK("ID set not exists", !bgpstream_id_set_exists(set, 174) &&
+                               !bgpstream_id_set_exists(set, 4200000001) &&
+                               !bgpstream_id_set_exists(set, 65536));
+  CHECK("ID set size", bgpstream_id_set_size(set) == 3);
+
+  bgpstream_id_set_rewind(set);
+  while ((id = bgpstream_id_set_next(set)) != NULL) {
+    if (cnt > 0 && *id <= prev) {
+      sorted = 0;
+    }
+    prev = *id;
+    cnt++;
+  }
+  CHECK("ID set iterate", cnt == 3 && sorted);
+
+  bgpstream_id_set_clear(set);
+  CHECK("ID set clear", bgpstream_id_set_size(set) == 0 &&
+                          !bgpstream_id_set_exists(set, 3356));
+
+  bgpstream_id_set_destroy(set);
+  return 0;
+}
+
+static int test_id_set_dense()
+{
+  bgpstream_id_set_t *set;
+  uint32_t *ids;
+  uint32_t *id;
+  int i, cnt = 0, ok = 1;
+
+  set = bgpstream_id_set_create();
+  ids = malloc(sizeof(uint32_t) * DENSE_CNT);
+
+  // even IDs in the 65536-131071 range
+  for (i = 0; i < DENSE_CNT; i++) {
+    ids[i] = 65536 + i * 2;
+  }
+  CHECK("ID set bulk insert",
+        bgpstream_id_set_insert_bulk(set, ids, DENSE_CNT) == DENSE_CNT);
+  CHECK("ID set bulk insert duplicates",
+        bgpstream_id_set_insert_bulk(set, ids, DENSE_CNT) == 0);
+  CHECK("ID set bulk size", bgpstream_id_set_size(set) == DENSE_CNT);
+
+  for (i = 0; i < DENSE_CNT; i++) {
+    if (!bgpstream_id_set_exists(set, 65536 + i * 2) ||
+        bgpstream_id_set_exists(set, 65536 + i * 2 + 1)) {
+      ok = 0;
+    }
+  }
+  CHECK("ID set dense exists", ok);
+
+  bgpstream_id_set_rewind(set);
+  while ((id = bgpstream_id_set_next(set)) != NULL) {
+    if (*id != 65536 + cnt * 2) {
+      ok = 0;
+    }
+    cnt++;
+  }
+  CHECK("ID set dense iterate", ok && cnt == DENSE_CNT);
+
+  free(ids);
+  bgpstream_id_set_destroy(set);
+  return 0;
+}
+
+static int test_id_set_algebra()
+{
+  bgpstream_id_set_t *a, *b, *c;
+  uint32_t i;
+  int ok = 1;
+
+  a = bgpstream_id_set_create();
+  b = bgpstream_id_set_create();
+  c = bgpstream_id_set_create();
+
+  // a = multiples of 2, b = multiples of 3 (both dense and sparse)
+  for (i = 0; i < 3 * DENSE_CNT; i++) {
+    if (i % 2 == 0) {
+      bgpstream_id_set_insert(a, i);
+    }
+    if (i % 3 == 0) {
+      bgpstream_id_set_insert(b, i);
+    }
+  }
+  bgpstream_id_set_insert(a, 1000000);
+  bgpstream_id_set_insert(b, 2000000);
+
+  bgpstream_id_set_merge(c, a);
+  CHECK("ID set intersect", bgpstream_id_set_intersect(c, b) == 0);
+  for (i = 0; i < 3 * DENSE_CNT; i++) {
+    if (bgpstream_id_set_exists(c, i) != (i % 6 == 0)) {
+      ok = 0;
+    }
+  }
+  CHECK("ID set intersect result",
+        ok && bgpstream_id_set_size(c) == DENSE_CNT / 2 &&
+          !bgpstream_id_set_exists(c, 1000000));
+
+  bgpstream_id_set_clear(c);
+  bgpstream_id_set_merge(c, a);
+  CHECK("ID set subtract", bgpstream_id_set_subtract(c, b) == 0);
+  for (i = 0; i < 3 * DENSE_CNT; i++) {
+    if (bgpstream_id_set_exists(c, i) != (i % 2 == 0 && i % 3 != 0)) {
+      ok = 0;
+    }
+  }
+  CHECK("ID set subtract result",
+        ok && bgpstream_id_set_exists(c, 1000000));
+
+  bgpstream_id_set_clear(c);
+  bgpstream_id_set_merge(c, a);
+  CHECK("ID set merge", bgpstream_id_set_merge(c, b) == 0);
+  for (i = 0; i < 3 * DENSE_CNT; i++) {
+    if (bgpstream_id_set_exists(c, i) != (i % 2 == 0 || i % 3 == 0)) {
+      ok = 0;
+    }
+  }
+  CHECK("ID set merge result", ok && bgpstream_id_set_exists(c, 1000000) &&
+                                 bgpstream_id_set_exists(c, 2000000));
+
+  bgpstream_id_set_destroy(a);
+  bgpstream_id_set_destroy(b);
+  bgpstream_id_set_destroy(c);
+  return 0;
+}
+
+static int test_id_set_serialize()
+{
+  bgpstream_id_set_t *a, *b;
+  uint8_t *buf;
+  size_t len;
+  uint32_t i;
+  int ok = 1;
+
+  a = bgpstream_id_set_create();
+  b = bgpstream_id_set_create();
+
+  for (i = 0; i < DENSE_CNT; i++) {
+    bgpstream_id_set_insert(a, i * 3);
+  }
+  bgpstream_id_set_insert(a, 4200000000);
+
+  len = bgpstream_id_set_serialized_size(a);
+  buf = malloc(len);
+  CHECK("ID set serialize short buffer",
+        bgpstream_id_set_serialize(buf, len - 1, a) == 0);
+  CHECK("ID set serialize", bgpstream_id_set_serialize(buf, len, a) == len);
+  CHECK("ID set deserialize",
+        bgpstream_id_set_deserialize(b, buf, len) == len);
+
+  for (i = 0; i < 3 * DENSE_CNT; i++) {
+    if (bgpstream_id_set_exists(b, i) != (i % 3 == 0)) {
+      ok = 0;
+    }
+  }
+  CHECK("ID set deserialize result",
+        ok && bgpstream_id_set_size(b) == DENSE_CNT + 1 &&
+          bgpstream_id_set_exists(b, 4200000000));
+
+  CHECK("ID set deserialize truncated",
+        bgpstream_id_set_deserialize(b, buf, len - 1) == 0 &&
+          bgpstream_id_set_size(b) == 0);
+
+  free(buf);
+  bgpstream_id_set_destroy(a);
+  bgpstream_id_set_destroy(b);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("ID set basics", test_id_set_basic() == 0);
+  CHECK_SECTION("ID set dense", test_id_set_dense() == 0);
+  CHECK_SECTION("ID set algebra", test_id_set_algebra() == 0);
+  CHECK_SECTION("ID set serialization", test_id_set_serialize() == 0);
+  ENDTEST;
+  return 0;
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The model covers a small universe: IPv4 prefixes inside 10.0.0.0/16 and
+ * IPv6 prefixes inside 2001::/56, counted in /64s as the IP counter does. */
+#define MODEL_V4_SIZE 65536
+#define MODEL_V6_MS_SIZE 256
+#define MODEL_V6_LS_SIZE 256
+
+/* number of model rounds (alternating add and add_bulk) */
+#define MODEL_ROUNDS 20
+/* upper bound on the number of prefixes added in a round, well above the
+ * number of pending intervals that triggers a merge */
+#define MODEL_PFX_MAX 12000
+/* add a query every this many single adds, so that merges happen at
+ * different points */
+#define MODEL_QUERY_INTERVAL 3000
+/* number of random overlap queries per round */
+#define MODEL_QUERY_CNT 2000
+
+static unsigned char model_v4[MODEL_V4_SIZE];
+static unsigned char model_v6[MODEL_V6_MS_SIZE][MODEL_V6_LS_SIZE];
+
+static void random_pfx(bgpstream_pfx_t *pfx, int v6)
+{
+  memset(pfx, 0, sizeof(*pfx));
+  if (!v6) {
+    pfx->address.version = BGPSTREAM_ADDR_VERSION_IPV4;
+    pfx->address.bs_ipv4.addr.s_addr = htonl(0x0a000000 | (rand() & 0xffff));
+    pfx->mask_len = 16 + rand() % 17;
+  } else {
+    pfx->address.version = BGPSTREAM_ADDR_VERSION_IPV6;
+    pfx->address.bs_ipv6.addr.s6_addr[0] = 0x20;
+    pfx->address.bs_ipv6.addr.s6_addr[1] = 0x01;
+    pfx->address.bs_ipv6.addr.s6_addr[7] = rand();
+    pfx->address.bs_ipv6.addr.s6_addr[8] = rand();
+    pfx->mask_len = 56 + rand() % 17;
+  }
+}
+
+/* Find the range of model cells that the prefix covers */
+static void model_range(const bgpstream_pfx_t *pfx, int *ms_lo, int *ms_hi,
+                        int *ls_lo, int *ls_hi)
+{
+  int host;
+  if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+    host = 32 - pfx->mask_len;
+    *ls_lo = (ntohl(pfx->address.bs_ipv4.addr.s_addr) & 0xffff) >> host
+             << host;
+    *ls_hi = *ls_lo + (1 << host);
+    *ms_lo = 0;
+    *ms_hi = 1;
+  } else if (pfx->mask_len <= 64) {
+    host = 64 - pfx->mask_len;
+    *ms_lo = pfx->address.bs_ipv6.addr.s6_addr[7] >> host << host;
+    *ms_hi = *ms_lo + (1 << host);
+    *ls_lo = 0;
+    *ls_hi = MODEL_V6_LS_SIZE;
+  } else {
+    host = 72 - pfx->mask_len;
+    *ms_lo = pfx->address.bs_ipv6.addr.s6_addr[7];
+    *ms_hi = *ms_lo + 1;
+    *ls_lo = pfx->address.bs_ipv6.addr.s6_addr[8] >> host << host;
+    *ls_hi = *ls_lo + (1 << host);
+  }
+}
+
+static void model_add(const bgpstream_pfx_t *pfx)
+{
+  int ms_lo, ms_hi, ls_lo, ls_hi, ms, ls;
+  model_range(pfx, &ms_lo, &ms_hi, &ls_lo, &ls_hi);
+  for (ms = ms_lo; ms < ms_hi; ms++) {
+    for (ls = ls_lo; ls < ls_hi; ls++) {
+      if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+        model_v4[ls] = 1;
+      } else {
+        model_v6[ms][ls] = 1;
+      }
+    }
+  }
+}
+
+/* Count the addresses (IPv4) or /64s (IPv6) of pfx that the model holds */
+static uint64_t model_overlap(const bgpstream_pfx_t *pfx)
+{
+  int ms_lo, ms_hi, ls_lo, ls_hi, ms, ls, any;
+  uint64_t cnt = 0;
+  model_range(pfx, &ms_lo, &ms_hi, &ls_lo, &ls_hi);
+  for (ms = ms_lo; ms < ms_hi; ms++) {
+    any = 0;
+    for (ls = ls_lo; ls < ls_hi; ls++) {
+      if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+        cnt += model_v4[ls];
+      } else {
+        any |= model_v6[ms][ls];
+      }
+    }
+    cnt += any;
+  }
+  return cnt;
+}
+
+static int test_ip_counter_basic()
+{
+  bgpstream_ip_counter_t *ipc;
+  bgpstream_pfx_t pfx;
+  uint8_t more_specific;
+
+  CHECK("IP counter create", (ipc = bgpstream_ip_counter_create()) != NULL);
+
+  bgpstream_str2pfx("10.0.0.0/8", &pfx);
+  CHECK("IP counter add v4", bgpstream_ip_counter_add(ipc, &pfx) == 0);
+  bgpstream_str2pfx("10.1.0.0/16", &pfx);
+  CHECK("IP counter v4 more specific",
+        bgpstream_ip_counter_is_overlapping(ipc, &pfx, &more_specific) ==
+            65536 &&
+          more_specific == 1);
+  bgpstream_str2pfx("0.0.0.0/0", &pfx);
+  CHECK("IP counter v4 less specific",
+        bgpstream_ip_counter_is_overlapping(ipc, &pfx, &more_specific) ==
+            1 << 24 &&
+          more_specific == 0);
+  bgpstream_ip_counter_add(ipc, &pfx);
+  CHECK("IP counter v4 count",
+        bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV4) ==
+          (1ULL << 32));
+
+  bgpstream_str2pfx("2001:db8::/32", &pfx);
+  CHECK("IP counter add v6", bgpstream_ip_counter_add(ipc, &pfx) == 0);
+  bgpstream_str2pfx("2001:db8:1::/48", &pfx);
+  CHECK("IP counter v6 more specific",
+        bgpstream_ip_counter_is_overlapping(ipc, &pfx, &more_specific) ==
+            65536 &&
+          more_specific == 1);
+  bgpstream_str2pfx("2001:db8:1::/96", &pfx);
+  CHECK("IP counter v6 longer than /64",
+        bgpstream_ip_counter_is_overlapping(ipc, &pfx, &more_specific) == 1 &&
+          more_specific == 1);
+  bgpstream_str2pfx("2001::/16", &pfx);
+  CHECK("IP counter v6 less specific",
+        bgpstream_ip_counter_is_overlapping(ipc, &pfx, &more_specific) ==
+            (1ULL << 32) &&
+          more_specific == 0);
+
+  bgpstream_ip_counter_clear(ipc);
+  CHECK("IP counter clear",
+        bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV4) ==
+            0 &&
+          bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV6) ==
+            0);
+
+  bgpstream_ip_counter_destroy(ipc);
+  return 0;
+}
+
+static int test_ip_counter_model()
+{
+  bgpstream_ip_counter_t *ipc;
+  bgpstream_pfx_t *pfxs;
+  bgpstream_pfx_t pfx;
+  uint64_t cnt4, cnt6, overlap;
+  uint8_t more_specific;
+  int add_ok = 1, count_ok = 1, overlap_ok = 1, clear_ok = 1;
+  int round, cnt, i, ms, ls, any;
+
+  srand(11);
+  pfxs = malloc(sizeof(bgpstream_pfx_t) * MODEL_PFX_MAX);
+  ipc = bgpstream_ip_counter_create();
+
+  for (round = 0; round < MODEL_ROUNDS; round++) {
+    memset(model_v4, 0, sizeof(model_v4));
+    memset(model_v6, 0, sizeof(model_v6));
+
+    cnt = 1 + rand() % MODEL_PFX_MAX;
+    for (i = 0; i < cnt; i++) {
+      random_pfx(&pfxs[i], rand() % 2);
+      model_add(&pfxs[i]);
+    }
+    if (round % 2) {
+      if (bgpstream_ip_counter_add_bulk(ipc, pfxs, cnt) != 0) {
+        add_ok = 0;
+      }
+    } else {
+      for (i = 0; i < cnt; i++) {
+        if (bgpstream_ip_counter_add(ipc, &pfxs[i]) != 0) {
+          add_ok = 0;
+        }
+        if (i % MODEL_QUERY_INTERVAL == 0) {
+          bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV4);
+        }
+      }
+    }
+
+    cnt4 = cnt6 = 0;
+    for (ls = 0; ls < MODEL_V4_SIZE; ls++) {
+      cnt4 += model_v4[ls];
+    }
+    for (ms = 0; ms < MODEL_V6_MS_SIZE; ms++) {
+      any = 0;
+      for (ls = 0; ls < MODEL_V6_LS_SIZE; ls++) {
+        any |= model_v6[ms][ls];
+      }
+      cnt6 += any;
+    }
+    if (bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV4) !=
+          cnt4 ||
+        bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV6) !=
+          cnt6) {
+      count_ok = 0;
+    }
+
+    for (i = 0; i < MODEL_QUERY_CNT; i++) {
+      random_pfx(&pfx, rand() % 2);
+      overlap = bgpstream_ip_counter_is_overlapping(ipc, &pfx, &more_specific);
+      if (overlap != model_overlap(&pfx) || (more_specific && overlap == 0)) {
+        overlap_ok = 0;
+      }
+    }
+
+    bgpstream_ip_counter_clear(ipc);
+    if (bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV4) !=
+          0 ||
+        bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV6) !=
+          0) {
+      clear_ok = 0;
+    }
+  }
+
+  CHECK("IP counter model add", add_ok);
+  CHECK("IP counter model count", count_ok);
+  CHECK("IP counter model overlap", overlap_ok);
+  CHECK("IP counter model clear", clear_ok);
+
+  bgpstream_ip_counter_destroy(ipc);
+  free(pfxs);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("IP counter basic", test_ip_counter_basic() == 0);
+  CHECK_SECTION("IP counter model", test_ip_counter_model() == 0);
+  ENDTEST;
+  return 0;
+}
@@ -29,6 +29,7 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -48,6 +49,25 @@
 #define IPV6_TEST_PFX_B_CHILD "2001:48d0:101:501:beef::/96"
 #define IPV6_TEST_64_CNT 65537
 
+/* number of distinct prefixes that the model test picks from */
+#define MODEL_PFX_CNT 500
+/* number of random insert/remove operations in the model test */
+#define MODEL_OPS_CNT 20000
+/* check the whole tree against the model every this many operations */
+#define MODEL_CHECK_INTERVAL 1000
+/* enough prefixes to grow the node pools several times */
+#define GROWTH_PFX_CNT 200000
+/* number of prefixes (with duplicates) given to the bulk builders */
+#define BUILD_PFX_CNT 50000
+/* number of prefixes inserted before a bulk build */
+#define BUILD_PREINSERT_CNT 100
+/* number of reader threads in the concurrent test */
+#define CONCURRENT_READER_CNT 3
+/* number of writer operations in the concurrent test */
+#define CONCURRENT_OPS_CNT 100000
+/* user data that readers expect to find on every node */
+#define CONCURRENT_USER_MAGIC 0x5eed5eed
+
 static int test_patricia()
 {
   bgpstream_patricia_tree_t *pt;
@@ -171,9 +191,474 @@ static int test_patricia()
   return 0;
 }
 
+/* Fill in a random prefix. Prefixes are clustered in a few small address
+ * ranges so that they overlap often. */
+static void random_pfx(bgpstream_pfx_t *pfx, int v6)
+{
+  memset(pfx, 0, sizeof(*pfx));
+  if (!v6) {
+    pfx->address.version = BGPSTREAM_ADDR_VERSION_IPV4;
+    pfx->address.bs_ipv4.addr.s_addr =
+      htonl(0x0a000000 | (rand() & 0xffff) << 4);
+    pfx->mask_len = 8 + rand() % 25;
+  } else {
+    pfx->address.version = BGPSTREAM_ADDR_VERSION_IPV6;
+    pfx->address.bs_ipv6.addr.s6_addr[0] = 0x20;
+    pfx->address.bs_ipv6.addr.s6_addr[1] = 0x01;
+    pfx->address.bs_ipv6.addr.s6_addr[2] = rand() & 0x3;
+    pfx->address.bs_ipv6.addr.s6_addr[3] = rand();
+    pfx->address.bs_ipv6.addr.s6_addr[4] = rand();
+    pfx->mask_len = 16 + rand() % 40;
+  }
+  bgpstream_addr_mask(&pfx->address, pfx->mask_len);
+}
+
+/* Fill the array with distinct random prefixes (half of them IPv6) */
+static void random_pfxs(bgpstream_pfx_t *pfxs, int cnt)
+{
+  int i, j;
+  for (i = 0; i < cnt; i++) {
+    random_pfx(&pfxs[i], i % 2);
+    for (j = 0; j < i; j++) {
+      if (bgpstream_pfx_equal(&pfxs[i], &pfxs[j])) {
+        i--;
+        break;
+      }
+    }
+  }
+}
+
+/* Check whether prefix a covers (is less or equally specific than) b */
+static int pfx_covers(const bgpstream_pfx_t *a, const bgpstream_pfx_t *b)
+{
+  bgpstream_pfx_t tmp;
+  if (a->address.version != b->address.version || a->mask_len > b->mask_len) {
+    return 0;
+  }
+  tmp = *b;
+  bgpstream_addr_mask(&tmp.address, a->mask_len);
+  tmp.mask_len = a->mask_len;
+  return bgpstream_pfx_equal(&tmp, a);
+}
+
+static int user_destroyed_cnt = 0;
+
+static void user_destroy(void *user)
+{
+  user_destroyed_cnt++;
+  free(user);
+}
+
+static int walk_cnt;
+
+static bgpstream_patricia_walk_cb_result_t
+walk_count(const bgpstream_patricia_tree_t *pt,
+           const bgpstream_patricia_node_t *node, void *data)
+{
+  walk_cnt++;
+  return BGPSTREAM_PATRICIA_WALK_CONTINUE;
+}
+
+/* Compare every query the tree answers with a brute-force evaluation over
+ * the prefixes that are present. Returns 1 if they all agree. */
+static int model_check(bgpstream_patricia_tree_t *pt,
+                       bgpstream_patricia_tree_result_set_t *res,
+                       const bgpstream_pfx_t *pfxs, const int *present,
+                       int cnt)
+{
+  bgpstream_patricia_node_t *node;
+  uint64_t cnt4 = 0, cnt6 = 0;
+  int less, more, less_cnt, more_cnt;
+  uint8_t overlap;
+  int i, j;
+
+  for (i = 0; i < cnt; i++) {
+    node = bgpstream_patricia_tree_search_exact(pt, &pfxs[i]);
+    if ((node != NULL) != present[i]) {
+      return 0;
+    }
+    if (present[i]) {
+      if (pfxs[i].address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+        cnt4++;
+      } else {
+        cnt6++;
+      }
+      if (!bgpstream_pfx_equal(bgpstream_patricia_tree_get_pfx(node),
+                               &pfxs[i]) ||
+          bgpstream_patricia_tree_get_user(node) == NULL) {
+        return 0;
+      }
+    }
+    less = more = less_cnt = more_cnt = 0;
+    for (j = 0; j < cnt; j++) {
+      if (!present[j] || j == i) {
+        continue;
+      }
+      if (pfx_covers(&pfxs[j], &pfxs[i])) {
+        less = 1;
+        less_cnt++;
+      }
+      if (pfx_covers(&pfxs[i], &pfxs[j])) {
+        more = 1;
+        more_cnt++;
+      }
+    }
+    overlap = (present[i] ? BGPSTREAM_PATRICIA_EXACT_MATCH : 0) |
+              (less ? BGPSTREAM_PATRICIA_LESS_SPECIFICS : 0) |
+              (more ? BGPSTREAM_PATRICIA_MORE_SPECIFICS : 0);
+    if (bgpstream_patricia_tree_get_pfx_overlap_info(pt, &pfxs[i]) !=
+        overlap) {
+      return 0;
+    }
+    if (present[i]) {
+      if (bgpstream_patricia_tree_get_more_specifics(pt, node, res) != 0 ||
+          bgpstream_patricia_tree_result_set_count(res) != more_cnt ||
+          bgpstream_patricia_tree_get_less_specifics(pt, node, res) != 0 ||
+          bgpstream_patricia_tree_result_set_count(res) != less_cnt) {
+        return 0;
+      }
+    }
+  }
+
+  walk_cnt = 0;
+  bgpstream_patricia_tree_walk(pt, walk_count, NULL);
+  return bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV4) ==
+           cnt4 &&
+         bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV6) ==
+           cnt6 &&
+         walk_cnt == (int)(cnt4 + cnt6);
+}
+
+static int test_patricia_model()
+{
+  bgpstream_patricia_tree_t *pt;
+  bgpstream_patricia_tree_result_set_t *res;
+  bgpstream_patricia_node_t *node;
+  bgpstream_pfx_t *pfxs;
+  int present[MODEL_PFX_CNT];
+  int users_cnt = 0;
+  int ok = 1, insert_ok = 1;
+  int i, op;
+
+  srand(42);
+  pfxs = malloc(sizeof(bgpstream_pfx_t) * MODEL_PFX_CNT);
+  random_pfxs(pfxs, MODEL_PFX_CNT);
+  memset(present, 0, sizeof(present));
+
+  pt = bgpstream_patricia_tree_create(user_destroy);
+  res = bgpstream_patricia_tree_result_set_create();
+
+  for (op = 0; op < MODEL_OPS_CNT; op++) {
+    i = rand() % MODEL_PFX_CNT;
+    if (rand() % 3 != 0) {
+      if ((node = bgpstream_patricia_tree_insert(pt, &pfxs[i])) == NULL) {
+        insert_ok = 0;
+        continue;
+      }
+      if (!present[i]) {
+        bgpstream_patricia_tree_set_user(pt, node, malloc(1));
+        users_cnt++;
+      }
+      present[i] = 1;
+    } else {
+      bgpstream_patricia_tree_remove(pt, &pfxs[i]);
+      present[i] = 0;
+    }
+    if (op % MODEL_CHECK_INTERVAL == 0 &&
+        !model_check(pt, res, pfxs, present, MODEL_PFX_CNT)) {
+      ok = 0;
+    }
+  }
+  CHECK("Patricia Tree model insert", insert_ok);
+  CHECK("Patricia Tree model queries", ok);
+
+  bgpstream_patricia_tree_clear(pt);
+  memset(present, 0, sizeof(present));
+  CHECK("Patricia Tree model clear",
+        model_check(pt, res, pfxs, present, MODEL_PFX_CNT) &&
+          user_destroyed_cnt == users_cnt);
+
+  bgpstream_patricia_tree_result_set_destroy(&res);
+  bgpstream_patricia_tree_destroy(pt);
+  free(pfxs);
+  return 0;
+}
+
+static int test_patricia_growth()
+{
+  bgpstream_patricia_tree_t *pt;
+  bgpstream_pfx_t pfx;
+  int i, ok = 1;
+
+#define GROWTH_PFX(i)                                                          \
+  do {                                                                         \
+    memset(&pfx, 0, sizeof(pfx));                                              \
+    pfx.address.version = BGPSTREAM_ADDR_VERSION_IPV4;                         \
+    pfx.address.bs_ipv4.addr.s_addr = htonl(0x0a000000 + (i));                 \
+    pfx.mask_len = 32;                                                         \
+  } while (0)
+
+  pt = bgpstream_patricia_tree_create(NULL);
+
+  for (i = 0; i < GROWTH_PFX_CNT; i++) {
+    GROWTH_PFX(i);
+    if (bgpstream_patricia_tree_insert(pt, &pfx) == NULL) {
+      ok = 0;
+    }
+  }
+  CHECK("Patricia Tree growth insert",
+        ok && bgpstream_patricia_prefix_count(
+                pt, BGPSTREAM_ADDR_VERSION_IPV4) == GROWTH_PFX_CNT);
+
+  for (i = 0; i < GROWTH_PFX_CNT; i++) {
+    GROWTH_PFX(i);
+    if (bgpstream_patricia_tree_search_exact(pt, &pfx) == NULL) {
+      ok = 0;
+    }
+  }
+  CHECK("Patricia Tree growth search", ok);
+
+  // free every other node, then reuse the freed nodes
+  for (i = 0; i < GROWTH_PFX_CNT; i += 2) {
+    GROWTH_PFX(i);
+    bgpstream_patricia_tree_remove(pt, &pfx);
+  }
+  for (i = 0; i < GROWTH_PFX_CNT; i++) {
+    GROWTH_PFX(i);
+    if ((bgpstream_patricia_tree_search_exact(pt, &pfx) != NULL) != (i % 2)) {
+      ok = 0;
+    }
+  }
+  CHECK("Patricia Tree growth remove",
+        ok && bgpstream_patricia_prefix_count(
+                pt, BGPSTREAM_ADDR_VERSION_IPV4) == GROWTH_PFX_CNT / 2);
+
+  for (i = 0; i < GROWTH_PFX_CNT; i += 2) {
+    GROWTH_PFX(i);
+    if (bgpstream_patricia_tree_insert(pt, &pfx) == NULL) {
+      ok = 0;
+    }
+  }
+  CHECK("Patricia Tree growth reinsert",
+        ok && bgpstream_patricia_prefix_count(
+                pt, BGPSTREAM_ADDR_VERSION_IPV4) == GROWTH_PFX_CNT &&
+          bgpstream_patricia_tree_count_24subnets(pt) ==
+            (GROWTH_PFX_CNT + 255) / 256);
+
+  bgpstream_patricia_tree_clear(pt);
+  CHECK("Patricia Tree growth clear",
+        bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV4) == 0);
+
+  bgpstream_patricia_tree_destroy(pt);
+  return 0;
+}
+
+/* Check that two trees hold the same prefixes and answer the same overlap
+ * queries */
+static int trees_equal(bgpstream_patricia_tree_t *a,
+                       bgpstream_patricia_tree_t *b,
+                       const bgpstream_pfx_t *pfxs, int cnt)
+{
+  int i;
+  if (bgpstream_patricia_prefix_count(a, BGPSTREAM_ADDR_VERSION_IPV4) !=
+        bgpstream_patricia_prefix_count(b, BGPSTREAM_ADDR_VERSION_IPV4) ||
+      bgpstream_patricia_prefix_count(a, BGPSTREAM_ADDR_VERSION_IPV6) !=
+        bgpstream_patricia_prefix_count(b, BGPSTREAM_ADDR_VERSION_IPV6) ||
+      bgpstream_patricia_tree_count_24subnets(a) !=
+        bgpstream_patricia_tree_count_24subnets(b) ||
+      bgpstream_patricia_tree_count_64subnets(a) !=
+        bgpstream_patricia_tree_count_64subnets(b)) {
+    return 0;
+  }
+  for (i = 0; i < cnt; i++) {
+    if (bgpstream_patricia_tree_search_exact(b, &pfxs[i]) == NULL ||
+        bgpstream_patricia_tree_get_pfx_overlap_info(a, &pfxs[i]) !=
+          bgpstream_patricia_tree_get_pfx_overlap_info(b, &pfxs[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int test_patricia_build()
+{
+  bgpstream_patricia_tree_t *pt_insert, *pt_build, *pt_sorted;
+  bgpstream_pfx_t *pfxs, *pfxs_copy;
+  int i, ok = 1;
+
+  srand(7);
+  pfxs = malloc(sizeof(bgpstream_pfx_t) * BUILD_PFX_CNT);
+  pfxs_copy = malloc(sizeof(bgpstream_pfx_t) * BUILD_PFX_CNT);
+  for (i = 0; i < BUILD_PFX_CNT; i++) {
+    random_pfx(&pfxs[i], i % 3 == 0);
+  }
+  // the builders must cope with duplicates
+  for (i = 0; i < BUILD_PFX_CNT / 10; i++) {
+    pfxs[rand() % BUILD_PFX_CNT] = pfxs[rand() % BUILD_PFX_CNT];
+  }
+  memcpy(pfxs_copy, pfxs, sizeof(bgpstream_pfx_t) * BUILD_PFX_CNT);
+
+  pt_insert = bgpstream_patricia_tree_create(NULL);
+  for (i = 0; i < BUILD_PFX_CNT; i++) {
+    if (bgpstream_patricia_tree_insert(pt_insert, &pfxs[i]) == NULL) {
+      ok = 0;
+    }
+  }
+  CHECK("Patricia Tree insert reference", ok);
+
+  // build into a tree that already holds some of the prefixes
+  pt_build = bgpstream_patricia_tree_create(NULL);
+  for (i = 0; i < BUILD_PREINSERT_CNT; i++) {
+    bgpstream_patricia_tree_insert(pt_build, &pfxs[i]);
+  }
+  CHECK("Patricia Tree build",
+        bgpstream_patricia_tree_build(pt_build, pfxs_copy, BUILD_PFX_CNT, 4) ==
+          0);
+  CHECK("Patricia Tree build matches insert",
+        trees_equal(pt_insert, pt_build, pfxs, BUILD_PFX_CNT));
+
+  // build_sorted must also accept input that is not sorted
+  pt_sorted = bgpstream_patricia_tree_create(NULL);
+  CHECK("Patricia Tree build sorted (unsorted input)",
+        bgpstream_patricia_tree_build_sorted(pt_sorted, pfxs, BUILD_PFX_CNT) ==
+          0);
+  CHECK("Patricia Tree build sorted matches insert",
+        trees_equal(pt_insert, pt_sorted, pfxs, BUILD_PFX_CNT));
+
+  bgpstream_patricia_tree_destroy(pt_insert);
+  bgpstream_patricia_tree_destroy(pt_build);
+  bgpstream_patricia_tree_destroy(pt_sorted);
+  free(pfxs);
+  free(pfxs_copy);
+  return 0;
+}
+
+static bgpstream_patricia_tree_t *concurrent_pt;
+static bgpstream_pfx_t concurrent_pfxs[MODEL_PFX_CNT];
+static int concurrent_stop = 0;
+static int concurrent_failures = 0;
+
+static void concurrent_user_destroy(void *user)
+{
+  *(int *)user = 0;
+  free(user);
+}
+
+static void *concurrent_reader(void *arg)
+{
+  bgpstream_patricia_tree_reader_t *reader;
+  bgpstream_patricia_tree_result_set_t *res;
+  bgpstream_patricia_node_t *node, *less;
+  const bgpstream_pfx_t *pfx, *node_pfx;
+  unsigned int seed = (unsigned int)(long)arg;
+  uint8_t last_len;
+  int *user;
+  int failures = 0;
+  int i;
+
+  reader = bgpstream_patricia_tree_reader_create(concurrent_pt);
+  res = bgpstream_patricia_tree_result_set_create();
+  if (reader == NULL || res == NULL) {
+    __atomic_add_fetch(&concurrent_failures, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  while (!__atomic_load_n(&concurrent_stop, __ATOMIC_RELAXED)) {
+    bgpstream_patricia_tree_read_lock(reader);
+    for (i = 0; i < 64; i++) {
+      pfx = &concurrent_pfxs[rand_r(&seed) % MODEL_PFX_CNT];
+      bgpstream_patricia_tree_get_pfx_overlap_info(concurrent_pt, pfx);
+      node = bgpstream_patricia_tree_search_best(concurrent_pt, pfx);
+      if (node == NULL) {
+        continue;
+      }
+      node_pfx = bgpstream_patricia_tree_get_pfx(node);
+      user = bgpstream_patricia_tree_get_user(node);
+      if ((node_pfx != NULL && !pfx_covers(node_pfx, pfx)) ||
+          (user != NULL && *user != CONCURRENT_USER_MAGIC)) {
+        failures++;
+      }
+      bgpstream_patricia_tree_get_node_overlap_info(concurrent_pt, node);
+      bgpstream_patricia_tree_get_more_specifics(concurrent_pt, node, res);
+      bgpstream_patricia_tree_get_less_specifics(concurrent_pt, node, res);
+      last_len = UINT8_MAX;
+      while ((less = bgpstream_patricia_tree_result_set_next(res)) != NULL) {
+        // the writer may have removed the prefix in the meantime
+        if ((node_pfx = bgpstream_patricia_tree_get_pfx(less)) == NULL) {
+          continue;
+        }
+        if (!pfx_covers(node_pfx, pfx) || node_pfx->mask_len >= last_len) {
+          failures++;
+        }
+        last_len = node_pfx->mask_len;
+      }
+    }
+    bgpstream_patricia_tree_read_unlock(reader);
+  }
+
+  bgpstream_patricia_tree_result_set_destroy(&res);
+  bgpstream_patricia_tree_reader_destroy(reader);
+  __atomic_add_fetch(&concurrent_failures, failures, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+static int test_patricia_concurrent()
+{
+  pthread_t readers[CONCURRENT_READER_CNT];
+  bgpstream_patricia_node_t *node;
+  int *user;
+  int i, op, ok = 1;
+
+  srand(3);
+  random_pfxs(concurrent_pfxs, MODEL_PFX_CNT);
+
+  concurrent_pt = bgpstream_patricia_tree_create(concurrent_user_destroy);
+  CHECK("Patricia Tree set concurrent",
+        bgpstream_patricia_tree_set_concurrent(concurrent_pt) == 0);
+
+  for (i = 0; i < CONCURRENT_READER_CNT; i++) {
+    pthread_create(&readers[i], NULL, concurrent_reader, (void *)(long)(i + 1));
+  }
+
+  for (op = 0; op < CONCURRENT_OPS_CNT; op++) {
+    i = rand() % MODEL_PFX_CNT;
+    if (rand() % 2) {
+      if ((node = bgpstream_patricia_tree_insert(concurrent_pt,
+                                                 &concurrent_pfxs[i])) ==
+          NULL) {
+        ok = 0;
+        continue;
+      }
+      user = malloc(sizeof(int));
+      *user = CONCURRENT_USER_MAGIC;
+      bgpstream_patricia_tree_set_user(concurrent_pt, node, user);
+    } else {
+      bgpstream_patricia_tree_remove(concurrent_pt, &concurrent_pfxs[i]);
+    }
+    if (op % (CONCURRENT_OPS_CNT / 4) == CONCURRENT_OPS_CNT / 4 - 1) {
+      bgpstream_patricia_tree_clear(concurrent_pt);
+    }
+  }
+
+  __atomic_store_n(&concurrent_stop, 1, __ATOMIC_RELAXED);
+  for (i = 0; i < CONCURRENT_READER_CNT; i++) {
+    pthread_join(readers[i], NULL);
+  }
+  CHECK("Patricia Tree concurrent writer", ok);
+  CHECK("Patricia Tree concurrent readers", concurrent_failures == 0);
+
+  bgpstream_patricia_tree_destroy(concurrent_pt);
+  return 0;
+}
+
 int main()
 {
   CHECK_SECTION("Patricia Tree", test_patricia() == 0);
+  CHECK_SECTION("Patricia Tree model", test_patricia_model() == 0);
+  CHECK_SECTION("Patricia Tree growth", test_patricia_growth() == 0);
+  CHECK_SECTION("Patricia Tree build", test_patricia_build() == 0);
+  CHECK_SECTION("Patricia Tree concurrent",
+                test_patricia_concurrent() == 0);
   ENDTEST;
   return 0;
 }
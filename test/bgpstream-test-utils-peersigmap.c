@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+#include "bgpstream_test_ids.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+
+#define COLLECTORS_CNT 8
+#define PEERS_CNT 3000
+
+static bgpstream_peer_sig_map_t *map;
+
+static void peer_ip(int peer, bgpstream_ip_addr_t *ip)
+{
+  memset(ip, 0, sizeof(*ip));
+  if (peer % 2) {
+    ip->version = BGPSTREAM_ADDR_VERSION_IPV4;
+    ip->bs_ipv4.addr.s_addr = htonl(0x0a000000 + peer);
+  } else {
+    ip->version = BGPSTREAM_ADDR_VERSION_IPV6;
+    ip->bs_ipv6.addr.s6_addr[0] = 0x20;
+    ip->bs_ipv6.addr.s6_addr[1] = 0x01;
+    ip->bs_ipv6.addr.s6_addr[14] = peer >> 8;
+    ip->bs_ipv6.addr.s6_addr[15] = peer;
+  }
+}
+
+/* Get the ID of the i-th test peer, and check its signature */
+static uint32_t peer_get_id(int i)
+{
+  bgpstream_peer_sig_t *sig;
+  bgpstream_peer_id_t id;
+  bgpstream_ip_addr_t ip;
+  char collector[BGPSTREAM_UTILS_STR_NAME_LEN];
+  int peer = i % PEERS_CNT;
+
+  snprintf(collector, sizeof(collector), "rrc%02d", i / PEERS_CNT);
+  peer_ip(peer, &ip);
+  if ((id = bgpstream_peer_sig_map_get_id(map, collector, &ip,
+                                          65000 + peer)) == 0 ||
+      (sig = bgpstream_peer_sig_map_get_sig(map, id)) == NULL ||
+      strcmp(sig->collector_str, collector) != 0 ||
+      !bgpstream_addr_equal(&sig->peer_ip_addr, &ip) ||
+      sig->peer_asnumber != 65000 + peer) {
+    return 0;
+  }
+  return id;
+}
+
+static int test_peer_sig_map_basic()
+{
+  bgpstream_ip_addr_t ip;
+  bgpstream_peer_id_t id;
+  bgpstream_peer_sig_t *sig;
+
+  CHECK("Peer sig map create", (map = bgpstream_peer_sig_map_create()) != NULL);
+
+  peer_ip(1, &ip);
+  CHECK("Peer sig map first ID",
+        (id = bgpstream_peer_sig_map_get_id(map, "rrc00", &ip, 65001)) == 1);
+  CHECK("Peer sig map same ID",
+        bgpstream_peer_sig_map_get_id(map, "rrc00", &ip, 65001) == id);
+  CHECK("Peer sig map other collector",
+        bgpstream_peer_sig_map_get_id(map, "rrc01", &ip, 65001) == 2);
+  CHECK("Peer sig map get sig",
+        (sig = bgpstream_peer_sig_map_get_sig(map, id)) != NULL &&
+          strcmp(sig->collector_str, "rrc00") == 0 &&
+          bgpstream_addr_equal(&sig->peer_ip_addr, &ip) &&
+          sig->peer_asnumber == 65001);
+  CHECK("Peer sig map unknown IDs",
+        bgpstream_peer_sig_map_get_sig(map, 0) == NULL &&
+          bgpstream_peer_sig_map_get_sig(map, 3) == NULL);
+  CHECK("Peer sig map size", bgpstream_peer_sig_map_get_size(map) == 2);
+
+  bgpstream_peer_sig_map_clear(map);
+  CHECK("Peer sig map clear",
+        bgpstream_peer_sig_map_get_size(map) == 0 &&
+          bgpstream_peer_sig_map_get_sig(map, id) == NULL);
+  // IDs are not reused after a clear
+  peer_ip(2, &ip);
+  CHECK("Peer sig map ID after clear",
+        (id = bgpstream_peer_sig_map_get_id(map, "rrc02", &ip, 65002)) == 3 &&
+          (sig = bgpstream_peer_sig_map_get_sig(map, id)) != NULL &&
+          strcmp(sig->collector_str, "rrc02") == 0);
+  CHECK("Peer sig map stale IDs after clear",
+        bgpstream_peer_sig_map_get_sig(map, 1) == NULL &&
+          bgpstream_peer_sig_map_get_sig(map, 2) == NULL);
+
+  bgpstream_peer_sig_map_destroy(map);
+  return 0;
+}
+
+static int test_peer_sig_map_threads()
+{
+  test_ids_result_t res;
+  int cnt = COLLECTORS_CNT * PEERS_CNT;
+
+  map = bgpstream_peer_sig_map_create();
+
+  res = test_ids_threads(peer_get_id, cnt, 1);
+  CHECK("Peer sig map threads get ID", res.stable);
+  CHECK("Peer sig map threads size",
+        bgpstream_peer_sig_map_get_size(map) == cnt);
+  CHECK("Peer sig map threads agree", res.agree);
+  CHECK("Peer sig map threads distinct IDs", res.distinct);
+
+  // again after a clear, which assigns new IDs
+  bgpstream_peer_sig_map_clear(map);
+  res = test_ids_threads(peer_get_id, cnt, cnt + 1);
+  CHECK("Peer sig map threads after clear",
+        res.stable && res.agree && res.distinct &&
+          bgpstream_peer_sig_map_get_size(map) == cnt &&
+          bgpstream_peer_sig_map_get_sig(map, cnt) == NULL &&
+          bgpstream_peer_sig_map_get_sig(map, 2 * cnt + 1) == NULL);
+
+  bgpstream_peer_sig_map_destroy(map);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("Peer sig map basic", test_peer_sig_map_basic() == 0);
+  CHECK_SECTION("Peer sig map threads", test_peer_sig_map_threads() == 0);
+  ENDTEST;
+  return 0;
+}
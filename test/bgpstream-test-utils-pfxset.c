@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* number of random prefixes (with many duplicates) in the model test */
+#define MODEL_PFX_CNT 3000
+
+/* number of distinct prefixes in the growth test, enough to grow every
+ * shard several times and to merge with multiple threads */
+#define GROWTH_PFX_CNT 300000
+
+/* Fill in a random prefix from a small space, so that duplicates are
+ * common */
+static void random_pfx(bgpstream_pfx_t *pfx)
+{
+  memset(pfx, 0, sizeof(*pfx));
+  if (rand() % 3) {
+    pfx->address.version = BGPSTREAM_ADDR_VERSION_IPV4;
+    pfx->address.bs_ipv4.addr.s_addr = htonl((rand() % 2000) << 8);
+    pfx->mask_len = 23 + rand() % 2;
+  } else {
+    pfx->address.version = BGPSTREAM_ADDR_VERSION_IPV6;
+    pfx->address.bs_ipv6.addr.s6_addr[0] = 0x20;
+    pfx->address.bs_ipv6.addr.s6_addr[3] = rand() % 500;
+    pfx->mask_len = 47 + rand() % 2;
+  }
+  pfx->allowed_matches = rand() % 4;
+}
+
+/* Build the i-th of a sequence of distinct prefixes */
+static void growth_pfx(bgpstream_pfx_t *pfx, int i)
+{
+  memset(pfx, 0, sizeof(*pfx));
+  if (i % 2) {
+    pfx->address.version = BGPSTREAM_ADDR_VERSION_IPV4;
+    pfx->address.bs_ipv4.addr.s_addr = htonl(i << 8);
+    pfx->mask_len = 24;
+  } else {
+    pfx->address.version = BGPSTREAM_ADDR_VERSION_IPV6;
+    pfx->address.bs_ipv6.addr.s6_addr[0] = 0x20;
+    pfx->address.bs_ipv6.addr.s6_addr[1] = 0x01;
+    pfx->address.bs_ipv6.addr.s6_addr[4] = i >> 16;
+    pfx->address.bs_ipv6.addr.s6_addr[5] = i >> 8;
+    pfx->address.bs_ipv6.addr.s6_addr[6] = i;
+    pfx->mask_len = 56;
+  }
+}
+
+/* Naive model: the distinct prefixes inserted so far, each with the
+ * allowed_matches it was first inserted with */
+static bgpstream_pfx_t model[MODEL_PFX_CNT];
+static int model_cnt = 0;
+
+static int model_find(const bgpstream_pfx_t *pfx)
+{
+  int i;
+  for (i = 0; i < model_cnt; i++) {
+    if (bgpstream_pfx_equal(&model[i], pfx)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int iterate_cnt;
+static int iterate_ok;
+
+static void iterate_check(bgpstream_pfx_t *pfx, void *user)
+{
+  int i = model_find(pfx);
+  iterate_cnt++;
+  if (i < 0 || model[i].allowed_matches != pfx->allowed_matches) {
+    iterate_ok = 0;
+  }
+}
+
+static void iterate_count(bgpstream_pfx_t *pfx, void *user)
+{
+  iterate_cnt++;
+  if (!bgpstream_pfx_set_exists((bgpstream_pfx_set_t *)user, pfx)) {
+    iterate_ok = 0;
+  }
+}
+
+static int test_pfx_set_model()
+{
+  bgpstream_pfx_set_t *set, *bulk_set;
+  bgpstream_pfx_t *pfxs;
+  bgpstream_pfx_t pfx;
+  uint8_t results[MODEL_PFX_CNT];
+  int v4_cnt = 0;
+  int i, new, found, insert_ok = 1, exists_ok = 1;
+
+  srand(5);
+  pfxs = malloc(sizeof(bgpstream_pfx_t) * MODEL_PFX_CNT);
+  set = bgpstream_pfx_set_create();
+
+  for (i = 0; i < MODEL_PFX_CNT; i++) {
+    random_pfx(&pfxs[i]);
+    new = (model_find(&pfxs[i]) < 0);
+    if (new) {
+      model[model_cnt++] = pfxs[i];
+      if (pfxs[i].address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+        v4_cnt++;
+      }
+    }
+    if (bgpstream_pfx_set_insert(set, &pfxs[i]) != new ||
+        !bgpstream_pfx_set_exists(set, &pfxs[i])) {
+      insert_ok = 0;
+    }
+  }
+  CHECK("Prefix set model insert", insert_ok);
+  CHECK("Prefix set model size",
+        bgpstream_pfx_set_size(set) == model_cnt &&
+          bgpstream_pfx_set_version_size(set, BGPSTREAM_ADDR_VERSION_IPV4) ==
+            v4_cnt);
+
+  for (i = 0; i < MODEL_PFX_CNT; i++) {
+    random_pfx(&pfx);
+    if (bgpstream_pfx_set_exists(set, &pfx) != (model_find(&pfx) >= 0)) {
+      exists_ok = 0;
+    }
+  }
+  CHECK("Prefix set model exists", exists_ok);
+
+  iterate_cnt = 0;
+  iterate_ok = 1;
+  bgpstream_pfx_set_iterate(set, iterate_check, NULL);
+  CHECK("Prefix set model iterate",
+        iterate_ok && iterate_cnt == model_cnt);
+
+  bulk_set = bgpstream_pfx_set_create();
+  CHECK("Prefix set model insert bulk",
+        bgpstream_pfx_set_insert_bulk(bulk_set, pfxs, MODEL_PFX_CNT) ==
+          model_cnt);
+  iterate_cnt = 0;
+  iterate_ok = 1;
+  bgpstream_pfx_set_iterate(bulk_set, iterate_check, NULL);
+  CHECK("Prefix set model iterate bulk",
+        iterate_ok && iterate_cnt == model_cnt);
+
+  for (i = 0; i < MODEL_PFX_CNT; i++) {
+    random_pfx(&pfxs[i]);
+  }
+  found = bgpstream_pfx_set_exists_bulk(bulk_set, pfxs, MODEL_PFX_CNT,
+                                        results);
+  exists_ok = 1;
+  for (i = 0; i < MODEL_PFX_CNT; i++) {
+    if (results[i] != (model_find(&pfxs[i]) >= 0)) {
+      exists_ok = 0;
+    }
+    found -= results[i];
+  }
+  CHECK("Prefix set model exists bulk", exists_ok && found == 0);
+
+  // merging does not change the allowed_matches of existing prefixes
+  for (i = 0; i < model_cnt; i++) {
+    pfxs[i] = model[i];
+    pfxs[i].allowed_matches = (model[i].allowed_matches + 1) % 4;
+  }
+  bgpstream_pfx_set_clear(bulk_set);
+  bgpstream_pfx_set_insert_bulk(bulk_set, pfxs, model_cnt);
+  CHECK("Prefix set model merge",
+        bgpstream_pfx_set_merge(set, bulk_set) == 0 &&
+          bgpstream_pfx_set_size(set) == model_cnt);
+  iterate_cnt = 0;
+  iterate_ok = 1;
+  bgpstream_pfx_set_iterate(set, iterate_check, NULL);
+  CHECK("Prefix set model iterate merged",
+        iterate_ok && iterate_cnt == model_cnt);
+
+  bgpstream_pfx_set_clear(set);
+  CHECK("Prefix set model clear",
+        bgpstream_pfx_set_size(set) == 0 &&
+          !bgpstream_pfx_set_exists(set, &model[0]));
+
+  bgpstream_pfx_set_destroy(set);
+  bgpstream_pfx_set_destroy(bulk_set);
+  free(pfxs);
+  return 0;
+}
+
+static int test_pfx_set_growth()
+{
+  bgpstream_pfx_set_t *set, *other;
+  bgpstream_pfx_t *pfxs;
+  int i, ok = 1;
+
+  pfxs = malloc(sizeof(bgpstream_pfx_t) * GROWTH_PFX_CNT);
+  for (i = 0; i < GROWTH_PFX_CNT; i++) {
+    growth_pfx(&pfxs[i], i);
+  }
+
+  // the first half one at a time, then all of them in bulk
+  set = bgpstream_pfx_set_create();
+  for (i = 0; i < GROWTH_PFX_CNT / 2; i++) {
+    if (bgpstream_pfx_set_insert(set, &pfxs[i]) != 1) {
+      ok = 0;
+    }
+  }
+  CHECK("Prefix set growth insert",
+        ok && bgpstream_pfx_set_size(set) == GROWTH_PFX_CNT / 2);
+  CHECK("Prefix set growth insert bulk",
+        bgpstream_pfx_set_insert_bulk(set, pfxs, GROWTH_PFX_CNT) ==
+            GROWTH_PFX_CNT - GROWTH_PFX_CNT / 2 &&
+          bgpstream_pfx_set_size(set) == GROWTH_PFX_CNT);
+  CHECK("Prefix set growth exists bulk",
+        bgpstream_pfx_set_exists_bulk(set, pfxs, GROWTH_PFX_CNT, NULL) ==
+          GROWTH_PFX_CNT);
+
+  // merge into a set that holds the second half plus prefixes of its own
+  other = bgpstream_pfx_set_create();
+  bgpstream_pfx_set_insert_bulk(other, pfxs + GROWTH_PFX_CNT / 2,
+                                GROWTH_PFX_CNT - GROWTH_PFX_CNT / 2);
+  for (i = 0; i < GROWTH_PFX_CNT / 2; i++) {
+    growth_pfx(&pfxs[i], GROWTH_PFX_CNT + i);
+  }
+  bgpstream_pfx_set_insert_bulk(other, pfxs, GROWTH_PFX_CNT / 2);
+  CHECK("Prefix set growth merge",
+        bgpstream_pfx_set_merge(other, set) == 0 &&
+          bgpstream_pfx_set_size(other) ==
+            GROWTH_PFX_CNT + GROWTH_PFX_CNT / 2);
+  CHECK("Prefix set growth merged exists",
+        bgpstream_pfx_set_exists_bulk(other, pfxs, GROWTH_PFX_CNT / 2, NULL) ==
+          GROWTH_PFX_CNT / 2);
+
+  iterate_cnt = 0;
+  iterate_ok = 1;
+  bgpstream_pfx_set_iterate(set, iterate_count, other);
+  CHECK("Prefix set growth iterate",
+        iterate_ok && iterate_cnt == GROWTH_PFX_CNT);
+
+  CHECK("Prefix set growth merge self",
+        bgpstream_pfx_set_merge(set, set) == 0 &&
+          bgpstream_pfx_set_size(set) == GROWTH_PFX_CNT);
+
+  bgpstream_pfx_set_clear(other);
+  CHECK("Prefix set growth clear",
+        bgpstream_pfx_set_size(other) == 0 &&
+          bgpstream_pfx_set_exists_bulk(other, pfxs, GROWTH_PFX_CNT / 2,
+                                        NULL) == 0);
+
+  bgpstream_pfx_set_destroy(set);
+  bgpstream_pfx_set_destroy(other);
+  free(pfxs);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("Prefix set model", test_pfx_set_model() == 0);
+  CHECK_SECTION("Prefix set growth", test_pfx_set_growth() == 0);
+  ENDTEST;
+  return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+#include "bgpstream_test_ids.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* number of distinct strings, enough to grow the index and the string chunks
+ * several times */
+#define STRS_CNT 20000
+
+/* Intern the i-th test string, using both interning functions */
+static uint32_t intern_get_id(int i)
+{
+  bgpstream_str_id_t id;
+  const char *str;
+  char buf[64];
+  int len;
+
+  len = snprintf(buf, sizeof(buf), "route-views%d.routeviews.org", i);
+  id = (i % 2) ? bgpstream_str_intern(buf) : bgpstream_str_intern_len(buf, len);
+  if (id == BGPSTREAM_STR_ID_INVALID || id == BGPSTREAM_STR_ID_EMPTY ||
+      (str = bgpstream_str_intern_get(id)) == NULL || strcmp(str, buf) != 0) {
+    return 0;
+  }
+  return id;
+}
+
+static int test_str_intern_basic()
+{
+  bgpstream_str_id_t id;
+
+  CHECK("String intern empty",
+        bgpstream_str_intern("") == BGPSTREAM_STR_ID_EMPTY &&
+          bgpstream_str_intern_len("rrc00", 0) == BGPSTREAM_STR_ID_EMPTY &&
+          strcmp(bgpstream_str_intern_get(BGPSTREAM_STR_ID_EMPTY), "") == 0);
+  CHECK("String intern",
+        (id = bgpstream_str_intern("ris")) != BGPSTREAM_STR_ID_INVALID &&
+          id != BGPSTREAM_STR_ID_EMPTY);
+  CHECK("String intern same ID", bgpstream_str_intern("ris") == id);
+  CHECK("String intern len",
+        bgpstream_str_intern_len("rislive", 3) == id &&
+          bgpstream_str_intern("rislive") != id);
+  CHECK("String intern get", strcmp(bgpstream_str_intern_get(id), "ris") == 0);
+  CHECK("String intern unknown ID",
+        bgpstream_str_intern_get(id + 100) == NULL);
+
+  bgpstream_str_intern_destroy();
+  CHECK("String intern destroy", bgpstream_str_intern_get(id) == NULL);
+  CHECK("String intern after destroy",
+        bgpstream_str_intern("routeviews") == 1 &&
+          strcmp(bgpstream_str_intern_get(1), "routeviews") == 0);
+
+  bgpstream_str_intern_destroy();
+  return 0;
+}
+
+static int test_str_intern_threads()
+{
+  test_ids_result_t res = test_ids_threads(intern_get_id, STRS_CNT, 1);
+
+  CHECK("String intern threads", res.stable);
+  CHECK("String intern threads agree", res.agree);
+  CHECK("String intern threads distinct IDs",
+        res.distinct && bgpstream_str_intern_get(STRS_CNT + 1) == NULL);
+
+  bgpstream_str_intern_destroy();
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("String intern basic", test_str_intern_basic() == 0);
+  CHECK_SECTION("String intern threads", test_str_intern_threads() == 0);
+  ENDTEST;
+  return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BGPSTREAM_TEST_IDS_H
+#define __BGPSTREAM_TEST_IDS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Concurrency test shared by the maps that assign IDs to values (e.g., the
+ * string intern table and the peer signature map): several threads get the
+ * IDs of the same values at the same time.
+ */
+
+/* number of threads that get the IDs of the same values concurrently */
+#define TEST_IDS_THREADS_CNT 4
+
+/* Get the ID of the i-th test value (assigning one if needed) and check that
+ * the ID maps back to that value. Returns the ID, or 0 if either failed. */
+typedef uint32_t(test_ids_get_cb_t)(int i);
+
+typedef struct test_ids_result {
+
+  /* every thread got a valid ID for every value, twice the same one */
+  int stable;
+
+  /* all the threads got the same IDs */
+  int agree;
+
+  /* the IDs are distinct and dense, starting from the expected ID */
+  int distinct;
+
+} test_ids_result_t;
+
+typedef struct test_ids_thread {
+  pthread_t thread;
+  int t;
+  test_ids_get_cb_t *get_id;
+  int values_cnt;
+  uint32_t *ids;
+  int failures;
+} test_ids_thread_t;
+
+/* Get the ID of every value twice, each thread in a different order (the
+ * number of values must not be a multiple of 7919) */
+static void *test_ids_thread(void *arg)
+{
+  test_ids_thread_t *th = arg;
+  uint32_t id;
+  int round, i, k;
+
+  for (round = 0; round < 2; round++) {
+    for (i = 0; i < th->values_cnt; i++) {
+      k = (int)(((int64_t)i * 7919 + th->t * 31) % th->values_cnt);
+      id = th->get_id(k);
+      if (id == 0 || (round > 0 && th->ids[k] != id)) {
+        th->failures++;
+      }
+      th->ids[k] = id;
+    }
+  }
+  return NULL;
+}
+
+static test_ids_result_t test_ids_threads(test_ids_get_cb_t *get_id,
+                                          int values_cnt, uint32_t first_id)
+{
+  test_ids_thread_t threads[TEST_IDS_THREADS_CNT];
+  test_ids_result_t res = {1, 1, 1};
+  uint8_t *seen;
+  uint32_t id;
+  int t, i;
+
+  for (t = 0; t < TEST_IDS_THREADS_CNT; t++) {
+    threads[t].t = t;
+    threads[t].get_id = get_id;
+    threads[t].values_cnt = values_cnt;
+    threads[t].ids = calloc(values_cnt, sizeof(uint32_t));
+    threads[t].failures = 0;
+    pthread_create(&threads[t].thread, NULL, test_ids_thread, &threads[t]);
+  }
+  for (t = 0; t < TEST_IDS_THREADS_CNT; t++) {
+    pthread_join(threads[t].thread, NULL);
+    if (threads[t].failures != 0) {
+      res.stable = 0;
+    }
+  }
+
+  for (t = 1; t < TEST_IDS_THREADS_CNT; t++) {
+    if (memcmp(threads[0].ids, threads[t].ids,
+               sizeof(uint32_t) * values_cnt) != 0) {
+      res.agree = 0;
+    }
+  }
+
+  seen = calloc(values_cnt, 1);
+  for (i = 0; i < values_cnt; i++) {
+    id = threads[0].ids[i];
+    if (id < first_id || id - first_id >= (uint32_t)values_cnt ||
+        seen[id - first_id]) {
+      res.distinct = 0;
+      continue;
+    }
+    seen[id - first_id] = 1;
+  }
+  free(seen);
+
+  for (t = 0; t < TEST_IDS_THREADS_CNT; t++) {
+    free(threads[t].ids);
+  }
+  return res;
+}
+
+#endif /* __BGPSTREAM_TEST_IDS_H */
@@ -164,6 +164,15 @@ static struct bs_options_t bs_opts[] =
    "",
    "print info "
    "for each BGP record (used mostly for debugging BGPStream)"},
+  {{"lazy-decode", no_argument, 0, 'L'},
+   "",
+   "only decode the BGP data of a record when its elems are needed "
+   "(faster with -r alone, but records with a corrupted BGP payload are "
+   "not reported as corrupted)"},
+  {{"output-mrt", required_argument, 0, 'M'},
+   "<file>",
+   "write each element of a BGP record to <file> in MRT format "
+   "(compressed if <file> ends in .gz or .bz2)"},
   {{"output-headers", no_argument, 0, 'i'},
    "",
    "print format information before output"},
@@ -356,8 +365,11 @@ int main(int argc, char *argv[])
   int live = 0;
   int output_info = 0;
   int record_output_on = 0;
+  int lazy_decode = 0;
   int record_bgpdump_output_on = 0;
   int elem_output_on = 0;
+  const char *mrt_output_file = NULL;
+  bgpstream_mrt_writer_t *mrt_writer = NULL;
   int exitstatus = -1; // fail, until proven otherwise
 
   int rec_limit = -1;
@@ -500,6 +512,12 @@ int main(int argc, char *argv[])
     case 'e':
       elem_output_on = 1;
       break;
+    case 'M':
+      mrt_output_file = optarg;
+      break;
+    case 'L':
+      lazy_decode = 1;
+      break;
     case 'i':
       output_info = 1;
       break;
@@ -581,7 +599,8 @@ int main(int argc, char *argv[])
   }
 
   // if the user did not specify any output format, default to per elem
-  if (!record_output_on && !elem_output_on && !record_bgpdump_output_on) {
+  if (!record_output_on && !elem_output_on && !record_bgpdump_output_on &&
+      mrt_output_file == NULL) {
     elem_output_on = 1;
   }
 
@@ -642,6 +661,22 @@ int main(int argc, char *argv[])
     bgpstream_set_live_mode(bs);
   }
 
+  /* only decode BGP payloads that are needed for the output */
+  if (lazy_decode != 0) {
+    bgpstream_set_lazy_decode(bs);
+  }
+
+  /* elems are consumed as soon as they are extracted, so they may reference
+     the parsed message directly */
+  bgpstream_set_zero_copy_elems(bs);
+
+  if (mrt_output_file != NULL &&
+      (mrt_writer = bgpstream_mrt_writer_create(mrt_output_file)) == NULL) {
+    fprintf(stderr, "ERROR: Could not create MRT output file %s\n",
+            mrt_output_file);
+    goto done;
+  }
+
   /* turn on interface */
   if (bgpstream_start(bs) < 0) {
     return -1;
@@ -681,13 +716,14 @@ int main(int argc, char *argv[])
 
     /* check if the record is of type RIB, in case extract the ID */
     /* print the RIB start line */
-    if (bs_record->type == BGPSTREAM_RIB &&
+    if ((record_output_on || record_bgpdump_output_on || elem_output_on) &&
+        bs_record->type == BGPSTREAM_RIB &&
         bs_record->dump_pos == BGPSTREAM_DUMP_START &&
         print_record(bs_record) != 0) {
       goto done;
     }
 
-    if (record_bgpdump_output_on || elem_output_on) {
+    if (record_bgpdump_output_on || elem_output_on || mrt_writer != NULL) {
       while ((erc = bgpstream_record_get_next_elem(bs_record, &bs_elem)) > 0) {
 #ifdef WITH_RPKI
         if (rpki_input != NULL && rpki_input->rpki_active) {
@@ -703,6 +739,12 @@ int main(int argc, char *argv[])
         } else if (elem_output_on && print_elem(bs_record, bs_elem) != 0) {
           goto done;
         }
+        if (mrt_writer != NULL &&
+            bgpstream_mrt_writer_write_elem(mrt_writer, bs_record, bs_elem) !=
+              0) {
+          fprintf(stderr, "ERROR: Failed to write elem in MRT format\n");
+          goto done;
+        }
       }
 
       if (erc != 0) {
@@ -711,7 +753,8 @@ int main(int argc, char *argv[])
       }
 
       /* check if end of RIB has been reached */
-      if (bs_record->type == BGPSTREAM_RIB &&
+      if ((record_bgpdump_output_on || elem_output_on) &&
+          bs_record->type == BGPSTREAM_RIB &&
           bs_record->dump_pos == BGPSTREAM_DUMP_END &&
           print_record(bs_record) != 0) {
         goto done;
@@ -721,6 +764,9 @@ int main(int argc, char *argv[])
 
   if (rrc < 0) {
     fprintf(stderr, "ERROR: Failed to get record from stream\n");
+  } else if (mrt_writer != NULL &&
+             bgpstream_mrt_writer_flush(mrt_writer) != 0) {
+    fprintf(stderr, "ERROR: Failed to write MRT output\n");
   } else {
     exitstatus = 0; // success
   }
@@ -733,6 +779,8 @@ done:
   }
 #endif
 
+  bgpstream_mrt_writer_destroy(mrt_writer);
+
   /* deallocate memory for interface */
   bgpstream_destroy(bs);
   return exitstatus;